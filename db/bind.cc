@@ -3,17 +3,35 @@
 // found in the LICENSE file.
 
 #include <iostream>
+#include <memory>
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 #include <string>
 
 #include "db_manager.h"
+#include "trace.h"
 
 namespace py = pybind11;
 using namespace tdchunk;
 
+// one chunk of getversion_array, file indexes the file name list
+struct ChunkRecord {
+  uint32_t file;
+  uint64_t start;
+  uint64_t length;
+};
+
+// Calls made here drop the GIL while they run in C++, so data loader
+// threads and the training loop keep going. Python objects are built
+// after the GIL is taken back.
+
 std::unordered_map<std::string, std::vector<py::tuple>> GetCheckpointFiles(DBManager* db_manager, int index, int version) {
-  std::vector<CkptMetaData> metadata = db_manager->GetCheckpointFiles(index, version);
+  std::vector<CkptMetaData> metadata;
+  {
+    py::gil_scoped_release release;
+    metadata = db_manager->GetCheckpointFiles(index, version);
+  }
   std::unordered_map<std::string, std::vector<py::tuple>> res;
   for (auto meta : metadata) {
     res[meta.file_name].push_back(py::make_tuple(meta.start, meta.length));
@@ -21,19 +39,490 @@ std::unordered_map<std::string, std::vector<py::tuple>> GetCheckpointFiles(DBMan
   return res;
 }
 
+// (file_names, array of (file, start, length)), one row per chunk
+py::tuple GetCheckpointArray(DBManager* db_manager, int index, int version) {
+  std::vector<CkptMetaData> metadata;
+  {
+    py::gil_scoped_release release;
+    metadata = db_manager->GetCheckpointFiles(index, version);
+  }
+  std::vector<std::string> names;
+  std::unordered_map<std::string, uint32_t> ids;
+  py::array_t<ChunkRecord> records(metadata.size());
+  ChunkRecord* out = records.mutable_data();
+  for (size_t i = 0; i < metadata.size(); i++) {
+    auto it = ids.emplace(metadata[i].file_name, static_cast<uint32_t>(names.size()));
+    if (it.second) names.push_back(metadata[i].file_name);
+    out[i].file = it.first->second;
+    out[i].start = metadata[i].start;
+    out[i].length = metadata[i].length;
+  }
+  return py::make_tuple(names, records);
+}
+
+// [(file_name, start, length, [(chunk_index, offset, length), ...]), ...]
+std::vector<py::tuple> GetRestorePlan(DBManager* db_manager, int index, int version, uint64_t max_gap) {
+  std::vector<RestoreRead> plan;
+  {
+    py::gil_scoped_release release;
+    plan = db_manager->GetRestorePlan(index, version, max_gap);
+  }
+  std::vector<py::tuple> res;
+  for (const auto& read : plan) {
+    std::vector<py::tuple> segments;
+    for (const auto& segment : read.segments) {
+      segments.push_back(py::make_tuple(segment.chunk, segment.offset, segment.length));
+    }
+    res.push_back(py::make_tuple(read.file_name, read.start, read.length, segments));
+  }
+  return res;
+}
+
+py::dict GetAmplification(DBManager* db_manager, int index) {
+  // a copy, async joins keep recording into the stats of the DB
+  std::unique_ptr<AmplificationStats> copy;
+  {
+    py::gil_scoped_release release;
+    copy.reset(new AmplificationStats(db_manager->GetAmplificationStats(index)));
+  }
+  const AmplificationStats& stats = *copy;
+  py::dict versions;
+  for (const auto& pair : stats.Versions()) {
+    versions[py::int_(pair.first)] = py::make_tuple(pair.second.bytes_read,
+                                                    pair.second.unique_rows,
+                                                    pair.second.read_amp);
+  }
+  py::dict res;
+  res["joined_bytes"] = stats.JoinedBytes();
+  res["extraction_bytes"] = stats.ExtractionBytes();
+  res["write_amp"] = stats.WriteAmplification();
+  res["unique_rows"] = stats.UniqueRows();
+  res["row_bytes"] = stats.RowBytes();
+  res["versions"] = versions;
+  return res;
+}
+
+py::dict GetSpaceStats(DBManager* db_manager, int index) {
+  SpaceStats stats;
+  {
+    py::gil_scoped_release release;
+    stats = db_manager->GetSpaceStats(index);
+  }
+  py::dict res;
+  res["live_bytes"] = stats.live_bytes;
+  res["file_bytes"] = stats.file_bytes;
+  res["allocated_bytes"] = stats.allocated_bytes;
+  res["dead_bytes"] = stats.dead_bytes;
+  res["reclaimed_bytes"] = stats.reclaimed_bytes;
+  res["space_amp"] = stats.space_amp;
+  res["containers"] = stats.containers;
+  res["container_dead_bytes"] = stats.container_dead_bytes;
+  return res;
+}
+
+// one dict per version, newest first
+std::vector<py::dict> GetLayout(DBManager* db_manager, int index, bool count_rows) {
+  std::vector<VersionLayout> layouts;
+  {
+    py::gil_scoped_release release;
+    layouts = db_manager->AnalyzeVersions(index, count_rows);
+  }
+  std::vector<py::dict> res;
+  for (const auto& layout : layouts) {
+    py::dict d;
+    d["version"] = layout.version;
+    d["chunks"] = layout.chunks;
+    d["bytes"] = layout.bytes;
+    d["files"] = layout.files;
+    d["reads"] = layout.reads;
+    d["depth"] = layout.depth;
+    d["rows"] = layout.rows;
+    d["unique_rows"] = layout.unique_rows;
+    d["read_amp"] = layout.read_amp;
+    res.push_back(d);
+  }
+  return res;
+}
+
+// the same as a structured array with one row per version
+py::array_t<VersionLayout> GetLayoutArray(DBManager* db_manager, int index, bool count_rows) {
+  std::vector<VersionLayout> layouts;
+  {
+    py::gil_scoped_release release;
+    layouts = db_manager->AnalyzeVersions(index, count_rows);
+  }
+  py::array_t<VersionLayout> res(layouts.size());
+  std::copy(layouts.begin(), layouts.end(), res.mutable_data());
+  return res;
+}
+
+// counters by name, histograms as dicts of count, sum, min, max,
+// average and percentiles. index -1 sums all DBs.
+py::dict GetMetrics(DBManager* db_manager, int index) {
+  Statistics aggregated;
+  const Statistics* stats = &aggregated;
+  if (index < 0) {
+    db_manager->GetAggregatedStatistics(&aggregated);
+  } else {
+    py::gil_scoped_release release;
+    stats = db_manager->GetStatistics(index);
+  }
+  if (stats == nullptr) throw py::value_error("getmetrics got an unknown table index");
+  py::dict res;
+  for (int t = 0; t < kNumTickers; t++) {
+    res[TickerName(static_cast<Ticker>(t))] = stats->GetTickerCount(static_cast<Ticker>(t));
+  }
+  for (int h = 0; h < kNumHistograms; h++) {
+    HistogramData data;
+    stats->GetHistogramData(static_cast<HistogramType>(h), &data);
+    py::dict hist;
+    hist["count"] = data.count;
+    hist["sum"] = data.sum;
+    hist["min"] = data.min;
+    hist["max"] = data.max;
+    hist["average"] = data.average;
+    hist["p50"] = data.p50;
+    hist["p95"] = data.p95;
+    hist["p99"] = data.p99;
+    hist["p999"] = data.p999;
+    res[HistogramName(static_cast<HistogramType>(h))] = hist;
+  }
+  return res;
+}
+
+std::vector<py::bytes> ChunksToBytes(const std::vector<std::string>& chunks) {
+  std::vector<py::bytes> res;
+  for (const auto& chunk : chunks) {
+    res.push_back(py::bytes(chunk));
+  }
+  return res;
+}
+
+std::vector<py::bytes> ReadCheckpoint(DBManager* db_manager, int index, int version) {
+  std::vector<std::string> chunks;
+  {
+    py::gil_scoped_release release;
+    db_manager->ReadCheckpoint(index, version, &chunks);
+  }
+  return ChunksToBytes(chunks);
+}
+
+// A concurrent.futures.Future and the reference to it a worker owns,
+// await it with asyncio.wrap_future.
+py::object NewFuture(py::object** owned) {
+  py::object future = py::module::import("concurrent.futures").attr("Future")();
+  *owned = new py::object(future);
+  return future;
+}
+
+// Call set_result or set_exception of a future unless it was cancelled
+// and drop the reference of the worker. REQUIRES: GIL held
+void SettleFuture(py::object* owned, const char* method, const py::object& arg) {
+  try {
+    if (owned->attr("set_running_or_notify_cancel")().cast<bool>()) {
+      owned->attr(method)(arg);
+    }
+  } catch (py::error_already_set&) {
+    // cancelled or resolved in the meantime
+  }
+  delete owned;
+}
+
+// Resolve a future with result, or with a RuntimeError holding error.
+// REQUIRES: GIL held
+void ResolveFuture(py::object* owned, bool ok, const py::object& result, const std::string& error) {
+  if (ok) {
+    SettleFuture(owned, "set_result", result);
+  } else {
+    SettleFuture(owned, "set_exception", py::module::import("builtins").attr("RuntimeError")(error));
+  }
+}
+
+// Run work on the executor of DB index without the GIL and resolve the
+// returned future with to_python(result). Calls for one DB run in
+// submission order.
+template <typename R>
+py::object SubmitAsync(DBManager* db_manager, int index, std::function<R()> work,
+                       std::function<py::object(const R&)> to_python) {
+  py::object* owned;
+  py::object future = NewFuture(&owned);
+  db_manager->Submit(index, [owned, work, to_python] {
+    bool ok = true;
+    R result = R();
+    std::string error;
+    try {
+      result = work();
+    } catch (const std::exception& e) {
+      ok = false;
+      error = e.what();
+    }
+    py::gil_scoped_acquire acquire;
+    if (!ok) {
+      ResolveFuture(owned, false, py::none(), error);
+      return;
+    }
+    // a failed conversion must still resolve the future, an exception
+    // leaving the worker would end the process
+    py::object value;
+    try {
+      value = to_python(result);
+    } catch (py::error_already_set& e) {
+      SettleFuture(owned, "set_exception", e.value());
+      return;
+    } catch (const std::exception& e) {
+      ResolveFuture(owned, false, py::none(), e.what());
+      return;
+    }
+    ResolveFuture(owned, true, value, std::string());
+  });
+  return future;
+}
+
+py::object ToNone(const bool&) {
+  return py::none();
+}
+
+py::object ToBool(const bool& b) {
+  return py::bool_(b);
+}
+
+// The DBs get their indexes before this returns, so calls made on them
+// later, async or not, wait for their open or open them first.
+py::object OpenAsync(DBManager* db_manager, const std::vector<std::string>& db_paths, bool do_concat,
+                     float extract_thres, bool lazy) {
+  size_t first;
+  bool added;
+  {
+    py::gil_scoped_release release;
+    added = db_manager->AddDBs(db_paths, do_concat, extract_thres, &first);
+  }
+  size_t last = first + db_paths.size();
+  return SubmitAsync<bool>(db_manager, -1, [=] {
+    return (lazy || db_manager->OpenRange(first, last)) && added;
+  }, &ToBool);
+}
+
+// resolves once the chunk is joined, not when the join is queued
+py::object JoinAsync(DBManager* db_manager, int index, const std::vector<uint32_t>& keys,
+                     uint64_t file_number, uint64_t length) {
+  std::vector<JoinRequest> requests(1);
+  requests[0].index = index;
+  requests[0].keys = keys;
+  requests[0].file_number = file_number;
+  requests[0].length = length;
+  py::object* owned;
+  py::object future = NewFuture(&owned);
+  bool ok;
+  {
+    py::gil_scoped_release release;
+    ok = db_manager->JoinAll(std::move(requests), [owned] {
+      py::gil_scoped_acquire acquire;
+      ResolveFuture(owned, true, py::none(), std::string());
+    });
+  }
+  if (!ok) {
+    // nothing was submitted, the future is never handed out
+    delete owned;
+    throw py::value_error(std::string("join_async") + " got an unknown table index");
+  }
+  return future;
+}
+
+py::object DeleteVersionAsync(DBManager* db_manager, int index, int version) {
+  return SubmitAsync<bool>(db_manager, index, [=] {
+    return db_manager->DeleteCheckpointsBefore(index, version);
+  }, &ToBool);
+}
+
+// The keys of one join_all or join_packed chunk. Only a 1-d uint32
+// array is taken, other dtypes raise instead of being cast, which would
+// wrap negative or wide keys. The keys are copied, joins outlive the call.
+std::vector<uint32_t> KeysOf(const py::handle& obj, const char* method) {
+  if (!py::isinstance<py::array_t<uint32_t>>(obj)) {
+    throw py::type_error(std::string(method) + " expects keys as a numpy uint32 array");
+  }
+  auto keys = obj.cast<py::array_t<uint32_t, py::array::c_style>>();
+  if (keys.ndim() != 1) throw py::value_error(std::string(method) + " expects 1-d keys");
+  if (keys.size() == 0) throw py::value_error(std::string(method) + " got a chunk without keys");
+  return std::vector<uint32_t>(keys.data(), keys.data() + keys.size());
+}
+
+// join_all([(index, keys, file_number, length), ...]) joins one chunk
+// per table with one call and resolves one future once all of them are
+// joined.
+py::object JoinAll(DBManager* db_manager, const std::vector<py::tuple>& joins) {
+  std::vector<JoinRequest> requests(joins.size());
+  for (size_t i = 0; i < joins.size(); i++) {
+    if (joins[i].size() != 4) throw py::value_error("join_all expects (index, keys, file_number, length)");
+    requests[i].index = joins[i][0].cast<int>();
+    requests[i].keys = KeysOf(joins[i][1], "join_all");
+    requests[i].file_number = joins[i][2].cast<uint64_t>();
+    requests[i].length = joins[i][3].cast<uint64_t>();
+  }
+  py::object* owned;
+  py::object future = NewFuture(&owned);
+  bool ok;
+  {
+    py::gil_scoped_release release;
+    ok = db_manager->JoinAll(std::move(requests), [owned] {
+      py::gil_scoped_acquire acquire;
+      ResolveFuture(owned, true, py::none(), std::string());
+    });
+  }
+  if (!ok) {
+    // nothing was submitted, the future is never handed out
+    delete owned;
+    throw py::value_error(std::string("join_all") + " got an unknown table index");
+  }
+  return future;
+}
+
+// join_packed(number, [(index, keys, start, length), ...]) joins the
+// regions of container number once its table of contents is synced, the
+// future resolves once every table joined its region.
+py::object JoinPacked(DBManager* db_manager, uint64_t number, const std::vector<py::tuple>& joins) {
+  std::vector<PackedJoinRequest> requests(joins.size());
+  for (size_t i = 0; i < joins.size(); i++) {
+    if (joins[i].size() != 4) throw py::value_error("join_packed expects (index, keys, start, length)");
+    requests[i].index = joins[i][0].cast<int>();
+    requests[i].keys = KeysOf(joins[i][1], "join_packed");
+    requests[i].start = joins[i][2].cast<uint64_t>();
+    requests[i].length = joins[i][3].cast<uint64_t>();
+  }
+  py::object* owned;
+  py::object future = NewFuture(&owned);
+  bool ok;
+  {
+    py::gil_scoped_release release;
+    ok = db_manager->JoinPacked(number, std::move(requests), [owned] {
+      py::gil_scoped_acquire acquire;
+      ResolveFuture(owned, true, py::none(), std::string());
+    });
+  }
+  if (!ok) {
+    ResolveFuture(owned, false, py::none(), "cannot write packed container " + std::to_string(number));
+  }
+  return future;
+}
+
+std::vector<std::tuple<uint32_t, uint64_t, uint64_t>> ReadPackedTableOfContents(const std::string& file_name) {
+  std::vector<PackedEntry> entries;
+  bool ok;
+  {
+    py::gil_scoped_release release;
+    ok = ReadPackedToc(file_name, &entries);
+  }
+  if (!ok) throw py::value_error("no packed table of contents in " + file_name);
+  std::vector<std::tuple<uint32_t, uint64_t, uint64_t>> res;
+  for (const auto& entry : entries) {
+    res.emplace_back(entry.table, entry.start, entry.length);
+  }
+  return res;
+}
+
+py::object ReadCheckpointAsync(DBManager* db_manager, int index, int version) {
+  return SubmitAsync<std::vector<std::string>>(db_manager, index, [=] {
+    std::vector<std::string> chunks;
+    db_manager->ReadCheckpoint(index, version, &chunks);
+    return chunks;
+  }, [](const std::vector<std::string>& chunks) {
+    return py::cast(ChunksToBytes(chunks));
+  });
+}
+
+// The destructor waits for submitted calls, which need the GIL to
+// resolve their futures.
+struct ReleaseGILDeleter {
+  void operator()(DBManager* db_manager) const {
+    py::gil_scoped_release release;
+    delete db_manager;
+  }
+};
 
 PYBIND11_MODULE(py_tdchunk, m) {
   m.doc() = "tdchunk interface";
 
-  py::class_<DBManager>(m, "DBManager")
+  PYBIND11_NUMPY_DTYPE(ChunkRecord, file, start, length);
+  PYBIND11_NUMPY_DTYPE(VersionLayout, version, chunks, bytes, files, reads, depth, rows,
+                       unique_rows, read_amp);
+
+  // every method may wait for a join or a background task of a DB, so
+  // all of them run without the GIL
+  using release_gil = py::call_guard<py::gil_scoped_release>;
+  py::class_<DBManager, std::unique_ptr<DBManager, ReleaseGILDeleter>>(m, "DBManager")
       .def(py::init<>())
-      .def("open", (bool (DBManager::*)(const std::vector<std::string>& db_paths, bool do_concat_, float extract_thres)) & DBManager::OpenDBs)
+      .def("open", (bool (DBManager::*)(const std::vector<std::string>& db_paths, bool do_concat_, float extract_thres, bool lazy)) & DBManager::OpenDBs,
+           py::arg("db_paths"), py::arg("do_concat"), py::arg("extract_thres"), py::arg("lazy") = false, release_gil())
       // .def("flush", (bool (DBManager::*)(int index, const std::string& file_name)) & DBManager::Flush)
-      .def("join", (void (DBManager::*)(int index, const std::vector<uint32_t>& keys, uint64_t file_number, int length)) & DBManager::Join)
-      .def("get_next_number", (uint64_t (DBManager::*)(int index)) & DBManager::GetNextNumber)
-      .def("delversion", (bool (DBManager::*)(int index, int version)) & DBManager::DeleteCheckpointsBefore)
-      .def("releasedb", (void (DBManager::*)()) & DBManager::ReleaseDBs);
+      .def("join", (bool (DBManager::*)(int index, const std::vector<uint32_t>& keys, uint64_t file_number, uint64_t length)) & DBManager::Join, release_gil())
+      .def("get_next_number", (uint64_t (DBManager::*)(int index)) & DBManager::GetNextNumber, release_gil())
+      .def("get_next_file_path", (std::pair<uint64_t, std::string> (DBManager::*)(int index)) & DBManager::GetNextFilePath, release_gil())
+      .def("delversion", (bool (DBManager::*)(int index, int version)) & DBManager::DeleteCheckpointsBefore, release_gil())
+      .def("set_io_engine", (void (DBManager::*)(int type, int queue_depth, bool use_direct_io)) & DBManager::SetIOEngine, release_gil())
+      .def("set_extraction_policy", (bool (DBManager::*)(const std::string& name, double param)) & DBManager::SetExtractionPolicy, release_gil())
+      .def("compact", (void (DBManager::*)(int index, int start, int end)) & DBManager::Compact, release_gil())
+      .def("set_max_columns", (void (DBManager::*)(int max_columns)) & DBManager::SetMaxColumns, release_gil())
+      // false in packed mode, see enable_packed
+      .def("set_merge_every", (bool (DBManager::*)(int merge_every)) & DBManager::SetMergeEvery, release_gil())
+      .def("set_rewrite_threshold", (void (DBManager::*)(double min_live_fraction)) & DBManager::SetRewriteThreshold, release_gil())
+      .def("compact_filters", (void (DBManager::*)(int index)) & DBManager::CompactFilterFile, release_gil())
+      .def("set_delete_rate_limit", (void (DBManager::*)(uint64_t bytes_per_sec)) & DBManager::SetDeleteRateLimit, release_gil())
+      .def("set_retention", (void (DBManager::*)(int keep_last, const std::vector<std::pair<int, int>>& tiers)) & DBManager::SetRetention,
+           py::arg("keep_last"), py::arg("tiers") = std::vector<std::pair<int, int>>(), release_gil())
+      .def("apply_retention", (void (DBManager::*)(int index)) & DBManager::ApplyRetention, release_gil())
+      .def("add_data_path", (int (DBManager::*)(int index, const std::string& path)) & DBManager::AddDataPath, release_gil())
+      .def("set_tiering", (void (DBManager::*)(uint32_t cold_path_id, int cold_level, int cold_age)) & DBManager::SetTiering,
+           py::arg("cold_path_id"), py::arg("cold_level") = 0, py::arg("cold_age") = 0, release_gil())
+      .def("migrate", (void (DBManager::*)(int index)) & DBManager::Migrate, release_gil())
+      .def("set_striping", (bool (DBManager::*)(int index, const std::vector<uint32_t>& path_ids, int mode)) & DBManager::SetStriping,
+           py::arg("index"), py::arg("path_ids"), py::arg("mode") = static_cast<int>(kStripeRoundRobin), release_gil())
+      .def("set_staging", (bool (DBManager::*)(int index, uint32_t path_id)) & DBManager::SetStaging, release_gil())
+      .def("wait_for_destage", (void (DBManager::*)(int index)) & DBManager::WaitForDestage, release_gil())
+      .def("set_rate_limit", (void (DBManager::*)(uint64_t bytes_per_sec, uint64_t ios_per_sec)) & DBManager::SetRateLimit,
+           py::arg("bytes_per_sec"), py::arg("ios_per_sec") = 0, release_gil())
+      .def("request_io", (void (DBManager::*)(uint64_t bytes, int priority)) & DBManager::RequestIO,
+           py::arg("bytes"), py::arg("priority") = static_cast<int>(kIOPriorityWrite), release_gil())
+      .def("dump_metrics", (bool (DBManager::*)(const std::string& file_name)) & DBManager::DumpStatistics, release_gil())
+      .def("start_op_trace", (bool (DBManager::*)(const std::string& file_name)) & DBManager::StartOpTrace, release_gil())
+      .def("stop_op_trace", (void (DBManager::*)()) & DBManager::EndOpTrace, release_gil())
+      .def("wait_for_background_work", (void (DBManager::*)()) & DBManager::WaitForBackgroundWork, release_gil())
+      .def("enable_packed", (bool (DBManager::*)(const std::string& dir)) & DBManager::EnablePackedCheckpoints, release_gil())
+      .def("new_packed_file", (std::pair<uint64_t, std::string> (DBManager::*)()) & DBManager::NewPackedFile, release_gil())
+      .def("releasedb", (void (DBManager::*)()) & DBManager::ReleaseDBs, release_gil())
+      // concurrent.futures.Future of the result, for asyncio.wrap_future
+      .def("open_async", &OpenAsync, py::arg("db_paths"), py::arg("do_concat"),
+           py::arg("extract_thres"), py::arg("lazy") = false)
+      .def("join_async", &JoinAsync)
+      .def("join_all", &JoinAll)
+      .def("join_packed", &JoinPacked)
+      .def("delversion_async", &DeleteVersionAsync)
+      .def("readversion_async", &ReadCheckpointAsync);
 
   m.def("getversion", &GetCheckpointFiles);
+  m.def("getversion_array", &GetCheckpointArray);
+  m.def("getrestoreplan", &GetRestorePlan, py::arg("db_manager"), py::arg("index"),
+        py::arg("version"), py::arg("max_gap") = kRestoreMaxGap);
+  m.def("readversion", &ReadCheckpoint);
+  m.def("read_packed_toc", &ReadPackedTableOfContents);
+  m.def("getamplification", &GetAmplification);
+  m.def("getspacestats", &GetSpaceStats);
+  m.def("getlayout", &GetLayout, py::arg("db_manager"), py::arg("index"),
+        py::arg("count_rows") = false);
+  m.def("getlayout_array", &GetLayoutArray, py::arg("db_manager"), py::arg("index"),
+        py::arg("count_rows") = false);
+  m.def("getmetrics", &GetMetrics, py::arg("db_manager"), py::arg("index") = -1);
+  // spans of all DBs in the process, dumped as Chrome trace JSON
+  m.def("start_tracing", &StartTracing);
+  m.def("stop_tracing", &StopTracing);
+  m.def("dump_trace", &DumpTrace);
+
+  m.attr("STRIPE_ROUND_ROBIN") = static_cast<int>(kStripeRoundRobin);
+  m.attr("STRIPE_CAPACITY") = static_cast<int>(kStripeCapacity);
+
+  // priorities of request_io
+  m.attr("IO_PRIORITY_RESTORE") = static_cast<int>(kIOPriorityRestore);
+  m.attr("IO_PRIORITY_WRITE") = static_cast<int>(kIOPriorityWrite);
+  m.attr("IO_PRIORITY_EXTRACTION") = static_cast<int>(kIOPriorityExtraction);
+  m.attr("IO_PRIORITY_BACKGROUND") = static_cast<int>(kIOPriorityBackground);
 
 }
\ No newline at end of file
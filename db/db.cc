@@ -2,6 +2,9 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
 #include <thread>
 #include <fstream>
 #include <iostream>
@@ -14,12 +17,36 @@
 
 #include "db.h"
 #include "file_helper.h"
+#include "mmap_file.h"
+#include "trace.h"
 
 namespace tdchunk {
 
 DB::DB()
   : use_filter_(true),
-    background_compaction_scheduled_(false) {
+    io_engine_(nullptr),
+    extraction_policy_(nullptr),
+    deleter_(nullptr),
+    retention_policy_(nullptr),
+    rate_limiter_(nullptr),
+    stripe_mode_(kStripeRoundRobin),
+    next_stripe_(0),
+    staging_path_id_(0),
+    destager_(nullptr),
+    shared_path_id_(0),
+    background_compaction_scheduled_(false),
+    list_changes_(0),
+    unlocked_readers_(0),
+    max_columns_(0),
+    merge_every_(0),
+    min_live_fraction_(0),
+    reclaimed_bytes_(0),
+    filter_number_(0),
+    manifest_generation_(0),
+    snapshot_current_(false),
+    rewrites_since_snapshot_(0),
+    l0_bytes_(0),
+    l0_bytes_valid_(false) {
   file_linked_list = nullptr;
   file_list_ = new std::vector<FileMetaData*>();
   bg_flush = nullptr;
@@ -29,9 +56,16 @@ DB::DB()
 }
 
 DB::~DB() {
-  if (bg_flush && bg_flush->joinable()) {
-    bg_flush->join();
+  WaitForBackgroundWork();
+  // staged chunks are written out before closing
+  delete destager_;
+  // a clean close leaves a snapshot of the whole manifest
+  if (manifest_.is_open() && !snapshot_current_) {
+    std::lock_guard<std::mutex> l(mutex_);
+    RewriteManifest(true);
   }
+  // unfinished deletions stay logged in the manifest
+  delete deleter_;
   if (filter_file_.is_open()) {
     filter_file_.flush();
     filter_file_.close();
@@ -42,6 +76,12 @@ DB::~DB() {
   }
 
   delete file_linked_list;
+  delete io_engine_;
+  for (auto engine : path_engines_) {
+    delete engine;
+  }
+  delete extraction_policy_;
+  delete retention_policy_;
 
   // delete file_list and filemetadata
   for (auto it = file_list_->begin(); it != file_list_->end(); it++) {
@@ -56,91 +96,297 @@ bool DB::Open(const std::string& name, bool do_concat, float extract_thres) {
   // open db
   dbname_ = name;
   do_concat_ = do_concat;
-  extract_thres_ = extract_thres;
+  delete extraction_policy_;
+  extraction_policy_ = new ThresholdExtractionPolicy(extract_thres);
 
   bool s = CreateDir(dbname_);
-  std::string manifest_name = dbname_ + "/manifest";
-  //filter
-  std::string filter_file_name_ = dbname_ + "/filter";
-  if (use_filter_) {
-    if (!FileExists(filter_file_name_)) {
-      filter_file_.open(filter_file_name_, std::ios::out | std::ios::trunc);
-    } else {
-      filter_file_.open(filter_file_name_, std::ios::out | std::ios::app);
-    }
+  data_paths_.assign(1, dbname_);
+  if (io_engine_ == nullptr) {
+    io_engine_ = NewIOEngine(io_options_);
   }
+  std::string manifest_name = dbname_ + "/manifest";
+  // chunk files logged as queued for deletion
+  std::vector<uint64_t> obsolete;
   //manifest
   if (!FileExists(manifest_name)) {
     manifest_.open(manifest_name, std::ios::out | std::ios::trunc); //create new file
   } else {
     // recover db according to manifest
-    std::ifstream file(manifest_name);
-    file.seekg(0, std::ios::beg);
-
-    uint32_t tag, level, column;
-    uint64_t start;
-    uint64_t length;
-    uint64_t number;
-    uint32_t smallest, largest;
-    uint64_t filter_start, filter_length;
-    while(file >> tag) {
-      FileMetaData* f = new FileMetaData;
-      if (tag == kFlag) {
-        file >> level >> column;
-        f->tag = tag;
-        f->level = level;
-        f->column = column;
-        f->number = 0;
-        file_list_->push_back(f);
-      } else if (tag == kNewFile || tag == kMergedFile) {
-        file >> start >> length >> level >> column >> number >> smallest >> largest >> filter_start >> filter_length;
-        f->tag = tag;
-        f->start = start;
-        f->length = length;
-        f->level = level;
-        f->column = column;
-        f->number = number;
-        f->smallest = smallest;
-        f->largest = largest;
-        f->filter_start = filter_start;
-        f->filter_length = filter_length;
-        file_list_->push_back(f);
-      } else if (tag == kMergedRef) { // to delete merged file
-        int ref;
-        file >> number >> ref;
-        if (ref != 0) {
-          merged_file_ref[number] = ref;
-        }
-      }
-      
+    if (!LoadSnapshot(manifest_name, &obsolete)) {
+      LoadManifest(manifest_name, 0, &obsolete);
+    }
+    for (size_t i = 1; i < data_paths_.size(); i++) {
+      CreateDir(data_paths_[i]);
     }
-    file.close();
     manifest_.open(manifest_name, std::ios::out | std::ios::app);
+  }
 
+  //filter, append to the end of the file the manifest points at
+  if (use_filter_) {
+    filter_file_.open(FilterFileName(filter_number_),
+                      std::ios::out | std::ios::app | std::ios::ate);
   }
 
   // recover linked list
   file_linked_list = new FileLinkedList(*file_list_);
+  // the filter file is numbered from the same sequence as the chunks
+  file_linked_list->max_file_num_ = std::max(file_linked_list->max_file_num_, filter_number_);
+  deleter_ = new FileDeleter();
+  deleter_->SetStatistics(&stats_);
+  std::unordered_set<uint64_t> live;
+  for (auto file : *file_list_) {
+    if (file->tag == kNewFile || file->tag == kMergedFile) {
+      live.insert(file->number);
+    }
+  }
+  // outputs of a merge, extraction or compaction cut short by a crash
+  obsolete.insert(obsolete.end(), pending_outputs_.begin(), pending_outputs_.end());
+  pending_outputs_.clear();
+  for (auto number : obsolete) {
+    // a crash may leave a file logged before the manifest dropped it
+    if (live.count(number) != 0) continue;
+    // never hand out a number whose file is still being deleted
+    file_linked_list->max_file_num_ = std::max(file_linked_list->max_file_num_, number);
+    deleter_->Schedule(ChunkFileName(number), number);
+  }
+  DeleteOrphanFiles();
+
+  // finish destaging what was joined before the last close
+  if (staging_path_id_ != 0 && staging_path_id_ < data_paths_.size()) {
+    destager_ = new ThreadPool(1);
+    for (auto number : live) {
+      if (PathId(number) == staging_path_id_) ScheduleDestage(number);
+    }
+  } else {
+    staging_path_id_ = 0;
+  }
 
+  // keys are dense row ids, the largest one bounds the distinct rows
+  uint64_t rows = 0;
+  for (auto file : *file_list_) {
+    if ((file->tag == kNewFile || file->tag == kMergedFile) && file->largest + 1ull > rows) {
+      rows = file->largest + 1ull;
+    }
+  }
+  amp_stats_.SeedUniqueRows(rows);
+
+  // false if the DB directory could not be created
+  return manifest_.is_open();
+}
+
+bool DB::OpenReadOnly(const std::string& name) {
+  dbname_ = name;
+  data_paths_.assign(1, dbname_);
+  if (io_engine_ == nullptr) {
+    io_engine_ = NewIOEngine(io_options_);
+  }
+  std::string manifest_name = dbname_ + "/manifest";
+  if (!FileExists(manifest_name)) return false;
+  std::vector<uint64_t> obsolete;
+  if (!LoadSnapshot(manifest_name, &obsolete)) {
+    LoadManifest(manifest_name, 0, &obsolete);
+  }
+  file_linked_list = new FileLinkedList(*file_list_);
+  deleter_ = new FileDeleter();
   return true;
 }
 
-void DB::NotifyJoin(const std::vector<uint32_t>& keys, uint64_t file_number, uint64_t length) {
+void DB::LoadManifest(const std::string& manifest_name, uint64_t offset,
+                      std::vector<uint64_t>* obsolete) {
+  std::ifstream file(manifest_name);
+  file.seekg(offset, std::ios::beg);
+
+  uint32_t tag, column;
+  uint64_t number;
+  while(file >> tag) {
+    if (tag == kFlag || tag == kNewFile || tag == kMergedFile) {
+      FileMetaData* f = new FileMetaData;
+      DecodeFrom(file, tag, f);
+      file_list_->push_back(f);
+    } else if (tag == kMergedRef) { // to delete merged file
+      int ref;
+      file >> number >> ref;
+      if (ref != 0) {
+        merged_file_ref[number] = ref;
+      }
+    } else if (tag == kFilterFile) {
+      file >> number;
+      filter_number_ = number;
+    } else if (tag == kObsoleteFile) {
+      file >> number;
+      obsolete->push_back(number);
+    } else if (tag == kDroppedColumn) {
+      file >> column;
+      dropped_columns_.insert(column);
+    } else if (tag == kDataPath) {
+      uint32_t path_id;
+      std::string path;
+      file >> path_id >> path;
+      if (path_id >= data_paths_.size()) data_paths_.resize(path_id + 1);
+      data_paths_[path_id] = path;
+    } else if (tag == kFilePath) {
+      uint32_t path_id;
+      file >> number >> path_id;
+      file_path_id_[number] = path_id;
+    } else if (tag == kStagingPath) {
+      file >> staging_path_id_;
+    } else if (tag == kManifestGeneration) {
+      file >> manifest_generation_;
+    } else if (tag == kSharedPath) {
+      file >> shared_path_id_;
+    } else if (tag == kPendingFile) {
+      uint32_t path_id;
+      file >> number >> path_id;
+      if (path_id != 0) file_path_id_[number] = path_id;
+      pending_outputs_.insert(number);
+    }
+    
+  }
+  file.close();
+}
+
+bool DB::LoadSnapshot(const std::string& manifest_name, std::vector<uint64_t>* obsolete) {
+  TraceSpan span("DB::LoadSnapshot");
+  std::string snapshot_name = dbname_ + "/snapshot";
+  uint64_t size;
+  if (!GetFileSize(snapshot_name, &size)) return false;
+  std::string contents(size, '\0');
+  std::ifstream file(snapshot_name, std::ios::in | std::ios::binary);
+  if (!file.read(&contents[0], size)) return false;
+  file.close();
+  MetadataSnapshot snapshot;
+  if (!DecodeSnapshot(contents, &snapshot)) return false;
+
+  // the manifest must still end, or continue, where the snapshot was
+  // taken, a crash between the two renames leaves an older snapshot
+  uint64_t manifest_size;
+  const std::string& expected = snapshot.manifest_tail;
+  std::string tail(expected.size(), '\0');
+  std::ifstream manifest(manifest_name, std::ios::in | std::ios::binary);
+  if (expected.empty() || !GetFileSize(manifest_name, &manifest_size) ||
+      manifest_size < snapshot.manifest_size || snapshot.manifest_size < expected.size() ||
+      !manifest.seekg(snapshot.manifest_size - expected.size()) ||
+      !manifest.read(&tail[0], tail.size()) || tail != expected) {
+    for (auto f : snapshot.files) {
+      delete f;
+    }
+    return false;
+  }
+  manifest.close();
+
+  file_list_->insert(file_list_->end(), snapshot.files.begin(), snapshot.files.end());
+  for (const auto& ref : snapshot.merged_refs) {
+    if (ref.second != 0) merged_file_ref[ref.first] = ref.second;
+  }
+  filter_number_ = snapshot.filter_number;
+  dropped_columns_.insert(snapshot.dropped_columns.begin(), snapshot.dropped_columns.end());
+  obsolete->insert(obsolete->end(), snapshot.obsolete.begin(), snapshot.obsolete.end());
+  for (const auto& path : snapshot.data_paths) {
+    if (path.first >= data_paths_.size()) data_paths_.resize(path.first + 1);
+    data_paths_[path.first] = path.second;
+  }
+  for (const auto& path : snapshot.file_paths) {
+    file_path_id_[path.first] = path.second;
+  }
+  staging_path_id_ = snapshot.staging_path_id;
+  shared_path_id_ = snapshot.shared_path_id;
+  manifest_generation_ = snapshot.generation;
+
+  // joins and deletions logged since
+  if (manifest_size > snapshot.manifest_size) {
+    LoadManifest(manifest_name, snapshot.manifest_size, obsolete);
+  }
+  snapshot_current_ = manifest_size == snapshot.manifest_size;
+  return true;
+}
+
+void DB::NotifyJoin(std::vector<uint32_t> keys, uint64_t file_number, uint64_t length,
+                    std::function<void()> done) {
+  Schedule(std::bind(&DB::JoinThen, this, std::move(keys), file_number, 0, length,
+                     std::move(done)));
+}
+
+void DB::NotifyJoinShared(std::vector<uint32_t> keys, uint64_t number, uint64_t start,
+                          uint64_t length, std::function<void()> done) {
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    // like a staged chunk, the path is known before the join
+    file_path_id_[number] = shared_path_id_;
+    unjoined_numbers_.insert(number);
+  }
+  Schedule(std::bind(&DB::JoinThen, this, std::move(keys), number, start, length,
+                     std::move(done)));
+}
+
+void DB::JoinThen(const std::vector<uint32_t>& keys, uint64_t file_number, uint64_t start,
+                  uint64_t length, const std::function<void()>& done) {
+  JoinRegion(keys, file_number, start, length);
+  if (done) done();
+}
+
+void DB::Schedule(std::function<void()> work) {
+  std::lock_guard<std::mutex> l(bg_mu_);
+  if (bg_flush && bg_flush->joinable()) {
+    bg_flush->join();
+  }
+  bg_flush.reset(new std::thread(std::move(work)));
+}
+
+void DB::WaitForBackgroundWork() {
+  std::lock_guard<std::mutex> l(bg_mu_);
   if (bg_flush && bg_flush->joinable()) {
     bg_flush->join();
   }
-  // bg_flush.reset(new std::thread(&DB::Flush, this));
-  bg_flush.reset(new std::thread(std::bind(&DB::Join, this, keys, file_number, length)));
-  // Flush();
 }
 
 uint64_t DB::GetNextNumber() {
+  std::lock_guard<std::mutex> l(mutex_);
   return file_linked_list->NextFileNumber();
 }
 
+void DB::GetNextFilePath(uint64_t* number, std::string* file_name) {
+  std::lock_guard<std::mutex> l(mutex_);
+  if (staging_path_id_ != 0) {
+    // acknowledged from memory, the destager writes it out after join
+    *number = file_linked_list->NextFileNumber();
+    file_path_id_[*number] = staging_path_id_;
+  } else {
+    *number = NewChunkNumber();
+  }
+  unjoined_numbers_.insert(*number);
+  *file_name = ChunkFileName(*number);
+}
+
 void DB::Join(const std::vector<uint32_t>& keys, uint64_t file_number, uint64_t length) {
+  JoinRegion(keys, file_number, 0, length);
+}
+
+void DB::JoinRegion(const std::vector<uint32_t>& keys, uint64_t file_number, uint64_t start,
+                    uint64_t length) {
+  TraceSpan span("DB::Join");
+  stats_.RecordTick(kJoins);
+  {
+    StopWatch sw(&stats_, kJoinMicros);
+    {
+      IOChargeScope charge(this);
+      std::lock_guard<std::mutex> l(mutex_);
+      JoinLocked(keys, file_number, start, length);
+    }
+    BackgroundExtraction(keys);
+  }
+  MaybeMerge();
+  MaybeApplyRetention();
+  MaybeCompact();
+  MaybeRewriteContainers();
+  MaybeCompactFilterFile();
+  MaybeMigrate();
+}
+
+void DB::JoinLocked(const std::vector<uint32_t>& keys, uint64_t file_number, uint64_t start,
+                    uint64_t length) {
   uint64_t filter_start = 0, filter_length = 0;
   if(use_filter_) {
+    TraceSpan span("Join.CreateFilter");
     std::string result;
     filter_policy_->CreateFilter(keys, &result);
     filter_start = filter_file_.tellp();
@@ -153,22 +399,47 @@ void DB::Join(const std::vector<uint32_t>& keys, uint64_t file_number, uint64_t
   meta->number = file_number;
   meta->smallest = keys[0];
   meta->largest = keys[keys.size() - 1];
-  meta->tag = kNewFile;
+  // a region of a shared container is ref counted like a merged one
+  bool shared = IsShared(file_number);
+  meta->tag = shared ? kMergedFile : kNewFile;
   meta->level = 0;
   meta->filter_start = filter_start;
   meta->filter_length = filter_length;
-  meta->start = 0;
+  meta->start = start;
   meta->length = length;
 
   file_list_->push_back(meta);
   file_linked_list->AddL0Node(meta);
+  // extractions read against the old head are planned again
+  list_changes_++;
+  amp_stats_.RecordJoin(keys, length);
+  // a new column is one chunk wide, it reads the level 0 chunk of every
+  // column and older versions read what they did before
+  if (l0_bytes_valid_) {
+    l0_bytes_ += length;
+    version_bytes_[meta->column] = l0_bytes_;
+  } else {
+    l0_bytes_ = VersionBytes(meta->column);
+    l0_bytes_valid_ = true;
+  }
 
+  TraceSpan manifest_span("Join.ManifestAppend");
   std::string to_write;
   EncodeTo(meta, to_write);
   manifest_ << to_write;
+  unjoined_numbers_.erase(file_number);
+  snapshot_current_ = false;
+  if (PathId(file_number) != 0) {
+    manifest_ << kFilePath << " " << file_number << " " << PathId(file_number) << "\n";
+  }
+  if (shared) {
+    manifest_ << kMergedRef << " " << file_number << " " << ++merged_file_ref[file_number] << "\n";
+  }
   manifest_.flush();
-
-  BackgroundExtraction(keys);
+  manifest_span.Finish();
+  if (staging_path_id_ != 0 && PathId(file_number) == staging_path_id_) {
+    ScheduleDestage(file_number);
+  }
 }
 
 // void DB::Flush() {
@@ -243,92 +514,292 @@ void DB::Join(const std::vector<uint32_t>& keys, uint64_t file_number, uint64_t
 // }
 
 bool DB::ShouldExtract(const std::vector<uint32_t>& keys, std::vector<FileMetaData*>& to_be_extracted) {
+  TraceSpan span("DB::ShouldExtract");
   to_be_extracted.clear();
-  if (extract_thres_ > 0 && keys.size() <= 100) return false;
+  assert(!keys.empty());
 
-  auto thres = static_cast<int>(keys.size() * extract_thres_);
-  
   //first, choose files by smallest and largest key
   std::vector<FileMetaData*> overlapped;
   file_linked_list->GetOverlappedFilesL0(overlapped);
   if (overlapped.size() == 0) return false;
 
+  std::vector<ExtractionCandidate> candidates;
   if (!use_filter_) {
-    to_be_extracted = overlapped;
+    for (auto file : overlapped) {
+      ExtractionCandidate c;
+      c.file = file;
+      c.hits = keys.size();
+      candidates.push_back(c);
+    }
   } else {
     //open filter file for read;
-    std::ifstream f(dbname_ + "/filter");
-    assert(!keys.empty());
+    std::ifstream f(FilterFileName(filter_number_));
 
     for (auto file : overlapped) {
       if (file->filter_length == 0) {
         continue;
       }
+      TraceSpan read_span("ShouldExtract.ReadFilter");
       f.seekg(file->filter_start, std::ios::beg);
       char* filter = new char[file->filter_length];
       f.read(filter, file->filter_length);
+      read_span.Finish();
 
-      int hit = 0;
+      TraceSpan probe_span("ShouldExtract.Probe");
+      ExtractionCandidate c;
+      c.file = file;
+      c.hits = 0;
       for (auto key : keys) {
-        bool e = filter_policy_->KeyMayMatch(key, filter, file->filter_length);
-        hit += e;
-      }
-      if (hit > thres) {
-        // std::cout << hit << " ";
-        to_be_extracted.push_back(file);
+        c.hits += filter_policy_->KeyMayMatch(key, filter, file->filter_length);
       }
+      candidates.push_back(c);
+      probe_span.Finish();
+      stats_.RecordTick(kFilterProbes, keys.size());
+      stats_.RecordTick(kFilterHits, c.hits);
 
-      delete filter;
+      delete[] filter;
     }
-    // std::cout << std::endl;
     f.close();
   }
 
-  return to_be_extracted.size() != 0;
+  ExtractionContext ctx;
+  ctx.new_rows = keys.size();
+  ctx.version_bytes = VersionBytes(file_linked_list->getHeadFileMeta()->column);
+  ctx.stats = &amp_stats_;
+  return extraction_policy_->PickFiles(ctx, candidates, &to_be_extracted);
 }
 
-void DB::BackgroundExtraction(const std::vector<uint32_t>& keys) {
-  bool rewrite = false;
-  std::vector<FileMetaData*> input;
-  if (ShouldExtract(keys, input)) {// generate Extraction
-    // std::cout << "doing extraction with " << input.size() << " files" << std::endl;
-    
-    Extraction* e = new Extraction(file_linked_list->getHeadFileMeta(), input);
-    bool success = DoExtractionWork(e);
+uint64_t DB::VersionBytes(int version) {
+  auto it = version_bytes_.find(version);
+  if (it != version_bytes_.end()) return it->second;
+  std::vector<FileMetaData*> files;
+  uint64_t bytes = 0;
+  if (file_linked_list->GetVersion(version, files)) {
+    for (auto file : files) {
+      if (file->tag == kNewFile || file->tag == kMergedFile) {
+        bytes += file->length;
+      }
+    }
+    version_bytes_[version] = bytes;
+  }
+  return bytes;
+}
+
+void DB::InvalidateVersionBytes() {
+  version_bytes_.clear();
+  l0_bytes_valid_ = false;
+}
 
-    rewrite = true;
+AmplificationStats DB::GetAmplificationStats() {
+  std::lock_guard<std::mutex> l(mutex_);
+  return amp_stats_;
+}
 
-    if (success) {
-      CleanupExtraction(e);
-    } else {
-      assert(success); // error 
+void DB::SetExtractionPolicy(ExtractionPolicy* policy) {
+  // joins use the policy under mutex_, extractions also while reading
+  // without it
+  std::unique_lock<std::mutex> l(mutex_);
+  no_unlocked_readers_.wait(l, [this] { return unlocked_readers_ == 0; });
+  delete extraction_policy_;
+  extraction_policy_ = policy;
+}
+
+void DB::BackgroundExtraction(const std::vector<uint32_t>& keys) {
+  TraceSpan span("DB::BackgroundExtraction");
+  std::unique_ptr<Extraction> e;
+  int column;
+  uint64_t list_changes;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    FileMetaData* head = file_linked_list->getHeadFileMeta();
+    column = head->column;
+    std::vector<FileMetaData*> input;
+    if (!ShouldExtract(keys, input)) {
+      amp_stats_.RecordVersion(column, VersionBytes(column));
+      return;
     }
-    delete e;
+    std::vector<InputChunk> inputs;
+    for (auto file : input) {
+      inputs.push_back(ChunkInput(file));
+    }
+    e.reset(new Extraction(ChunkInput(head), inputs));
+    list_changes = list_changes_;
+    AddUnlockedReader();
   }
-  if (rewrite) {
+
+  stats_.RecordTick(kExtractions);
+  StopWatch sw(&stats_, kExtractionMicros);
+  // restores and other background work go on while the chunks are read
+  bool success = DoExtractionWork(e.get());
+
+  std::lock_guard<std::mutex> l(mutex_);
+  RemoveUnlockedReader();
+  if (success && list_changes == list_changes_) {
+    std::unordered_set<uint64_t> input_file_columns;
+    for (const auto& result : e->results) {
+      InstallExtractionResults(result);
+      input_file_columns.insert(result.input->meta.column);
+      e->should_del_files.push_back(result.input->file);
+    }
+    // move children to deeper
+    file_linked_list->MoveOtherToDeeper(input_file_columns, *file_list_);
+    CleanupExtraction(e.get());
     RewriteManifest();
+  } else {
+    // an input may be gone, a later join extracts again
+    DiscardOutputs(e->outputs);
   }
-  return ;
+  amp_stats_.RecordVersion(column, VersionBytes(column));
 }
 
-bool DB::RewriteManifest() {
-  //write manifest
-  manifest_.close();
-  manifest_.open(dbname_+"/manifest", std::ios::out | std::ios::trunc);
+bool DB::RewriteManifest(bool write_snapshot) {
+  TraceSpan span("DB::RewriteManifest");
+  // every change of the file list but a join is followed by a rewrite
+  InvalidateVersionBytes();
+  list_changes_++;
+  // outputs are installed before the rewrite that follows them, the
+  // rest were given up
+  std::unordered_set<uint64_t> live;
   for (auto file : *file_list_) {
-    if (file->tag == kDeletedFile) continue;
+    if (file->tag == kNewFile || file->tag == kMergedFile) live.insert(file->number);
+  }
+  for (auto number : pending_outputs_) {
+    if (live.count(number) == 0) ObsoleteFile(number);
+  }
+  pending_outputs_.clear();
+  StopWatch sw(&stats_, kManifestWriteMicros);
+  // the manifest and its snapshot log the same state
+  MetadataSnapshot snapshot;
+  for (auto file : *file_list_) {
+    if (file->tag != kDeletedFile) snapshot.files.push_back(file);
+  }
+  // sorted here once rather than at every open
+  std::sort(snapshot.files.begin(), snapshot.files.end(), &CompareFileMetaData);
+  snapshot.merged_refs.assign(merged_file_ref.begin(), merged_file_ref.end());
+  snapshot.filter_number = filter_number_;
+  // forget dropped columns whose nodes are gone
+  std::vector<int> columns;
+  file_linked_list->GetColumns(&columns);
+  std::unordered_set<int> present(columns.begin(), columns.end());
+  for (auto it = dropped_columns_.begin(); it != dropped_columns_.end();) {
+    if (present.count(*it) == 0) {
+      it = dropped_columns_.erase(it);
+    } else {
+      snapshot.dropped_columns.push_back(*it);
+      ++it;
+    }
+  }
+  snapshot.obsolete = deleter_->Pending();
+  for (size_t i = 1; i < data_paths_.size(); i++) {
+    snapshot.data_paths.push_back(std::make_pair(static_cast<uint32_t>(i), data_paths_[i]));
+  }
+  snapshot.staging_path_id = staging_path_id_;
+  snapshot.shared_path_id = shared_path_id_;
+  // tiers of live files and of files still to be deleted
+  std::unordered_set<uint64_t> numbers(snapshot.obsolete.begin(), snapshot.obsolete.end());
+  for (auto file : snapshot.files) {
+    if (file->tag == kNewFile || file->tag == kMergedFile) numbers.insert(file->number);
+  }
+  for (auto it = file_path_id_.begin(); it != file_path_id_.end();) {
+    if (numbers.count(it->first) == 0) {
+      if (unjoined_numbers_.count(it->first) != 0) {
+        ++it;
+        continue;
+      }
+      it = file_path_id_.erase(it);
+    } else {
+      snapshot.file_paths.push_back(*it);
+      ++it;
+    }
+  }
+  snapshot.generation = ++manifest_generation_;
+
+  // write the new manifest aside and rename it over the old one, so a
+  // crash leaves either the old or the new file list and ref counts
+  std::string contents;
+  for (auto file : snapshot.files) {
     std::string to_write;
     EncodeTo(file, to_write);
-    manifest_ << to_write;
+    contents += to_write;
   }
-  for (auto pair : merged_file_ref) {
-    std::string to_write = std::to_string(kMergedRef) + " "
-                          + std::to_string(pair.first) + " "
-                          + std::to_string(pair.second) + "\n";
-    manifest_ << to_write;
+  for (const auto& pair : snapshot.merged_refs) {
+    contents += std::to_string(kMergedRef) + " "
+                + std::to_string(pair.first) + " "
+                + std::to_string(pair.second) + "\n";
   }
-  manifest_.flush();
+  if (filter_number_ != 0) {
+    contents += std::to_string(kFilterFile) + " " + std::to_string(filter_number_) + "\n";
+  }
+  for (auto column : snapshot.dropped_columns) {
+    contents += std::to_string(kDroppedColumn) + " " + std::to_string(column) + "\n";
+  }
+  for (auto number : snapshot.obsolete) {
+    contents += std::to_string(kObsoleteFile) + " " + std::to_string(number) + "\n";
+  }
+  for (const auto& path : snapshot.data_paths) {
+    contents += std::to_string(kDataPath) + " " + std::to_string(path.first) + " " + path.second + "\n";
+  }
+  if (staging_path_id_ != 0) {
+    contents += std::to_string(kStagingPath) + " " + std::to_string(staging_path_id_) + "\n";
+  }
+  if (shared_path_id_ != 0) {
+    contents += std::to_string(kSharedPath) + " " + std::to_string(shared_path_id_) + "\n";
+  }
+  for (const auto& path : snapshot.file_paths) {
+    contents += std::to_string(kFilePath) + " " + std::to_string(path.first) + " "
+                + std::to_string(path.second) + "\n";
+  }
+  contents += std::to_string(kManifestGeneration) + " " + std::to_string(snapshot.generation) + "\n";
+  std::string manifest_name = dbname_ + "/manifest";
+  std::string tmp_name = manifest_name + ".tmp";
+  if (!WriteStringToFileSync(contents, tmp_name) ||
+      !RenameFile(tmp_name, manifest_name)) {
+    return false;
+  }
+  SyncDir(dbname_);
+  manifest_.close();
+  manifest_.open(manifest_name, std::ios::out | std::ios::app);
+
+  // a reader without the lock may still map the regions and containers,
+  // they are released by the first rewrite after it is done
+  if (unlocked_readers_ == 0) {
+    // no manifest references the released regions any more
+    for (const auto& region : dead_regions_) {
+      if (PunchHole(ChunkFileName(region.number), region.start, region.length)) {
+        reclaimed_bytes_ += region.length;
+      }
+    }
+    dead_regions_.clear();
+  }
+  // kept until SetSharedPath installs the owner after an open
+  if (shared_release_ && unlocked_readers_ == 0) {
+    for (auto number : released_shared_) {
+      shared_release_(number);
+    }
+    released_shared_.clear();
+  }
+
+  snapshot.manifest_size = contents.size();
+  snapshot.manifest_tail = contents.substr(contents.size() - std::min(contents.size(), kSnapshotTailSize));
+  // a snapshot costs an fsync, the manifest alone can still be replayed
+  if (write_snapshot || ++rewrites_since_snapshot_ >= kSnapshotInterval) {
+    snapshot_current_ = WriteSnapshot(snapshot);
+    if (snapshot_current_) rewrites_since_snapshot_ = 0;
+  } else {
+    snapshot_current_ = false;
+  }
+  return true;
+}
 
+bool DB::WriteSnapshot(const MetadataSnapshot& snapshot) {
+  TraceSpan span("DB::WriteSnapshot");
+  std::string contents;
+  EncodeSnapshot(snapshot, &contents);
+  // the directory is not synced, a lost rename leaves the snapshot of an
+  // older generation, which open ignores
+  std::string snapshot_name = dbname_ + "/snapshot";
+  std::string tmp_name = snapshot_name + ".tmp";
+  return WriteStringToFileSync(contents, tmp_name) && RenameFile(tmp_name, snapshot_name);
 }
 
 bool DB::CleanupExtraction(Extraction* e) {
@@ -336,16 +807,10 @@ bool DB::CleanupExtraction(Extraction* e) {
   bool success = true;
   for (auto file : e->should_del_files) {
     if (file->tag == kNewFile) {
-      auto fname = MakeFileName(dbname_, file->number, "tdc");
-      success = DeleteFile(fname);
+      ObsoleteFile(file->number);
       file->tag = kDeletedFile;
     } else if (file->tag == kMergedFile) {
-      merged_file_ref[file->number]--;
-      if (merged_file_ref[file->number] <= 0) {
-        auto fname = MakeFileName(dbname_, file->number, "tdc");
-        success = DeleteFile(fname);
-        merged_file_ref.erase(file->number);
-      }
+      success = ReleaseMergedRegion(file);
       // file is not deleted but file meta should be deleted
       file->tag = kDeletedFile;
     }
@@ -357,56 +822,58 @@ bool DB::CleanupExtraction(Extraction* e) {
 
 
 bool DB::DoExtractionWork(Extraction* e) {
+  TraceSpan span("DB::DoExtractionWork");
   // 1. unpack base file
-  std::string base_fname = MakeFileName(dbname_, e->base_->number, "tdc");
-  msgpack::object base_file_content;
-  std::ifstream base_input(base_fname, std::ios::binary);
-  base_input.seekg(0, std::ios::beg);
-  std::stringstream buffer;
-  buffer << base_input.rdbuf();
-
-  // unpack MessagePack data
-  msgpack::object_handle oh = msgpack::unpack(buffer.str().data(), buffer.str().size());
-  base_file_content = oh.get();
+  const FileMetaData& base = e->base_.meta;
+  msgpack::object_handle base_oh;
+  ChargeIO(base.length, 0, kIOPriorityExtraction);
+  // the mapping is read in while decoding
+  TraceSpan base_decode_span("Extraction.Decode");
+  if (!UnpackRegion(e->base_.fname, base.start, base.length, base_oh)) {
+    return false;
+  }
+  base_decode_span.Finish();
+  msgpack::object base_file_content = base_oh.get();
 
+  TraceSpan base_build_span("Extraction.BuildMap");
   std::map<uint32_t, std::vector<double>> base_map;
   base_file_content.convert(base_map);
+  base_build_span.Finish();
 
   assert(!base_map.empty());
   // generate base file iterator
   auto base_file_iter = base_map.begin();
 
-  std::unordered_set<uint64_t> input_file_columns;
-
   // 2. for every file in inputs
   int ext_cnt = 0;
   std::vector<int> act_files;
   std::ofstream concated_retained_file_;
   std::ofstream concated_extracted_file_;
-  for (auto file : e->inputs_) {
+  for (const auto& input : e->inputs_) {
+    const FileMetaData* file = &input.meta;
     // reset base_iter
     base_file_iter = base_map.begin();
 
 
     // find equal keys using double pointer
-    std::string fname = MakeFileName(dbname_, file->number, "tdc");
-    msgpack::object cur_file_content;
-    std::ifstream cur_input(fname, std::ios::binary);
-    cur_input.seekg(file->start, std::ios::beg);
-    char* cur_buffer = new char[file->length];
-    cur_input.read(cur_buffer, file->length);
-    // unpack MessagePack data
-    msgpack::object_handle oh = msgpack::unpack(cur_buffer, file->length);
-    cur_file_content = oh.get();
+    // only the chunk's region of a merged file is mapped
+    msgpack::object_handle oh;
+    ChargeIO(file->length, 0, kIOPriorityExtraction);
+    TraceSpan decode_span("Extraction.Decode");
+    if (!UnpackRegion(input.fname, file->start, file->length, oh)) {
+      return false;
+    }
+    decode_span.Finish();
+    msgpack::object cur_file_content = oh.get();
     
+    TraceSpan build_span("Extraction.BuildMap");
     std::map<uint32_t, std::vector<double>> cur_map;
     cur_file_content.convert(cur_map);
+    build_span.Finish();
 
     assert(!cur_map.empty());
 
-    auto cur_file_iter = cur_map.begin();
-
-    int comp = file->smallest - e->base_->smallest;
+    int comp = file->smallest - base.smallest;
 
     if (comp > 0) { // comp > 0
       // base iter seek to file->smallest
@@ -416,52 +883,18 @@ bool DB::DoExtractionWork(Extraction* e) {
         }
       }
       if (base_file_iter->first > file->largest) {
-        cur_input.close();
-        delete cur_buffer;
         continue;
       }
     }
 
-    int total_extracted = 0;
-    while (cur_file_iter != cur_map.end() && base_file_iter != base_map.end()) {
-      
-      bool extracted = false;
-      bool retained = false;
-      auto f_key = cur_file_iter->first;
-      auto f_value = cur_file_iter->second;
-      auto base_key = base_file_iter->first;
-      int equal = f_key - base_key;
-      if (equal > 0) {
-        base_file_iter++;
-      } else if (equal < 0) {
-        retained = true;
-        cur_file_iter++;
-      } else { //equal, extract to file
-        extracted = true;
-        total_extracted++;
-        cur_file_iter++;
-        base_file_iter++;
-      }
-
-      // push into data_map
-      if (extracted) {
-        e->out_extracted[f_key] = f_value;
-      }
-      if (retained) {
-        e->out_retained[f_key] = f_value;
-      }
-    }
-    
-    while (cur_file_iter != cur_map.end()) { // write unfinished keys
-      auto f_key = cur_file_iter->first;
-      auto f_value = cur_file_iter->second;
-      e->out_retained[f_key] = f_value;
-      cur_file_iter++;
-    }
+    TraceSpan join_span("Extraction.MergeJoin");
+    int total_extracted = MergeJoin(base_file_iter, base_map.end(), cur_map,
+                                    &e->out_extracted, &e->out_retained);
+    join_span.Finish();
 
 
     //cur file done. Before switch to next file, save and reset data_map
-    if (total_extracted <= static_cast<int>(base_map.size() * extract_thres_)) { 
+    if (!extraction_policy_->ShouldInstall(total_extracted, base_map.size())) {
       // no equal keys found or too little extracted data, should not extract file
       // do nothing and clear current data_map
       // assert(e->out_extracted.empty());
@@ -470,20 +903,21 @@ bool DB::DoExtractionWork(Extraction* e) {
     } else {
       // std::cout << total_extracted << " ";
       ext_cnt++;
+      stats_.RecordTick(kFilesExtracted);
+      TraceSpan pack_span("Extraction.Pack");
       act_files.push_back(file->column);
       
       if (do_concat_) {
         if (!concated_extracted_file_.is_open()) {
-          e->extracted.number = file_linked_list->NextFileNumber();
-          e->retained.number = file_linked_list->NextFileNumber();
-          auto extracted_file = MakeFileName(dbname_, e->extracted.number, "tdc");
+          std::string extracted_file, retained_file;
+          e->extracted.number = NewOutput(&extracted_file);
+          e->retained.number = NewOutput(&retained_file);
+          e->outputs.push_back(e->extracted.number);
+          e->outputs.push_back(e->retained.number);
           concated_extracted_file_.open(extracted_file, std::ios::binary);
-          auto retained_file = MakeFileName(dbname_, e->retained.number, "tdc");
           concated_retained_file_.open(retained_file, std::ios::binary);
           concated_extracted_file_.seekp(std::ios::beg);
           concated_retained_file_.seekp(std::ios::beg);
-          merged_file_ref[e->extracted.number] = 0;
-          merged_file_ref[e->retained.number] = 0;
         }
         assert(concated_extracted_file_.is_open());
         assert(concated_retained_file_.is_open());
@@ -496,7 +930,6 @@ bool DB::DoExtractionWork(Extraction* e) {
           e->extracted.length = buffer.str().size();
           e->extracted.smallest = e->out_extracted.begin()->first;
           e->extracted.largest = e->out_extracted.rbegin()->first;
-          merged_file_ref[e->extracted.number]++;
         }
         if (!e->out_retained.empty()) {
           e->retained.start = concated_retained_file_.tellp();
@@ -506,13 +939,13 @@ bool DB::DoExtractionWork(Extraction* e) {
           e->retained.length = buffer.str().size();
           e->retained.smallest = e->out_retained.begin()->first;
           e->retained.largest = e->out_retained.rbegin()->first;
-          merged_file_ref[e->retained.number]++;
         }
       } else {
-        e->extracted.number = file_linked_list->NextFileNumber();
-        e->retained.number = file_linked_list->NextFileNumber();
-        auto extracted_file = MakeFileName(dbname_, e->extracted.number, "tdc");
-        auto retained_file = MakeFileName(dbname_, e->retained.number, "tdc");
+        std::string extracted_file, retained_file;
+        e->extracted.number = NewOutput(&extracted_file);
+        e->retained.number = NewOutput(&retained_file);
+        e->outputs.push_back(e->extracted.number);
+        e->outputs.push_back(e->retained.number);
 
         if (!e->out_extracted.empty()) {
           auto length = PackToFile(extracted_file, e->out_extracted);
@@ -530,21 +963,27 @@ bool DB::DoExtractionWork(Extraction* e) {
         }
       }
 
-      InstallExtractionResults(e, file->column);
+      pack_span.Finish();
+
+      uint64_t written = 0;
+      if (!e->out_extracted.empty()) written += e->extracted.length;
+      if (!e->out_retained.empty()) written += e->retained.length;
+      ChargeIO(0, written, kIOPriorityExtraction);
+
+      // installed once every input is read
+      Extraction::Result result;
+      result.input = &input;
+      result.retained = e->retained;
+      result.extracted = e->extracted;
+      result.has_extracted = !e->out_extracted.empty();
+      for (const auto& item : e->out_retained) {
+        result.retained_keys.push_back(item.first);
+      }
+      e->results.push_back(result);
       e->out_extracted.clear();
       e->out_retained.clear();
-
-      // move children to deeper
-      input_file_columns.insert(file->column);
-
-      e->should_del_files.push_back(file);
-      // file->tag = kDeletedFile;
     }
-    cur_input.close();
-    delete cur_buffer;
   }
-  base_input.close();
-  file_linked_list->MoveOtherToDeeper(input_file_columns, *file_list_);
   if (do_concat_) {
     if (concated_extracted_file_.is_open()) {
       concated_extracted_file_.flush();
@@ -561,88 +1000,119 @@ bool DB::DoExtractionWork(Extraction* e) {
 
 
 
-bool DB::InstallExtractionResults(Extraction* extract, int column) {
-  assert(extract != nullptr);
+bool DB::InstallExtractionResults(const Extraction::Result& result) {
+  TraceSpan span("DB::InstallExtractionResults");
+  int column = result.input->meta.column;
+  uint64_t written = 0;
   // add to linked list
-  if (!extract->out_retained.empty()) {
+  if (!result.retained_keys.empty()) {
 
     FileMetaData* retained_meta = new FileMetaData();
 
     // create filter, just append, ignore unavailable filters
     if (use_filter_) {
-      std::vector<uint32_t> keys;
-      for (auto item : extract->out_retained) {
-        keys.push_back(item.first);
-      }
-      std::string result;
-      filter_policy_->CreateFilter(keys, &result);
+      TraceSpan filter_span("Install.CreateFilter");
+      std::string filter;
+      filter_policy_->CreateFilter(result.retained_keys, &filter);
       auto start = filter_file_.tellp();
-      auto length = result.length();
-      filter_file_ << result;
+      auto length = filter.length();
+      filter_file_ << filter;
       filter_file_.flush();
       retained_meta->filter_start = start;
       retained_meta->filter_length = length;
     }
     if (do_concat_) {
       retained_meta->tag = kMergedFile;
+      merged_file_ref[result.retained.number]++;
     } else {
       retained_meta->tag = kNewFile;
     }
-    retained_meta->number = extract->retained.number;
+    retained_meta->number = result.retained.number;
     retained_meta->level = 0;
     retained_meta->column = column;
-    retained_meta->smallest = extract->retained.smallest;
-    retained_meta->largest = extract->retained.largest;
-    retained_meta->start = extract->retained.start;
-    retained_meta->length = extract->retained.length;
+    retained_meta->smallest = result.retained.smallest;
+    retained_meta->largest = result.retained.largest;
+    retained_meta->start = result.retained.start;
+    retained_meta->length = result.retained.length;
     file_linked_list->ReplaceL0Node(retained_meta, column);
     file_list_->push_back(retained_meta);
+    written += result.retained.length;
   } else {
     FileMetaData* retained_meta = new FileMetaData();
     retained_meta->tag = kFlag;
-    retained_meta->number = extract->retained.number;
+    retained_meta->number = result.retained.number;
     retained_meta->level = 0;
     retained_meta->column = column;
     file_linked_list->ReplaceL0Node(retained_meta, column);
     file_list_->push_back(retained_meta);
   }
-  if (!extract->out_extracted.empty()) {
+  if (result.has_extracted) {
     FileMetaData* extracted_meta = new FileMetaData();
     if (do_concat_) {
       extracted_meta->tag = kMergedFile;
+      merged_file_ref[result.extracted.number]++;
     } else {
       extracted_meta->tag = kNewFile;
     }
-    extracted_meta->number = extract->extracted.number;
-    extracted_meta->smallest = extract->extracted.smallest;
-    extracted_meta->largest = extract->extracted.largest;
-    extracted_meta->start = extract->extracted.start;
-    extracted_meta->length = extract->extracted.length;
+    extracted_meta->number = result.extracted.number;
+    extracted_meta->smallest = result.extracted.smallest;
+    extracted_meta->largest = result.extracted.largest;
+    extracted_meta->start = result.extracted.start;
+    extracted_meta->length = result.extracted.length;
     extracted_meta->level = 1;
     extracted_meta->column = column;
     file_linked_list->ExtractOneChild(extracted_meta, column);
     file_list_->push_back(extracted_meta);
+    written += result.extracted.length;
   }
+  amp_stats_.RecordExtraction(written);
 
   return true;
 }
 
-// bool compare(const CkptMetaData& a, const CkptMetaData& b) {
-//   if (a.file_name == b.file_name) {
-//     return a.start < b.start;
-//   }
-//   return a.file_name < b.file_name;
-// }
+InputChunk DB::ChunkInput(FileMetaData* file) {
+  InputChunk input;
+  input.file = file;
+  input.meta = *file;
+  input.fname = ChunkFileName(file->number);
+  return input;
+}
+
+uint64_t DB::NewOutput(std::string* fname) {
+  std::lock_guard<std::mutex> l(mutex_);
+  uint64_t number = NewChunkNumber();
+  LogPendingOutput(number);
+  *fname = ChunkFileName(number);
+  return number;
+}
+
+void DB::DiscardOutputs(const std::vector<uint64_t>& numbers) {
+  for (auto number : numbers) {
+    // a rewrite meanwhile already gave it up
+    if (pending_outputs_.erase(number) != 0) ObsoleteFile(number);
+  }
+}
+
+void DB::AddUnlockedReader() {
+  if (unlocked_readers_++ == 0) deleter_->Pause();
+}
+
+void DB::RemoveUnlockedReader() {
+  if (--unlocked_readers_ == 0) {
+    deleter_->Resume();
+    no_unlocked_readers_.notify_all();
+  }
+}
 
 std::vector<CkptMetaData> DB::GetCheckpointFiles(int version) {
-  // gm: when background_compaction_scheduled_ is true wait;
-  // while (background_compaction_scheduled_) {
-  //   continue;
-  // }
-  // assert(!background_compaction_scheduled_);
+  std::lock_guard<std::mutex> l(mutex_);
+  return CheckpointFiles(version);
+}
 
+std::vector<CkptMetaData> DB::CheckpointFiles(int version) {
   std::vector<FileMetaData*> results;
   std::vector<CkptMetaData> ckpt_res;
+  if (dropped_columns_.count(version) != 0) return ckpt_res;
 
   bool success = file_linked_list->GetVersion(version, results);
   if (success) {
@@ -651,7 +1121,7 @@ std::vector<CkptMetaData> DB::GetCheckpointFiles(int version) {
         continue;
       } else if (it->tag == kNewFile || it->tag == kMergedFile) {
         auto number = it->number;
-        auto name = MakeFileName(dbname_, number, "tdc");
+        auto name = ChunkFileName(number);
         CkptMetaData cur_ckpt;
         cur_ckpt.file_name = name;
         cur_ckpt.start = it->start;
@@ -660,72 +1130,1141 @@ std::vector<CkptMetaData> DB::GetCheckpointFiles(int version) {
       }
     }
   }
-  // std::sort(ckpt_res.begin(), ckpt_res.end(), compare);
+  // linked-list order, GetRestorePlan gives the physical read order
   return ckpt_res;
 }
 
+std::vector<RestoreRead> DB::GetRestorePlan(int version, uint64_t max_gap) {
+  std::lock_guard<std::mutex> l(mutex_);
+  return PlanRestore(CheckpointFiles(version), max_gap);
+}
+
+bool DB::ReadCheckpoint(int version, std::vector<std::string>* chunks) {
+  TraceSpan span("DB::ReadCheckpoint");
+  stats_.RecordTick(kRestores);
+  StopWatch sw(&stats_, kRestoreMicros);
+  std::vector<RestoreRead> plan;
+  bool direct;
+  // one reader per data path, so striped devices are read in parallel
+  std::map<uint32_t, std::vector<size_t>> by_path;
+  std::map<uint32_t, IOEngine*> engines_by_path;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    std::vector<CkptMetaData> metas = CheckpointFiles(version);
+    plan = PlanRestore(metas, kRestoreMaxGap);
+    chunks->clear();
+    chunks->resize(metas.size());
+    direct = io_options_.use_direct_io;
+    for (size_t i = 0; i < plan.size(); i++) {
+      uint32_t path_id = PathIdOfName(plan[i].file_name);
+      by_path[path_id].push_back(i);
+      engines_by_path[path_id] = EngineForPath(path_id);
+    }
+    // the files stay until the read is done, other work takes the lock
+    // meanwhile
+    AddUnlockedReader();
+  }
+
+  std::vector<IORequest> reqs(plan.size());
+  for (size_t i = 0; i < plan.size(); i++) {
+    IORequest& r = reqs[i];
+    r.file_name = plan[i].file_name;
+    r.offset = plan[i].start;
+    r.length = plan[i].length;
+    if (direct) {
+      // widen to aligned boundaries and read into a bounce buffer
+      uint64_t end = r.offset + r.length;
+      r.offset -= r.offset % kDirectIOAlignment;
+      end = (end + kDirectIOAlignment - 1) / kDirectIOAlignment * kDirectIOAlignment;
+      r.length = end - r.offset;
+      r.buf = AllocateAligned(r.length);
+    } else if (plan[i].segments.size() == 1) {
+      // a lone chunk is read in place
+      auto& chunk = (*chunks)[plan[i].segments[0].chunk];
+      chunk.resize(r.length);
+      r.buf = &chunk[0];
+    } else {
+      r.buf = new char[r.length];
+    }
+    ChargeIO(r.length, 0, kIOPriorityRestore);
+  }
+
+  TraceSpan read_span("ReadCheckpoint.Read");
+  if (by_path.size() == 1) {
+    engines_by_path.begin()->second->Read(reqs);
+  } else if (by_path.size() > 1) {
+    std::vector<std::vector<IORequest>> groups;
+    std::vector<IOEngine*> engines;
+    for (const auto& pair : by_path) {
+      groups.emplace_back();
+      for (auto i : pair.second) {
+        groups.back().push_back(reqs[i]);
+      }
+      engines.push_back(engines_by_path[pair.first]);
+    }
+    std::vector<std::thread> readers;
+    for (size_t k = 0; k < groups.size(); k++) {
+      std::vector<IORequest>* group = &groups[k];
+      IOEngine* engine = engines[k];
+      readers.emplace_back([engine, group] { engine->Read(*group); });
+    }
+    size_t k = 0;
+    for (const auto& pair : by_path) {
+      readers[k].join();
+      for (size_t j = 0; j < pair.second.size(); j++) {
+        reqs[pair.second[j]].result = groups[k][j].result;
+      }
+      k++;
+    }
+  }
+
+  read_span.Finish();
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    RemoveUnlockedReader();
+  }
+
+  bool success = true;
+  for (size_t i = 0; i < plan.size(); i++) {
+    uint64_t skip = plan[i].start - reqs[i].offset;
+    bool in_place = !direct && plan[i].segments.size() == 1;
+    for (const auto& segment : plan[i].segments) {
+      // a widened tail may run past EOF, only the chunk itself must be there
+      if (reqs[i].result < static_cast<int64_t>(skip + segment.offset + segment.length)) {
+        success = false;
+      } else if (!in_place) {
+        (*chunks)[segment.chunk].assign(reqs[i].buf + skip + segment.offset, segment.length);
+      }
+    }
+    if (direct) {
+      FreeAligned(reqs[i].buf);
+    } else if (!in_place) {
+      delete[] reqs[i].buf;
+    }
+  }
+  return success;
+}
+
+void DB::SetIOEngineOptions(const IOEngineOptions& options) {
+  // restores read with the engines once they leave mutex_
+  std::unique_lock<std::mutex> l(mutex_);
+  no_unlocked_readers_.wait(l, [this] { return unlocked_readers_ == 0; });
+  io_options_ = options;
+  delete io_engine_;
+  io_engine_ = NewIOEngine(io_options_);
+  for (auto engine : path_engines_) {
+    delete engine;
+  }
+  path_engines_.clear();
+}
+
 //delete versions that <= n
-void DB::DeleteCheckpointsBefore(int version) {
+bool DB::DeleteCheckpointsBefore(int version) {
+  std::lock_guard<std::mutex> l(mutex_);
 
-  // while (background_compaction_scheduled_) {
-  //   continue;
-  // }
-  // assert(!background_compaction_scheduled_);
-  
   //1. remove nodes from file_linked_list and get files need to delete
   std::vector<FileMetaData* > should_delete;
-  file_linked_list->DeleteVersion(dbname_, version, should_delete);
+  if (!file_linked_list->DeleteVersion(version, should_delete)) return false;
 
   //2. delete meta and remove from file_list
-  for (auto meta : should_delete){
-    if (meta->tag == kNewFile){
-      auto fname = MakeFileName(dbname_, meta->number, "tdc");
-      DeleteFile(fname);
-    }
-    meta->tag = kDeletedFile;
-    file_list_->erase(std::remove(file_list_->begin(), file_list_->end(), meta), file_list_->end());
-    delete meta;
+  DropFiles(should_delete);
+  // columns whose nodes newer versions still read are no versions anymore
+  std::vector<int> columns;
+  file_linked_list->GetColumns(&columns);
+  for (auto column : columns) {
+    if (column <= version) dropped_columns_.insert(column);
   }
   //3. update manifest
-  RewriteManifest();
-  return ;
+  return RewriteManifest();
 }
 
 void DB::PrintTree() {
+  std::lock_guard<std::mutex> l(mutex_);
   file_linked_list->PrintList();
 }
 
 void DB::Merge(int start, int end) {
+  TraceSpan span("DB::Merge");
+  IOChargeScope charge(this);
+  std::lock_guard<std::mutex> l(mutex_);
   std::vector<std::vector<FileMetaData*>> to_merge = file_linked_list->MergeColumns(start, end);
   if (to_merge.size() == 0) return;
+  InvalidateVersionBytes();
 
-  for (auto level_files : to_merge) {
-    // open first file and merge other files to the first file 
+  // 1. append other files to the first file of every level, in the kernel
+  std::vector<uint64_t> merged_numbers;
+  for (auto& level_files : to_merge) {
     assert(level_files.size() > 1);
-    auto file_name = MakeFileName(dbname_, level_files[0]->number, "tdc");
-    std::ofstream file(file_name, std::ios::app | std::ios::binary);
-    level_files[0]->tag = kMergedFile;
-    level_files[0]->start = 0;
-    level_files[0]->length = file.tellp();
-    for (int i = 1; i < level_files.size(); i++) {
+    auto file_name = ChunkFileName(level_files[0]->number);
+    uint64_t offset = 0;
+    if (!GetFileSize(file_name, &offset)) break;
+    int dst_fd = ::open(file_name.c_str(), O_WRONLY);
+    if (dst_fd < 0) break;
+
+    bool success = true;
+    std::vector<uint64_t> starts(level_files.size(), 0);
+    std::vector<uint64_t> lengths(level_files.size(), offset);
+    for (size_t i = 1; i < level_files.size() && success; i++) {
       assert(level_files[i]->tag == kNewFile);
+      auto cur_name = ChunkFileName(level_files[i]->number);
+      int src_fd = ::open(cur_name.c_str(), O_RDONLY);
+      success = src_fd >= 0 && GetFileSize(cur_name, &lengths[i]);
+      if (success) {
+        ChargeIO(lengths[i], lengths[i], kIOPriorityBackground);
+        success = CopyFileData(src_fd, 0, dst_fd, offset, lengths[i]);
+      }
+      if (src_fd >= 0) ::close(src_fd);
+      starts[i] = offset;
+      offset += lengths[i];
+    }
+    success = success && ::fdatasync(dst_fd) == 0;
+    ::close(dst_fd);
+    // a failed copy only leaves unreferenced bytes at the end of the file
+    if (!success) break;
+
+    for (size_t i = 0; i < level_files.size(); i++) {
+      if (i > 0) merged_numbers.push_back(level_files[i]->number);
       level_files[i]->tag = kMergedFile;
-      level_files[i]->start = file.tellp();
-      auto cur_name = MakeFileName(dbname_, level_files[i]->number, "tdc");
-      std::ifstream cur_file(cur_name, std::ios::in | std::ios::binary);
-      std::stringstream buffer;
-      buffer << cur_file.rdbuf();
-      file.write(buffer.str().data(), buffer.str().size());
-      level_files[i]->length = (uint64_t)file.tellp() - level_files[i]->start;
+      level_files[i]->start = starts[i];
+      level_files[i]->length = lengths[i];
       level_files[i]->number = level_files[0]->number;
-      // delete old file
-      cur_file.close();
-      DeleteFile(cur_name);
     }
-
     // record ref count
     merged_file_ref[level_files[0]->number] = level_files.size();
   }
+
+  // 2. persist new locations and refs, 3. only then drop the sources
+  if (merged_numbers.empty() || !RewriteManifest()) return;
+  for (auto number : merged_numbers) {
+    ObsoleteFile(number);
+  }
+}
+
+void DB::SetMergeEvery(int merge_every) {
+  WaitForBackgroundWork();
+  merge_every_ = merge_every;
+}
+
+void DB::MaybeMerge() {
+  int start, end;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    if (merge_every_ <= 1 || file_linked_list->getHeadFileMeta() == nullptr ||
+        !file_linked_list->ShouldMerge(start, end, merge_every_)) {
+      return;
+    }
+  }
+  Merge(start, end);
+}
+
+void DB::DeleteOrphanFiles() {
+  std::unordered_set<uint64_t> live;
+  for (auto file : *file_list_) {
+    if (file->tag == kNewFile || file->tag == kMergedFile) {
+      live.insert(file->number);
+    }
+  }
+  for (uint32_t path_id = 0; path_id < data_paths_.size(); path_id++) {
+    const std::string& dir = data_paths_[path_id];
+    std::vector<std::string> children;
+    // other DBs own files there too
+    if (path_id == shared_path_id_ && path_id != 0) continue;
+    if (dir.empty() || !GetChildren(dir, &children)) continue;
+    for (const auto& child : children) {
+      unsigned long long number;
+      char suffix[8];
+      if (std::sscanf(child.c_str(), "%llu.%7s", &number, suffix) != 2) {
+        // a legacy filter file replaced by a compacted one
+        if (path_id == 0 && child == "filter" && filter_number_ != 0) {
+          deleter_->Schedule(dir + "/" + child, 0);
+        }
+        continue;
+      }
+      // a number on disk is never handed out again, whether its file
+      // goes or not
+      file_linked_list->max_file_num_ = std::max<uint64_t>(file_linked_list->max_file_num_, number);
+      // the copy of a migration or destage on the path the manifest does
+      // not point at, or a filter file replaced by a compacted one. A
+      // chunk no manifest record covers may still be joined by its writer.
+      if ((std::string(suffix) == "tdc" && live.count(number) != 0 && PathId(number) != path_id) ||
+          (path_id == 0 && std::string(suffix) == "filter" && number != filter_number_)) {
+        deleter_->Schedule(dir + "/" + child, 0);
+      }
+    }
+  }
+}
+
+bool DB::CompactColumns(int start, int end) {
+  TraceSpan span("DB::CompactColumns");
+  std::vector<std::vector<InputChunk>> inputs;
+  uint64_t list_changes;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    std::vector<std::vector<FileMetaData*>> files;
+    if (!file_linked_list->GetCompactionInputs(start, end, &files)) return false;
+    inputs.resize(files.size());
+    for (size_t level = 0; level < files.size(); level++) {
+      for (auto file : files[level]) {
+        inputs[level].push_back(ChunkInput(file));
+      }
+    }
+    list_changes = list_changes_;
+    AddUnlockedReader();
+  }
+
+  // joins and restores go on while the columns are read and written
+  bool success = true;
+  std::vector<FileMetaData*> outputs;
+  std::vector<uint64_t> numbers;
+  std::vector<std::vector<uint32_t>> l0_keys;
+  for (size_t level = 0; success && level < inputs.size(); level++) {
+    // inputs are ordered newest column first, insert keeps the first value
+    std::map<uint32_t, std::vector<double>> merged;
+    for (const auto& input : inputs[level]) {
+      msgpack::object_handle oh;
+      ChargeIO(input.meta.length, 0, kIOPriorityBackground);
+      if (!UnpackRegion(input.fname, input.meta.start, input.meta.length, oh)) {
+        success = false;
+        break;
+      }
+      std::map<uint32_t, std::vector<double>> cur_map;
+      oh.get().convert(cur_map);
+      merged.insert(std::make_move_iterator(cur_map.begin()), std::make_move_iterator(cur_map.end()));
+    }
+    if (!success) break;
+
+    FileMetaData* meta = new FileMetaData();
+    meta->level = level;
+    meta->column = end;
+    if (merged.empty()) {
+      meta->tag = kFlag;
+      meta->number = 0;
+    } else {
+      std::string fname;
+      meta->tag = kNewFile;
+      meta->number = NewOutput(&fname);
+      numbers.push_back(meta->number);
+      meta->start = 0;
+      meta->length = PackToFile(fname, merged);
+      ChargeIO(0, meta->length, kIOPriorityBackground);
+      meta->smallest = merged.begin()->first;
+      meta->largest = merged.rbegin()->first;
+      // only L0 files are probed by extraction
+      if (use_filter_ && level == 0) {
+        l0_keys.emplace_back();
+        for (const auto& item : merged) {
+          l0_keys.back().push_back(item.first);
+        }
+      }
+    }
+    outputs.push_back(meta);
+  }
+
+  std::lock_guard<std::mutex> l(mutex_);
+  RemoveUnlockedReader();
+  if (!success || list_changes != list_changes_) {
+    // the columns may be gone, a later join compacts again
+    DiscardOutputs(numbers);
+    for (auto meta : outputs) {
+      delete meta;
+    }
+    return false;
+  }
+  // the filter file is appended to under the lock only
+  size_t next_keys = 0;
+  for (auto meta : outputs) {
+    if (!use_filter_ || meta->level != 0 || meta->tag != kNewFile) continue;
+    std::string result;
+    filter_policy_->CreateFilter(l0_keys[next_keys++], &result);
+    meta->filter_start = filter_file_.tellp();
+    meta->filter_length = result.length();
+    filter_file_ << result;
+    filter_file_.flush();
+  }
+
+  std::vector<FileMetaData*> obsolete;
+  file_linked_list->InstallCompaction(start, end, outputs, &obsolete);
+  for (auto meta : outputs) {
+    file_list_->push_back(meta);
+  }
+  DropFiles(obsolete);
+  RewriteManifest();
+  return true;
+}
+
+void DB::ScheduleCompaction(int start, int end) {
+  Schedule([this, start, end] { CompactColumns(start, end); });
+}
+
+void DB::SetMaxColumns(int max_columns) {
+  WaitForBackgroundWork();
+  max_columns_ = max_columns;
+}
+
+void DB::MaybeCompact() {
+  int oldest, newest;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    if (max_columns_ <= 0 || !file_linked_list->GetColumnRange(&oldest, &newest)) return;
+  }
+  if (newest - oldest + 1 > max_columns_) {
+    // keep half of the budget as individual versions
+    CompactColumns(oldest, newest - max_columns_ / 2);
+  }
+}
+
+void DB::DropFiles(const std::vector<FileMetaData*>& metas) {
+  std::unordered_set<FileMetaData*> dropped;
+  for (auto meta : metas) {
+    if (meta->tag == kNewFile) {
+      ObsoleteFile(meta->number);
+    } else if (meta->tag == kMergedFile) {
+      ReleaseMergedRegion(meta);
+    }
+    meta->tag = kDeletedFile;
+    dropped.insert(meta);
+  }
+  // one pass over file_list_
+  file_list_->erase(std::remove_if(file_list_->begin(), file_list_->end(),
+                                   [&dropped](FileMetaData* meta) {
+                                     return dropped.count(meta) != 0;
+                                   }),
+                    file_list_->end());
+  for (auto meta : dropped) {
+    delete meta;
+  }
+}
+
+bool DB::ReleaseMergedRegion(FileMetaData* meta) {
+  merged_file_ref[meta->number]--;
+  if (merged_file_ref[meta->number] <= 0) {
+    merged_file_ref.erase(meta->number);
+    ObsoleteFile(meta->number);
+    return true;
+  }
+  // the manifest on disk still references the region until the next
+  // rewrite, the hole is punched after it
+  DeadRegion region;
+  region.number = meta->number;
+  region.start = meta->start;
+  region.length = meta->length;
+  dead_regions_.push_back(region);
+  return true;
+}
+
+void DB::SetRewriteThreshold(double min_live_fraction) {
+  WaitForBackgroundWork();
+  min_live_fraction_ = min_live_fraction;
+}
+
+void DB::MaybeRewriteContainers() {
+  IOChargeScope charge(this);
+  std::lock_guard<std::mutex> l(mutex_);
+  if (min_live_fraction_ <= 0) return;
+
+  std::unordered_map<uint64_t, std::vector<FileMetaData*>> containers;
+  for (auto file : *file_list_) {
+    // dead regions of a shared container are punched out instead
+    if (file->tag == kMergedFile && !IsShared(file->number)) {
+      containers[file->number].push_back(file);
+    }
+  }
+
+  bool rewritten = false;
+  std::vector<uint64_t> obsolete, staged;
+  for (auto& pair : containers) {
+    auto fname = ChunkFileName(pair.first);
+    uint64_t size = 0, live = 0;
+    for (auto meta : pair.second) {
+      live += meta->length;
+    }
+    if (!GetFileSize(fname, &size) || size == 0 ||
+        static_cast<double>(live) / size >= min_live_fraction_) {
+      continue;
+    }
+
+    // copy the live regions back to back into a new container
+    uint64_t number = file_linked_list->NextFileNumber();
+    // the rewritten container stays on its tier
+    if (PathId(pair.first) != 0) file_path_id_[number] = PathId(pair.first);
+    LogPendingOutput(number);
+    auto new_name = ChunkFileName(number);
+    int src_fd = ::open(fname.c_str(), O_RDONLY);
+    int dst_fd = ::open(new_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool success = src_fd >= 0 && dst_fd >= 0;
+    std::vector<uint64_t> starts;
+    uint64_t offset = 0;
+    for (auto meta : pair.second) {
+      if (!success) break;
+      ChargeIO(meta->length, meta->length, kIOPriorityBackground);
+      success = CopyFileData(src_fd, meta->start, dst_fd, offset, meta->length);
+      starts.push_back(offset);
+      offset += meta->length;
+    }
+    success = success && ::fdatasync(dst_fd) == 0;
+    if (src_fd >= 0) ::close(src_fd);
+    if (dst_fd >= 0) ::close(dst_fd);
+    if (!success) {
+      DeleteFile(new_name);
+      continue;
+    }
+
+    for (size_t i = 0; i < pair.second.size(); i++) {
+      pair.second[i]->number = number;
+      pair.second[i]->start = starts[i];
+    }
+    merged_file_ref[number] = merged_file_ref[pair.first];
+    merged_file_ref.erase(pair.first);
+    obsolete.push_back(pair.first);
+    if (staging_path_id_ != 0 && PathId(number) == staging_path_id_) staged.push_back(number);
+    rewritten = true;
+  }
+
+  // the old containers go only after the manifest points at the new ones
+  if (rewritten && RewriteManifest()) {
+    for (auto number : obsolete) {
+      ObsoleteFile(number);
+    }
+  }
+  // like a joined chunk, a container rewritten on the staging path is
+  // copied to its stripe
+  for (auto number : staged) {
+    ScheduleDestage(number);
+  }
+}
+
+SpaceStats DB::GetSpaceStats() {
+  std::lock_guard<std::mutex> l(mutex_);
+  SpaceStats stats;
+  // file_num -> live bytes in it
+  std::unordered_map<uint64_t, uint64_t> live;
+  std::unordered_set<uint64_t> containers;
+  for (auto file : *file_list_) {
+    if (file->tag == kNewFile || file->tag == kMergedFile) {
+      stats.live_bytes += file->length;
+      live[file->number] += file->length;
+      if (file->tag == kMergedFile) containers.insert(file->number);
+    }
+  }
+  for (const auto& pair : live) {
+    auto fname = ChunkFileName(pair.first);
+    uint64_t size = 0, allocated = 0;
+    if (IsShared(pair.first)) {
+      // only the regions of this DB count, the rest belongs to others
+      stats.file_bytes += pair.second;
+      stats.allocated_bytes += pair.second;
+      continue;
+    }
+    GetFileSize(fname, &size);
+    GetAllocatedSize(fname, &allocated);
+    stats.file_bytes += size;
+    stats.allocated_bytes += allocated;
+    if (containers.count(pair.first) != 0 && size > pair.second) {
+      stats.container_dead_bytes += size - pair.second;
+    }
+  }
+  stats.containers = containers.size();
+  stats.dead_bytes = stats.file_bytes > stats.live_bytes ? stats.file_bytes - stats.live_bytes : 0;
+  stats.reclaimed_bytes = reclaimed_bytes_;
+  stats.space_amp = stats.live_bytes > 0
+                    ? static_cast<double>(stats.allocated_bytes) / stats.live_bytes : 0;
+  return stats;
+}
+
+std::vector<int> DB::GetVersions() {
+  std::lock_guard<std::mutex> l(mutex_);
+  std::vector<int> columns, versions;
+  file_linked_list->GetColumns(&columns);
+  for (auto column : columns) {
+    if (dropped_columns_.count(column) == 0) versions.push_back(column);
+  }
+  return versions;
+}
+
+bool DB::AnalyzeVersion(int version, bool count_rows, VersionLayout* layout) {
+  IOChargeScope charge(this);
+  std::lock_guard<std::mutex> l(mutex_);
+  std::vector<FileMetaData*> files;
+  if (dropped_columns_.count(version) != 0 || !file_linked_list->GetVersion(version, files)) {
+    return false;
+  }
+  *layout = VersionLayout();
+  layout->version = version;
+  for (auto file : files) {
+    layout->depth = std::max(layout->depth, static_cast<int>(file->level) + 1);
+  }
+
+  std::vector<CkptMetaData> metas = CheckpointFiles(version);
+  std::unordered_set<std::string> names;
+  for (const auto& meta : metas) {
+    layout->chunks++;
+    layout->bytes += meta.length;
+    names.insert(meta.file_name);
+  }
+  layout->files = names.size();
+  layout->reads = PlanRestore(metas, kRestoreMaxGap).size();
+  if (!count_rows) return true;
+
+  std::unordered_set<uint32_t> keys;
+  for (const auto& meta : metas) {
+    msgpack::object_handle oh;
+    ChargeIO(meta.length, 0, kIOPriorityBackground);
+    if (!UnpackRegion(meta.file_name, meta.start, meta.length, oh)) return false;
+    // keys only, the values stay msgpack objects
+    std::map<uint32_t, msgpack::object> chunk;
+    oh.get().convert(chunk);
+    layout->rows += chunk.size();
+    for (const auto& pair : chunk) {
+      keys.insert(pair.first);
+    }
+  }
+  layout->unique_rows = keys.size();
+  layout->read_amp = keys.empty() ? 0 : static_cast<double>(layout->rows) / keys.size();
+  return true;
+}
+
+std::vector<VersionLayout> DB::AnalyzeVersions(bool count_rows) {
+  std::vector<VersionLayout> layouts;
+  for (auto version : GetVersions()) {
+    VersionLayout layout;
+    if (AnalyzeVersion(version, count_rows, &layout)) layouts.push_back(layout);
+  }
+  return layouts;
+}
+
+void DB::ObsoleteFile(uint64_t number) {
+  if (IsShared(number)) {
+    // other DBs may still read the container, it goes back to its owner
+    // once the manifest on disk no longer references it
+    released_shared_.push_back(number);
+    return;
+  }
+  manifest_ << kObsoleteFile << " " << number << "\n";
+  manifest_.flush();
+  snapshot_current_ = false;
+  deleter_->Schedule(ChunkFileName(number), number);
+}
+
+void DB::SetRetentionPolicy(RetentionPolicy* policy) {
+  std::lock_guard<std::mutex> l(mutex_);
+  delete retention_policy_;
+  retention_policy_ = policy;
+}
+
+bool DB::ApplyRetention() {
+  std::lock_guard<std::mutex> l(mutex_);
+  if (retention_policy_ == nullptr) return false;
+
+  std::vector<int> columns;
+  file_linked_list->GetColumns(&columns);
+  bool changed = false;
+  for (auto column : retention_policy_->Dropped(columns)) {
+    changed = dropped_columns_.insert(column).second || changed;
+  }
+  if (!changed) return true;
+
+  std::vector<FileMetaData*> freed, flags;
+  file_linked_list->DropColumns(dropped_columns_, &freed, &flags);
+  for (auto flag : flags) {
+    file_list_->push_back(flag);
+  }
+  DropFiles(freed);
+  return RewriteManifest();
+}
+
+void DB::ScheduleRetention() {
+  Schedule(std::bind(&DB::MaybeApplyRetention, this));
+}
+
+void DB::MaybeApplyRetention() {
+  if (!ApplyRetention()) return;
+  int start, end;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    if (!file_linked_list->OldestDroppedRun(dropped_columns_, &start, &end)) return;
+  }
+  // one run per batch, the rest follows after the next joins
+  CompactColumns(start, end);
+}
+
+uint32_t DB::PathId(uint64_t number) {
+  auto it = file_path_id_.find(number);
+  if (it == file_path_id_.end() || it->second >= data_paths_.size()) return 0;
+  return it->second;
+}
+
+std::string DB::ChunkFileName(uint64_t number) {
+  return MakeFileName(data_paths_[PathId(number)], number, "tdc");
+}
+
+uint32_t DB::TargetPathId(FileMetaData* meta, int newest) {
+  uint32_t cold = tiering_.cold_path_id;
+  if (cold != 0 && cold < data_paths_.size()) {
+    if (tiering_.cold_level > 0 && static_cast<int>(meta->level) >= tiering_.cold_level) return cold;
+    if (tiering_.cold_age > 0 && newest - static_cast<int>(meta->column) >= tiering_.cold_age) return cold;
+  }
+  return HotPathId(meta->number);
+}
+
+uint32_t DB::HotPathId(uint64_t number) {
+  uint32_t current = PathId(number);
+  if (current == 0 || current != tiering_.cold_path_id) return current;
+  // back from the cold tier onto a stripe
+  return stripe_paths_.empty() ? 0 : stripe_paths_[number % stripe_paths_.size()];
+}
+
+bool DB::SetStriping(const std::vector<uint32_t>& path_ids, StripeMode mode) {
+  WaitForBackgroundWork();
+  std::lock_guard<std::mutex> l(mutex_);
+  for (auto path_id : path_ids) {
+    if (path_id >= data_paths_.size()) return false;
+  }
+  stripe_paths_ = path_ids;
+  stripe_mode_ = mode;
+  stripe_credit_.assign(path_ids.size(), 0);
+  return true;
+}
+
+uint32_t DB::NextStripePath() {
+  if (stripe_paths_.empty()) return 0;
+  if (stripe_mode_ == kStripeRoundRobin) {
+    return stripe_paths_[next_stripe_++ % stripe_paths_.size()];
+  }
+  // smooth weighted round robin, the weights follow the free space
+  double total = 0;
+  size_t best = 0;
+  for (size_t i = 0; i < stripe_paths_.size(); i++) {
+    uint64_t free_bytes = 0;
+    GetFreeSpace(data_paths_[stripe_paths_[i]], &free_bytes);
+    double weight = static_cast<double>(free_bytes);
+    stripe_credit_[i] += weight;
+    total += weight;
+    if (stripe_credit_[i] > stripe_credit_[best]) best = i;
+  }
+  stripe_credit_[best] -= total;
+  return stripe_paths_[best];
+}
+
+uint64_t DB::NewChunkNumber() {
+  uint64_t number = file_linked_list->NextFileNumber();
+  uint32_t path_id = NextStripePath();
+  if (path_id != 0) file_path_id_[number] = path_id;
+  return number;
+}
+
+void DB::LogPendingOutput(uint64_t number) {
+  manifest_ << kPendingFile << " " << number << " " << PathId(number) << "\n";
+  manifest_.flush();
+  snapshot_current_ = false;
+  pending_outputs_.insert(number);
+}
+
+bool DB::IsShared(uint64_t number) {
+  return shared_path_id_ != 0 && PathId(number) == shared_path_id_;
+}
+
+uint32_t DB::PathIdOfName(const std::string& file_name) {
+  std::string dir = file_name.substr(0, file_name.rfind('/'));
+  for (uint32_t i = 0; i < data_paths_.size(); i++) {
+    if (data_paths_[i] == dir) return i;
+  }
+  return 0;
+}
+
+IOEngine* DB::EngineForPath(uint32_t path_id) {
+  if (path_id == 0) return io_engine_;
+  if (path_id >= path_engines_.size()) path_engines_.resize(path_id + 1, nullptr);
+  if (path_engines_[path_id] == nullptr) {
+    path_engines_[path_id] = NewIOEngine(io_options_);
+  }
+  return path_engines_[path_id];
+}
+
+bool DB::AddDataPath(const std::string& path, uint32_t* path_id) {
+  std::lock_guard<std::mutex> l(mutex_);
+  bool added;
+  if (!AddDataPathLocked(path, path_id, &added)) return false;
+  return !added || RewriteManifest();
+}
+
+bool DB::AddDataPathLocked(const std::string& path, uint32_t* path_id, bool* added) {
+  *added = false;
+  for (uint32_t i = 0; i < data_paths_.size(); i++) {
+    if (data_paths_[i] == path) {
+      *path_id = i;
+      return true;
+    }
+  }
+  if (!CreateDir(path) && !FileExists(path)) return false;
+  data_paths_.push_back(path);
+  *path_id = data_paths_.size() - 1;
+  *added = true;
+  return true;
 }
 
-}
\ No newline at end of file
+void DB::SetTiering(const TieringOptions& options) {
+  WaitForBackgroundWork();
+  tiering_ = options;
+}
+
+bool DB::MigrateFiles(uint64_t max_bytes) {
+  IOChargeScope charge(this);
+  std::lock_guard<std::mutex> l(mutex_);
+  int oldest, newest;
+  if (!file_linked_list->GetColumnRange(&oldest, &newest)) return false;
+
+  // target tier and live regions of every file
+  std::map<uint64_t, uint32_t> targets;
+  std::unordered_map<uint64_t, std::vector<FileMetaData*>> regions;
+  for (auto file : *file_list_) {
+    if (file->tag != kNewFile && file->tag != kMergedFile) continue;
+    if (IsShared(file->number)) continue;
+    // left to the destager, which copies without mutex_
+    if (staging_path_id_ != 0 && PathId(file->number) == staging_path_id_) continue;
+    uint32_t target = TargetPathId(file, newest);
+    auto it = targets.find(file->number);
+    if (it == targets.end()) {
+      targets[file->number] = target;
+    } else if (target != tiering_.cold_path_id) {
+      // one hot chunk keeps the whole container hot
+      it->second = target;
+    }
+    regions[file->number].push_back(file);
+  }
+
+  uint64_t moved_bytes = 0;
+  std::vector<std::pair<uint64_t, uint32_t>> moved;
+  std::vector<std::string> sources;
+  for (const auto& pair : targets) {
+    if (moved_bytes >= max_bytes) break;
+    if (PathId(pair.first) == pair.second) continue;
+    auto src_name = ChunkFileName(pair.first);
+    for (auto meta : regions[pair.first]) {
+      moved_bytes += meta->length;
+    }
+    auto dst_name = MakeFileName(data_paths_[pair.second], pair.first, "tdc");
+    if (!CopyRegions(src_name, dst_name, regions[pair.first], kIOPriorityBackground)) continue;
+    moved.push_back(pair);
+    sources.push_back(src_name);
+  }
+  if (moved.empty()) return false;
+
+  for (const auto& pair : moved) {
+    SyncDir(data_paths_[pair.second]);
+    if (pair.second == 0) {
+      file_path_id_.erase(pair.first);
+    } else {
+      file_path_id_[pair.first] = pair.second;
+    }
+  }
+  // the copies are used only once the manifest points at them, a crash
+  // before leaves them to the orphan scan
+  if (!RewriteManifest()) return false;
+  for (const auto& name : sources) {
+    deleter_->Schedule(name, 0);
+  }
+  return true;
+}
+
+bool DB::CopyRegions(const std::string& src_name, const std::string& dst_name,
+                     const std::vector<FileMetaData*>& regions, IOPriority priority) {
+  uint64_t size = 0;
+  if (!GetFileSize(src_name, &size)) return false;
+
+  // copy only the live regions at their offsets, holes stay holes
+  int src_fd = ::open(src_name.c_str(), O_RDONLY);
+  int dst_fd = ::open(dst_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  bool success = src_fd >= 0 && dst_fd >= 0;
+  for (auto meta : regions) {
+    if (!success) break;
+    ChargeIO(meta->length, meta->length, priority);
+    success = CopyFileData(src_fd, meta->start, dst_fd, meta->start, meta->length);
+  }
+  success = success && ::ftruncate(dst_fd, size) == 0 && ::fdatasync(dst_fd) == 0;
+  if (src_fd >= 0) ::close(src_fd);
+  if (dst_fd >= 0) ::close(dst_fd);
+  if (!success) {
+    DeleteFile(dst_name);
+  }
+  return success;
+}
+
+bool DB::SetStagingPath(uint32_t path_id) {
+  WaitForBackgroundWork();
+  // files queued for the old staging path are written out first
+  WaitForDestage();
+  std::lock_guard<std::mutex> l(mutex_);
+  if (path_id >= data_paths_.size()) return false;
+  staging_path_id_ = path_id;
+  if (staging_path_id_ != 0 && destager_ == nullptr) {
+    destager_ = new ThreadPool(1);
+  }
+  return RewriteManifest();
+}
+
+void DB::ScheduleDestage(uint64_t number) {
+  destage_pending_.Add(1);
+  destager_->Schedule([this, number] {
+    Destage(number);
+    destage_pending_.Done();
+  });
+}
+
+void DB::Destage(uint64_t number) {
+  // copies of the live regions, the FileMetaData may go once unlocked
+  std::vector<FileMetaData> copied;
+  uint32_t target;
+  std::string src_name, dst_name, target_dir;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    // merged into another file or deleted meanwhile
+    if (staging_path_id_ == 0 || PathId(number) != staging_path_id_) return;
+    for (auto file : *file_list_) {
+      if ((file->tag == kNewFile || file->tag == kMergedFile) && file->number == number) {
+        copied.push_back(*file);
+      }
+    }
+    if (copied.empty()) return;
+    target = NextStripePath();
+    if (target == staging_path_id_) target = 0;
+    src_name = ChunkFileName(number);
+    target_dir = data_paths_[target];
+    dst_name = MakeFileName(target_dir, number, "tdc");
+  }
+
+  // joins and restores go on while the chunk is copied
+  std::vector<FileMetaData*> regions;
+  for (auto& meta : copied) {
+    regions.push_back(&meta);
+  }
+  if (!CopyRegions(src_name, dst_name, regions, kIOPriorityWrite)) return;
+  SyncDir(target_dir);
+
+  std::lock_guard<std::mutex> l(mutex_);
+  // every region still live must be in the copy, regions dropped
+  // meanwhile only leave dead bytes in it
+  size_t live = 0;
+  bool staged = staging_path_id_ != 0 && PathId(number) == staging_path_id_;
+  bool covered = staged;
+  for (auto file : *file_list_) {
+    if (!covered) break;
+    if ((file->tag != kNewFile && file->tag != kMergedFile) || file->number != number) continue;
+    live++;
+    bool found = false;
+    for (const auto& meta : copied) {
+      found = found || (meta.start == file->start && meta.length == file->length);
+    }
+    covered = found;
+  }
+  if (!covered || live == 0) {
+    DeleteFile(dst_name);
+    // a merge moved regions into it meanwhile, copy it again
+    if (staged && live > 0) ScheduleDestage(number);
+    return;
+  }
+
+  if (target == 0) {
+    file_path_id_.erase(number);
+  } else {
+    file_path_id_[number] = target;
+  }
+  // the last line of a number wins at open
+  manifest_ << kFilePath << " " << number << " " << target << "\n";
+  manifest_.flush();
+  snapshot_current_ = false;
+  // a manifest that still names the staging copy after a crash would
+  // have the orphan scan delete the destaged one
+  if (!SyncFile(dbname_ + "/manifest")) return;
+  // the staging copy only holds memory now, a reader without the lock
+  // may still have it open
+  deleter_->Schedule(src_name, 0);
+}
+
+void DB::WaitForDestage() {
+  destage_pending_.Wait();
+}
+
+void DB::ScheduleMigration() {
+  Schedule([this] { MigrateFiles(kMigrationBatchBytes); });
+}
+
+void DB::MaybeMigrate() {
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    if (tiering_.cold_path_id == 0) return;
+  }
+  MigrateFiles(kMigrationBatchBytes);
+}
+
+void DB::SetRateLimiter(RateLimiter* rate_limiter) {
+  // destaging charges its copies without mutex_
+  rate_limiter_ = rate_limiter;
+  deleter_->SetRateLimiter(rate_limiter);
+}
+
+thread_local DB::IOChargeScope* DB::current_charge_ = nullptr;
+
+DB::IOChargeScope::IOChargeScope(DB* db) : db_(db), prev_(current_charge_) {
+  current_charge_ = this;
+}
+
+DB::IOChargeScope::~IOChargeScope() {
+  current_charge_ = prev_;
+  for (const auto& charge : charges_) {
+    charge.limiter->Request(charge.bytes, charge.priority);
+  }
+}
+
+void DB::ChargeIO(uint64_t read_bytes, uint64_t write_bytes, IOPriority priority) {
+  stats_.RecordTick(kBytesRead, read_bytes);
+  stats_.RecordTick(kBytesWritten, write_bytes);
+  RateLimiter* rate_limiter = rate_limiter_;
+  if (rate_limiter == nullptr) return;
+  if (current_charge_ != nullptr && current_charge_->db_ == this) {
+    // waiting here would hold mutex_ while other priorities queue for it
+    IOChargeScope::Charge charge;
+    charge.limiter = rate_limiter;
+    charge.bytes = read_bytes + write_bytes;
+    charge.priority = priority;
+    current_charge_->charges_.push_back(charge);
+  } else {
+    rate_limiter->Request(read_bytes + write_bytes, priority);
+  }
+}
+
+void DB::SetDeleteRateLimit(uint64_t bytes_per_sec) {
+  deleter_->SetRateLimit(bytes_per_sec);
+}
+
+bool DB::SetSharedPath(const std::string& dir, std::function<void(uint64_t)> release,
+                       uint32_t* path_id) {
+  WaitForBackgroundWork();
+  std::lock_guard<std::mutex> l(mutex_);
+  // the recorded dir wins, containers there are never taken for files
+  // of this DB because another dir was passed
+  if (!SharedPathLocked().empty() && SharedPathLocked() != dir) return false;
+  bool added;
+  if (!AddDataPathLocked(dir, path_id, &added)) return false;
+  shared_release_ = std::move(release);
+  // the caller counts references from the files the DB reads now
+  released_shared_.clear();
+  if (!added && shared_path_id_ == *path_id) return true;
+  // the path and its tag land in the same rewrite
+  shared_path_id_ = *path_id;
+  return RewriteManifest();
+}
+
+std::string DB::GetSharedPath() {
+  std::lock_guard<std::mutex> l(mutex_);
+  return SharedPathLocked();
+}
+
+std::string DB::SharedPathLocked() {
+  if (shared_path_id_ == 0 || shared_path_id_ >= data_paths_.size()) return std::string();
+  return data_paths_[shared_path_id_];
+}
+
+void DB::GetFilesOnPath(uint32_t path_id, std::unordered_set<uint64_t>* numbers) {
+  std::lock_guard<std::mutex> l(mutex_);
+  for (auto file : *file_list_) {
+    if ((file->tag == kNewFile || file->tag == kMergedFile) && PathId(file->number) == path_id) {
+      numbers->insert(file->number);
+    }
+  }
+}
+
+bool DB::ReserveFileNumber(uint64_t number) {
+  std::lock_guard<std::mutex> l(mutex_);
+  if (file_linked_list->max_file_num_ >= number) return false;
+  file_linked_list->max_file_num_ = number;
+  return true;
+}
+
+std::string DB::FilterFileName(uint64_t number) {
+  // number 0 is the file of DBs created before filter compaction
+  if (number == 0) return dbname_ + "/filter";
+  return MakeFileName(dbname_, number, "filter");
+}
+
+bool DB::CompactFilterFile() {
+  IOChargeScope charge(this);
+  std::lock_guard<std::mutex> l(mutex_);
+  if (!use_filter_) return false;
+  filter_file_.flush();
+  auto old_name = FilterFileName(filter_number_);
+  MappedRegion old_filters;
+  if (!old_filters.Open(old_name, 0, 0, kAdviseSequential)) return false;
+
+  // copy the filters of live chunks back to back
+  std::string contents;
+  std::vector<FileMetaData*> metas;
+  std::vector<uint64_t> old_starts;
+  // filters cut short by a crash, they point into the file deleted below
+  std::vector<FileMetaData*> lost;
+  std::vector<std::pair<uint64_t, uint64_t>> lost_filters;
+  for (auto file : *file_list_) {
+    if ((file->tag != kNewFile && file->tag != kMergedFile) || file->filter_length == 0) {
+      continue;
+    }
+    if (file->filter_start + file->filter_length > old_filters.size()) {
+      lost.push_back(file);
+      lost_filters.push_back(std::make_pair(file->filter_start, file->filter_length));
+      // read as a chunk without a filter from now on
+      file->filter_start = 0;
+      file->filter_length = 0;
+      continue;
+    }
+    metas.push_back(file);
+    old_starts.push_back(file->filter_start);
+    file->filter_start = contents.size();
+    contents.append(old_filters.data() + old_starts.back(), file->filter_length);
+  }
+  old_filters.Close();
+  ChargeIO(0, contents.size(), kIOPriorityBackground);
+
+  uint64_t old_number = filter_number_;
+  filter_number_ = file_linked_list->NextFileNumber();
+  auto new_name = FilterFileName(filter_number_);
+  // writing over the live filter file would lose it below
+  assert(new_name != old_name);
+  // the new offsets become visible together with the new file number
+  if (!WriteStringToFileSync(contents, new_name) || !RewriteManifest()) {
+    for (size_t i = 0; i < metas.size(); i++) {
+      metas[i]->filter_start = old_starts[i];
+    }
+    for (size_t i = 0; i < lost.size(); i++) {
+      lost[i]->filter_start = lost_filters[i].first;
+      lost[i]->filter_length = lost_filters[i].second;
+    }
+    filter_number_ = old_number;
+    DeleteFile(new_name);
+    return false;
+  }
+
+  filter_file_.close();
+  filter_file_.open(new_name, std::ios::out | std::ios::app | std::ios::ate);
+  // unreferenced now, the orphan scan at open catches it after a crash
+  deleter_->Schedule(old_name, 0);
+  return true;
+}
+
+void DB::MaybeCompactFilterFile() {
+  uint64_t size = 0, live = 0;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    if (!use_filter_) return;
+    for (auto file : *file_list_) {
+      if (file->tag == kNewFile || file->tag == kMergedFile) {
+        live += file->filter_length;
+      }
+    }
+    filter_file_.flush();
+    GetFileSize(FilterFileName(filter_number_), &size);
+  }
+  // rewrite once more than half of the file is dead
+  if (size > kMinFilterCompactionBytes && size > 2 * live) {
+    CompactFilterFile();
+  }
+}
+
+}
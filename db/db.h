@@ -4,19 +4,80 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <map>
+#include <functional>
+#include <mutex>
 #include <thread>
 
 #include "extraction.h"
+#include "extraction_policy.h"
+#include "file_deleter.h"
 #include "file_list.h"
 #include "bloom_filter.h"
+#include "io_engine.h"
+#include "metadata_snapshot.h"
+#include "rate_limiter.h"
+#include "restore_plan.h"
+#include "retention_policy.h"
+#include "statistics.h"
+#include "thread_pool.h"
 
 namespace tdchunk {
 
 class MemTable;
 
+// filter files smaller than this are never compacted
+static const uint64_t kMinFilterCompactionBytes = 4 * 1024 * 1024;
+
+// manifest rewrites between two snapshots, a clean close always writes one
+static const int kSnapshotInterval = 16;
+
+// Chunks at level >= cold_level, or of columns at least cold_age
+// columns behind the newest one, belong on data path cold_path_id.
+// A rule set to 0 is off.
+struct TieringOptions {
+  uint32_t cold_path_id = 0;
+  int cold_level = 0;
+  int cold_age = 0;
+};
+
+enum StripeMode {
+  kStripeRoundRobin = 0,
+  kStripeCapacity = 1 // weighted by the free space of each path
+};
+
+// bytes migrated between tiers per background batch
+static const uint64_t kMigrationBatchBytes = 256 * 1024 * 1024;
+
+struct SpaceStats {
+  uint64_t live_bytes = 0;      // bytes referenced by the manifest
+  uint64_t file_bytes = 0;      // logical size of the chunk files
+  uint64_t allocated_bytes = 0; // blocks the chunk files occupy
+  uint64_t dead_bytes = 0;      // file_bytes - live_bytes
+  uint64_t reclaimed_bytes = 0; // punched out of merged files so far
+  double space_amp = 0;         // allocated_bytes / live_bytes
+  uint64_t containers = 0;      // kMergedFile containers
+  uint64_t container_dead_bytes = 0; // dead_bytes inside containers
+};
+
+// What a restore of one version reads.
+struct VersionLayout {
+  int version = 0;
+  uint64_t chunks = 0;
+  uint64_t bytes = 0;
+  uint64_t files = 0;       // distinct files
+  uint64_t reads = 0;       // reads of the restore plan, each one seek
+  int depth = 0;            // levels read per column
+  uint64_t rows = 0;        // rows read, 0 unless counted
+  uint64_t unique_rows = 0; // distinct keys among them
+  double read_amp = 0;      // rows / unique_rows
+};
+
 class DB {
  public:
   // Open the database with the specified "name".
@@ -26,40 +87,307 @@ class DB {
   // Caller should delete *dbptr when it is no longer needed.
   bool Open(const std::string& name, bool do_concat, float extract_thres);
 
+  // Load the manifest of name without touching any file, e.g. to analyze
+  // a DB another process has open. Only the const-like queries below
+  // (versions, layouts, space stats, restores) may be used afterwards.
+  bool OpenReadOnly(const std::string& name);
+
   DB();
   DB(const DB&) = delete;
   DB& operator=(const DB&) = delete;
 
   ~DB();
 
-  void NotifyJoin(const std::vector<uint32_t>& keys, uint64_t file_number, uint64_t length);
+  // Join in the background after the previous join, then run done if
+  // set. keys are moved in when the caller passes an rvalue.
+  void NotifyJoin(std::vector<uint32_t> keys, uint64_t file_number, uint64_t length,
+                  std::function<void()> done = nullptr);
+  // NotifyJoin of the region [start, start + length) of the shared
+  // container number. REQUIRES: SetSharedPath set a path
+  void NotifyJoinShared(std::vector<uint32_t> keys, uint64_t number, uint64_t start,
+                        uint64_t length, std::function<void()> done = nullptr);
+  // Block until the last scheduled join or maintenance task finished.
+  void WaitForBackgroundWork();
   // void Flush();
   void Join(const std::vector<uint32_t>& keys, uint64_t file_number, uint64_t length);
 
   std::vector<CkptMetaData> GetCheckpointFiles(int version);
 
-  void DeleteCheckpointsBefore(int version);
+  // Ranges of version sorted by (file, offset), with neighbours closer
+  // than max_gap coalesced into one read.
+  std::vector<RestoreRead> GetRestorePlan(int version, uint64_t max_gap);
+
+  // Restore path: read every chunk of version into *chunks, in the order
+  // of GetCheckpointFiles, issuing the coalesced plan as one batch on
+  // the I/O engine.
+  bool ReadCheckpoint(int version, std::vector<std::string>* chunks);
+
+  // Replace the I/O engine used by restore and merge, once no restore is
+  // reading.
+  void SetIOEngineOptions(const IOEngineOptions& options);
+
+  // Delete version and older ones. A version inside a compacted range
+  // rounds down to the newest older version. Returns false, deleting
+  // nothing, if no version is that old.
+  bool DeleteCheckpointsBefore(int version);
 
   bool ShouldExtract(const std::vector<uint32_t>& keys, std::vector<FileMetaData*>& to_be_extracted);
 
+  // Takes ownership of policy. Open installs a ThresholdExtractionPolicy
+  // built from extract_thres.
+  void SetExtractionPolicy(ExtractionPolicy* policy);
+  // a copy, joins keep updating the stats of the DB
+  AmplificationStats GetAmplificationStats();
+  Statistics* GetStatistics() { return &stats_; }
+
   void PrintTree();
 
   void Merge(int start, int end);
   uint64_t GetNextNumber();
+  // Number and file name of a new chunk, placed on the next stripe.
+  void GetNextFilePath(uint64_t* number, std::string* file_name);
+
+  // Consolidate columns [start, end] into one base column end holding,
+  // per level, the deduplicated rows with the newest column winning.
+  // Versions >= end read the base; versions in [start, end) are dropped.
+  bool CompactColumns(int start, int end);
+  void ScheduleCompaction(int start, int end);
+
+  // Compact in the background whenever more than max_columns columns
+  // are live, so restores read at most max_columns columns. Versions
+  // older than the compacted base can no longer be restored. 0 = off.
+  void SetMaxColumns(int max_columns);
+
+  // After a join, concatenate the same-level files of every merge_every
+  // columns into kMergedFile containers. 0 = off.
+  void SetMergeEvery(int merge_every);
+
+  // Rewrite merged containers whose live fraction drops below
+  // min_live_fraction in the background. 0 = off.
+  void SetRewriteThreshold(double min_live_fraction);
+
+  SpaceStats GetSpaceStats();
+
+  // versions that can be restored, newest first
+  std::vector<int> GetVersions();
+  // Layout of the restore of version. count_rows decodes every chunk to
+  // count its rows and distinct keys.
+  bool AnalyzeVersion(int version, bool count_rows, VersionLayout* layout);
+  // AnalyzeVersion of every version, newest first
+  std::vector<VersionLayout> AnalyzeVersions(bool count_rows);
+
+  // Takes ownership of policy, nullptr keeps every version.
+  void SetRetentionPolicy(RetentionPolicy* policy);
+
+  // Drop the versions the retention policy does not keep and free the
+  // chunks no kept version reads. Dropped versions cannot be restored.
+  bool ApplyRetention();
+  // ApplyRetention, then fold the oldest run of dropped columns into the
+  // kept column above it, in the background.
+  void ScheduleRetention();
+
+  // I/O of restores, extraction and background work goes through
+  // rate_limiter, not owned. nullptr = unlimited.
+  void SetRateLimiter(RateLimiter* rate_limiter);
+
+  // Add a directory chunk files can be placed in, *path_id is its index
+  // for TieringOptions. Path 0 is the DB directory.
+  bool AddDataPath(const std::string& path, uint32_t* path_id);
+  void SetTiering(const TieringOptions& options);
+  // Move up to max_bytes of chunk files to the path the tiering rules
+  // pick for them. A container stays hot while any chunk in it is hot.
+  bool MigrateFiles(uint64_t max_bytes);
+  void ScheduleMigration();
+
+  // Spread new chunk files over path_ids (from AddDataPath). Restores
+  // read each path with its own I/O engine in parallel. Empty = all on
+  // path 0.
+  bool SetStriping(const std::vector<uint32_t>& path_ids, StripeMode mode);
+
+  // Hand out new chunk files on path_id, e.g. a tmpfs directory, and
+  // copy them to their stripe in the background once joined. Chunks not
+  // destaged yet are lost if the host goes down, WaitForDestage makes
+  // everything joined so far durable. 0 = off.
+  bool SetStagingPath(uint32_t path_id);
+  void WaitForDestage();
+
+  // Bytes per second the background deleter may free, 0 = unlimited.
+  void SetDeleteRateLimit(uint64_t bytes_per_sec);
+
+  // Containers in dir hold regions of other DBs too. Their regions are
+  // joined with NotifyJoinShared, and the DB never deletes, rewrites or
+  // migrates them. Once it reads no region of a container and its
+  // manifest on disk no longer references it, it calls release(number)
+  // instead of deleting. dir is recorded in the manifest, another dir is
+  // refused later. *path_id is the data path of dir.
+  bool SetSharedPath(const std::string& dir, std::function<void(uint64_t)> release,
+                     uint32_t* path_id);
+  // the dir the manifest records for shared containers, empty if none
+  std::string GetSharedPath();
+  // numbers of the containers on path_id the DB reads regions of
+  void GetFilesOnPath(uint32_t path_id, std::unordered_set<uint64_t>* numbers);
+  // Never hand out number or a smaller one for a file of this DB.
+  // Returns false if one >= number was handed out already.
+  bool ReserveFileNumber(uint64_t number);
+
+  // Rewrite the filter file with only the filters of live chunks. The
+  // new offsets and file are switched in by the manifest rewrite.
+  bool CompactFilterFile();
 
  private:
 
+  // Run work on the background thread after the previous work finished.
+  void Schedule(std::function<void()> work);
+  void JoinThen(const std::vector<uint32_t>& keys, uint64_t file_number, uint64_t start,
+                uint64_t length, const std::function<void()>& done);
+  // Join of a region, chunk files start at 0
+  void JoinRegion(const std::vector<uint32_t>& keys, uint64_t file_number, uint64_t start,
+                  uint64_t length);
+
+  void MaybeCompact();
+  void MaybeMerge();
+  void MaybeRewriteContainers();
+  void MaybeCompactFilterFile();
+  void MaybeApplyRetention();
+  void MaybeMigrate();
+
+  std::string FilterFileName(uint64_t number);
+
+  // Read the manifest from offset on into file_list_ and the path, ref
+  // and column tables. Numbers of files queued for deletion go to
+  // obsolete, outputs logged as pending to pending_outputs_.
+  void LoadManifest(const std::string& manifest_name, uint64_t offset,
+                    std::vector<uint64_t>* obsolete);
+  // Load the snapshot, then the records the manifest logged after it.
+  // Returns false, loading nothing, if there is no snapshot of the
+  // current manifest.
+  bool LoadSnapshot(const std::string& manifest_name, std::vector<uint64_t>* obsolete);
+
+  // REQUIRES: mutex_ held
+  uint32_t PathId(uint64_t number);
+  std::string ChunkFileName(uint64_t number);
+  uint32_t TargetPathId(FileMetaData* meta, int newest);
+  // path of a hot file, its stripe
+  uint32_t HotPathId(uint64_t number);
+  uint32_t NextStripePath();
+  // NextFileNumber placed on the next stripe
+  uint64_t NewChunkNumber();
+  // Log number as an output the DB is about to write. An output not in
+  // the file list at the next manifest rewrite or open is deleted.
+  void LogPendingOutput(uint64_t number);
+  uint32_t PathIdOfName(const std::string& file_name);
+  // a container on the shared path
+  bool IsShared(uint64_t number);
+  // the dir of shared_path_id_, empty if none. REQUIRES: mutex_ held
+  std::string SharedPathLocked();
+  // Find path in data_paths_ or add it without logging it, *added tells
+  // which. REQUIRES: mutex_ held
+  bool AddDataPathLocked(const std::string& path, uint32_t* path_id, bool* added);
+  IOEngine* EngineForPath(uint32_t path_id);
+  // copy the regions of src_name to the same offsets in dst_name, needs
+  // no lock
+  bool CopyRegions(const std::string& src_name, const std::string& dst_name,
+                   const std::vector<FileMetaData*>& regions, IOPriority priority);
+
+  // REQUIRES: mutex_ held
+  void ScheduleDestage(uint64_t number);
+  void Destage(uint64_t number);
+
+  // Count the bytes of an I/O and wait for the rate limiter, a copy
+  // reads and writes the same bytes. Inside an IOChargeScope of this DB
+  // the wait is left to the end of the scope.
+  void ChargeIO(uint64_t read_bytes, uint64_t write_bytes, IOPriority priority);
+
+  // Collects the ChargeIO calls of this thread, and waits for the rate
+  // limiter once they are all made. Declared before the lock_guard of
+  // mutex_, so the wait comes after the unlock and a restore never
+  // queues for mutex_ behind background work waiting for tokens.
+  class IOChargeScope {
+   public:
+    explicit IOChargeScope(DB* db);
+    IOChargeScope(const IOChargeScope&) = delete;
+    IOChargeScope& operator=(const IOChargeScope&) = delete;
+    ~IOChargeScope();
+
+   private:
+    friend class DB;
+    struct Charge {
+      RateLimiter* limiter;
+      uint64_t bytes;
+      IOPriority priority;
+    };
+    DB* db_;
+    IOChargeScope* prev_;
+    std::vector<Charge> charges_;
+  };
+  // innermost IOChargeScope of the calling thread
+  static thread_local IOChargeScope* current_charge_;
+
+  // Drop one ref of a kMergedFile container, deleting the container once
+  // unreferenced. Otherwise the region is punched out by the next
+  // manifest rewrite.
+  // REQUIRES: mutex_ held
+  bool ReleaseMergedRegion(FileMetaData* meta);
+
+  // Delete copies of live files left on another path and stale filter
+  // files. Other files are left alone, their numbers are never reused.
+  void DeleteOrphanFiles();
+
+  // Log chunk file number as obsolete and hand it to the deleter. The
+  // log line is dropped by the first manifest rewrite after the unlink.
+  // REQUIRES: mutex_ held
+  void ObsoleteFile(uint64_t number);
+
+  // REQUIRES: mutex_ held
+  std::vector<CkptMetaData> CheckpointFiles(int version);
+
+  // Release the data of metas (files, merged file refs), remove them
+  // from file_list_ and free them. REQUIRES: mutex_ held
+  void DropFiles(const std::vector<FileMetaData*>& metas);
+
+  // REQUIRES: mutex_ held
+  void JoinLocked(const std::vector<uint32_t>& keys, uint64_t file_number, uint64_t start,
+                  uint64_t length);
+
+  // Pick the inputs under mutex_, read and split them without it, and
+  // install the results unless the file list changed meanwhile.
   void BackgroundExtraction(const std::vector<uint32_t>& keys);
 
-  bool DoExtractionWork(Extraction* e); // args to be decided 
+  // needs no lock
+  bool DoExtractionWork(Extraction* e);
 
-  bool InstallExtractionResults(Extraction* extract, int column);
+  // REQUIRES: mutex_ held
+  bool InstallExtractionResults(const Extraction::Result& result);
 
-  bool RewriteManifest();
+  // REQUIRES: mutex_ held
+  InputChunk ChunkInput(FileMetaData* file);
+  // Number and file name of a new output of background work running
+  // without mutex_, logged as pending. Takes mutex_.
+  uint64_t NewOutput(std::string* fname);
+  // Give up the outputs of background work that was not installed.
+  // REQUIRES: mutex_ held
+  void DiscardOutputs(const std::vector<uint64_t>& numbers);
+
+  // Count a restore or background job about to read chunk files without
+  // mutex_. Until the last one is removed, no chunk file is deleted, no
+  // hole punched and no shared container released, so the files it
+  // planned to read stay as they were. REQUIRES: mutex_ held
+  void AddUnlockedReader();
+  void RemoveUnlockedReader();
+
+  // Also writes the snapshot of the new manifest if write_snapshot or
+  // every kSnapshotInterval rewrites.
+  bool RewriteManifest(bool write_snapshot = false);
+  bool WriteSnapshot(const MetadataSnapshot& snapshot);
 
   // delete unuseful files
   bool CleanupExtraction(Extraction* e);
 
+  // bytes a restore of version reads, cached until the file list changes
+  // other than by a join
+  uint64_t VersionBytes(int version);
+  void InvalidateVersionBytes();
+
   void CreateFilterForMap(const std::map<int32_t, std::vector<double>>& data_map);
 
   std::ofstream manifest_;
@@ -67,19 +395,90 @@ class DB {
   std::string dbname_;
   bool use_filter_;
   BloomFilterPolicy* filter_policy_;
+  IOEngineOptions io_options_;
+  IOEngine* io_engine_;
+  ExtractionPolicy* extraction_policy_;
+  AmplificationStats amp_stats_;
+  Statistics stats_;
+  FileDeleter* deleter_;
+  RetentionPolicy* retention_policy_;
+  std::atomic<RateLimiter*> rate_limiter_;
+  TieringOptions tiering_;
+  std::vector<uint32_t> stripe_paths_;
+  StripeMode stripe_mode_;
+  uint64_t next_stripe_;
+  // smooth weighted round robin state of kStripeCapacity
+  std::vector<double> stripe_credit_;
+  uint32_t staging_path_id_;
+  ThreadPool* destager_;
+  WaitGroup destage_pending_;
+  uint32_t shared_path_id_;
+  std::function<void(uint64_t)> shared_release_;
+  // shared containers dropped since the last manifest rewrite
+  std::vector<uint64_t> released_shared_;
+  // engines of data paths other than 0, by path id
+  std::vector<IOEngine*> path_engines_;
 
   // use to sync main thread and sub thread
   bool background_compaction_scheduled_;
 
+  // guards file_list_, file_linked_list, merged_file_ref and the manifest
+  std::mutex mutex_;
+  // bumped by every manifest rewrite, so by every change of the file
+  // list but a join. Background work reading without mutex_ installs its
+  // results only if it did not change since the inputs were picked.
+  uint64_t list_changes_;
+  // see AddUnlockedReader, engines and the extraction policy are only
+  // replaced once it drops to 0
+  int unlocked_readers_;
+  std::condition_variable no_unlocked_readers_;
+  int max_columns_;
+  int merge_every_;
+  double min_live_fraction_;
+  uint64_t reclaimed_bytes_;
+  // 0 while the filters are still in the legacy "filter" file
+  uint64_t filter_number_;
+  // of the last manifest rewrite, ties the snapshot to it
+  uint64_t manifest_generation_;
+  // false once the manifest logged records the snapshot lacks
+  bool snapshot_current_;
+  int rewrites_since_snapshot_;
+  // version -> bytes a restore of it reads
+  std::unordered_map<int, uint64_t> version_bytes_;
+  // bytes of the level 0 chunk of every column, what a new column reads
+  uint64_t l0_bytes_;
+  bool l0_bytes_valid_;
+
+  // columns of versions dropped by retention or deleted, the nodes stay
+  // while kept versions still read some of their chunks
+  std::unordered_set<int> dropped_columns_;
+
+  // directories of the chunk files, 0 is dbname_
+  std::vector<std::string> data_paths_;
+  // file_num -> index in data_paths_, absent for 0
+  std::unordered_map<uint64_t, uint32_t> file_path_id_;
+  // handed out by GetNextFilePath and not joined yet
+  std::unordered_set<uint64_t> unjoined_numbers_;
+  // outputs logged with kPendingFile since the last manifest rewrite
+  std::unordered_set<uint64_t> pending_outputs_;
+  // released regions of containers, punched once a rewrite dropped them
+  struct DeadRegion {
+    uint64_t number;
+    uint64_t start;
+    uint64_t length;
+  };
+  std::vector<DeadRegion> dead_regions_;
+
   // file_num -> ref
   std::unordered_map<uint64_t, int> merged_file_ref;
   std::vector<FileMetaData*>* file_list_;
   FileLinkedList* file_linked_list;
   std::unique_ptr<std::thread> bg_flush;
+  // guards bg_flush, which DBManager callers may schedule or wait on
+  // from several threads
+  std::mutex bg_mu_;
   std::string cur_flush_file;
   bool do_concat_;
-  // threshold of the number of kvs to be extracted
-  float extract_thres_;
 
 };
 }
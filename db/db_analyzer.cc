@@ -0,0 +1,141 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Prints what a restore of every version of a DB reads, and how much
+// space the DB wastes. The DB is opened read-only, so it can be pointed
+// at the directory of a running job.
+//
+//   db_analyzer --db=/data/ckpt/table0,/data/ckpt/table1 --count_rows
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "db.h"
+
+using namespace tdchunk;
+
+namespace {
+
+// flags
+std::string FLAGS_db = "";       // comma separated DB directories
+bool FLAGS_count_rows = false;   // decode chunks to count rows, slow
+int FLAGS_version = -1;          // only this version, -1 = all
+
+bool ParseFlag(const char* arg, const char* name, std::string* value) {
+  size_t len = std::strlen(name);
+  if (std::strncmp(arg, "--", 2) != 0 || std::strncmp(arg + 2, name, len) != 0 ||
+      arg[2 + len] != '=') {
+    return false;
+  }
+  *value = arg + 3 + len;
+  return true;
+}
+
+std::string Bytes(uint64_t bytes) {
+  const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+  double value = static_cast<double>(bytes);
+  int i = 0;
+  while (value >= 1024 && i < 4) {
+    value /= 1024;
+    i++;
+  }
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.1f %s", value, units[i]);
+  return buf;
+}
+
+void PrintLayout(const VersionLayout& l) {
+  std::printf("%8d %8llu %12s %6llu %6llu %5d", l.version,
+              static_cast<unsigned long long>(l.chunks), Bytes(l.bytes).c_str(),
+              static_cast<unsigned long long>(l.files),
+              static_cast<unsigned long long>(l.reads), l.depth);
+  if (FLAGS_count_rows) {
+    std::printf(" %12llu %12llu %8.2f", static_cast<unsigned long long>(l.rows),
+                static_cast<unsigned long long>(l.unique_rows), l.read_amp);
+  }
+  std::printf("\n");
+}
+
+bool Analyze(const std::string& name) {
+  DB db;
+  if (!db.OpenReadOnly(name)) {
+    std::fprintf(stderr, "%s: no manifest\n", name.c_str());
+    return false;
+  }
+
+  std::vector<VersionLayout> layouts;
+  if (FLAGS_version >= 0) {
+    VersionLayout layout;
+    if (!db.AnalyzeVersion(FLAGS_version, FLAGS_count_rows, &layout)) {
+      std::fprintf(stderr, "%s: version %d cannot be restored\n", name.c_str(), FLAGS_version);
+      return false;
+    }
+    layouts.push_back(layout);
+  } else {
+    layouts = db.AnalyzeVersions(FLAGS_count_rows);
+  }
+
+  std::printf("%s\n", name.c_str());
+  std::printf("%8s %8s %12s %6s %6s %5s", "version", "chunks", "bytes", "files", "reads",
+              "depth");
+  if (FLAGS_count_rows) {
+    std::printf(" %12s %12s %8s", "rows", "unique_rows", "read_amp");
+  }
+  std::printf("\n");
+  int deepest = 0;
+  uint64_t most_reads = 0;
+  for (const auto& layout : layouts) {
+    PrintLayout(layout);
+    deepest = std::max(deepest, layout.depth);
+    most_reads = std::max(most_reads, layout.reads);
+  }
+
+  SpaceStats space = db.GetSpaceStats();
+  std::printf("versions %zu, deepest %d levels, at most %llu reads per restore\n",
+              layouts.size(), deepest, static_cast<unsigned long long>(most_reads));
+  std::printf("live %s, files %s, allocated %s, space amp %.2f\n",
+              Bytes(space.live_bytes).c_str(), Bytes(space.file_bytes).c_str(),
+              Bytes(space.allocated_bytes).c_str(), space.space_amp);
+  std::printf("dead %s, %llu containers holding %s dead\n\n", Bytes(space.dead_bytes).c_str(),
+              static_cast<unsigned long long>(space.containers),
+              Bytes(space.container_dead_bytes).c_str());
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    std::string v;
+    if (ParseFlag(argv[i], "db", &v)) {
+      FLAGS_db = v;
+    } else if (ParseFlag(argv[i], "count_rows", &v)) {
+      FLAGS_count_rows = v != "0" && v != "false";
+    } else if (std::strcmp(argv[i], "--count_rows") == 0) {
+      FLAGS_count_rows = true;
+    } else if (ParseFlag(argv[i], "version", &v)) {
+      FLAGS_version = std::atoi(v.c_str());
+    } else {
+      std::fprintf(stderr, "invalid flag '%s'\n", argv[i]);
+      return 1;
+    }
+  }
+  if (FLAGS_db.empty()) {
+    std::fprintf(stderr, "usage: db_analyzer --db=dir[,dir...] [--count_rows] [--version=n]\n");
+    return 1;
+  }
+
+  bool ok = true;
+  std::stringstream dbs(FLAGS_db);
+  std::string name;
+  while (std::getline(dbs, name, ',')) {
+    if (!name.empty()) ok = Analyze(name) && ok;
+  }
+  return ok ? 0 : 1;
+}
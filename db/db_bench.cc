@@ -0,0 +1,413 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Synthetic embedding-table checkpoint workload. Every version writes
+// the rows a Zipfian update stream touched since the previous one,
+// joins them, and periodically restores and trims old versions. The
+// report is one JSON object.
+//
+//   db_bench --db=/tmp/tdchunk_bench --tables=4 --rows=100000 --dim=16
+//            --versions=50 --update_fraction=0.05 --zipf=0.99
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "db_manager.h"
+#include "msgpack_helper.h"
+
+using namespace tdchunk;
+
+namespace {
+
+// flags
+std::string FLAGS_db = "/tmp/tdchunk_bench";
+int FLAGS_tables = 4;
+int FLAGS_rows = 100000;        // rows per table
+int FLAGS_dim = 16;             // embedding dimension
+int FLAGS_versions = 50;        // checkpoints after the full one
+double FLAGS_update_fraction = 0.05; // updates per interval, fraction of rows
+double FLAGS_zipf = 0.99;       // in [0, 1), 0 = uniform
+bool FLAGS_do_concat = false;
+double FLAGS_extract_thres = 0.3;
+std::string FLAGS_policy = "threshold";
+double FLAGS_policy_param = -1; // defaults to extract_thres for "threshold"
+int FLAGS_restore_every = 10;   // restore the newest version every n, 0 = never
+int FLAGS_keep_versions = 0;    // DeleteCheckpointsBefore keeps the last n, 0 = all
+int FLAGS_merge_every = 0;
+int FLAGS_max_columns = 0;
+int FLAGS_io_engine = 1;        // 0 thread pool, 1 io_uring
+bool FLAGS_direct_io = false;
+uint64_t FLAGS_seed = 301;
+std::string FLAGS_report = "";  // file for the JSON report, stdout if empty
+
+uint64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Zipfian over [0, n) after Gray et al., as in YCSB. Ranks are
+// scrambled so hot rows are spread over the key space.
+class ZipfianGenerator {
+ public:
+  ZipfianGenerator(uint64_t n, double theta, uint64_t seed)
+    : n_(n), theta_(theta), rnd_(seed), uniform_(0.0, 1.0) {
+    if (theta_ <= 0) return;
+    zetan_ = Zeta(n_, theta_);
+    double zeta2 = Zeta(2, theta_);
+    alpha_ = 1.0 / (1.0 - theta_);
+    eta_ = (1 - std::pow(2.0 / n_, 1 - theta_)) / (1 - zeta2 / zetan_);
+  }
+
+  uint64_t Next() {
+    double u = uniform_(rnd_);
+    if (theta_ <= 0) return static_cast<uint64_t>(u * n_) % n_;
+    double uz = u * zetan_;
+    uint64_t rank;
+    if (uz < 1.0) {
+      rank = 0;
+    } else if (uz < 1.0 + std::pow(0.5, theta_)) {
+      rank = 1;
+    } else {
+      rank = static_cast<uint64_t>(n_ * std::pow(eta_ * u - eta_ + 1, alpha_));
+    }
+    return Scramble(std::min(rank, n_ - 1));
+  }
+
+ private:
+  static double Zeta(uint64_t n, double theta) {
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; i++) {
+      sum += 1.0 / std::pow(static_cast<double>(i), theta);
+    }
+    return sum;
+  }
+
+  uint64_t Scramble(uint64_t rank) const {
+    // FNV-1a of the rank
+    uint64_t h = 14695981039346656037ull;
+    for (int i = 0; i < 8; i++) {
+      h ^= (rank >> (i * 8)) & 0xff;
+      h *= 1099511628211ull;
+    }
+    return h % n_;
+  }
+
+  uint64_t n_;
+  double theta_;
+  double zetan_ = 0;
+  double alpha_ = 0;
+  double eta_ = 0;
+  std::mt19937_64 rnd_;
+  std::uniform_real_distribution<double> uniform_;
+};
+
+// Latency samples of one operation.
+class OpStats {
+ public:
+  void Add(uint64_t micros, uint64_t bytes) {
+    samples_.push_back(micros);
+    bytes_ += bytes;
+    total_micros_ += micros;
+  }
+
+  std::string ToJson() {
+    std::sort(samples_.begin(), samples_.end());
+    std::ostringstream out;
+    double seconds = total_micros_ / 1e6;
+    out << "{\"ops\": " << samples_.size()
+        << ", \"bytes\": " << bytes_
+        << ", \"ops_per_sec\": " << (seconds > 0 ? samples_.size() / seconds : 0)
+        << ", \"mb_per_sec\": " << (seconds > 0 ? bytes_ / 1048576.0 / seconds : 0)
+        << ", \"latency_us\": {\"avg\": "
+        << (samples_.empty() ? 0 : static_cast<double>(total_micros_) / samples_.size())
+        << ", \"p50\": " << Percentile(0.50)
+        << ", \"p90\": " << Percentile(0.90)
+        << ", \"p99\": " << Percentile(0.99)
+        << ", \"p999\": " << Percentile(0.999)
+        << ", \"max\": " << (samples_.empty() ? 0 : samples_.back()) << "}}";
+    return out.str();
+  }
+
+ private:
+  uint64_t Percentile(double p) const {
+    if (samples_.empty()) return 0;
+    size_t index = static_cast<size_t>(p * (samples_.size() - 1) + 0.5);
+    return samples_[std::min(index, samples_.size() - 1)];
+  }
+
+  std::vector<uint64_t> samples_;
+  uint64_t bytes_ = 0;
+  uint64_t total_micros_ = 0;
+};
+
+bool ParseFlag(const char* arg, const char* name, std::string* value) {
+  size_t len = std::strlen(name);
+  if (std::strncmp(arg, "--", 2) != 0 || std::strncmp(arg + 2, name, len) != 0 ||
+      arg[2 + len] != '=') {
+    return false;
+  }
+  *value = arg + 3 + len;
+  return true;
+}
+
+std::string JsonString(const std::string& s) {
+  return "\"" + s + "\"";
+}
+
+class Benchmark {
+ public:
+  Benchmark() : rows_written_(0) {}
+
+  bool Run() {
+    ::mkdir(FLAGS_db.c_str(), 0755);
+    std::vector<std::string> paths;
+    for (int i = 0; i < FLAGS_tables; i++) {
+      paths.push_back(FLAGS_db + "/table." + std::to_string(i));
+    }
+    if (!db_manager_.OpenDBs(paths, FLAGS_do_concat, static_cast<float>(FLAGS_extract_thres))) {
+      std::fprintf(stderr, "cannot open %s\n", FLAGS_db.c_str());
+      return false;
+    }
+    double param = FLAGS_policy_param >= 0 ? FLAGS_policy_param : FLAGS_extract_thres;
+    if (!db_manager_.SetExtractionPolicy(FLAGS_policy, param)) {
+      std::fprintf(stderr, "unknown policy %s\n", FLAGS_policy.c_str());
+      return false;
+    }
+    db_manager_.SetIOEngine(FLAGS_io_engine, 64, FLAGS_direct_io);
+    db_manager_.SetMergeEvery(FLAGS_merge_every);
+    db_manager_.SetMaxColumns(FLAGS_max_columns);
+
+    std::vector<ZipfianGenerator*> generators;
+    for (int t = 0; t < FLAGS_tables; t++) {
+      generators.push_back(new ZipfianGenerator(FLAGS_rows, FLAGS_zipf, FLAGS_seed + t));
+    }
+
+    uint64_t start = NowMicros();
+    // a failed restore fails the run
+    bool success = true;
+    // a join needs at least one key
+    uint64_t updates = std::max<uint64_t>(1, FLAGS_rows * FLAGS_update_fraction);
+    // version 0 is the full table
+    for (int version = 0; version <= FLAGS_versions; version++) {
+      for (int t = 0; t < FLAGS_tables; t++) {
+        std::set<uint32_t> keys;
+        if (version == 0) {
+          for (int row = 0; row < FLAGS_rows; row++) keys.insert(row);
+        } else {
+          for (uint64_t i = 0; i < updates; i++) keys.insert(generators[t]->Next());
+        }
+        WriteCheckpoint(t, version, keys);
+      }
+      if (FLAGS_restore_every > 0 && version > 0 && version % FLAGS_restore_every == 0) {
+        db_manager_.WaitForBackgroundWork();
+        for (int t = 0; t < FLAGS_tables; t++) {
+          success = Restore(t, version) && success;
+        }
+      }
+      if (FLAGS_keep_versions > 0 && version >= FLAGS_keep_versions) {
+        for (int t = 0; t < FLAGS_tables; t++) {
+          uint64_t begin = NowMicros();
+          db_manager_.DeleteCheckpointsBefore(t, version - FLAGS_keep_versions);
+          delete_.Add(NowMicros() - begin, 0);
+        }
+      }
+    }
+    db_manager_.WaitForBackgroundWork();
+    elapsed_micros_ = NowMicros() - start;
+
+    for (auto generator : generators) {
+      delete generator;
+    }
+    return success;
+  }
+
+  std::string Report() {
+    SpaceStats space;
+    double write_amp = 0;
+    uint64_t joined = 0, extracted = 0;
+    for (int t = 0; t < FLAGS_tables; t++) {
+      SpaceStats s = db_manager_.GetSpaceStats(t);
+      space.live_bytes += s.live_bytes;
+      space.file_bytes += s.file_bytes;
+      space.allocated_bytes += s.allocated_bytes;
+      space.dead_bytes += s.dead_bytes;
+      space.reclaimed_bytes += s.reclaimed_bytes;
+      AmplificationStats amp = db_manager_.GetAmplificationStats(t);
+      joined += amp.JoinedBytes();
+      extracted += amp.ExtractionBytes();
+    }
+    if (joined > 0) write_amp = static_cast<double>(extracted) / joined;
+    space.space_amp = space.live_bytes > 0
+                      ? static_cast<double>(space.allocated_bytes) / space.live_bytes : 0;
+
+    std::ostringstream out;
+    out << "{\n  \"config\": {"
+        << "\"db\": " << JsonString(FLAGS_db)
+        << ", \"tables\": " << FLAGS_tables
+        << ", \"rows\": " << FLAGS_rows
+        << ", \"dim\": " << FLAGS_dim
+        << ", \"versions\": " << FLAGS_versions
+        << ", \"update_fraction\": " << FLAGS_update_fraction
+        << ", \"zipf\": " << FLAGS_zipf
+        << ", \"policy\": " << JsonString(FLAGS_policy)
+        << ", \"extract_thres\": " << FLAGS_extract_thres
+        << ", \"do_concat\": " << (FLAGS_do_concat ? "true" : "false")
+        << ", \"merge_every\": " << FLAGS_merge_every
+        << ", \"max_columns\": " << FLAGS_max_columns
+        << ", \"keep_versions\": " << FLAGS_keep_versions
+        << ", \"io_engine\": " << FLAGS_io_engine
+        << ", \"direct_io\": " << (FLAGS_direct_io ? "true" : "false") << "},\n"
+        << "  \"elapsed_sec\": " << elapsed_micros_ / 1e6 << ",\n"
+        << "  \"rows_written\": " << rows_written_ << ",\n"
+        << "  \"write\": " << write_.ToJson() << ",\n"
+        << "  \"join\": " << join_.ToJson() << ",\n"
+        << "  \"get_version\": " << get_version_.ToJson() << ",\n"
+        << "  \"restore\": " << restore_.ToJson() << ",\n"
+        << "  \"delete\": " << delete_.ToJson() << ",\n"
+        << "  \"extraction_bytes\": " << extracted << ",\n"
+        << "  \"write_amp\": " << write_amp << ",\n"
+        << "  \"space\": {\"live_bytes\": " << space.live_bytes
+        << ", \"file_bytes\": " << space.file_bytes
+        << ", \"allocated_bytes\": " << space.allocated_bytes
+        << ", \"dead_bytes\": " << space.dead_bytes
+        << ", \"reclaimed_bytes\": " << space.reclaimed_bytes
+        << ", \"space_amp\": " << space.space_amp << "}\n}\n";
+    return out.str();
+  }
+
+  void Close() {
+    db_manager_.ReleaseDBs();
+  }
+
+ private:
+  void WriteCheckpoint(int table, int version, const std::set<uint32_t>& keys) {
+    std::map<uint32_t, std::vector<double>> data;
+    for (auto key : keys) {
+      data[key].assign(FLAGS_dim, version + key * 1e-6);
+    }
+    std::vector<uint32_t> key_list(keys.begin(), keys.end());
+
+    uint64_t begin = NowMicros();
+    std::pair<uint64_t, std::string> file = db_manager_.GetNextFilePath(table);
+    uint32_t length = PackToFile(file.second, data);
+    uint64_t written = NowMicros();
+    write_.Add(written - begin, length);
+
+    db_manager_.Join(table, key_list, file.first, length);
+    join_.Add(NowMicros() - written, length);
+    rows_written_ += keys.size();
+  }
+
+  bool Restore(int table, int version) {
+    uint64_t begin = NowMicros();
+    std::vector<CkptMetaData> files = db_manager_.GetCheckpointFiles(table, version);
+    get_version_.Add(NowMicros() - begin, 0);
+
+    begin = NowMicros();
+    std::vector<std::string> chunks;
+    if (!db_manager_.ReadCheckpoint(table, version, &chunks)) {
+      std::fprintf(stderr, "restore of table %d version %d failed\n", table, version);
+      return false;
+    }
+    uint64_t bytes = 0;
+    for (const auto& chunk : chunks) {
+      bytes += chunk.size();
+    }
+    restore_.Add(NowMicros() - begin, bytes);
+    return true;
+  }
+
+  DBManager db_manager_;
+  OpStats write_;
+  OpStats join_;
+  OpStats get_version_;
+  OpStats restore_;
+  OpStats delete_;
+  uint64_t rows_written_;
+  uint64_t elapsed_micros_ = 0;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    std::string v;
+    if (ParseFlag(argv[i], "db", &v)) {
+      FLAGS_db = v;
+    } else if (ParseFlag(argv[i], "tables", &v)) {
+      FLAGS_tables = std::atoi(v.c_str());
+    } else if (ParseFlag(argv[i], "rows", &v)) {
+      FLAGS_rows = std::atoi(v.c_str());
+    } else if (ParseFlag(argv[i], "dim", &v)) {
+      FLAGS_dim = std::atoi(v.c_str());
+    } else if (ParseFlag(argv[i], "versions", &v)) {
+      FLAGS_versions = std::atoi(v.c_str());
+    } else if (ParseFlag(argv[i], "update_fraction", &v)) {
+      FLAGS_update_fraction = std::atof(v.c_str());
+    } else if (ParseFlag(argv[i], "zipf", &v)) {
+      FLAGS_zipf = std::atof(v.c_str());
+    } else if (ParseFlag(argv[i], "do_concat", &v)) {
+      FLAGS_do_concat = std::atoi(v.c_str()) != 0;
+    } else if (ParseFlag(argv[i], "extract_thres", &v)) {
+      FLAGS_extract_thres = std::atof(v.c_str());
+    } else if (ParseFlag(argv[i], "policy", &v)) {
+      FLAGS_policy = v;
+    } else if (ParseFlag(argv[i], "policy_param", &v)) {
+      FLAGS_policy_param = std::atof(v.c_str());
+    } else if (ParseFlag(argv[i], "restore_every", &v)) {
+      FLAGS_restore_every = std::atoi(v.c_str());
+    } else if (ParseFlag(argv[i], "keep_versions", &v)) {
+      FLAGS_keep_versions = std::atoi(v.c_str());
+    } else if (ParseFlag(argv[i], "merge_every", &v)) {
+      FLAGS_merge_every = std::atoi(v.c_str());
+    } else if (ParseFlag(argv[i], "max_columns", &v)) {
+      FLAGS_max_columns = std::atoi(v.c_str());
+    } else if (ParseFlag(argv[i], "io_engine", &v)) {
+      FLAGS_io_engine = std::atoi(v.c_str());
+    } else if (ParseFlag(argv[i], "direct_io", &v)) {
+      FLAGS_direct_io = std::atoi(v.c_str()) != 0;
+    } else if (ParseFlag(argv[i], "seed", &v)) {
+      FLAGS_seed = std::strtoull(v.c_str(), nullptr, 10);
+    } else if (ParseFlag(argv[i], "report", &v)) {
+      FLAGS_report = v;
+    } else {
+      std::fprintf(stderr, "invalid flag '%s'\n", argv[i]);
+      return 1;
+    }
+  }
+  if (FLAGS_tables <= 0 || FLAGS_rows <= 0 || FLAGS_dim <= 0 || FLAGS_versions < 0) {
+    std::fprintf(stderr, "tables, rows and dim must be positive\n");
+    return 1;
+  }
+  if (FLAGS_zipf < 0 || FLAGS_zipf >= 1) {
+    std::fprintf(stderr, "zipf must be in [0, 1)\n");
+    return 1;
+  }
+
+  Benchmark bench;
+  if (!bench.Run()) return 1;
+  std::string report = bench.Report();
+  bench.Close();
+
+  if (FLAGS_report.empty()) {
+    std::fputs(report.c_str(), stdout);
+  } else {
+    std::ofstream out(FLAGS_report);
+    out << report;
+  }
+  return 0;
+}
@@ -3,49 +3,574 @@
 // found in the LICENSE file.
 
 #include "db_manager.h"
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
+#include <memory>
+#include <thread>
 
 namespace tdchunk {
 
-bool DBManager::OpenDBs(const std::vector<std::string>& db_paths, bool do_concat, float extract_thres) {
+DBManager::DBManager()
+  : rate_limiter_(0, 0),
+    merge_every_(0),
+    next_packed_number_(1),
+    packed_deleter_(nullptr) {}
+
+DBManager::~DBManager() {
+  ReleaseDBs();
+  // containers still queued are found again by the next enable
+  delete packed_deleter_;
+}
+
+bool DBManager::OpenDBs(const std::vector<std::string>& db_paths, bool do_concat, float extract_thres,
+                        bool lazy) {
+  size_t first;
+  bool success = AddDBs(db_paths, do_concat, extract_thres, &first);
+  if (lazy) return success;
+  return OpenRange(first, first + db_paths.size()) && success;
+}
+
+bool DBManager::AddDBs(const std::vector<std::string>& db_paths, bool do_concat,
+                       float extract_thres, size_t* first) {
+  {
+    std::lock_guard<std::mutex> l(dbs_mu_);
+    *first = _dbs.size();
+    for (const auto& db_path : db_paths) {
+      OpenState* state = new OpenState;
+      state->opened = false;
+      state->ok = false;
+      state->path = db_path;
+      state->do_concat = do_concat;
+      state->extract_thres = extract_thres;
+      open_states_.push_back(state);
+      _dbs.push_back(new DB());
+    }
+  }
   bool success = true;
   for (const auto& db_path : db_paths) {
-    DB* db = new DB();
-    success = db->Open(db_path, do_concat, extract_thres);
-    _dbs.push_back(db);
+    success = (FileExists(db_path) || CreateDir(db_path)) && success;
   }
   return success;
 }
 
+bool DBManager::OpenRange(size_t first, size_t last) {
+  if (first >= last) return true;
+  std::atomic<bool> success(true);
+  {
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    ThreadPool pool(std::min<int>(threads, last - first));
+    for (size_t i = first; i < last; i++) {
+      pool.Schedule([this, i, &success] {
+        if (!OpenDB(i)) success = false;
+      });
+    }
+  }  // the pool finishes every open before it is destroyed
+  return success;
+}
+
+bool DBManager::OpenDB(size_t index) {
+  OpenState* state;
+  DB* db;
+  {
+    std::lock_guard<std::mutex> l(dbs_mu_);
+    state = open_states_[index];
+    db = _dbs[index];
+  }
+  std::lock_guard<std::mutex> l(state->mu);
+  if (state->opened) return state->ok;
+  bool ok = db->Open(state->path, state->do_concat, state->extract_thres);
+  db->SetRateLimiter(&rate_limiter_);
+  std::lock_guard<std::mutex> s(settings_mu_);
+  for (const auto& setting : settings_) {
+    setting(db);
+  }
+  state->ok = ok;
+  state->opened = true;
+  return ok;
+}
+
+DB* DBManager::GetDB(int index) {
+  OpenState* state;
+  DB* db;
+  {
+    std::lock_guard<std::mutex> l(dbs_mu_);
+    state = open_states_[index];
+    db = _dbs[index];
+  }
+  if (!state->opened) OpenDB(index);
+  return db;
+}
+
+bool DBManager::ValidIndex(int index) {
+  std::lock_guard<std::mutex> l(dbs_mu_);
+  return index >= 0 && static_cast<size_t>(index) < _dbs.size();
+}
+
+std::vector<DB*> DBManager::AllDBs() {
+  std::lock_guard<std::mutex> l(dbs_mu_);
+  return _dbs;
+}
+
+void DBManager::ForEachDB(const std::function<void(DB*)>& fn) {
+  std::lock_guard<std::mutex> l(settings_mu_);
+  std::vector<DB*> dbs;
+  std::vector<OpenState*> states;
+  {
+    std::lock_guard<std::mutex> d(dbs_mu_);
+    dbs = _dbs;
+    states = open_states_;
+  }
+  // DBs added meanwhile are not opened yet, they apply fn when they are
+  for (size_t i = 0; i < dbs.size(); i++) {
+    if (states[i]->opened) fn(dbs[i]);
+  }
+  settings_.push_back(fn);
+}
+
 // void DBManager::Flush(int index, const std::string& file_name) {
-//   _dbs[index]->NotifyFlush(file_name);
+//   GetDB(index)->NotifyFlush(file_name);
 // }
 
-void DBManager::Join(int index, const std::vector<uint32_t>& keys, uint64_t file_number, uint64_t length) {
-  _dbs[index]->NotifyJoin(keys, file_number, length);
+bool DBManager::Join(int index, const std::vector<uint32_t>& keys, uint64_t file_number, uint64_t length) {
+  // checked here, GetDB on the executor has no one to report to
+  if (!ValidIndex(index)) return false;
+  TraceJoin(index, keys, file_number, length);
+  // through the executor, a join_all or join_async before it goes first
+  Submit(index, [this, index, keys, file_number, length] {
+    GetDB(index)->NotifyJoin(keys, file_number, length);
+  });
+  return true;
+}
+
+bool DBManager::JoinAll(std::vector<JoinRequest> requests, std::function<void()> done) {
+  if (requests.empty()) {
+    if (done) done();
+    return true;
+  }
+  for (const auto& r : requests) {
+    if (!ValidIndex(r.index)) return false;
+  }
+  std::shared_ptr<std::atomic<size_t>> pending(new std::atomic<size_t>(requests.size()));
+  std::function<void()> one_done = [pending, done] {
+    if (--*pending == 0 && done) done();
+  };
+  for (auto& r : requests) {
+    TraceJoin(r.index, r.keys, r.file_number, r.length);
+    std::shared_ptr<JoinRequest> request(new JoinRequest(std::move(r)));
+    Submit(request->index, [this, request, one_done] {
+      GetDB(request->index)->NotifyJoin(std::move(request->keys), request->file_number,
+                                        request->length, one_done);
+    });
+  }
+  return true;
+}
+
+bool DBManager::EnablePackedCheckpoints(const std::string& dir) {
+  WaitForBackgroundWork();
+  std::lock_guard<std::mutex> l(packed_mu_);
+  if (!packed_dir_.empty()) return packed_dir_ == dir;
+  // merged regions of a container are never merged again
+  if (merge_every_ > 1) return false;
+  if (!CreateDir(dir) && !FileExists(dir)) return false;
+  size_t num_dbs = AllDBs().size();
+  // the containers of a DB stay where its manifest says
+  for (size_t i = 0; i < num_dbs; i++) {
+    std::string shared = GetDB(i)->GetSharedPath();
+    if (!shared.empty() && shared != dir) return false;
+  }
+
+  if (packed_deleter_ == nullptr) {
+    packed_deleter_ = new FileDeleter();
+    packed_deleter_->SetRateLimiter(&rate_limiter_);
+  }
+  // a container is live while any DB reads a region of it
+  std::unordered_map<uint64_t, int> refs;
+  for (size_t i = 0; i < num_dbs; i++) {
+    DB* db = GetDB(i);
+    uint32_t path_id;
+    if (!db->SetSharedPath(dir, [this](uint64_t number) { ReleasePackedFile(number); },
+                           &path_id)) {
+      return false;
+    }
+    std::unordered_set<uint64_t> numbers;
+    db->GetFilesOnPath(path_id, &numbers);
+    for (auto number : numbers) {
+      refs[number]++;
+    }
+  }
+
+  std::vector<std::string> children;
+  GetChildren(dir, &children);
+  for (const auto& child : children) {
+    unsigned long long number;
+    char suffix[8];
+    if (std::sscanf(child.c_str(), "%llu.%7s", &number, suffix) != 2 ||
+        std::string(suffix) != "tdc") {
+      continue;
+    }
+    next_packed_number_ = std::max<uint64_t>(next_packed_number_, number + 1);
+    if (refs.count(number) != 0) continue;
+    // written but never joined, or released before a crash. A container
+    // of a table this manager did not open is left alone.
+    std::vector<PackedEntry> entries;
+    bool ours = true;
+    if (ReadPackedToc(dir + "/" + child, &entries)) {
+      for (const auto& entry : entries) {
+        if (entry.table >= num_dbs) ours = false;
+      }
+    }
+    if (ours) packed_deleter_->Schedule(dir + "/" + child, 0);
+  }
+  {
+    std::lock_guard<std::mutex> r(packed_refs_mu_);
+    packed_refs_ = refs;
+  }
+  packed_dir_ = dir;
+  return true;
+}
+
+std::pair<uint64_t, std::string> DBManager::NewPackedFile() {
+  std::lock_guard<std::mutex> l(packed_mu_);
+  if (packed_dir_.empty()) return std::make_pair(0, std::string());
+  // past the numbers every DB handed out so far
+  uint64_t number = next_packed_number_;
+  size_t num_dbs = AllDBs().size();
+  for (size_t i = 0; i < num_dbs; i++) {
+    number = std::max(number, GetDB(i)->GetNextNumber() + 1);
+  }
+  // a DB may hand out numbers of its own meanwhile, then go past them
+  for (;;) {
+    bool reserved = true;
+    for (size_t i = 0; i < num_dbs; i++) {
+      if (!GetDB(i)->ReserveFileNumber(number)) {
+        reserved = false;
+        number = std::max(number, GetDB(i)->GetNextNumber() + 1);
+      }
+    }
+    if (reserved) break;
+  }
+  next_packed_number_ = number + 1;
+  return std::make_pair(number, MakeFileName(packed_dir_, number, "tdc"));
+}
+
+bool DBManager::JoinPacked(uint64_t number, std::vector<PackedJoinRequest> requests,
+                           std::function<void()> done) {
+  std::string dir;
+  {
+    std::lock_guard<std::mutex> l(packed_mu_);
+    dir = packed_dir_;
+  }
+  if (dir.empty()) return false;
+  std::string file_name = MakeFileName(dir, number, "tdc");
+  if (requests.empty()) {
+    packed_deleter_->Schedule(file_name, 0);
+    if (done) done();
+    return true;
+  }
+
+  std::vector<PackedEntry> entries;
+  std::unordered_set<int> tables;
+  size_t num_dbs = AllDBs().size();
+  for (const auto& r : requests) {
+    if (r.index < 0 || static_cast<size_t>(r.index) >= num_dbs || r.keys.empty()) {
+      return false;
+    }
+    PackedEntry entry;
+    entry.table = r.index;
+    entry.start = r.start;
+    entry.length = r.length;
+    entries.push_back(entry);
+    tables.insert(r.index);
+  }
+  // one sync makes the chunks of every table durable
+  if (!WritePackedToc(file_name, entries)) return false;
+  SyncDir(dir);
+  {
+    std::lock_guard<std::mutex> r(packed_refs_mu_);
+    packed_refs_[number] += tables.size();
+  }
+
+  std::shared_ptr<std::atomic<size_t>> pending(new std::atomic<size_t>(requests.size()));
+  std::function<void()> one_done = [pending, done] {
+    if (--*pending == 0 && done) done();
+  };
+  for (auto& r : requests) {
+    TraceJoin(r.index, r.keys, number, r.length);
+    std::shared_ptr<PackedJoinRequest> request(new PackedJoinRequest(std::move(r)));
+    Submit(request->index, [this, request, number, one_done] {
+      GetDB(request->index)->NotifyJoinShared(std::move(request->keys), number, request->start,
+                                              request->length, one_done);
+    });
+  }
+  return true;
+}
+
+void DBManager::ReleasePackedFile(uint64_t number) {
+  std::lock_guard<std::mutex> l(packed_refs_mu_);
+  auto it = packed_refs_.find(number);
+  if (it == packed_refs_.end() || --it->second > 0) return;
+  packed_refs_.erase(it);
+  // packed_dir_ is fixed once DBs can call this
+  packed_deleter_->Schedule(MakeFileName(packed_dir_, number, "tdc"), 0);
+}
+
+void DBManager::TraceJoin(int index, const std::vector<uint32_t>& keys, uint64_t file_number,
+                          uint64_t length) {
+  if (!op_trace_.IsOpen()) return;
+  TraceRecord record;
+  record.op = kTraceJoin;
+  record.index = index;
+  record.file_number = file_number;
+  record.length = length;
+  record.keys = keys;
+  op_trace_.Write(record);
+}
+
+void DBManager::TraceVersionOp(TraceOp op, int index, int version) {
+  if (!op_trace_.IsOpen()) return;
+  TraceRecord record;
+  record.op = op;
+  record.index = index;
+  record.version = version;
+  op_trace_.Write(record);
 }
 
 std::vector<CkptMetaData> DBManager::GetCheckpointFiles(int index, int version) {
-  return _dbs[index]->GetCheckpointFiles(version);
+  TraceVersionOp(kTraceGetVersion, index, version);
+  return GetDB(index)->GetCheckpointFiles(version);
+}
+
+std::vector<RestoreRead> DBManager::GetRestorePlan(int index, int version, uint64_t max_gap) {
+  return GetDB(index)->GetRestorePlan(version, max_gap);
+}
+
+bool DBManager::ReadCheckpoint(int index, int version, std::vector<std::string>* chunks) {
+  TraceVersionOp(kTraceGetVersion, index, version);
+  return GetDB(index)->ReadCheckpoint(version, chunks);
+}
+
+void DBManager::SetIOEngine(int type, int queue_depth, bool use_direct_io) {
+  IOEngineOptions options;
+  options.type = static_cast<IOEngineType>(type);
+  options.queue_depth = queue_depth;
+  options.use_direct_io = use_direct_io;
+  ForEachDB([options](DB* db) { db->SetIOEngineOptions(options); });
+}
+
+bool DBManager::DeleteCheckpointsBefore(int index, int version) {
+  TraceVersionOp(kTraceDeleteVersion, index, version);
+  return GetDB(index)->DeleteCheckpointsBefore(version);
 }
 
-void DBManager::DeleteCheckpointsBefore(int index, int version) {
-  _dbs[index]->DeleteCheckpointsBefore(version);
+bool DBManager::SetExtractionPolicy(const std::string& name, double param) {
+  ExtractionPolicy* policy = NewExtractionPolicy(name, param);
+  if (policy == nullptr) return false;
+  delete policy;
+  ForEachDB([name, param](DB* db) { db->SetExtractionPolicy(NewExtractionPolicy(name, param)); });
+  return true;
+}
+
+AmplificationStats DBManager::GetAmplificationStats(int index) {
+  return GetDB(index)->GetAmplificationStats();
+}
+
+Statistics* DBManager::GetStatistics(int index) {
+  if (!ValidIndex(index)) return nullptr;
+  return GetDB(index)->GetStatistics();
+}
+
+void DBManager::GetAggregatedStatistics(Statistics* stats) {
+  for (auto db : AllDBs()) {
+    stats->Merge(*db->GetStatistics());
+  }
+}
+
+bool DBManager::DumpStatistics(const std::string& file_name) {
+  std::vector<const Statistics*> stats;
+  std::vector<std::string> labels;
+  std::vector<DB*> dbs = AllDBs();
+  for (size_t i = 0; i < dbs.size(); i++) {
+    stats.push_back(dbs[i]->GetStatistics());
+    labels.push_back(std::to_string(i));
+  }
+  // scrapers never see a half written file
+  std::string tmp_name = file_name + ".tmp";
+  return WriteStringToFileSync(PrometheusText(stats, labels), tmp_name) &&
+         RenameFile(tmp_name, file_name);
+}
+
+bool DBManager::StartOpTrace(const std::string& file_name) {
+  return op_trace_.Open(file_name);
+}
+
+void DBManager::EndOpTrace() {
+  op_trace_.Close();
+}
+
+void DBManager::Compact(int index, int start, int end) {
+  GetDB(index)->ScheduleCompaction(start, end);
+}
+
+void DBManager::SetMaxColumns(int max_columns) {
+  ForEachDB([max_columns](DB* db) { db->SetMaxColumns(max_columns); });
+}
+
+bool DBManager::SetMergeEvery(int merge_every) {
+  {
+    std::lock_guard<std::mutex> l(packed_mu_);
+    // the regions of packed containers are merged already
+    if (!packed_dir_.empty() && merge_every > 1) return false;
+    merge_every_ = merge_every;
+  }
+  ForEachDB([merge_every](DB* db) { db->SetMergeEvery(merge_every); });
+  return true;
+}
+
+void DBManager::SetRewriteThreshold(double min_live_fraction) {
+  ForEachDB([min_live_fraction](DB* db) { db->SetRewriteThreshold(min_live_fraction); });
+}
+
+void DBManager::SetDeleteRateLimit(uint64_t bytes_per_sec) {
+  ForEachDB([bytes_per_sec](DB* db) { db->SetDeleteRateLimit(bytes_per_sec); });
+}
+
+void DBManager::SetRetention(int keep_last, const std::vector<std::pair<int, int>>& tiers) {
+  std::vector<RetentionTier> retention_tiers;
+  for (const auto& pair : tiers) {
+    RetentionTier tier;
+    tier.max_age = pair.first;
+    tier.every = pair.second;
+    retention_tiers.push_back(tier);
+  }
+  ForEachDB([keep_last, retention_tiers](DB* db) {
+    db->SetRetentionPolicy(new RetentionPolicy(keep_last, retention_tiers));
+  });
+}
+
+void DBManager::ApplyRetention(int index) {
+  GetDB(index)->ScheduleRetention();
+}
+
+int DBManager::AddDataPath(int index, const std::string& path) {
+  uint32_t path_id;
+  if (!GetDB(index)->AddDataPath(path, &path_id)) return -1;
+  return path_id;
+}
+
+void DBManager::SetTiering(uint32_t cold_path_id, int cold_level, int cold_age) {
+  TieringOptions options;
+  options.cold_path_id = cold_path_id;
+  options.cold_level = cold_level;
+  options.cold_age = cold_age;
+  ForEachDB([options](DB* db) { db->SetTiering(options); });
+}
+
+void DBManager::Migrate(int index) {
+  GetDB(index)->ScheduleMigration();
+}
+
+bool DBManager::SetStriping(int index, const std::vector<uint32_t>& path_ids, int mode) {
+  return GetDB(index)->SetStriping(path_ids, static_cast<StripeMode>(mode));
+}
+
+bool DBManager::SetStaging(int index, uint32_t path_id) {
+  return GetDB(index)->SetStagingPath(path_id);
+}
+
+void DBManager::WaitForDestage(int index) {
+  GetDB(index)->WaitForDestage();
+}
+
+void DBManager::SetRateLimit(uint64_t bytes_per_sec, uint64_t ios_per_sec) {
+  rate_limiter_.SetBytesPerSecond(bytes_per_sec);
+  rate_limiter_.SetIOsPerSecond(ios_per_sec);
+}
+
+void DBManager::RequestIO(uint64_t bytes, int priority) {
+  rate_limiter_.Request(bytes, static_cast<IOPriority>(priority));
+}
+
+SpaceStats DBManager::GetSpaceStats(int index) {
+  return GetDB(index)->GetSpaceStats();
+}
+
+std::vector<VersionLayout> DBManager::AnalyzeVersions(int index, bool count_rows) {
+  return GetDB(index)->AnalyzeVersions(count_rows);
+}
+
+void DBManager::CompactFilterFile(int index) {
+  GetDB(index)->CompactFilterFile();
+}
+
+void DBManager::Submit(int index, std::function<void()> work) {
+  std::lock_guard<std::mutex> l(submit_mu_);
+  if (submit_pools_.empty()) {
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 0; i < threads; i++) {
+      submit_pools_.push_back(new ThreadPool(1));
+    }
+  }
+  size_t shard = index < 0 ? 0 : static_cast<size_t>(index) % submit_pools_.size();
+  submit_pools_[shard]->Schedule(std::move(work));
+}
+
+void DBManager::DrainSubmitted() {
+  std::vector<ThreadPool*> pools;
+  {
+    std::lock_guard<std::mutex> l(submit_mu_);
+    pools.swap(submit_pools_);
+  }
+  // a pool runs its queue to the end before it is destroyed
+  for (auto pool : pools) {
+    delete pool;
+  }
+}
+
+void DBManager::WaitForBackgroundWork() {
+  DrainSubmitted();
+  for (auto db : AllDBs()) {
+    db->WaitForBackgroundWork();
+  }
 }
 
 void DBManager::ReleaseDBs() {
-  for (int i = 0; i < _dbs.size(); i++) {
-    delete _dbs[i];
+  DrainSubmitted();
+  std::vector<DB*> dbs;
+  std::vector<OpenState*> states;
+  {
+    std::lock_guard<std::mutex> l(dbs_mu_);
+    dbs.swap(_dbs);
+    states.swap(open_states_);
   }
-  _dbs.clear();
+  for (size_t i = 0; i < dbs.size(); i++) {
+    delete dbs[i];
+    delete states[i];
+  }
+  {
+    std::lock_guard<std::mutex> l(settings_mu_);
+    settings_.clear();
+  }
+  // DBs opened later enable packed checkpoints again
+  std::lock_guard<std::mutex> l(packed_mu_);
+  packed_dir_.clear();
+  merge_every_ = 0;
+  std::lock_guard<std::mutex> r(packed_refs_mu_);
+  packed_refs_.clear();
 }
 
 uint64_t DBManager::GetNextNumber(int index) {
-  return _dbs[index]->GetNextNumber();
+  return GetDB(index)->GetNextNumber();
+}
+
+std::pair<uint64_t, std::string> DBManager::GetNextFilePath(int index) {
+  std::pair<uint64_t, std::string> res;
+  GetDB(index)->GetNextFilePath(&res.first, &res.second);
+  return res;
 }
 
 void DBManager::PrintTree(int i) {
-  _dbs[i]->PrintTree();
+  GetDB(i)->PrintTree();
 }
 
 };
\ No newline at end of file
@@ -4,29 +4,226 @@
 
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <mutex>
+
 #include "db.h"
+#include "op_trace.h"
+#include "packed_container.h"
 
 namespace tdchunk {
 
+// one chunk of a JoinAll
+struct JoinRequest {
+  int index;
+  std::vector<uint32_t> keys;
+  uint64_t file_number;
+  uint64_t length;
+};
+
+// one table's chunk of a JoinPacked container
+struct PackedJoinRequest {
+  int index;
+  std::vector<uint32_t> keys;
+  uint64_t start;
+  uint64_t length;
+};
+
 class DBManager {
  public:
-  bool OpenDBs(const std::vector<std::string>& db_paths, bool do_concat, float extract_thres);
+  DBManager();
+  // DBs hold the shared rate limiter, release them first
+  ~DBManager();
+
+  // Open the DBs in parallel and return true if all of them opened. A
+  // lazy DB only has its directory checked here, its manifest is loaded
+  // on the first call that touches it. Settings made for every DB reach
+  // lazy DBs when they open.
+  bool OpenDBs(const std::vector<std::string>& db_paths, bool do_concat, float extract_thres,
+               bool lazy = false);
+  // Add DBs like a lazy OpenDBs, they get the indexes [*first, *first +
+  // db_paths.size()) at once. open_async opens them with OpenRange later,
+  // a call on one of them meanwhile opens it or waits for its open.
+  bool AddDBs(const std::vector<std::string>& db_paths, bool do_concat, float extract_thres,
+              size_t* first);
+  // Open the DBs [first, last) in parallel unless they are open, returns
+  // true if all of them opened.
+  bool OpenRange(size_t first, size_t last);
 
   void Flush(int index, const std::string& file_name);
 
-  void Join(int index, const std::vector<uint32_t>& keys, uint64_t file_number, uint64_t length);
+  // Join a chunk into DB index and return at once. Like every join it
+  // runs on the executor of the DB, after the joins submitted before it.
+  // Returns false, joining nothing, if there is no DB index.
+  bool Join(int index, const std::vector<uint32_t>& keys, uint64_t file_number, uint64_t length);
+  // Join a chunk into each of several DBs, e.g. all tables of one
+  // checkpoint, and return at once. Each DB waits for its previous join
+  // on its executor (see Submit), so the DBs join in parallel. done runs
+  // once every join, merges and compactions included, finished. Returns
+  // false, joining nothing, if a request names no DB.
+  bool JoinAll(std::vector<JoinRequest> requests, std::function<void()> done);
 
   std::vector<CkptMetaData> GetCheckpointFiles(int index, int version);
 
-  void DeleteCheckpointsBefore(int index, int version);
+  std::vector<RestoreRead> GetRestorePlan(int index, int version, uint64_t max_gap);
+
+  bool ReadCheckpoint(int index, int version, std::vector<std::string>* chunks);
+
+  // type: 0 thread pool, 1 io_uring
+  void SetIOEngine(int type, int queue_depth, bool use_direct_io);
+
+  bool DeleteCheckpointsBefore(int index, int version);
+
+  // Install a policy built by NewExtractionPolicy(name, param) on every
+  // DB. Returns false for an unknown name.
+  bool SetExtractionPolicy(const std::string& name, double param);
+
+  // a copy taken under the lock of the DB
+  AmplificationStats GetAmplificationStats(int index);
+
+  // Counters and latency histograms of one DB, nullptr if there is no
+  // DB index.
+  Statistics* GetStatistics(int index);
+  // Add the statistics of every DB to *stats.
+  void GetAggregatedStatistics(Statistics* stats);
+  // Replace file_name with the statistics of every DB in Prometheus text
+  // format, labelled by DB index, e.g. for a textfile collector.
+  bool DumpStatistics(const std::string& file_name);
+
+  // Record joins, version reads and deletes to file_name for db_replay,
+  // replacing the trace being recorded.
+  bool StartOpTrace(const std::string& file_name);
+  void EndOpTrace();
+
+  // Consolidate columns [start, end] of one DB in the background.
+  void Compact(int index, int start, int end);
+  // Bound the live columns of every DB, see DB::SetMaxColumns.
+  void SetMaxColumns(int max_columns);
+
+  // Merge every merge_every columns of every DB in the background.
+  // Returns false, changing nothing, in packed mode, whose chunks are
+  // regions of containers and never merged.
+  bool SetMergeEvery(int merge_every);
+
+  void SetRewriteThreshold(double min_live_fraction);
+  SpaceStats GetSpaceStats(int index);
+  // Restore layout of every version of one DB, newest first.
+  std::vector<VersionLayout> AnalyzeVersions(int index, bool count_rows);
+
+  void CompactFilterFile(int index);
+
+  void SetDeleteRateLimit(uint64_t bytes_per_sec);
+
+  // Add a storage tier directory to one DB, returns its path id or -1.
+  int AddDataPath(int index, const std::string& path);
+  // Tiering rules of every DB, see TieringOptions.
+  void SetTiering(uint32_t cold_path_id, int cold_level, int cold_age);
+  // Move one batch of files between tiers of one DB in the background.
+  void Migrate(int index);
+
+  // Stripe new chunks of one DB over path_ids, mode is a StripeMode.
+  bool SetStriping(int index, const std::vector<uint32_t>& path_ids, int mode);
+
+  // Stage new chunks of one DB on path_id, see DB::SetStagingPath.
+  bool SetStaging(int index, uint32_t path_id);
+  void WaitForDestage(int index);
+
+  // Limits of the rate limiter shared by all DBs, 0 = unlimited.
+  void SetRateLimit(uint64_t bytes_per_sec, uint64_t ios_per_sec);
+  // Wait for the shared limiter before an I/O the caller issues itself,
+  // e.g. writing a checkpoint chunk at kIOPriorityWrite.
+  void RequestIO(uint64_t bytes, int priority);
+  RateLimiter* GetRateLimiter() { return &rate_limiter_; }
+
+  // Install a RetentionPolicy on every DB, tiers are (max_age, every).
+  void SetRetention(int keep_last, const std::vector<std::pair<int, int>>& tiers);
+  // Apply the retention policy of one DB in the background.
+  void ApplyRetention(int index);
+
+  // Packed checkpoints: the chunks of all tables of one checkpoint go to
+  // one container in dir instead of one file per table. Each DB joins its
+  // chunk as a region of the container, and the container is deleted
+  // once no DB reads any region of it and every manifest dropped it.
+  // Opens every DB, call it after OpenDBs. Returns false if a DB recorded
+  // another dir, or merge_every is set. Containers no DB reads, e.g. left
+  // by a crash, are deleted unless they list a table past the open DBs.
+  bool EnablePackedCheckpoints(const std::string& dir);
+  // number and file name of a new container, the number is unused in
+  // every DB
+  std::pair<uint64_t, std::string> NewPackedFile();
+  // Append the table of contents of requests to container number, sync
+  // it, and join every region like JoinAll, done runs once all joined.
+  // Returns false, joining nothing, if the container cannot be written.
+  bool JoinPacked(uint64_t number, std::vector<PackedJoinRequest> requests,
+                  std::function<void()> done);
+
+  // Run work after the work submitted before it for DB index, work for
+  // different DBs may run in parallel. Backs the *_async bindings.
+  void Submit(int index, std::function<void()> work);
+
+  // Also waits for submitted work.
+  void WaitForBackgroundWork();
 
   void ReleaseDBs();
 
   void PrintTree(int index);
   uint64_t GetNextNumber(int index);
+  // number and file name the next chunk of one DB is written to
+  std::pair<uint64_t, std::string> GetNextFilePath(int index);
 
  private:
+  struct OpenState {
+    std::mutex mu;
+    std::atomic<bool> opened;
+    bool ok;
+    std::string path;
+    bool do_concat;
+    float extract_thres;
+  };
+
+  // Open DB index unless it is open, returns the result of its open.
+  bool OpenDB(size_t index);
+  // DB index, opened first if it was opened lazily
+  DB* GetDB(int index);
+  // true if index names an added DB
+  bool ValidIndex(int index);
+  // the DBs added so far, in index order
+  std::vector<DB*> AllDBs();
+  // Apply fn to every open DB now and to every other one once opened.
+  void ForEachDB(const std::function<void(DB*)>& fn);
+
+  void TraceJoin(int index, const std::vector<uint32_t>& keys, uint64_t file_number, uint64_t length);
+  void TraceVersionOp(TraceOp op, int index, int version);
+  // Finish all submitted work.
+  void DrainSubmitted();
+  // a DB read the last of its regions of container number
+  void ReleasePackedFile(uint64_t number);
+
+  // guards the _dbs and open_states_ vectors, not the DBs in them
+  std::mutex dbs_mu_;
   std::vector<DB*> _dbs;
+  std::vector<OpenState*> open_states_;
+  // guards settings_ and the opened flags
+  std::mutex settings_mu_;
+  std::vector<std::function<void(DB*)>> settings_;
+  // one thread each, DB index i uses submit_pools_[i % size]
+  std::mutex submit_mu_;
+  std::vector<ThreadPool*> submit_pools_;
+  RateLimiter rate_limiter_;
+  TraceWriter op_trace_;
+
+  // guards packed_dir_, next_packed_number_ and merge_every_, held while
+  // calling DBs
+  std::mutex packed_mu_;
+  int merge_every_;
+  std::string packed_dir_;
+  uint64_t next_packed_number_;
+  // container number -> DBs reading regions of it, taken under the
+  // mutex of a DB so no DB is called while it is held
+  std::mutex packed_refs_mu_;
+  std::unordered_map<uint64_t, int> packed_refs_;
+  FileDeleter* packed_deleter_;
 
 };
 
@@ -0,0 +1,356 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "db_manager.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "msgpack_helper.h"
+#include "util/testharness.h"
+
+namespace tdchunk {
+
+typedef std::map<uint32_t, std::vector<double>> Rows;
+
+// Write a chunk of DB index with one row per key in [first, last],
+// holding value, and return the join of it.
+static JoinRequest WriteChunk(DBManager* manager, int index, uint32_t first, uint32_t last,
+                              double value) {
+  JoinRequest request;
+  request.index = index;
+  std::pair<uint64_t, std::string> file = manager->GetNextFilePath(index);
+  Rows rows;
+  for (uint32_t key = first; key <= last; key++) {
+    rows[key] = std::vector<double>(1, value);
+    request.keys.push_back(key);
+  }
+  request.file_number = file.first;
+  request.length = PackToFile(file.second, rows);
+  return request;
+}
+
+static void JoinRows(DBManager* manager, int index, uint32_t first, uint32_t last, double value) {
+  JoinRequest r = WriteChunk(manager, index, first, last, value);
+  manager->Join(index, r.keys, r.file_number, r.length);
+  manager->WaitForBackgroundWork();
+}
+
+static Rows Restore(DBManager* manager, int index, int version) {
+  std::vector<std::string> chunks;
+  Rows rows;
+  if (!manager->ReadCheckpoint(index, version, &chunks)) return rows;
+  for (const auto& chunk : chunks) {
+    Rows cur;
+    msgpack::unpack(chunk.data(), chunk.size()).get().convert(cur);
+    rows.insert(cur.begin(), cur.end());
+  }
+  return rows;
+}
+
+// Write a packed container with a chunk of each of tables, one row per
+// key in [first, last] holding t * 10 + value, and join it. Returns its
+// number, 0 if the join failed.
+static uint64_t JoinPackedRows(DBManager* manager, const std::vector<int>& tables, uint32_t first,
+                               uint32_t last, int value) {
+  std::pair<uint64_t, std::string> file = manager->NewPackedFile();
+  std::string contents;
+  std::vector<PackedJoinRequest> requests;
+  for (auto t : tables) {
+    PackedJoinRequest request;
+    request.index = t;
+    Rows rows;
+    for (uint32_t key = first; key <= last; key++) {
+      rows[key] = std::vector<double>(1, t * 10 + value);
+      request.keys.push_back(key);
+    }
+    std::stringstream buffer;
+    msgpack::pack(buffer, rows);
+    request.start = contents.size();
+    request.length = buffer.str().size();
+    contents += buffer.str();
+    requests.push_back(request);
+  }
+  if (file.first == 0 || !WriteStringToFileSync(contents, file.second) ||
+      !manager->JoinPacked(file.first, requests, nullptr)) {
+    return 0;
+  }
+  manager->WaitForBackgroundWork();
+  return file.first;
+}
+
+static bool WaitForDeleted(const std::string& fname) {
+  for (int i = 0; i < 500 && FileExists(fname); i++) {
+    ::usleep(10000);
+  }
+  return !FileExists(fname);
+}
+
+// tables of three versions each, value t * 10 + version
+static std::vector<std::string> CreateTables(const std::string& name, int tables) {
+  std::string dir = lsedb::test::TmpDir(name);
+  std::vector<std::string> paths;
+  for (int t = 0; t < tables; t++) {
+    paths.push_back(dir + "/table." + std::to_string(t));
+  }
+  DBManager manager;
+  if (!manager.OpenDBs(paths, false, 2.0f)) return std::vector<std::string>();
+  for (int t = 0; t < tables; t++) {
+    for (int v = 0; v < 3; v++) {
+      JoinRows(&manager, t, v * 100, v * 100 + 99, t * 10 + v);
+    }
+  }
+  return paths;
+}
+
+TEST(DBManager, ParallelOpen) {
+  std::vector<std::string> paths = CreateTables("db_manager_parallel_open", 8);
+  ASSERT_EQ(paths.size(), 8u);
+  DBManager manager;
+  ASSERT_TRUE(manager.OpenDBs(paths, false, 2.0f));
+  for (int t = 0; t < 8; t++) {
+    Rows rows = Restore(&manager, t, 2);
+    ASSERT_EQ(rows.size(), 300u) << t;
+    ASSERT_EQ(rows[150][0], t * 10 + 1) << t;
+  }
+
+  // a path that cannot be a directory fails the open
+  std::string file = paths[0] + "/manifest";
+  DBManager bad;
+  ASSERT_FALSE(bad.OpenDBs({paths[1], file + "/table"}, false, 2.0f));
+}
+
+TEST(DBManager, LazyOpen) {
+  std::vector<std::string> paths = CreateTables("db_manager_lazy_open", 2);
+  ASSERT_EQ(paths.size(), 2u);
+  std::string fresh = paths[0] + ".fresh";
+  DBManager manager;
+  ASSERT_TRUE(manager.OpenDBs({paths[0], paths[1], fresh}, false, 2.0f, true));
+  ASSERT_TRUE(FileExists(fresh));
+  ASSERT_FALSE(FileExists(fresh + "/manifest"));
+
+  // settings made before the first use reach the DB when it opens
+  manager.SetRetention(1, {});
+  ASSERT_EQ(Restore(&manager, 1, 1).size(), 200u);
+  JoinRows(&manager, 1, 300, 399, 13);
+  ASSERT_TRUE(manager.GetCheckpointFiles(1, 1).empty());
+  ASSERT_EQ(Restore(&manager, 1, 3).size(), 400u);
+
+  // the first uses from several threads open the DB once
+  std::atomic<int> restored(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&manager, &restored] {
+      if (Restore(&manager, 0, 2).size() == 300u) restored++;
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(restored.load(), 4);
+
+  JoinRows(&manager, 2, 0, 9, 0);
+  ASSERT_EQ(Restore(&manager, 2, 0).size(), 10u);
+}
+
+
+TEST(DBManager, UseWhileAsyncOpen) {
+  std::vector<std::string> paths = CreateTables("db_manager_async_open", 4);
+  ASSERT_EQ(paths.size(), 4u);
+  DBManager manager;
+  size_t first;
+  ASSERT_TRUE(manager.AddDBs(paths, false, 2.0f, &first));
+  ASSERT_EQ(first, 0u);
+  std::atomic<bool> opened(false);
+  manager.Submit(-1, [&manager, &opened] { opened = manager.OpenRange(0, 4); });
+
+  // joins and reads issued before the open finished see the opened DBs
+  std::atomic<int> joined(0);
+  std::vector<JoinRequest> requests;
+  for (int t = 0; t < 4; t++) {
+    requests.push_back(WriteChunk(&manager, t, 300, 399, t * 10 + 3));
+  }
+  manager.JoinAll(requests, [&joined] { joined++; });
+  ASSERT_EQ(Restore(&manager, 2, 1).size(), 200u);
+  manager.WaitForBackgroundWork();
+  ASSERT_TRUE(opened.load());
+  ASSERT_EQ(joined.load(), 1);
+  for (int t = 0; t < 4; t++) {
+    Rows rows = Restore(&manager, t, 3);
+    ASSERT_EQ(rows.size(), 400u) << t;
+    ASSERT_EQ(rows[350][0], t * 10 + 3) << t;
+  }
+}
+
+TEST(DBManager, ConfigureWhileJoining) {
+  std::vector<std::string> paths = CreateTables("db_manager_configure", 2);
+  ASSERT_EQ(paths.size(), 2u);
+  DBManager manager;
+  ASSERT_TRUE(manager.OpenDBs(paths, false, 2.0f));
+
+  // policies and engines are replaced, and DBs added, under joins and
+  // restores of other threads
+  std::atomic<bool> stop(false);
+  std::thread configure([&manager, &stop, &paths] {
+    for (int i = 0; !stop; i++) {
+      manager.SetIOEngine(0, 1 + i % 4, false);
+      manager.SetExtractionPolicy(i % 2 == 0 ? "threshold" : "cost", 2.0);
+      manager.SetRetention(1000, {});
+      manager.OpenDBs({paths[0] + ".extra" + std::to_string(i)}, false, 2.0f, true);
+    }
+  });
+  for (int v = 3; v < 23; v++) {
+    for (int t = 0; t < 2; t++) {
+      JoinRows(&manager, t, v * 100, v * 100 + 99, t * 10 + v);
+      ASSERT_EQ(Restore(&manager, t, v).size(), (v + 1) * 100u) << t << " " << v;
+    }
+  }
+  stop = true;
+  configure.join();
+  manager.WaitForBackgroundWork();
+  ASSERT_EQ(Restore(&manager, 1, 22)[2250][0], 32);
+}
+
+
+TEST(DBManager, JoinAfterQueuedJoinAll) {
+  std::vector<std::string> paths = CreateTables("db_manager_join_order", 1);
+  ASSERT_EQ(paths.size(), 1u);
+  DBManager manager;
+  ASSERT_TRUE(manager.OpenDBs(paths, false, 2.0f));
+
+  // hold the executor of DB 0 so the join_all stays queued
+  std::mutex mu;
+  mu.lock();
+  manager.Submit(0, [&mu] { std::lock_guard<std::mutex> l(mu); });
+  manager.JoinAll({WriteChunk(&manager, 0, 300, 399, 3)}, nullptr);
+  JoinRequest r = WriteChunk(&manager, 0, 300, 399, 4);
+  manager.Join(0, r.keys, r.file_number, r.length);
+  mu.unlock();
+  manager.WaitForBackgroundWork();
+
+  // the direct join did not overtake the queued one
+  ASSERT_EQ(Restore(&manager, 0, 3)[350][0], 3);
+  ASSERT_EQ(Restore(&manager, 0, 4)[350][0], 4);
+}
+
+TEST(DBManager, JoinRejectsUnknownIndex) {
+  std::vector<std::string> paths = CreateTables("db_manager_bad_index", 2);
+  ASSERT_EQ(paths.size(), 2u);
+  DBManager manager;
+  ASSERT_TRUE(manager.OpenDBs(paths, false, 2.0f, true));
+
+  JoinRequest r = WriteChunk(&manager, 0, 0, 99, 0);
+  bool joined = false;
+  JoinRequest bad = r;
+  bad.index = 2;
+  ASSERT_FALSE(manager.JoinAll({r, bad}, [&joined] { joined = true; }));
+  bad.index = -1;
+  ASSERT_FALSE(manager.JoinAll({bad}, nullptr));
+  ASSERT_FALSE(manager.Join(2, r.keys, r.file_number, r.length));
+  ASSERT_TRUE(manager.GetStatistics(2) == nullptr);
+  ASSERT_TRUE(manager.GetStatistics(-1) == nullptr);
+  manager.WaitForBackgroundWork();
+  // nothing of the rejected join_all was joined
+  ASSERT_FALSE(joined);
+  ASSERT_TRUE(manager.GetAmplificationStats(0).Versions().empty());
+
+  // a lazy DB opens for its statistics
+  ASSERT_TRUE(manager.GetStatistics(1) != nullptr);
+  ASSERT_TRUE(manager.JoinAll({r}, [&joined] { joined = true; }));
+  manager.WaitForBackgroundWork();
+  ASSERT_TRUE(joined);
+  ASSERT_EQ(manager.GetAmplificationStats(0).Versions().size(), 1u);
+  ASSERT_EQ(Restore(&manager, 0, 0)[50][0], 0);
+}
+
+
+TEST(DBManager, PackedContainerReleasedByAllTables) {
+  std::string dir = lsedb::test::TmpDir("db_manager_packed_release");
+  std::vector<std::string> paths = {dir + "/table.0", dir + "/table.1"};
+  std::string packed = dir + "/packed";
+  uint64_t first, second;
+  {
+    DBManager manager;
+    ASSERT_TRUE(manager.OpenDBs(paths, false, 2.0f));
+    ASSERT_TRUE(manager.EnablePackedCheckpoints(packed));
+    first = JoinPackedRows(&manager, {0, 1}, 0, 99, 0);
+    second = JoinPackedRows(&manager, {0, 1}, 0, 99, 1);
+    ASSERT_GT(first, 0u);
+    ASSERT_GT(second, first);
+    ASSERT_EQ(Restore(&manager, 1, 1)[50][0], 11);
+  }
+
+  // the manifests record the dir, another one is refused
+  DBManager manager;
+  ASSERT_TRUE(manager.OpenDBs(paths, false, 2.0f));
+  ASSERT_FALSE(manager.EnablePackedCheckpoints(dir + "/moved"));
+  ASSERT_TRUE(FileExists(MakeFileName(packed, first, "tdc")));
+  ASSERT_TRUE(manager.EnablePackedCheckpoints(packed));
+  ASSERT_EQ(Restore(&manager, 0, 0)[50][0], 0);
+
+  // a container goes once both tables dropped their regions
+  ASSERT_TRUE(manager.DeleteCheckpointsBefore(0, 1));
+  manager.WaitForBackgroundWork();
+  ASSERT_TRUE(FileExists(MakeFileName(packed, first, "tdc")));
+  ASSERT_TRUE(manager.DeleteCheckpointsBefore(1, 1));
+  ASSERT_TRUE(WaitForDeleted(MakeFileName(packed, first, "tdc")));
+  ASSERT_TRUE(WaitForDeleted(MakeFileName(packed, second, "tdc")));
+}
+
+TEST(DBManager, PackedOrphanScanKeepsOtherTables) {
+  std::string dir = lsedb::test::TmpDir("db_manager_packed_orphans");
+  std::vector<std::string> paths = {dir + "/table.0", dir + "/table.1"};
+  std::string packed = dir + "/packed";
+  uint64_t shared, own, unjoined;
+  {
+    DBManager manager;
+    ASSERT_TRUE(manager.OpenDBs(paths, false, 2.0f));
+    ASSERT_TRUE(manager.EnablePackedCheckpoints(packed));
+    shared = JoinPackedRows(&manager, {0, 1}, 0, 99, 0);
+    // read by table 1 alone
+    own = JoinPackedRows(&manager, {1}, 100, 199, 1);
+    ASSERT_GT(own, 0u);
+    std::pair<uint64_t, std::string> file = manager.NewPackedFile();
+    unjoined = file.first;
+    ASSERT_TRUE(WriteStringToFileSync("never joined", file.second));
+  }
+
+  // a manager of table 0 alone keeps the container of table 1
+  {
+    DBManager manager;
+    ASSERT_TRUE(manager.OpenDBs({paths[0]}, false, 2.0f));
+    ASSERT_TRUE(manager.EnablePackedCheckpoints(packed));
+    ASSERT_TRUE(WaitForDeleted(MakeFileName(packed, unjoined, "tdc")));
+    manager.WaitForBackgroundWork();
+    ASSERT_TRUE(FileExists(MakeFileName(packed, shared, "tdc")));
+    ASSERT_TRUE(FileExists(MakeFileName(packed, own, "tdc")));
+  }
+
+  DBManager manager;
+  ASSERT_TRUE(manager.OpenDBs(paths, false, 2.0f));
+  ASSERT_TRUE(manager.EnablePackedCheckpoints(packed));
+  Rows rows = Restore(&manager, 1, 1);
+  ASSERT_EQ(rows.size(), 200u);
+  ASSERT_EQ(rows[150][0], 11);
+}
+
+TEST(DBManager, PackedRejectsMergeEvery) {
+  std::string dir = lsedb::test::TmpDir("db_manager_packed_merge");
+  DBManager manager;
+  ASSERT_TRUE(manager.OpenDBs({dir + "/table.0"}, false, 2.0f));
+  ASSERT_TRUE(manager.SetMergeEvery(2));
+  ASSERT_FALSE(manager.EnablePackedCheckpoints(dir + "/packed"));
+  ASSERT_TRUE(manager.SetMergeEvery(0));
+  ASSERT_TRUE(manager.EnablePackedCheckpoints(dir + "/packed"));
+  ASSERT_FALSE(manager.SetMergeEvery(2));
+  ASSERT_TRUE(manager.SetMergeEvery(0));
+}
+
+}
+
+int main() { return lsedb::test::RunAllTests(); }
@@ -0,0 +1,144 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Replays an operation trace recorded by DBManager::StartOpTrace against
+// the metadata-only Simulator, once per policy setting, and prints the
+// projected restore cost, write amplification and disk usage of each.
+//
+//   db_replay --trace=/tmp/ops.trace --policy=threshold
+//             --policy_params=0.1,0.3,0.5 --max_columns=16
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "op_trace.h"
+#include "simulator.h"
+
+using namespace tdchunk;
+
+namespace {
+
+// flags
+std::string FLAGS_trace = "";
+std::string FLAGS_policy = "threshold";
+std::string FLAGS_policy_params = "0.3"; // one replay per value
+int FLAGS_max_columns = 0;
+int FLAGS_merge_every = 0;
+int FLAGS_keep_last = 0;
+std::string FLAGS_tiers = "";    // max_age:every,...
+bool FLAGS_replay_deletes = true;
+
+bool ParseFlag(const char* arg, const char* name, std::string* value) {
+  size_t len = std::strlen(name);
+  if (std::strncmp(arg, "--", 2) != 0 || std::strncmp(arg + 2, name, len) != 0 ||
+      arg[2 + len] != '=') {
+    return false;
+  }
+  *value = arg + 3 + len;
+  return true;
+}
+
+std::vector<std::string> Split(const std::string& s, char sep) {
+  std::vector<std::string> parts;
+  std::stringstream in(s);
+  std::string part;
+  while (std::getline(in, part, sep)) {
+    if (!part.empty()) parts.push_back(part);
+  }
+  return parts;
+}
+
+double MiB(uint64_t bytes) {
+  return bytes / 1048576.0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    std::string v;
+    if (ParseFlag(argv[i], "trace", &v)) {
+      FLAGS_trace = v;
+    } else if (ParseFlag(argv[i], "policy", &v)) {
+      FLAGS_policy = v;
+    } else if (ParseFlag(argv[i], "policy_params", &v)) {
+      FLAGS_policy_params = v;
+    } else if (ParseFlag(argv[i], "max_columns", &v)) {
+      FLAGS_max_columns = std::atoi(v.c_str());
+    } else if (ParseFlag(argv[i], "merge_every", &v)) {
+      FLAGS_merge_every = std::atoi(v.c_str());
+    } else if (ParseFlag(argv[i], "keep_last", &v)) {
+      FLAGS_keep_last = std::atoi(v.c_str());
+    } else if (ParseFlag(argv[i], "tiers", &v)) {
+      FLAGS_tiers = v;
+    } else if (ParseFlag(argv[i], "replay_deletes", &v)) {
+      FLAGS_replay_deletes = v != "0" && v != "false";
+    } else {
+      std::fprintf(stderr, "invalid flag '%s'\n", argv[i]);
+      return 1;
+    }
+  }
+
+  // the trace is read once and replayed from memory
+  TraceReader reader;
+  if (FLAGS_trace.empty() || !reader.Open(FLAGS_trace)) {
+    std::fprintf(stderr, "cannot read trace '%s'\n", FLAGS_trace.c_str());
+    return 1;
+  }
+  std::vector<TraceRecord> records;
+  TraceRecord record;
+  while (reader.Next(&record)) {
+    records.push_back(record);
+  }
+
+  SimOptions options;
+  options.policy = FLAGS_policy;
+  options.max_columns = FLAGS_max_columns;
+  options.merge_every = FLAGS_merge_every;
+  options.keep_last = FLAGS_keep_last;
+  options.replay_deletes = FLAGS_replay_deletes;
+  for (const auto& tier : Split(FLAGS_tiers, ',')) {
+    std::vector<std::string> parts = Split(tier, ':');
+    if (parts.size() != 2) {
+      std::fprintf(stderr, "invalid tier '%s'\n", tier.c_str());
+      return 1;
+    }
+    RetentionTier t;
+    t.max_age = std::atoi(parts[0].c_str());
+    t.every = std::atoi(parts[1].c_str());
+    options.tiers.push_back(t);
+  }
+
+  std::printf("%zu records\n", records.size());
+  std::printf("%-18s %9s %12s %12s %12s %10s %12s %12s %8s\n", "policy", "write_amp",
+              "restore_MiB", "max_MiB", "newest_MiB", "newest_rd", "live_MiB", "peak_MiB",
+              "secs");
+  for (const auto& param : Split(FLAGS_policy_params, ',')) {
+    options.policy_param = std::atof(param.c_str());
+    Simulator sim(options);
+    if (!sim.Valid()) {
+      std::fprintf(stderr, "unknown policy '%s'\n", FLAGS_policy.c_str());
+      return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& r : records) {
+      sim.Apply(r);
+    }
+    SimResult res = sim.Result();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::string name = FLAGS_policy + "(" + param + ")";
+    double mean_restore = res.restores > 0 ? MiB(res.restore_bytes) / res.restores : 0;
+    std::printf("%-18s %9.3f %12.1f %12.1f %12.1f %10llu %12.1f %12.1f %8.2f\n", name.c_str(),
+                res.write_amp, mean_restore, MiB(res.max_restore_bytes), MiB(res.newest_bytes),
+                static_cast<unsigned long long>(res.newest_reads), MiB(res.live_bytes),
+                MiB(res.peak_live_bytes), secs);
+  }
+  return 0;
+}
@@ -0,0 +1,919 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "db.h"
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "extraction_policy.h"
+#include "msgpack_helper.h"
+#include "rate_limiter.h"
+#include "retention_policy.h"
+#include "trace.h"
+#include "util/testharness.h"
+
+namespace tdchunk {
+
+typedef std::map<uint32_t, std::vector<double>> Rows;
+
+// Pack one row per key, holding value, into a new chunk of db and join it.
+static uint64_t JoinRows(DB* db, const std::vector<uint32_t>& keys, double value) {
+  uint64_t number;
+  std::string fname;
+  db->GetNextFilePath(&number, &fname);
+  Rows rows;
+  for (auto key : keys) {
+    rows[key] = std::vector<double>(1, value);
+  }
+  db->Join(keys, number, PackToFile(fname, rows));
+  return number;
+}
+
+static std::vector<uint32_t> Keys(uint32_t first, uint32_t last) {
+  std::vector<uint32_t> keys;
+  for (uint32_t key = first; key <= last; key++) {
+    keys.push_back(key);
+  }
+  return keys;
+}
+
+// Rows a restore of version reads, the newest chunk of a key winning.
+static Rows Restore(DB* db, int version) {
+  std::vector<std::string> chunks;
+  Rows rows;
+  if (!db->ReadCheckpoint(version, &chunks)) return rows;
+  for (const auto& chunk : chunks) {
+    Rows cur;
+    msgpack::unpack(chunk.data(), chunk.size()).get().convert(cur);
+    rows.insert(cur.begin(), cur.end());
+  }
+  return rows;
+}
+
+TEST(DB, ReadCheckpoint) {
+  std::string dbname = lsedb::test::TmpDir("db_read_checkpoint");
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  JoinRows(&db, Keys(0, 99), 1);
+  JoinRows(&db, Keys(50, 59), 2);
+  ASSERT_EQ(db.GetVersions().size(), 2u);
+  ASSERT_EQ(db.GetVersions()[0], 1);
+
+  // chunks come back in GetCheckpointFiles order, newest first
+  std::vector<std::string> chunks;
+  ASSERT_TRUE(db.ReadCheckpoint(1, &chunks));
+  std::vector<CkptMetaData> files = db.GetCheckpointFiles(1);
+  ASSERT_EQ(chunks.size(), files.size());
+  ASSERT_EQ(chunks.size(), 2u);
+  for (size_t i = 0; i < files.size(); i++) {
+    ASSERT_EQ(chunks[i].size(), files[i].length);
+  }
+  // the plan reads files in name order
+  std::vector<RestoreRead> plan = db.GetRestorePlan(1, kRestoreMaxGap);
+  ASSERT_EQ(plan.size(), 2u);
+  ASSERT_LT(plan[0].file_name, plan[1].file_name);
+
+  Rows rows = Restore(&db, 1);
+  ASSERT_EQ(rows.size(), 100u);
+  ASSERT_EQ(rows[55][0], 2);
+  ASSERT_EQ(rows[1][0], 1);
+  rows = Restore(&db, 0);
+  ASSERT_EQ(rows.size(), 100u);
+  ASSERT_EQ(rows[55][0], 1);
+}
+
+
+static uint64_t CheckpointBytes(DB* db, int version) {
+  uint64_t bytes = 0;
+  for (const auto& file : db->GetCheckpointFiles(version)) {
+    bytes += file.length;
+  }
+  return bytes;
+}
+
+TEST(DB, VersionBytes) {
+  std::string dbname = lsedb::test::TmpDir("db_version_bytes");
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 0.5f));
+  // disjoint joins keep the running sum, overlapping ones extract and
+  // change the chunks older versions read
+  const uint32_t firsts[] = {0, 1000, 2000, 0, 500, 1000};
+  for (int i = 0; i < 6; i++) {
+    JoinRows(&db, Keys(firsts[i], firsts[i] + 199), i);
+    ASSERT_EQ(db.GetAmplificationStats().Versions()[i].bytes_read, CheckpointBytes(&db, i))
+        << "version " << i;
+  }
+  ASSERT_GT(db.GetAmplificationStats().ExtractionBytes(), 0u);
+}
+
+
+TEST(DB, DeleteCheckpointsInCompactedRange) {
+  std::string dbname = lsedb::test::TmpDir("db_delete_compacted");
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 0.5f));
+  // every join extracts the rows of the older columns it supersedes
+  for (int i = 0; i < 6; i++) {
+    JoinRows(&db, Keys(0, 199), i);
+  }
+  ASSERT_TRUE(db.CompactColumns(2, 4));
+  ASSERT_EQ(db.GetVersions().size(), 4u);
+
+  // version 3 was compacted away, versions 1 and 0 go instead
+  uint64_t live = db.GetSpaceStats().live_bytes;
+  ASSERT_TRUE(db.DeleteCheckpointsBefore(3));
+  ASSERT_LT(db.GetSpaceStats().live_bytes, live);
+  Rows rows = Restore(&db, 5);
+  ASSERT_EQ(rows.size(), 200u);
+  ASSERT_EQ(rows[150][0], 5);
+  rows = Restore(&db, 4);
+  ASSERT_EQ(rows.size(), 200u);
+  ASSERT_EQ(rows[150][0], 4);
+
+  // nothing is that old
+  ASSERT_FALSE(db.DeleteCheckpointsBefore(-1));
+}
+
+
+// The deleter runs on its own thread, give it up to 5s.
+static bool WaitForDeleted(const std::string& fname) {
+  for (int i = 0; i < 500 && FileExists(fname); i++) {
+    ::usleep(10000);
+  }
+  return !FileExists(fname);
+}
+
+TEST(DB, OrphanScanKeepsUnjoinedChunks) {
+  std::string dbname = lsedb::test::TmpDir("db_orphan_unjoined");
+  uint64_t number;
+  std::string fname;
+  uint64_t length;
+  {
+    DB db;
+    ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+    JoinRows(&db, Keys(0, 9), 1);
+    // written by its writer, the process stops before the join
+    db.GetNextFilePath(&number, &fname);
+    Rows rows;
+    rows[20] = std::vector<double>(1, 2);
+    length = PackToFile(fname, rows);
+  }
+  // a chunk no manifest ever knew about
+  ASSERT_TRUE(WriteStringToFileSync("x", MakeFileName(dbname, 500, "tdc")));
+
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  ASSERT_TRUE(FileExists(fname));
+  ASSERT_TRUE(FileExists(MakeFileName(dbname, 500, "tdc")));
+  // numbers on disk are not handed out again
+  ASSERT_GT(db.GetNextNumber(), 500u);
+
+  db.Join(std::vector<uint32_t>(1, 20), number, length);
+  Rows rows = Restore(&db, 1);
+  ASSERT_EQ(rows.size(), 11u);
+  ASSERT_EQ(rows[20][0], 2);
+}
+
+TEST(DB, OrphanScanDeletesPendingOutputs) {
+  std::string dbname = lsedb::test::TmpDir("db_orphan_pending");
+  {
+    DB db;
+    ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+    JoinRows(&db, Keys(0, 9), 1);
+  }
+  // a compaction output logged and written, then a crash before the
+  // manifest rewrite that would have installed it
+  {
+    std::ofstream manifest(dbname + "/manifest", std::ios::out | std::ios::app);
+    manifest << kPendingFile << " 400 0\n";
+  }
+  ASSERT_TRUE(WriteStringToFileSync("x", MakeFileName(dbname, 400, "tdc")));
+
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  ASSERT_TRUE(WaitForDeleted(MakeFileName(dbname, 400, "tdc")));
+  ASSERT_GT(db.GetNextNumber(), 400u);
+  ASSERT_EQ(Restore(&db, 0).size(), 10u);
+}
+
+
+TEST(DB, HolePunchedAfterManifestRewrite) {
+  std::string dbname = lsedb::test::TmpDir("db_hole_punch");
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 0.5f));
+  db.SetMergeEvery(2);
+  // columns 0 and 1 are merged into one container after the third join
+  JoinRows(&db, Keys(0, 4999), 0);
+  JoinRows(&db, Keys(10000, 14999), 1);
+  JoinRows(&db, Keys(20000, 24999), 2);
+  db.WaitForBackgroundWork();
+  ASSERT_EQ(db.GetSpaceStats().containers, 1u);
+
+  // the next rewrite fails, its extraction releases column 1's region
+  ASSERT_EQ(::mkdir((dbname + "/manifest.tmp").c_str(), 0755), 0);
+  JoinRows(&db, Keys(10000, 14999), 3);
+  db.WaitForBackgroundWork();
+  ASSERT_EQ(db.GetSpaceStats().reclaimed_bytes, 0u);
+
+  ASSERT_EQ(::rmdir((dbname + "/manifest.tmp").c_str()), 0);
+  uint32_t path_id;
+  ASSERT_TRUE(db.AddDataPath(dbname + "/cold", &path_id));
+  ASSERT_GT(db.GetSpaceStats().reclaimed_bytes, 0u);
+  Rows rows = Restore(&db, 3);
+  ASSERT_EQ(rows.size(), 15000u);
+  ASSERT_EQ(rows[12000][0], 3);
+  ASSERT_EQ(rows[2000][0], 0);
+}
+
+TEST(DB, AmplificationStatsWhileJoining) {
+  std::string dbname = lsedb::test::TmpDir("db_amp_stats");
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  // copies are read while joins record into the stats
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> unread(0);
+  std::thread reader([&db, &stop, &unread] {
+    while (!stop) {
+      AmplificationStats stats = db.GetAmplificationStats();
+      for (const auto& pair : stats.Versions()) {
+        if (pair.second.bytes_read == 0) unread++;
+      }
+    }
+  });
+  for (int v = 0; v < 20; v++) {
+    JoinRows(&db, Keys(v * 10, v * 10 + 99), v);
+  }
+  stop = true;
+  reader.join();
+  ASSERT_EQ(unread.load(), 0u);
+  AmplificationStats stats = db.GetAmplificationStats();
+  ASSERT_EQ(stats.Versions().size(), 20u);
+  ASSERT_EQ(stats.UniqueRows(), 290u);
+}
+
+// Number of the one .filter file in dbname, 0 if there is none or more.
+static uint64_t FilterNumber(const std::string& dbname) {
+  std::vector<std::string> children;
+  GetChildren(dbname, &children);
+  uint64_t found = 0;
+  int count = 0;
+  for (const auto& child : children) {
+    unsigned long long number;
+    char suffix[8];
+    if (std::sscanf(child.c_str(), "%llu.%7s", &number, suffix) == 2 &&
+        std::string(suffix) == "filter") {
+      found = number;
+      count++;
+    }
+  }
+  return count == 1 ? found : 0;
+}
+
+TEST(DB, FilterNumberNotReusedAfterReopen) {
+  std::string dbname = lsedb::test::TmpDir("db_filter_number");
+  uint64_t filter_number;
+  {
+    DB db;
+    ASSERT_TRUE(db.Open(dbname, false, 0.5f));
+    JoinRows(&db, Keys(0, 199), 0);
+    ASSERT_TRUE(db.CompactFilterFile());
+    filter_number = FilterNumber(dbname);
+    ASSERT_GT(filter_number, 0u);
+  }
+
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 0.5f));
+  ASSERT_GT(db.GetNextNumber(), filter_number);
+  ASSERT_TRUE(db.CompactFilterFile());
+  ASSERT_TRUE(WaitForDeleted(MakeFileName(dbname, filter_number, "filter")));
+  ASSERT_GT(FilterNumber(dbname), filter_number);
+
+  // the filters of the compacted file still find the overlap
+  JoinRows(&db, Keys(0, 199), 1);
+  ASSERT_GT(db.GetAmplificationStats().ExtractionBytes(), 0u);
+  ASSERT_EQ(Restore(&db, 1)[100][0], 1);
+}
+
+TEST(DB, LostFiltersDroppedByCompaction) {
+  std::string dbname = lsedb::test::TmpDir("db_lost_filters");
+  std::string filter_name;
+  uint64_t filter_size = 0;
+  {
+    DB db;
+    ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+    JoinRows(&db, Keys(0, 99), 0);
+    ASSERT_TRUE(db.CompactFilterFile());
+    filter_name = MakeFileName(dbname, FilterNumber(dbname), "filter");
+    ASSERT_TRUE(GetFileSize(filter_name, &filter_size));
+    JoinRows(&db, Keys(0, 99), 1);
+  }
+  // a crash lost the filter of the second chunk
+  ASSERT_EQ(::truncate(filter_name.c_str(), filter_size), 0);
+
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  ASSERT_TRUE(db.CompactFilterFile());
+  ASSERT_TRUE(WaitForDeleted(filter_name));
+  // only the chunk with a filter is probed, not offsets into the old file
+  uint64_t probes = db.GetStatistics()->GetTickerCount(kFilterProbes);
+  JoinRows(&db, Keys(0, 99), 2);
+  ASSERT_EQ(db.GetStatistics()->GetTickerCount(kFilterProbes) - probes, 100u);
+  ASSERT_EQ(Restore(&db, 2)[50][0], 2);
+}
+
+TEST(DB, ObsoleteFilesDeletedAfterReopen) {
+  std::string dbname = lsedb::test::TmpDir("db_obsolete_reopen");
+  std::vector<uint64_t> numbers;
+  {
+    DB db;
+    ASSERT_TRUE(db.Open(dbname, false, 0.5f));
+    // the deleter unlinks one file, then waits until the close
+    db.SetDeleteRateLimit(1);
+    // each join extracts all rows of the chunk before it
+    for (int i = 0; i < 4; i++) {
+      numbers.push_back(JoinRows(&db, Keys(0, 199), i));
+    }
+    numbers.pop_back();
+  }
+  int left = 0;
+  for (auto number : numbers) {
+    left += FileExists(MakeFileName(dbname, number, "tdc"));
+  }
+  ASSERT_GT(left, 0);
+
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 0.5f));
+  for (auto number : numbers) {
+    ASSERT_TRUE(WaitForDeleted(MakeFileName(dbname, number, "tdc"))) << number;
+  }
+  ASSERT_EQ(Restore(&db, 3)[100][0], 3);
+  ASSERT_EQ(Restore(&db, 0)[100][0], 0);
+}
+
+
+TEST(DB, RetentionDropsMiddleVersions) {
+  std::string dbname = lsedb::test::TmpDir("db_retention");
+  {
+    DB db;
+    ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+    // the newest, then every other version
+    db.SetRetentionPolicy(new RetentionPolicy(1, {{0, 2}}));
+    for (int i = 0; i < 6; i++) {
+      JoinRows(&db, Keys(i * 10, i * 10 + 9), i);
+    }
+    db.WaitForBackgroundWork();
+    std::vector<int> versions = db.GetVersions();
+    ASSERT_EQ(versions.size(), 4u);
+    ASSERT_EQ(versions[0], 5);
+    ASSERT_EQ(versions[1], 4);
+    ASSERT_EQ(versions[2], 2);
+    ASSERT_EQ(versions[3], 0);
+    ASSERT_TRUE(db.GetCheckpointFiles(3).empty());
+  }
+
+  // dropped versions stay dropped, kept ones still read the chunks of
+  // the dropped columns below them
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  ASSERT_EQ(db.GetVersions().size(), 4u);
+  Rows rows = Restore(&db, 4);
+  ASSERT_EQ(rows.size(), 50u);
+  ASSERT_EQ(rows[35][0], 3);
+  ASSERT_EQ(Restore(&db, 2).size(), 30u);
+  ASSERT_TRUE(Restore(&db, 3).empty());
+}
+
+TEST(DB, RestoreNotBlockedByThrottledCompaction) {
+  std::string dbname = lsedb::test::TmpDir("db_restore_priority");
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  JoinRows(&db, Keys(0, 9), 0);
+  for (int i = 1; i <= 4; i++) {
+    JoinRows(&db, Keys(0, 2999), i);
+  }
+  // the compaction below moves a few hundred KiB, about a second of tokens
+  RateLimiter limiter(200 << 10, 0);
+  db.SetRateLimiter(&limiter);
+
+  std::atomic<bool> compacted(false);
+  std::thread compaction([&] {
+    ASSERT_TRUE(db.CompactColumns(1, 4));
+    compacted = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  // the compaction waits for tokens outside mutex_, a small restore goes first
+  auto start = std::chrono::steady_clock::now();
+  Rows rows = Restore(&db, 0);
+  int64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  ASSERT_EQ(rows.size(), 10u);
+  ASSERT_LT(micros, 500000);
+  ASSERT_FALSE(compacted.load());
+  compaction.join();
+  ASSERT_EQ(Restore(&db, 4)[100][0], 4);
+  db.SetRateLimiter(nullptr);
+}
+
+TEST(DB, RestoreWhileVersionDeleted) {
+  std::string dbname = lsedb::test::TmpDir("db_restore_delete");
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 0.5f));
+  JoinRows(&db, Keys(0, 19999), 0);
+  // the rows of version 0 are extracted into a file only it reads
+  JoinRows(&db, Keys(0, 19999), 1);
+  std::vector<CkptMetaData> files = db.GetCheckpointFiles(0);
+  ASSERT_EQ(files.size(), 1u);
+  RateLimiter limiter(1 << 20, 0);
+  db.SetRateLimiter(&limiter);
+
+  Rows rows;
+  std::thread restore([&] { rows = Restore(&db, 0); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  // the restore reads without mutex_, the file outlives the version
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_TRUE(db.DeleteCheckpointsBefore(0));
+  int64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  ASSERT_LT(micros, 100000);
+  restore.join();
+  ASSERT_EQ(rows.size(), 20000u);
+  ASSERT_EQ(rows[100][0], 0);
+  limiter.SetBytesPerSecond(0);
+  ASSERT_TRUE(WaitForDeleted(files[0].file_name));
+  ASSERT_EQ(Restore(&db, 1)[100][0], 1);
+  db.SetRateLimiter(nullptr);
+}
+
+TEST(DB, CompactionGivenUpWhenColumnsDeleted) {
+  std::string dbname = lsedb::test::TmpDir("db_compact_delete");
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  for (int i = 0; i <= 4; i++) {
+    JoinRows(&db, Keys(0, 2999), i);
+  }
+  RateLimiter limiter(200 << 10, 0);
+  db.SetRateLimiter(&limiter);
+
+  std::atomic<bool> compacted(true);
+  std::thread compaction([&] { compacted = db.CompactColumns(1, 4); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  // the columns change while the compaction reads them, its outputs
+  // are given up
+  ASSERT_TRUE(db.DeleteCheckpointsBefore(1));
+  compaction.join();
+  ASSERT_FALSE(compacted.load());
+  limiter.SetBytesPerSecond(0);
+  ASSERT_EQ(db.GetVersions().size(), 3u);
+  for (int i = 2; i <= 4; i++) {
+    Rows rows = Restore(&db, i);
+    ASSERT_EQ(rows.size(), 3000u);
+    ASSERT_EQ(rows[100][0], i);
+  }
+  ASSERT_TRUE(db.CompactColumns(2, 4));
+  ASSERT_EQ(Restore(&db, 4)[100][0], 4);
+  db.SetRateLimiter(nullptr);
+}
+
+TEST(DB, MigrateColdChunks) {
+  std::string dbname = lsedb::test::TmpDir("db_tiering");
+  std::string cold_dir = lsedb::test::TmpDir("db_tiering_cold");
+  std::vector<uint64_t> numbers;
+  {
+    DB db;
+    ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+    uint32_t cold;
+    ASSERT_TRUE(db.AddDataPath(cold_dir, &cold));
+    ASSERT_EQ(cold, 1u);
+    for (int i = 0; i < 4; i++) {
+      numbers.push_back(JoinRows(&db, Keys(i * 100, i * 100 + 99), i));
+    }
+    TieringOptions options;
+    options.cold_path_id = cold;
+    options.cold_age = 2;
+    db.SetTiering(options);
+    ASSERT_TRUE(db.MigrateFiles(kMigrationBatchBytes));
+    // nothing left to move
+    ASSERT_FALSE(db.MigrateFiles(kMigrationBatchBytes));
+    for (int i = 0; i < 4; i++) {
+      bool is_cold = i < 2;
+      ASSERT_EQ(FileExists(MakeFileName(cold_dir, numbers[i], "tdc")), is_cold) << i;
+      if (is_cold) {
+        ASSERT_TRUE(WaitForDeleted(MakeFileName(dbname, numbers[i], "tdc"))) << i;
+      } else {
+        ASSERT_TRUE(FileExists(MakeFileName(dbname, numbers[i], "tdc"))) << i;
+      }
+    }
+    ASSERT_EQ(Restore(&db, 3).size(), 400u);
+  }
+
+  // the manifest remembers the path of each file
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  Rows rows = Restore(&db, 3);
+  ASSERT_EQ(rows.size(), 400u);
+  ASSERT_EQ(rows[50][0], 0);
+  ASSERT_EQ(rows[350][0], 3);
+  ASSERT_TRUE(FileExists(MakeFileName(cold_dir, numbers[0], "tdc")));
+
+  // chunks the rules no longer call cold come back
+  TieringOptions options;
+  options.cold_path_id = 1;
+  options.cold_age = 10;
+  db.SetTiering(options);
+  ASSERT_TRUE(db.MigrateFiles(kMigrationBatchBytes));
+  ASSERT_TRUE(FileExists(MakeFileName(dbname, numbers[0], "tdc")));
+  ASSERT_TRUE(WaitForDeleted(MakeFileName(cold_dir, numbers[0], "tdc")));
+  ASSERT_EQ(Restore(&db, 3).size(), 400u);
+}
+
+TEST(DB, StripeNewChunks) {
+  std::string dbname = lsedb::test::TmpDir("db_striping");
+  std::string dirs[2] = {lsedb::test::TmpDir("db_striping_a"), lsedb::test::TmpDir("db_striping_b")};
+  std::vector<uint64_t> numbers;
+  {
+    DB db;
+    ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+    std::vector<uint32_t> path_ids(2);
+    ASSERT_TRUE(db.AddDataPath(dirs[0], &path_ids[0]));
+    ASSERT_TRUE(db.AddDataPath(dirs[1], &path_ids[1]));
+    ASSERT_FALSE(db.SetStriping({path_ids[0], 7}, kStripeRoundRobin));
+    ASSERT_TRUE(db.SetStriping(path_ids, kStripeRoundRobin));
+    for (int i = 0; i < 4; i++) {
+      numbers.push_back(JoinRows(&db, Keys(i * 100, i * 100 + 99), i));
+    }
+    // one stripe after the other
+    for (int i = 0; i < 4; i++) {
+      ASSERT_TRUE(FileExists(MakeFileName(dirs[i % 2], numbers[i], "tdc"))) << i;
+      ASSERT_FALSE(FileExists(MakeFileName(dirs[1 - i % 2], numbers[i], "tdc"))) << i;
+      ASSERT_FALSE(FileExists(MakeFileName(dbname, numbers[i], "tdc"))) << i;
+    }
+    ASSERT_EQ(Restore(&db, 3).size(), 400u);
+
+    // every new chunk still lands on a stripe
+    ASSERT_TRUE(db.SetStriping(path_ids, kStripeCapacity));
+    uint64_t number = JoinRows(&db, Keys(400, 499), 4);
+    ASSERT_TRUE(FileExists(MakeFileName(dirs[0], number, "tdc")) ||
+                FileExists(MakeFileName(dirs[1], number, "tdc")));
+  }
+
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  Rows rows = Restore(&db, 4);
+  ASSERT_EQ(rows.size(), 500u);
+  ASSERT_EQ(rows[150][0], 1);
+  ASSERT_EQ(rows[450][0], 4);
+}
+
+TEST(DB, DestagedChunksSurviveCrash) {
+  std::string dbname = lsedb::test::TmpDir("db_destage");
+  std::string staging = lsedb::test::TmpDir("db_destage_staging");
+  std::vector<uint64_t> numbers;
+  {
+    DB db;
+    ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+    uint32_t path_id;
+    ASSERT_TRUE(db.AddDataPath(staging, &path_id));
+    ASSERT_TRUE(db.SetStagingPath(path_id));
+  }
+
+  // a child joins, waits for the destage and dies without closing
+  pid_t pid = ::fork();
+  if (pid == 0) {
+    DB* db = new DB();
+    if (!db->Open(dbname, false, 2.0f)) ::_exit(1);
+    for (int i = 0; i < 3; i++) {
+      JoinRows(db, Keys(i * 100, i * 100 + 99), i);
+    }
+    db->WaitForDestage();
+    ::_exit(0);
+  }
+  int status;
+  ASSERT_EQ(::waitpid(pid, &status, 0), pid);
+  ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  // the staging directory does not survive the host either
+  std::vector<std::string> children;
+  ASSERT_TRUE(GetChildren(staging, &children));
+  for (const auto& child : children) {
+    DeleteFile(staging + "/" + child);
+  }
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  Rows rows = Restore(&db, 2);
+  ASSERT_EQ(rows.size(), 300u);
+  ASSERT_EQ(rows[150][0], 1);
+}
+
+TEST(DB, DestageRetriedAfterMerge) {
+  std::string dbname = lsedb::test::TmpDir("db_destage_merge");
+  std::string staging = lsedb::test::TmpDir("db_destage_merge_staging");
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  uint32_t path_id;
+  ASSERT_TRUE(db.AddDataPath(staging, &path_id));
+  ASSERT_TRUE(db.SetStagingPath(path_id));
+  db.SetMergeEvery(2);
+  JoinRows(&db, Keys(0, 99), 0);
+  db.WaitForDestage();
+
+  // the copy of version 1 waits for tokens while the join of version 2
+  // merges version 0 into its file
+  RateLimiter limiter(8 << 10, 0);
+  db.SetRateLimiter(&limiter);
+  JoinRows(&db, Keys(100, 199), 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  JoinRows(&db, Keys(200, 299), 2);
+  limiter.SetBytesPerSecond(0);
+  db.WaitForBackgroundWork();
+  db.WaitForDestage();
+  db.SetRateLimiter(nullptr);
+
+  // nothing is left on the staging path
+  std::vector<std::string> children;
+  ASSERT_TRUE(GetChildren(staging, &children));
+  for (const auto& child : children) {
+    if (child.find(".tdc") == std::string::npos) continue;
+    ASSERT_TRUE(WaitForDeleted(staging + "/" + child)) << child;
+  }
+  Rows rows = Restore(&db, 2);
+  ASSERT_EQ(rows.size(), 300u);
+  ASSERT_EQ(rows[50][0], 0);
+  ASSERT_EQ(rows[150][0], 1);
+}
+
+TEST(DB, DestageRewrittenContainer) {
+  std::string dbname = lsedb::test::TmpDir("db_destage_rewrite");
+  std::string dir = lsedb::test::TmpDir("db_destage_rewrite_staging");
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  uint32_t path_id;
+  ASSERT_TRUE(db.AddDataPath(dir, &path_id));
+  ASSERT_TRUE(db.SetStriping({path_id}, kStripeRoundRobin));
+  db.SetMergeEvery(2);
+  JoinRows(&db, Keys(0, 99), 0);
+  JoinRows(&db, Keys(100, 199), 1);
+  uint64_t number = JoinRows(&db, Keys(200, 299), 2);
+  db.WaitForBackgroundWork();
+  ASSERT_EQ(db.GetSpaceStats().containers, 1u);
+
+  // the container of versions 0 and 1 is rewritten where it is, now
+  // the staging path, after the next join
+  ASSERT_TRUE(db.SetStriping({}, kStripeRoundRobin));
+  ASSERT_TRUE(db.SetStagingPath(path_id));
+  db.SetRewriteThreshold(2.0);
+  JoinRows(&db, Keys(300, 399), 3);
+  db.WaitForBackgroundWork();
+  db.WaitForDestage();
+
+  // only the chunk striped there before is left
+  std::unordered_set<uint64_t> numbers;
+  db.GetFilesOnPath(path_id, &numbers);
+  ASSERT_EQ(numbers.size(), 1u);
+  ASSERT_EQ(numbers.count(number), 1u);
+  ASSERT_EQ(db.GetSpaceStats().containers, 1u);
+  Rows rows = Restore(&db, 3);
+  ASSERT_EQ(rows.size(), 400u);
+  ASSERT_EQ(rows[50][0], 0);
+  ASSERT_EQ(rows[150][0], 1);
+}
+
+TEST(DB, StatisticsCountOperations) {
+  std::string dbname = lsedb::test::TmpDir("db_statistics");
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  for (int i = 0; i < 3; i++) {
+    JoinRows(&db, Keys(i * 100, i * 100 + 99), i);
+  }
+  Restore(&db, 2);
+  Statistics* stats = db.GetStatistics();
+  ASSERT_EQ(stats->GetTickerCount(kJoins), 3u);
+  ASSERT_EQ(stats->GetTickerCount(kRestores), 1u);
+  ASSERT_EQ(stats->GetTickerCount(kBytesRead), CheckpointBytes(&db, 2));
+  HistogramData data;
+  stats->GetHistogramData(kJoinMicros, &data);
+  ASSERT_EQ(data.count, 3u);
+  stats->GetHistogramData(kRestoreMicros, &data);
+  ASSERT_EQ(data.count, 1u);
+}
+
+TEST(DB, TraceJoinAndRestore) {
+  std::string dbname = lsedb::test::TmpDir("db_trace");
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  StartTracing();
+  JoinRows(&db, Keys(0, 99), 0);
+  Restore(&db, 0);
+  StopTracing();
+  // not recorded once stopped
+  JoinRows(&db, Keys(100, 199), 1);
+
+  std::string fname = dbname + "/trace.json";
+  ASSERT_TRUE(DumpTrace(fname));
+  std::ifstream in(fname);
+  std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  size_t joins = 0;
+  for (size_t pos = json.find("\"DB::Join\""); pos != std::string::npos;
+       pos = json.find("\"DB::Join\"", pos + 1)) {
+    joins++;
+  }
+  ASSERT_EQ(joins, 1u);
+  ASSERT_TRUE(json.find("\"Join.ManifestAppend\"") != std::string::npos);
+  ASSERT_TRUE(json.find("\"DB::ReadCheckpoint\"") != std::string::npos);
+}
+
+TEST(DB, AnalyzeVersion) {
+  std::string dbname = lsedb::test::TmpDir("db_analyze");
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  JoinRows(&db, Keys(0, 99), 0);
+  JoinRows(&db, Keys(50, 59), 1);
+
+  VersionLayout layout;
+  ASSERT_FALSE(db.AnalyzeVersion(7, false, &layout));
+  ASSERT_TRUE(db.AnalyzeVersion(1, false, &layout));
+  ASSERT_EQ(layout.version, 1);
+  ASSERT_EQ(layout.chunks, 2u);
+  ASSERT_EQ(layout.files, 2u);
+  ASSERT_EQ(layout.bytes, CheckpointBytes(&db, 1));
+  ASSERT_EQ(layout.depth, 1);
+  ASSERT_EQ(layout.rows, 0u);
+  ASSERT_TRUE(db.AnalyzeVersion(1, true, &layout));
+  ASSERT_EQ(layout.rows, 110u);
+  ASSERT_EQ(layout.unique_rows, 100u);
+  ASSERT_LT(std::fabs(layout.read_amp - 1.1), 1e-9);
+
+  std::vector<VersionLayout> layouts = db.AnalyzeVersions(true);
+  ASSERT_EQ(layouts.size(), 2u);
+  ASSERT_EQ(layouts[0].version, 1);
+  ASSERT_EQ(layouts[1].version, 0);
+  ASSERT_EQ(layouts[1].rows, 100u);
+
+  // a read-only open of the live DB sees the same and writes nothing
+  std::vector<std::string> before, after;
+  ASSERT_TRUE(GetChildren(dbname, &before));
+  uint64_t manifest_size, size;
+  ASSERT_TRUE(GetFileSize(dbname + "/manifest", &manifest_size));
+  {
+    DB reader;
+    ASSERT_TRUE(reader.OpenReadOnly(dbname));
+    ASSERT_TRUE(reader.AnalyzeVersion(1, true, &layout));
+    ASSERT_EQ(layout.rows, 110u);
+  }
+  ASSERT_TRUE(GetChildren(dbname, &after));
+  ASSERT_EQ(after.size(), before.size());
+  ASSERT_TRUE(GetFileSize(dbname + "/manifest", &size));
+  ASSERT_EQ(size, manifest_size);
+}
+
+TEST(DB, DeletedVersionsNotAnalyzed) {
+  std::string dbname = lsedb::test::TmpDir("db_analyze_deleted");
+  {
+    DB db;
+    ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+    JoinRows(&db, Keys(0, 99), 0);
+    JoinRows(&db, Keys(50, 59), 1);
+    JoinRows(&db, Keys(0, 9), 2);
+    // version 2 still reads the chunks of versions 1 and 0
+    ASSERT_TRUE(db.DeleteCheckpointsBefore(1));
+    ASSERT_EQ(db.GetVersions().size(), 1u);
+    ASSERT_EQ(db.GetVersions()[0], 2);
+    VersionLayout layout;
+    ASSERT_FALSE(db.AnalyzeVersion(1, false, &layout));
+    ASSERT_FALSE(db.AnalyzeVersion(0, false, &layout));
+    ASSERT_TRUE(db.GetCheckpointFiles(0).empty());
+    std::vector<VersionLayout> layouts = db.AnalyzeVersions(true);
+    ASSERT_EQ(layouts.size(), 1u);
+    ASSERT_EQ(layouts[0].version, 2);
+    ASSERT_EQ(layouts[0].unique_rows, 100u);
+  }
+
+  // the manifest remembers them
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  ASSERT_EQ(db.GetVersions().size(), 1u);
+  ASSERT_EQ(db.AnalyzeVersions(false).size(), 1u);
+  Rows rows = Restore(&db, 2);
+  ASSERT_EQ(rows.size(), 100u);
+  ASSERT_EQ(rows[5][0], 2);
+  ASSERT_EQ(rows[55][0], 1);
+  ASSERT_EQ(rows[75][0], 0);
+}
+
+static std::string ReadFile(const std::string& fname) {
+  std::ifstream in(fname, std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+TEST(DB, SnapshotOnCloseAndEveryInterval) {
+  std::string dbname = lsedb::test::TmpDir("db_snapshot_interval");
+  std::string snapshot_name = dbname + "/snapshot";
+  {
+    DB db;
+    ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+    JoinRows(&db, Keys(0, 99), 0);
+    JoinRows(&db, Keys(100, 199), 1);
+  }
+  std::string closed = ReadFile(snapshot_name);
+  ASSERT_FALSE(closed.empty());
+
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  // rewrites in between leave the snapshot of the close alone
+  for (int i = 0; i < kSnapshotInterval - 1; i++) {
+    ASSERT_TRUE(db.SetStagingPath(0));
+  }
+  ASSERT_TRUE(ReadFile(snapshot_name) == closed);
+  ASSERT_TRUE(db.SetStagingPath(0));
+  ASSERT_FALSE(ReadFile(snapshot_name) == closed);
+  ASSERT_EQ(Restore(&db, 1).size(), 200u);
+}
+
+TEST(DB, CorruptSnapshotFallsBackToManifest) {
+  std::string dbname = lsedb::test::TmpDir("db_snapshot_corrupt");
+  std::string snapshot_name = dbname + "/snapshot";
+  {
+    DB db;
+    ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+    JoinRows(&db, Keys(0, 99), 0);
+    JoinRows(&db, Keys(50, 149), 1);
+  }
+  // the tail still matches the manifest, only the files are off
+  std::string contents = ReadFile(snapshot_name);
+  ASSERT_GT(contents.size(), 32u);
+  contents[contents.size() / 2] ^= 0x01;
+  ASSERT_TRUE(WriteStringToFileSync(contents, snapshot_name));
+
+  {
+    DB db;
+    ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+    Rows rows = Restore(&db, 1);
+    ASSERT_EQ(rows.size(), 150u);
+    ASSERT_EQ(rows[75][0], 1);
+    ASSERT_EQ(Restore(&db, 0)[75][0], 0);
+  }
+  // the close wrote a good one again
+  ASSERT_FALSE(ReadFile(snapshot_name) == contents);
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  ASSERT_EQ(Restore(&db, 1).size(), 150u);
+}
+
+
+TEST(DB, SharedReleasedAfterManifestRewrite) {
+  std::string dbname = lsedb::test::TmpDir("db_shared_release");
+  std::string dir = dbname + "/packed";
+  DB db;
+  ASSERT_TRUE(db.Open(dbname, false, 2.0f));
+  std::vector<uint64_t> released;
+  uint32_t path_id;
+  ASSERT_TRUE(db.SetSharedPath(dir, [&released](uint64_t number) { released.push_back(number); },
+                               &path_id));
+  ASSERT_GT(path_id, 0u);
+  ASSERT_TRUE(db.GetSharedPath() == dir);
+  // another dir is refused once one is recorded
+  ASSERT_FALSE(db.SetSharedPath(dbname + "/other", nullptr, &path_id));
+
+  uint64_t number = db.GetNextNumber() + 1;
+  ASSERT_TRUE(db.ReserveFileNumber(number));
+  Rows rows;
+  for (auto key : Keys(0, 99)) {
+    rows[key] = std::vector<double>(1, 0);
+  }
+  uint64_t length = PackToFile(MakeFileName(dir, number, "tdc"), rows);
+  db.NotifyJoinShared(Keys(0, 99), number, 0, length);
+  db.WaitForBackgroundWork();
+  ASSERT_EQ(Restore(&db, 0)[50][0], 0);
+
+  // the manifest on disk still references the container after a failed
+  // rewrite, so it is not released yet
+  ASSERT_EQ(::mkdir((dbname + "/manifest.tmp").c_str(), 0755), 0);
+  db.DeleteCheckpointsBefore(0);
+  ASSERT_TRUE(released.empty());
+
+  ASSERT_EQ(::rmdir((dbname + "/manifest.tmp").c_str()), 0);
+  ASSERT_TRUE(db.AddDataPath(dbname + "/cold", &path_id));
+  ASSERT_EQ(released.size(), 1u);
+  ASSERT_EQ(released[0], number);
+  // the DB never deletes a shared container itself
+  ASSERT_TRUE(FileExists(MakeFileName(dir, number, "tdc")));
+}
+
+}
+
+int main() { return lsedb::test::RunAllTests(); }
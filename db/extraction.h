@@ -8,10 +8,49 @@
 #include <map>
 #include <msgpack.hpp>
 #include <fstream>
+#include <string>
 #include "file_list.h"
 
 namespace tdchunk {
 
+typedef std::map<uint32_t, std::vector<double>> ChunkMap;
+
+// Split file by the keys of base, starting at base_iter: rows whose key
+// is also in base go to extracted, the others to retained. Returns the
+// number of rows extracted.
+inline int MergeJoin(ChunkMap::const_iterator base_iter,
+                     ChunkMap::const_iterator base_end,
+                     const ChunkMap& file,
+                     ChunkMap* extracted, ChunkMap* retained) {
+  int total_extracted = 0;
+  auto cur_iter = file.begin();
+  while (cur_iter != file.end() && base_iter != base_end) {
+    if (cur_iter->first > base_iter->first) {
+      base_iter++;
+    } else if (cur_iter->first < base_iter->first) {
+      (*retained)[cur_iter->first] = cur_iter->second;
+      cur_iter++;
+    } else { // equal, extract to file
+      (*extracted)[cur_iter->first] = cur_iter->second;
+      total_extracted++;
+      cur_iter++;
+      base_iter++;
+    }
+  }
+  for (; cur_iter != file.end(); cur_iter++) { // write unfinished keys
+    (*retained)[cur_iter->first] = cur_iter->second;
+  }
+  return total_extracted;
+}
+
+// A chunk picked under the lock of the DB and read without it: a copy
+// of its meta as it was then and its file name.
+struct InputChunk {
+  FileMetaData* file; // the meta itself, only valid under the lock
+  FileMetaData meta;
+  std::string fname;
+};
+
 class Extraction {
 public:
   // Files produced by extraction
@@ -21,20 +60,32 @@ public:
     uint64_t start, length;
   };
 
+  // The split of one input, installed under the lock once all inputs
+  // were read. retained_keys are empty if no row was retained.
+  struct Result {
+    const InputChunk* input;
+    Output retained;
+    Output extracted;
+    bool has_extracted;
+    std::vector<uint32_t> retained_keys;
+  };
+
   Output retained;
   Output extracted;
 
-  explicit Extraction(FileMetaData* base,
-    const std::vector<FileMetaData*>& to_be_extracted)
+  explicit Extraction(const InputChunk& base,
+    const std::vector<InputChunk>& to_be_extracted)
     : base_(base),
       inputs_(to_be_extracted) {}
 
   ~Extraction() {
   }
 
-  FileMetaData* base_;
-  std::vector<FileMetaData*> inputs_;
-  // std::vector<Output> outputs;
+  InputChunk base_;
+  std::vector<InputChunk> inputs_;
+  std::vector<Result> results;
+  // every output file number, given up if the results are not installed
+  std::vector<uint64_t> outputs;
 
   // State kept for output being generated
   std::map<uint32_t, std::vector<double>> out_retained;
@@ -0,0 +1,169 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "extraction_policy.h"
+
+#include <algorithm>
+
+namespace tdchunk {
+
+AmplificationStats::AmplificationStats()
+  : seen_count_(0),
+    seeded_rows_(0),
+    joined_rows_(0),
+    joined_bytes_(0),
+    extraction_bytes_(0) {}
+
+AmplificationStats::AmplificationStats(const AmplificationStats& other) {
+  std::lock_guard<std::mutex> l(other.mu_);
+  seen_keys_ = other.seen_keys_;
+  seen_count_ = other.seen_count_;
+  seeded_rows_ = other.seeded_rows_;
+  joined_rows_ = other.joined_rows_;
+  joined_bytes_ = other.joined_bytes_;
+  extraction_bytes_ = other.extraction_bytes_;
+  versions_ = other.versions_;
+}
+
+void AmplificationStats::SeedUniqueRows(uint64_t rows) {
+  std::lock_guard<std::mutex> l(mu_);
+  seeded_rows_ = rows;
+}
+
+void AmplificationStats::RecordJoin(const std::vector<uint32_t>& keys, uint64_t length) {
+  std::lock_guard<std::mutex> l(mu_);
+  for (auto key : keys) {
+    if (key >= seen_keys_.size()) {
+      seen_keys_.resize(static_cast<size_t>(key) + 1, false);
+    }
+    if (!seen_keys_[key]) {
+      seen_keys_[key] = true;
+      seen_count_++;
+    }
+  }
+  joined_rows_ += keys.size();
+  joined_bytes_ += length;
+}
+
+void AmplificationStats::RecordExtraction(uint64_t bytes_written) {
+  std::lock_guard<std::mutex> l(mu_);
+  extraction_bytes_ += bytes_written;
+}
+
+void AmplificationStats::RecordVersion(int version, uint64_t bytes_read) {
+  std::lock_guard<std::mutex> l(mu_);
+  VersionAmplification& v = versions_[version];
+  v.bytes_read = bytes_read;
+  v.unique_rows = UniqueRowsLocked();
+  double needed = v.unique_rows * RowBytesLocked();
+  v.read_amp = needed > 0 ? bytes_read / needed : 0;
+}
+
+double AmplificationStats::RowBytesLocked() const {
+  if (joined_rows_ == 0) return 0;
+  return static_cast<double>(joined_bytes_) / joined_rows_;
+}
+
+uint64_t AmplificationStats::UniqueRowsLocked() const {
+  return std::max(seen_count_, seeded_rows_);
+}
+
+double AmplificationStats::RowBytes() const {
+  std::lock_guard<std::mutex> l(mu_);
+  return RowBytesLocked();
+}
+
+uint64_t AmplificationStats::UniqueRows() const {
+  std::lock_guard<std::mutex> l(mu_);
+  return UniqueRowsLocked();
+}
+
+double AmplificationStats::WriteAmplification() const {
+  std::lock_guard<std::mutex> l(mu_);
+  if (joined_bytes_ == 0) return 0;
+  return static_cast<double>(extraction_bytes_) / joined_bytes_;
+}
+
+uint64_t AmplificationStats::JoinedBytes() const {
+  std::lock_guard<std::mutex> l(mu_);
+  return joined_bytes_;
+}
+
+uint64_t AmplificationStats::ExtractionBytes() const {
+  std::lock_guard<std::mutex> l(mu_);
+  return extraction_bytes_;
+}
+
+std::map<int, VersionAmplification> AmplificationStats::Versions() const {
+  std::lock_guard<std::mutex> l(mu_);
+  return versions_;
+}
+
+ThresholdExtractionPolicy::ThresholdExtractionPolicy(float extract_thres)
+  : extract_thres_(extract_thres) {}
+
+bool ThresholdExtractionPolicy::PickFiles(const ExtractionContext& ctx,
+                                          const std::vector<ExtractionCandidate>& candidates,
+                                          std::vector<FileMetaData*>* chosen) {
+  chosen->clear();
+  if (extract_thres_ > 0 && ctx.new_rows <= 100) return false;
+
+  auto thres = static_cast<uint64_t>(ctx.new_rows * extract_thres_);
+  for (const auto& c : candidates) {
+    if (c.hits > thres) {
+      chosen->push_back(c.file);
+    }
+  }
+  return !chosen->empty();
+}
+
+bool ThresholdExtractionPolicy::ShouldInstall(uint64_t extracted, uint64_t base_rows) {
+  return extracted > static_cast<uint64_t>(base_rows * extract_thres_);
+}
+
+CostBasedExtractionPolicy::CostBasedExtractionPolicy(double target_read_amp)
+  : target_read_amp_(target_read_amp) {}
+
+bool CostBasedExtractionPolicy::PickFiles(const ExtractionContext& ctx,
+                                          const std::vector<ExtractionCandidate>& candidates,
+                                          std::vector<FileMetaData*>* chosen) {
+  chosen->clear();
+  double row_bytes = ctx.stats->RowBytes();
+  double budget = target_read_amp_ * ctx.stats->UniqueRows() * row_bytes;
+  double bytes = static_cast<double>(ctx.version_bytes);
+  if (row_bytes <= 0 || bytes <= budget) return false;
+
+  // most superseded bytes per byte rewritten first
+  std::vector<ExtractionCandidate> sorted;
+  for (const auto& c : candidates) {
+    if (c.hits > 0 && c.file->length > 0) sorted.push_back(c);
+  }
+  std::sort(sorted.begin(), sorted.end(),
+            [](const ExtractionCandidate& a, const ExtractionCandidate& b) {
+    return static_cast<double>(a.hits) / a.file->length >
+           static_cast<double>(b.hits) / b.file->length;
+  });
+
+  for (const auto& c : sorted) {
+    chosen->push_back(c.file);
+    bytes -= std::min(c.hits * row_bytes, static_cast<double>(c.file->length));
+    if (bytes <= budget) break;
+  }
+  return !chosen->empty();
+}
+
+bool CostBasedExtractionPolicy::ShouldInstall(uint64_t extracted, uint64_t /*base_rows*/) {
+  return extracted > 0;
+}
+
+ExtractionPolicy* NewExtractionPolicy(const std::string& name, double param) {
+  if (name == "threshold") {
+    return new ThresholdExtractionPolicy(static_cast<float>(param));
+  } else if (name == "cost") {
+    return new CostBasedExtractionPolicy(param);
+  }
+  return nullptr;
+}
+
+}
@@ -0,0 +1,134 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "file_helper.h"
+
+namespace tdchunk {
+
+// Read amplification of one version: bytes a restore reads divided by
+// the bytes of the distinct rows it needs.
+struct VersionAmplification {
+  uint64_t bytes_read = 0;
+  uint64_t unique_rows = 0;
+  double read_amp = 0;
+};
+
+// Tracks what checkpoints cost to write and to restore. Rows are sized
+// from the joined checkpoints, all rows of a table have the same
+// dimension.
+class AmplificationStats {
+ public:
+  AmplificationStats();
+  // a consistent copy, e.g. to read while joins go on
+  AmplificationStats(const AmplificationStats& other);
+  AmplificationStats& operator=(const AmplificationStats&) = delete;
+
+  // Seed the number of distinct rows, e.g. from the key range of the
+  // files found at open, before any join has been seen.
+  void SeedUniqueRows(uint64_t rows);
+
+  void RecordJoin(const std::vector<uint32_t>& keys, uint64_t length);
+  void RecordExtraction(uint64_t bytes_written);
+  void RecordVersion(int version, uint64_t bytes_read);
+
+  double RowBytes() const;
+  uint64_t UniqueRows() const;
+
+  // bytes written by extraction per byte checkpointed
+  double WriteAmplification() const;
+  uint64_t JoinedBytes() const;
+  uint64_t ExtractionBytes() const;
+  std::map<int, VersionAmplification> Versions() const;
+
+ private:
+  double RowBytesLocked() const;
+  uint64_t UniqueRowsLocked() const;
+
+  mutable std::mutex mu_;
+  std::vector<bool> seen_keys_;
+  uint64_t seen_count_;
+  uint64_t seeded_rows_;
+  uint64_t joined_rows_;
+  uint64_t joined_bytes_;
+  uint64_t extraction_bytes_;
+  std::map<int, VersionAmplification> versions_;
+};
+
+// An L0 file overlapping the checkpoint being joined.
+struct ExtractionCandidate {
+  FileMetaData* file;
+  uint64_t hits; // keys of the new checkpoint the filter says may be in file
+};
+
+struct ExtractionContext {
+  uint64_t new_rows;      // keys in the joined checkpoint
+  uint64_t version_bytes; // bytes a restore of the newest version reads
+  const AmplificationStats* stats;
+};
+
+// Decides when and which files to extract. Implementations must be
+// deterministic given their inputs so traces can be replayed offline.
+class ExtractionPolicy {
+ public:
+  virtual ~ExtractionPolicy() {}
+
+  // Pick files to extract out of candidates, returns !chosen->empty().
+  virtual bool PickFiles(const ExtractionContext& ctx,
+                         const std::vector<ExtractionCandidate>& candidates,
+                         std::vector<FileMetaData*>* chosen) = 0;
+
+  // After the merge-join of one picked file: install the split if
+  // extracted of the base_rows keys were found in it.
+  virtual bool ShouldInstall(uint64_t extracted, uint64_t base_rows) = 0;
+
+  virtual const char* Name() const = 0;
+};
+
+// Extract files where more than extract_thres of the new keys hit the
+// filter, skipping checkpoints of at most 100 keys.
+class ThresholdExtractionPolicy : public ExtractionPolicy {
+ public:
+  explicit ThresholdExtractionPolicy(float extract_thres);
+
+  bool PickFiles(const ExtractionContext& ctx,
+                 const std::vector<ExtractionCandidate>& candidates,
+                 std::vector<FileMetaData*>* chosen) override;
+  bool ShouldInstall(uint64_t extracted, uint64_t base_rows) override;
+  const char* Name() const override { return "threshold"; }
+
+ private:
+  float extract_thres_;
+};
+
+// Extract only while the newest version reads more than
+// target_read_amp times its distinct bytes. Files are taken in order
+// of superseded rows per byte rewritten, until the projected read
+// amplification drops under the target.
+class CostBasedExtractionPolicy : public ExtractionPolicy {
+ public:
+  explicit CostBasedExtractionPolicy(double target_read_amp);
+
+  bool PickFiles(const ExtractionContext& ctx,
+                 const std::vector<ExtractionCandidate>& candidates,
+                 std::vector<FileMetaData*>* chosen) override;
+  bool ShouldInstall(uint64_t extracted, uint64_t base_rows) override;
+  const char* Name() const override { return "cost"; }
+
+ private:
+  double target_read_amp_;
+};
+
+// "threshold" takes param as extract_thres, "cost" as the target read
+// amplification. Returns nullptr for unknown names.
+ExtractionPolicy* NewExtractionPolicy(const std::string& name, double param);
+
+}
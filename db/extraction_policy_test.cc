@@ -0,0 +1,118 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "extraction_policy.h"
+
+#include "util/testharness.h"
+
+namespace tdchunk {
+
+static FileMetaData MakeFile(uint64_t length) {
+  FileMetaData file = FileMetaData();
+  file.length = length;
+  return file;
+}
+
+static std::vector<uint32_t> Keys(uint32_t first, uint32_t last) {
+  std::vector<uint32_t> keys;
+  for (uint32_t key = first; key <= last; key++) {
+    keys.push_back(key);
+  }
+  return keys;
+}
+
+TEST(AmplificationStats, RowsAndAmplification) {
+  AmplificationStats stats;
+  stats.RecordJoin(Keys(0, 99), 400);
+  stats.RecordJoin(Keys(50, 149), 400);
+  ASSERT_EQ(stats.UniqueRows(), 150u);
+  ASSERT_EQ(stats.RowBytes(), 4.0);
+  ASSERT_EQ(stats.JoinedBytes(), 800u);
+
+  stats.RecordExtraction(200);
+  ASSERT_EQ(stats.WriteAmplification(), 0.25);
+
+  // 150 rows of 4 bytes are needed, 1200 are read
+  stats.RecordVersion(1, 1200);
+  std::map<int, VersionAmplification> versions = stats.Versions();
+  ASSERT_EQ(versions[1].bytes_read, 1200u);
+  ASSERT_EQ(versions[1].unique_rows, 150u);
+  ASSERT_EQ(versions[1].read_amp, 2.0);
+
+  // a seed only counts while it is larger than the rows seen
+  stats.SeedUniqueRows(100);
+  ASSERT_EQ(stats.UniqueRows(), 150u);
+  stats.SeedUniqueRows(300);
+  ASSERT_EQ(stats.UniqueRows(), 300u);
+}
+
+TEST(ThresholdExtractionPolicy, PickAndInstall) {
+  ThresholdExtractionPolicy policy(0.5f);
+  FileMetaData a = MakeFile(100), b = MakeFile(100);
+  std::vector<ExtractionCandidate> candidates = {{&a, 60}, {&b, 40}};
+  ExtractionContext ctx;
+  ctx.new_rows = 100;
+  ctx.version_bytes = 0;
+  ctx.stats = nullptr;
+  std::vector<FileMetaData*> chosen;
+  // checkpoints of at most 100 keys are never extracted
+  ASSERT_FALSE(policy.PickFiles(ctx, candidates, &chosen));
+  ASSERT_TRUE(chosen.empty());
+
+  ctx.new_rows = 101;
+  ASSERT_TRUE(policy.PickFiles(ctx, candidates, &chosen));
+  ASSERT_EQ(chosen.size(), 1u);
+  ASSERT_TRUE(chosen[0] == &a);
+
+  ASSERT_TRUE(policy.ShouldInstall(51, 100));
+  ASSERT_FALSE(policy.ShouldInstall(50, 100));
+}
+
+TEST(CostBasedExtractionPolicy, PickUntilUnderTarget) {
+  AmplificationStats stats;
+  stats.RecordJoin(Keys(0, 99), 400);
+  CostBasedExtractionPolicy policy(2.0);
+  // a and b supersede the same rows, a at a quarter of the bytes rewritten
+  FileMetaData a = MakeFile(100), b = MakeFile(400), c = MakeFile(400);
+  std::vector<ExtractionCandidate> candidates = {{&b, 50}, {&a, 50}, {&c, 0}};
+  ExtractionContext ctx;
+  ctx.new_rows = 100;
+  ctx.stats = &stats;
+  std::vector<FileMetaData*> chosen;
+
+  // the budget is 2.0 * 100 rows * 4 bytes
+  ctx.version_bytes = 800;
+  ASSERT_FALSE(policy.PickFiles(ctx, candidates, &chosen));
+
+  // a saves 100 bytes, enough for 900
+  ctx.version_bytes = 900;
+  ASSERT_TRUE(policy.PickFiles(ctx, candidates, &chosen));
+  ASSERT_EQ(chosen.size(), 1u);
+  ASSERT_TRUE(chosen[0] == &a);
+
+  // c holds none of the new rows and is never picked
+  ctx.version_bytes = 2000;
+  ASSERT_TRUE(policy.PickFiles(ctx, candidates, &chosen));
+  ASSERT_EQ(chosen.size(), 2u);
+  ASSERT_TRUE(chosen[1] == &b);
+
+  ASSERT_TRUE(policy.ShouldInstall(1, 100));
+  ASSERT_FALSE(policy.ShouldInstall(0, 100));
+}
+
+TEST(ExtractionPolicy, NewByName) {
+  ExtractionPolicy* policy = NewExtractionPolicy("threshold", 0.5);
+  ASSERT_TRUE(policy != nullptr);
+  ASSERT_EQ(std::string(policy->Name()), "threshold");
+  delete policy;
+  policy = NewExtractionPolicy("cost", 2.0);
+  ASSERT_TRUE(policy != nullptr);
+  ASSERT_EQ(std::string(policy->Name()), "cost");
+  delete policy;
+  ASSERT_TRUE(NewExtractionPolicy("none", 0) == nullptr);
+}
+
+}
+
+int main() { return lsedb::test::RunAllTests(); }
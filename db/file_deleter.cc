@@ -0,0 +1,163 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "file_deleter.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+namespace tdchunk {
+
+// files are shrunk by this much per truncate before being unlinked
+static const uint64_t kTruncateStep = 64 * 1024 * 1024;
+
+FileDeleter::FileDeleter()
+  : paused_(0),
+    stop_(false),
+    bytes_per_sec_(0),
+    rate_limiter_(nullptr),
+    limiter_users_(0),
+    stats_(nullptr) {
+  thread_ = std::thread(&FileDeleter::BackgroundLoop, this);
+}
+
+FileDeleter::~FileDeleter() {
+  {
+    std::lock_guard<std::mutex> l(mu_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+void FileDeleter::SetRateLimit(uint64_t bytes_per_sec) {
+  std::lock_guard<std::mutex> l(mu_);
+  bytes_per_sec_ = bytes_per_sec;
+}
+
+void FileDeleter::SetRateLimiter(RateLimiter* rate_limiter) {
+  std::unique_lock<std::mutex> l(mu_);
+  rate_limiter_ = rate_limiter;
+  // the old limiter may be freed once this returns
+  cv_.wait(l, [this] { return limiter_users_ == 0; });
+}
+
+void FileDeleter::SetStatistics(Statistics* stats) {
+  std::lock_guard<std::mutex> l(mu_);
+  stats_ = stats;
+}
+
+void FileDeleter::Schedule(const std::string& fname, uint64_t id) {
+  {
+    std::lock_guard<std::mutex> l(mu_);
+    Entry entry;
+    entry.fname = fname;
+    entry.id = id;
+    queue_.push_back(entry);
+  }
+  cv_.notify_all();
+}
+
+std::vector<uint64_t> FileDeleter::Pending() {
+  std::lock_guard<std::mutex> l(mu_);
+  std::vector<uint64_t> ids = in_progress_;
+  for (const auto& entry : queue_) {
+    if (entry.id != 0) ids.push_back(entry.id);
+  }
+  return ids;
+}
+
+void FileDeleter::Pause() {
+  std::lock_guard<std::mutex> l(mu_);
+  paused_++;
+}
+
+void FileDeleter::Resume() {
+  {
+    std::lock_guard<std::mutex> l(mu_);
+    paused_--;
+  }
+  cv_.notify_all();
+}
+
+void FileDeleter::WaitForIdle() {
+  std::unique_lock<std::mutex> l(mu_);
+  cv_.wait(l, [this] { return stop_ || (queue_.empty() && in_progress_.empty()); });
+}
+
+void FileDeleter::BackgroundLoop() {
+  while (true) {
+    Entry entry;
+    {
+      std::unique_lock<std::mutex> l(mu_);
+      cv_.wait(l, [this] { return stop_ || (!queue_.empty() && paused_ == 0); });
+      if (stop_) return;
+      entry = queue_.front();
+      queue_.pop_front();
+      if (entry.id != 0) in_progress_.push_back(entry.id);
+    }
+    Delete(entry);
+    {
+      std::lock_guard<std::mutex> l(mu_);
+      in_progress_.erase(std::remove(in_progress_.begin(), in_progress_.end(), entry.id),
+                         in_progress_.end());
+    }
+    cv_.notify_all();
+  }
+}
+
+void FileDeleter::Delete(const Entry& entry) {
+  struct ::stat st;
+  if (::stat(entry.fname.c_str(), &st) != 0) return; // already gone
+  uint64_t size = static_cast<uint64_t>(st.st_blocks) * 512;
+
+  if (size > kTruncateStep) {
+    int fd = ::open(entry.fname.c_str(), O_WRONLY);
+    if (fd >= 0) {
+      uint64_t length = st.st_size;
+      while (length > kTruncateStep) {
+        length -= kTruncateStep;
+        if (::ftruncate(fd, length) != 0) break;
+        Throttle(kTruncateStep);
+        size -= std::min(size, kTruncateStep);
+      }
+      ::close(fd);
+    }
+  }
+  if (::unlink(entry.fname.c_str()) == 0) {
+    std::lock_guard<std::mutex> l(mu_);
+    if (stats_ != nullptr) stats_->RecordTick(kFilesDeleted);
+  }
+  Throttle(size);
+}
+
+void FileDeleter::Throttle(uint64_t bytes) {
+  uint64_t bytes_per_sec;
+  RateLimiter* rate_limiter;
+  {
+    std::lock_guard<std::mutex> l(mu_);
+    bytes_per_sec = bytes_per_sec_;
+    rate_limiter = rate_limiter_;
+    if (rate_limiter != nullptr) limiter_users_++;
+  }
+  if (rate_limiter != nullptr) {
+    rate_limiter->Request(bytes, kIOPriorityBackground);
+    {
+      std::lock_guard<std::mutex> l(mu_);
+      limiter_users_--;
+    }
+    cv_.notify_all();
+  }
+  if (bytes_per_sec == 0 || bytes == 0) return;
+  std::unique_lock<std::mutex> l(mu_);
+  // wake up early on stop
+  cv_.wait_for(l, std::chrono::microseconds(bytes * 1000000 / bytes_per_sec),
+               [this] { return stop_; });
+}
+
+}
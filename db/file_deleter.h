@@ -0,0 +1,82 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rate_limiter.h"
+#include "statistics.h"
+
+namespace tdchunk {
+
+// Unlinks obsolete files on its own thread so callers never wait on the
+// filesystem freeing extents. Large files are truncated step by step
+// before the unlink, and the bytes freed per second can be limited.
+class FileDeleter {
+ public:
+  FileDeleter();
+  FileDeleter(const FileDeleter&) = delete;
+  FileDeleter& operator=(const FileDeleter&) = delete;
+
+  // Stops without draining the queue, pending deletions are redone from
+  // the manifest on the next open.
+  ~FileDeleter();
+
+  // 0 = unlimited
+  void SetRateLimit(uint64_t bytes_per_sec);
+
+  // Charge the bytes every truncate and unlink frees as background I/O,
+  // not owned. Returns once the old limiter is no longer used.
+  void SetRateLimiter(RateLimiter* rate_limiter);
+
+  // Count unlinked files in kFilesDeleted, not owned.
+  void SetStatistics(Statistics* stats);
+
+  // id is the file number logged in the manifest, 0 if not logged.
+  void Schedule(const std::string& fname, uint64_t id);
+
+  // ids of logged files not deleted yet
+  std::vector<uint64_t> Pending();
+
+  // Hold back deletions not started yet until as many Resume calls, e.g.
+  // while files are read without the lock that orders their deletion.
+  // Files scheduled meanwhile are queued and stay pending.
+  void Pause();
+  void Resume();
+
+  // Block until the queue is empty.
+  void WaitForIdle();
+
+ private:
+  struct Entry {
+    std::string fname;
+    uint64_t id;
+  };
+
+  void BackgroundLoop();
+  void Delete(const Entry& entry);
+  // account for bytes freed, sleeping to stay under the rate limit
+  void Throttle(uint64_t bytes);
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<Entry> queue_;
+  std::vector<uint64_t> in_progress_;
+  int paused_;
+  bool stop_;
+  uint64_t bytes_per_sec_;
+  RateLimiter* rate_limiter_;
+  int limiter_users_; // Throttle calls inside rate_limiter_
+  Statistics* stats_;
+  std::thread thread_;
+};
+
+}
@@ -0,0 +1,94 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "file_deleter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "file_helper.h"
+#include "util/testharness.h"
+
+namespace tdchunk {
+
+static std::string WriteFile(const std::string& dir, const std::string& name, size_t size) {
+  std::string fname = dir + "/" + name;
+  ASSERT_TRUE(WriteStringToFileSync(std::string(size, 'x'), fname));
+  return fname;
+}
+
+TEST(FileDeleter, DeletesInBackground) {
+  std::string dir = lsedb::test::TmpDir("deleter_background");
+  Statistics stats;
+  FileDeleter deleter;
+  deleter.SetStatistics(&stats);
+  std::vector<std::string> names;
+  for (int i = 1; i <= 3; i++) {
+    names.push_back(WriteFile(dir, std::to_string(i), 4096));
+    deleter.Schedule(names.back(), i);
+  }
+  // already gone, e.g. deleted before a crash and logged again
+  deleter.Schedule(dir + "/missing", 4);
+  deleter.WaitForIdle();
+  for (const auto& name : names) {
+    ASSERT_FALSE(FileExists(name)) << name;
+  }
+  ASSERT_TRUE(deleter.Pending().empty());
+  ASSERT_EQ(stats.GetTickerCount(kFilesDeleted), 3u);
+}
+
+TEST(FileDeleter, PendingUntilDeleted) {
+  std::string dir = lsedb::test::TmpDir("deleter_pending");
+  FileDeleter deleter;
+  // the first unlink is followed by a long wait
+  deleter.SetRateLimit(1024);
+  deleter.Schedule(WriteFile(dir, "1", 64 * 1024), 1);
+  deleter.Schedule(WriteFile(dir, "2", 4096), 2);
+  deleter.Schedule(WriteFile(dir, "unlogged", 4096), 0);
+  std::vector<uint64_t> pending = deleter.Pending();
+  std::sort(pending.begin(), pending.end());
+  ASSERT_EQ(pending.size(), 2u);
+  ASSERT_EQ(pending[0], 1u);
+  ASSERT_EQ(pending[1], 2u);
+  // stopping does not drain the queue, the manifest still logs them
+}
+
+TEST(FileDeleter, PausedUntilResumed) {
+  std::string dir = lsedb::test::TmpDir("deleter_paused");
+  FileDeleter deleter;
+  deleter.Pause();
+  deleter.Pause();
+  std::string fname = WriteFile(dir, "1", 4096);
+  deleter.Schedule(fname, 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  ASSERT_TRUE(FileExists(fname));
+  ASSERT_EQ(deleter.Pending().size(), 1u);
+  deleter.Resume();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  ASSERT_TRUE(FileExists(fname));
+  deleter.Resume();
+  deleter.WaitForIdle();
+  ASSERT_FALSE(FileExists(fname));
+  ASSERT_TRUE(deleter.Pending().empty());
+}
+
+TEST(FileDeleter, RateLimit) {
+  std::string dir = lsedb::test::TmpDir("deleter_rate_limit");
+  FileDeleter deleter;
+  deleter.SetRateLimit(1 << 20);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 1; i <= 4; i++) {
+    deleter.Schedule(WriteFile(dir, std::to_string(i), 64 * 1024), i);
+  }
+  deleter.WaitForIdle();
+  auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  // 256 KiB at 1 MiB/s
+  ASSERT_GE(micros, 200000);
+}
+
+}
+
+int main() { return lsedb::test::RunAllTests(); }
@@ -8,7 +8,11 @@
 #include <cstdint>
 #include <string>
 #include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <unistd.h>
 #include <dirent.h>
 
@@ -40,10 +44,116 @@ bool FileExists(const std::string& filename) {
   return ::access(filename.c_str(), F_OK) == 0;
 }
 
+bool GetFileSize(const std::string& filename, uint64_t* size) {
+  struct ::stat file_stat;
+  if (::stat(filename.c_str(), &file_stat) != 0) {
+    *size = 0;
+    return false;
+  }
+  *size = file_stat.st_size;
+  return true;
+}
+
 bool DeleteFile(const std::string& filename) {
   return ::unlink(filename.c_str()) == 0;
 }
 
+bool GetAllocatedSize(const std::string& filename, uint64_t* size) {
+  struct ::stat file_stat;
+  if (::stat(filename.c_str(), &file_stat) != 0) {
+    *size = 0;
+    return false;
+  }
+  *size = static_cast<uint64_t>(file_stat.st_blocks) * 512;
+  return true;
+}
+
+bool GetFreeSpace(const std::string& path, uint64_t* bytes) {
+  struct ::statvfs fs;
+  if (::statvfs(path.c_str(), &fs) != 0) {
+    *bytes = 0;
+    return false;
+  }
+  *bytes = static_cast<uint64_t>(fs.f_bavail) * fs.f_frsize;
+  return true;
+}
+
+bool PunchHole(const std::string& filename, uint64_t offset, uint64_t length) {
+  int fd = ::open(filename.c_str(), O_WRONLY);
+  if (fd < 0) return false;
+  bool success = ::fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length) == 0;
+  ::close(fd);
+  return success;
+}
+
+bool RenameFile(const std::string& from, const std::string& to) {
+  return ::rename(from.c_str(), to.c_str()) == 0;
+}
+
+bool WriteStringToFileSync(const std::string& data, const std::string& fname) {
+  int fd = ::open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return false;
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      ::close(fd);
+      return false;
+    }
+    done += n;
+  }
+  bool success = ::fsync(fd) == 0;
+  return ::close(fd) == 0 && success;
+}
+
+bool SyncDir(const std::string& dirname) {
+  int fd = ::open(dirname.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) return false;
+  bool success = ::fsync(fd) == 0;
+  ::close(fd);
+  return success;
+}
+
+bool SyncFile(const std::string& filename) {
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  bool success = ::fdatasync(fd) == 0;
+  ::close(fd);
+  return success;
+}
+
+bool CopyFileData(int src_fd, uint64_t src_offset, int dst_fd, uint64_t dst_offset, uint64_t length) {
+  loff_t in_off = src_offset;
+  loff_t out_off = dst_offset;
+  bool use_sendfile = false;
+  while (length > 0) {
+    ssize_t n;
+    if (!use_sendfile) {
+      n = ::copy_file_range(src_fd, &in_off, dst_fd, &out_off, length, 0);
+      if (n < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+        // sendfile writes at the file position of dst_fd
+        if (::lseek(dst_fd, out_off, SEEK_SET) < 0) return false;
+        use_sendfile = true;
+        continue;
+      }
+    } else {
+      off_t off = in_off;
+      n = ::sendfile(dst_fd, src_fd, &off, length);
+      if (n > 0) {
+        in_off = off;
+        out_off += n;
+      }
+    }
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (n == 0) return false; // source ended early
+    length -= n;
+  }
+  return true;
+}
 
 bool GetChildren(const std::string& directory_path,
                     std::vector<std::string>* result) {
@@ -86,4 +196,18 @@ void EncodeTo(FileMetaData* file, std::string& dst) {
   }
 }
 
+bool DecodeFrom(std::istream& in, uint32_t tag, FileMetaData* file) {
+  file->tag = tag;
+  if (tag == kFlag) {
+    in >> file->level >> file->column;
+    file->number = 0;
+  } else if (tag == kNewFile || tag == kMergedFile) {
+    in >> file->start >> file->length >> file->level >> file->column >> file->number
+       >> file->smallest >> file->largest >> file->filter_start >> file->filter_length;
+  } else {
+    return false;
+  }
+  return !in.fail();
+}
+
 }
@@ -6,6 +6,7 @@
 
 #include <string>
 #include <fstream>
+#include <istream>
 #include <vector>
 
 #include "util/coding.h"
@@ -17,7 +18,16 @@ enum Tag {
   kNewFile = 1,
   kFlag = 2, // for empty nodes 
   kMergedFile = 3, // for merged nodes
-  kMergedRef = 4 // for referece counters
+  kMergedRef = 4, // for referece counters
+  kFilterFile = 5, // number of the current filter file
+  kObsoleteFile = 6, // chunk file queued for deletion
+  kDroppedColumn = 7, // column whose version retention dropped or a delete removed
+  kDataPath = 8, // directory of a storage tier
+  kFilePath = 9, // tier of a chunk file not in dbname
+  kStagingPath = 10, // data path new chunks are staged in
+  kManifestGeneration = 11, // last record of a rewritten manifest
+  kSharedPath = 12, // data path of containers shared with other DBs
+  kPendingFile = 13 // output the DB is writing, deleted at open unless live
 };
 struct FileMetaData {
   uint32_t tag;
@@ -46,10 +56,31 @@ std::string MakeFileName(const std::string& dbname, uint64_t number,
 bool CreateDir(const std::string& dirname);
 bool DeleteFile(const std::string& filename);
 bool FileExists(const std::string& filename);
+bool GetFileSize(const std::string& filename, uint64_t* size);
+// bytes of disk the file occupies, holes excluded
+bool GetAllocatedSize(const std::string& filename, uint64_t* size);
+// bytes an unprivileged writer can still allocate on the filesystem of path
+bool GetFreeSpace(const std::string& path, uint64_t* bytes);
+// Deallocate [offset, offset + length) keeping the file size.
+bool PunchHole(const std::string& filename, uint64_t offset, uint64_t length);
+bool RenameFile(const std::string& from, const std::string& to);
+// Write data to fname and fsync it before returning.
+bool WriteStringToFileSync(const std::string& data, const std::string& fname);
+// fsync a directory so renames and unlinks inside it are durable.
+bool SyncDir(const std::string& dirname);
+// fdatasync a file written through another handle, e.g. an std::ofstream
+// after flush().
+bool SyncFile(const std::string& filename);
+// Copy length bytes between descriptors inside the kernel, with
+// copy_file_range and sendfile as fallback.
+bool CopyFileData(int src_fd, uint64_t src_offset, int dst_fd, uint64_t dst_offset, uint64_t length);
 bool GetChildren(const std::string& directory_path,
                     std::vector<std::string>* result);
 
 void EncodeTo(FileMetaData* file, std::string& dst);
+// Read the fields EncodeTo writes after tag. Returns false for tags
+// that are not file metadata.
+bool DecodeFrom(std::istream& in, uint32_t tag, FileMetaData* file);
 
 }
 
@@ -20,12 +20,15 @@ namespace tdchunk{
 FileLinkedList::FileLinkedList(std::vector<FileMetaData*>& list) {
 
   int max_file_num = 0;
-  std::sort(list.begin(), list.end(), &CompareFileMetaData);
+  // lists loaded from a snapshot are sorted already
+  if (!std::is_sorted(list.begin(), list.end(), &CompareFileMetaData)) {
+    std::sort(list.begin(), list.end(), &CompareFileMetaData);
+  }
   l0_head = nullptr;
 
   if (!list.empty()) {
     int cur_level = 0;
-    int cur_column = 0;
+    int cur_column = -1; // columns before a compacted one may be gone
     FileListNode* cur_child = nullptr;
     for (auto file : list) {
       //get max file number
@@ -36,7 +39,7 @@ FileLinkedList::FileLinkedList(std::vector<FileMetaData*>& list) {
 
       if (file->column != cur_column) {
         //switch to next column
-        assert(file->column == (cur_column + 1) );
+        assert(static_cast<int>(file->column) > cur_column);
         cur_column = file->column;
         cur_level = 0;
       }
@@ -269,14 +272,15 @@ std::vector<std::vector<FileMetaData*>> FileLinkedList::MergeColumns(int start,
 }
 
 // delete useless file and meta data
-void FileLinkedList::DeleteVersion(std::string dbname_, int n, std::vector<FileMetaData*>& should_delete) {
-  // 1. find target node and prev node
+bool FileLinkedList::DeleteVersion(int n, std::vector<FileMetaData*>& should_delete) {
+  // 1. find target node and prev node, nodes are newest first
   L0_ListNode* prev_node = nullptr;
   auto target_node = l0_head;
-  while (target_node != nullptr && target_node->children_head_->file_->column != n) {
+  while (target_node != nullptr && static_cast<int>(target_node->children_head_->file_->column) > n) {
     prev_node = target_node;
     target_node = target_node->next_;
   }
+  if (target_node == nullptr) return false;
 
   int width = (prev_node != nullptr) ? prev_node->num_of_children : 0;
 
@@ -290,7 +294,7 @@ void FileLinkedList::DeleteVersion(std::string dbname_, int n, std::vector<FileM
     // if level < width, save to merge
     // else should delete
     auto cur_child = current_node->children_head_;
-    auto prev_of_child = cur_child;
+    FileListNode* prev_of_child = nullptr;
     while (cur_child != nullptr) {
       if (cur_child->file_->level < width) {
         // save to merge
@@ -300,43 +304,179 @@ void FileLinkedList::DeleteVersion(std::string dbname_, int n, std::vector<FileM
         prev_of_child = cur_child;
         cur_child = cur_child->next_;
       } else {
-        //should delete
-        if (cur_child->file_->tag == kNewFile) {
-          should_delete.push_back(cur_child->file_);
-        }
-        // delete node and move to next
-        prev_of_child->next_ = nullptr;
-        prev_of_child = cur_child;
+        //should delete, flags too so they leave file_list and the manifest
+        should_delete.push_back(cur_child->file_);
+        // unlink node and move to next
         auto del_node = cur_child;
         cur_child = cur_child->next_;
+        if (prev_of_child == nullptr) {
+          current_node->children_head_ = cur_child;
+        } else {
+          prev_of_child->next_ = cur_child;
+        }
         delete del_node;
         current_node->num_of_children--;
       }
     }
     if (current_node->num_of_children == 0) {
-      prev_of_cur->next_ = nullptr;
-      prev_of_cur = current_node;
       auto del_l0_node = current_node;
       current_node = current_node->next_;
+      if (prev_of_cur == nullptr) {
+        l0_head = current_node;
+      } else {
+        prev_of_cur->next_ = current_node;
+      }
       delete del_l0_node;
     } else {
       prev_of_cur = current_node;
       current_node = current_node->next_;
     }
   }
-  
-  if (prev_node == nullptr) { 
-    // all nodes are deleted, reset l0_head
-    l0_head = nullptr;
+
+  // columns kept for newer versions can be consolidated with
+  // GetCompactionInputs / InstallCompaction
+  return true;
+}
+
+
+FileLinkedList::L0_ListNode* FileLinkedList::FindNode(int column, L0_ListNode** prev) {
+  L0_ListNode* prev_node = nullptr;
+  auto cur = l0_head;
+  while (cur != nullptr && static_cast<int>(cur->children_head_->file_->column) != column) {
+    prev_node = cur;
+    cur = cur->next_;
   }
+  if (prev != nullptr) *prev = prev_node;
+  return cur;
+}
 
-  // TODO:
-  // merge files to corresponding level
-  
+bool FileLinkedList::GetColumnRange(int* oldest, int* newest) {
+  if (l0_head == nullptr) return false;
+  *newest = l0_head->children_head_->file_->column;
+  auto cur = l0_head;
+  while (cur->next_ != nullptr) {
+    cur = cur->next_;
+  }
+  *oldest = cur->children_head_->file_->column;
+  return true;
+}
 
-  
+bool FileLinkedList::GetCompactionInputs(int start, int end, std::vector<std::vector<FileMetaData*>>* levels) {
+  auto end_node = FindNode(end, nullptr);
+  if (end_node == nullptr || start > end) return false;
+
+  // deeper levels of older columns are only read by versions before end
+  int width = end_node->num_of_children;
+  levels->clear();
+  levels->resize(width);
+  auto cur = end_node;
+  while (cur != nullptr && static_cast<int>(cur->children_head_->file_->column) >= start) {
+    auto child = cur->children_head_;
+    for (int level = 0; level < width && child != nullptr; level++) {
+      if (child->file_->tag == kNewFile || child->file_->tag == kMergedFile) {
+        (*levels)[level].push_back(child->file_);
+      }
+      child = child->next_;
+    }
+    cur = cur->next_;
+  }
+  return true;
+}
+
+bool FileLinkedList::InstallCompaction(int start, int end, const std::vector<FileMetaData*>& files,
+                                       std::vector<FileMetaData*>* obsolete) {
+  L0_ListNode* prev = nullptr;
+  auto end_node = FindNode(end, &prev);
+  if (end_node == nullptr || files.empty()) return false;
+
+  // unlink [start, end] and collect their metadata
+  auto cur = end_node;
+  while (cur != nullptr && static_cast<int>(cur->children_head_->file_->column) >= start) {
+    auto child = cur->children_head_;
+    while (child != nullptr) {
+      obsolete->push_back(child->file_);
+      child = child->next_;
+    }
+    auto to_del = cur;
+    cur = cur->next_;
+    delete to_del;
+  }
+
+  // the compacted column takes the place of end
+  auto node = new L0_ListNode(files[0], cur);
+  auto last_child = node->children_head_;
+  for (size_t level = 1; level < files.size(); level++) {
+    auto child = new FileListNode;
+    child->file_ = files[level];
+    child->next_ = nullptr;
+    last_child->next_ = child;
+    last_child = child;
+    node->num_of_children++;
+    if (files[level]->tag == kFlag) {
+      node->num_of_empty_children++;
+    }
+  }
+  if (prev == nullptr) {
+    l0_head = node;
+  } else {
+    prev->next_ = node;
+  }
+  return true;
+}
+
+void FileLinkedList::GetColumns(std::vector<int>* columns) {
+  columns->clear();
+  for (auto cur = l0_head; cur != nullptr; cur = cur->next_) {
+    columns->push_back(cur->children_head_->file_->column);
+  }
+}
+
+void FileLinkedList::DropColumns(const std::unordered_set<int>& dropped,
+                                 std::vector<FileMetaData*>* freed,
+                                 std::vector<FileMetaData*>* flags) {
+  if (l0_head == nullptr) return;
+  // width of the oldest kept version seen so far, older columns have
+  // at least as many levels
+  int width = l0_head->num_of_children;
+  for (auto cur = l0_head->next_; cur != nullptr; cur = cur->next_) {
+    int column = cur->children_head_->file_->column;
+    if (dropped.count(column) == 0) {
+      width = cur->num_of_children;
+      continue;
+    }
+    int level = 0;
+    for (auto child = cur->children_head_; child != nullptr; child = child->next_, level++) {
+      auto file = child->file_;
+      if (level < width || (file->tag != kNewFile && file->tag != kMergedFile)) continue;
+      FileMetaData* flag = new FileMetaData();
+      flag->tag = kFlag;
+      flag->level = file->level;
+      flag->column = file->column;
+      flag->number = 0;
+      child->file_ = flag;
+      cur->num_of_empty_children++;
+      freed->push_back(file);
+      flags->push_back(flag);
+    }
+  }
 }
 
+bool FileLinkedList::OldestDroppedRun(const std::unordered_set<int>& dropped, int* start, int* end) {
+  bool found = false;
+  int kept = -1;
+  for (auto cur = l0_head; cur != nullptr; cur = cur->next_) {
+    int column = cur->children_head_->file_->column;
+    if (cur != l0_head && dropped.count(column) != 0) {
+      // walking to older columns, the run grows downwards
+      *start = column;
+      *end = kept;
+      found = true;
+    } else {
+      kept = column;
+    }
+  }
+  return found;
+}
 
 bool FileLinkedList::GetOverlappedFilesL0(std::vector<FileMetaData*>& results){
   if (l0_head == nullptr) return false;
@@ -43,7 +43,9 @@ class FileLinkedList {
   void MoveChildrenToDeeperLevel(L0_ListNode* cur, std::vector<FileMetaData*>& file_list); // start from start_node
 
   bool GetVersion(int n, std::vector<FileMetaData*>& results);
-  void DeleteVersion(std::string dbname_, int n, std::vector<FileMetaData*>& should_delete);
+  // Delete version n and older ones. If column n was compacted away the
+  // newest column older than n is taken. Returns false if there is none.
+  bool DeleteVersion(int n, std::vector<FileMetaData*>& should_delete);
 
   bool GetOverlappedFilesL0(std::vector<FileMetaData*>& results);
 
@@ -55,10 +57,36 @@ class FileLinkedList {
   std::vector<std::vector<FileMetaData*>> MergeColumns(int start, int end);
   bool ShouldMerge(int& start, int& end, int every);
 
+  // oldest and newest column in the list
+  bool GetColumnRange(int* oldest, int* newest);
+
+  // Files that versions >= end read from columns [start, end], by level,
+  // newest column first.
+  bool GetCompactionInputs(int start, int end, std::vector<std::vector<FileMetaData*>>* levels);
+  // Replace columns [start, end] by one column end holding files, one per
+  // level. Metadata of the replaced nodes is appended to obsolete.
+  bool InstallCompaction(int start, int end, const std::vector<FileMetaData*>& files,
+                         std::vector<FileMetaData*>* obsolete);
+
+  // columns in the list, newest first
+  void GetColumns(std::vector<int>* columns);
+
+  // Drop the versions of columns in dropped, the newest column is never
+  // dropped. A chunk of a dropped column at level L is still read by the
+  // oldest kept version v above it iff L < width(v). Other chunks are
+  // replaced by new kFlag metas, appended to flags, and their metadata is
+  // appended to freed.
+  void DropColumns(const std::unordered_set<int>& dropped, std::vector<FileMetaData*>* freed,
+                   std::vector<FileMetaData*>* flags);
+
+  // Oldest run [start, end) of dropped columns, end is the kept column
+  // right above it. CompactColumns(start, end) folds the run into end.
+  bool OldestDroppedRun(const std::unordered_set<int>& dropped, int* start, int* end);
+
   uint64_t max_file_num_;
  private:
+  L0_ListNode* FindNode(int column, L0_ListNode** prev);
 
-  
   L0_ListNode* l0_head;
   
 };
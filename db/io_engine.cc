@@ -0,0 +1,386 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "io_engine.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+#include "thread_pool.h"
+
+namespace tdchunk {
+
+char* AllocateAligned(size_t size) {
+  void* buf = nullptr;
+  if (size == 0) size = kDirectIOAlignment;
+  if (::posix_memalign(&buf, kDirectIOAlignment, size) != 0) {
+    return nullptr;
+  }
+  return static_cast<char*>(buf);
+}
+
+void FreeAligned(char* buf) {
+  ::free(buf);
+}
+
+namespace {
+
+bool IsAligned(const IORequest& r) {
+  return r.offset % kDirectIOAlignment == 0 &&
+         r.length % kDirectIOAlignment == 0 &&
+         reinterpret_cast<uintptr_t>(r.buf) % kDirectIOAlignment == 0;
+}
+
+// Descriptors opened for one batch: a buffered one per file and, with
+// direct I/O enabled, an O_DIRECT one used by aligned requests.
+class FileTable {
+ public:
+  FileTable(bool write, bool direct) : write_(write), direct_(direct) {}
+  FileTable(const FileTable&) = delete;
+  FileTable& operator=(const FileTable&) = delete;
+
+  ~FileTable() {
+    for (auto& pair : buffered_) {
+      if (pair.second >= 0) ::close(pair.second);
+    }
+    for (auto& pair : direct_fds_) {
+      if (pair.second >= 0) ::close(pair.second);
+    }
+  }
+
+  // Returns a descriptor for r, or -errno.
+  int Get(const IORequest& r) {
+    bool direct = direct_ && IsAligned(r);
+    auto& table = direct ? direct_fds_ : buffered_;
+    auto it = table.find(r.file_name);
+    if (it != table.end()) return it->second;
+
+    int flags = write_ ? (O_RDWR | O_CREAT) : O_RDONLY;
+    if (direct) flags |= O_DIRECT;
+    int fd = ::open(r.file_name.c_str(), flags, 0644);
+    if (fd < 0 && direct) {
+      // e.g. tmpfs does not support O_DIRECT
+      fd = ::open(r.file_name.c_str(), flags & ~O_DIRECT, 0644);
+    }
+    if (fd < 0) fd = -errno;
+    table[r.file_name] = fd;
+    return fd;
+  }
+
+ private:
+  bool write_;
+  bool direct_;
+  std::unordered_map<std::string, int> buffered_;
+  std::unordered_map<std::string, int> direct_fds_;
+};
+
+uint64_t MaxTransfer(const IOEngineOptions& options) {
+  // a cqe result is an int, stay below 2^31 whatever the option says
+  static const uint64_t kLimit = 1ull << 30;
+  if (options.max_transfer_bytes == 0 || options.max_transfer_bytes > kLimit) return kLimit;
+  // split points stay aligned for O_DIRECT
+  return std::max(kDirectIOAlignment,
+                  options.max_transfer_bytes - options.max_transfer_bytes % kDirectIOAlignment);
+}
+
+bool AllFinished(const std::vector<IORequest>& reqs) {
+  for (const auto& r : reqs) {
+    if (r.result != static_cast<int64_t>(r.length)) return false;
+  }
+  return true;
+}
+
+class ThreadPoolIOEngine : public IOEngine {
+ public:
+  explicit ThreadPoolIOEngine(const IOEngineOptions& options)
+    : pool_(options.num_threads),
+      use_direct_io_(options.use_direct_io),
+      max_transfer_(MaxTransfer(options)) {}
+
+  bool Read(std::vector<IORequest>& reqs) override { return Run(reqs, false); }
+  bool Write(std::vector<IORequest>& reqs) override { return Run(reqs, true); }
+
+  const char* Name() const override { return "threadpool"; }
+
+ private:
+  static void Transfer(int fd, IORequest* r, bool write, uint64_t max_transfer) {
+    uint64_t done = 0;
+    while (done < r->length) {
+      size_t len = std::min(r->length - done, max_transfer);
+      ssize_t n = write ? ::pwrite(fd, r->buf + done, len, r->offset + done)
+                        : ::pread(fd, r->buf + done, len, r->offset + done);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        r->result = -errno;
+        return;
+      }
+      if (n == 0) break; // EOF
+      done += n;
+    }
+    r->result = done;
+  }
+
+  bool Run(std::vector<IORequest>& reqs, bool write) {
+    FileTable files(write, use_direct_io_);
+    WaitGroup wg;
+    for (auto& r : reqs) {
+      int fd = files.Get(r);
+      if (fd < 0) {
+        r.result = fd;
+        continue;
+      }
+      IORequest* req = &r;
+      uint64_t max_transfer = max_transfer_;
+      wg.Add(1);
+      pool_.Schedule([fd, req, write, max_transfer, &wg] {
+        Transfer(fd, req, write, max_transfer);
+        wg.Done();
+      });
+    }
+    wg.Wait();
+    return AllFinished(reqs);
+  }
+
+  ThreadPool pool_;
+  bool use_direct_io_;
+  uint64_t max_transfer_;
+};
+
+int SysUringSetup(unsigned entries, struct io_uring_params* p) {
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+int SysUringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                                    flags, nullptr, 0));
+}
+
+int SysUringRegister(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+  return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+// io_uring driven through the raw syscalls. A batch keeps up to
+// queue_depth requests in flight and resubmits the rest of short
+// transfers, so hundreds of (file, offset, length) ranges are issued
+// without waiting on each other.
+class UringIOEngine : public IOEngine {
+ public:
+  explicit UringIOEngine(const IOEngineOptions& options)
+    : ring_fd_(-1),
+      depth_(options.queue_depth > 0 ? options.queue_depth : 1),
+      use_direct_io_(options.use_direct_io),
+      max_transfer_(MaxTransfer(options)),
+      sq_ptr_(MAP_FAILED), cq_ptr_(MAP_FAILED), sqes_(MAP_FAILED),
+      sq_ring_size_(0), cq_ring_size_(0), sqes_size_(0) {}
+
+  ~UringIOEngine() override {
+    if (sqes_ != MAP_FAILED) ::munmap(sqes_, sqes_size_);
+    if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) ::munmap(cq_ptr_, cq_ring_size_);
+    if (sq_ptr_ != MAP_FAILED) ::munmap(sq_ptr_, sq_ring_size_);
+    if (ring_fd_ >= 0) ::close(ring_fd_);
+  }
+
+  // Returns false if the kernel has no io_uring or lacks IORING_OP_READ
+  // and IORING_OP_WRITE (< 5.6).
+  bool Init() {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring_fd_ = SysUringSetup(depth_, &p);
+    if (ring_fd_ < 0) return false;
+
+    sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+      if (cq_ring_size_ > sq_ring_size_) sq_ring_size_ = cq_ring_size_;
+      cq_ring_size_ = sq_ring_size_;
+    }
+    sq_ptr_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) return false;
+    if (single_mmap) {
+      cq_ptr_ = sq_ptr_;
+    } else {
+      cq_ptr_ = ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+      if (cq_ptr_ == MAP_FAILED) return false;
+    }
+    sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) return false;
+
+    char* sq = static_cast<char*>(sq_ptr_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_entries_ = p.sq_entries;
+    sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    char* cq = static_cast<char*>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+
+    if (depth_ > static_cast<int>(sq_entries_)) depth_ = sq_entries_;
+
+    // probe for plain read/write opcodes
+    const unsigned kProbeOps = 256;
+    std::vector<char> probe_buf(sizeof(struct io_uring_probe) +
+                                kProbeOps * sizeof(struct io_uring_probe_op), 0);
+    auto probe = reinterpret_cast<struct io_uring_probe*>(probe_buf.data());
+    if (SysUringRegister(ring_fd_, IORING_REGISTER_PROBE, probe, kProbeOps) < 0) {
+      return false;
+    }
+    return OpSupported(probe, IORING_OP_READ) && OpSupported(probe, IORING_OP_WRITE);
+  }
+
+  bool Read(std::vector<IORequest>& reqs) override { return Run(reqs, false); }
+  bool Write(std::vector<IORequest>& reqs) override { return Run(reqs, true); }
+
+  const char* Name() const override { return "io_uring"; }
+
+ private:
+  static bool OpSupported(struct io_uring_probe* probe, int op) {
+    return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+  }
+
+  // Queue the remaining part of request i. Returns false if the
+  // submission queue is full.
+  bool Prepare(bool write, int fd, const IORequest& r, uint64_t done, size_t i) {
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    unsigned tail = *sq_tail_;
+    if (tail - head >= sq_entries_) return false;
+    unsigned index = tail & sq_mask_;
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(sqes_) + index;
+    memset(sqe, 0, sizeof(*sqe));
+
+    char* buf = r.buf + done;
+    // the rest of a split request goes in as a short transfer
+    uint64_t len = std::min(r.length - done, max_transfer_);
+    sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->off = r.offset + done;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = static_cast<uint32_t>(len);
+    sqe->user_data = i;
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  bool Run(std::vector<IORequest>& reqs, bool write) {
+    std::lock_guard<std::mutex> l(mu_);
+    FileTable files(write, use_direct_io_);
+    std::vector<int> fds(reqs.size());
+    std::vector<uint64_t> done(reqs.size(), 0);
+    std::deque<size_t> pending;
+    for (size_t i = 0; i < reqs.size(); i++) {
+      reqs[i].result = 0;
+      fds[i] = files.Get(reqs[i]);
+      if (fds[i] < 0) {
+        reqs[i].result = fds[i];
+      } else if (reqs[i].length > 0) {
+        pending.push_back(i);
+      }
+    }
+
+    int inflight = 0;
+    unsigned to_submit = 0;
+    while (!pending.empty() || inflight > 0) {
+      while (!pending.empty() && inflight < depth_) {
+        size_t i = pending.front();
+        if (!Prepare(write, fds[i], reqs[i], done[i], i)) break;
+        pending.pop_front();
+        inflight++;
+        to_submit++;
+      }
+
+      int ret = SysUringEnter(ring_fd_, to_submit, 1, IORING_ENTER_GETEVENTS);
+      if (ret < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+        // the ring is unusable, fail whatever has not completed
+        for (auto& r : reqs) {
+          if (r.result == 0 && r.length > 0) r.result = -errno;
+        }
+        return false;
+      }
+      to_submit -= ret;
+
+      unsigned head = *cq_head_;
+      unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+      while (head != tail) {
+        struct io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+        size_t i = cqe->user_data;
+        inflight--;
+        if (cqe->res == -EAGAIN || cqe->res == -EINTR) {
+          pending.push_back(i);
+        } else if (cqe->res < 0) {
+          reqs[i].result = cqe->res;
+        } else if (cqe->res == 0) { // EOF
+          reqs[i].result = done[i];
+        } else {
+          done[i] += cqe->res;
+          if (done[i] < reqs[i].length) {
+            pending.push_back(i); // short transfer, submit the rest
+          } else {
+            reqs[i].result = done[i];
+          }
+        }
+        head++;
+      }
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+    return AllFinished(reqs);
+  }
+
+  std::mutex mu_; // one batch owns the ring at a time
+  int ring_fd_;
+  int depth_;
+  bool use_direct_io_;
+  uint64_t max_transfer_;
+
+  void* sq_ptr_;
+  void* cq_ptr_;
+  void* sqes_;
+  size_t sq_ring_size_;
+  size_t cq_ring_size_;
+  size_t sqes_size_;
+
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  struct io_uring_cqe* cqes_;
+};
+
+}  // namespace
+
+IOEngine* NewIOEngine(const IOEngineOptions& options) {
+  if (options.type == kUringIO) {
+    UringIOEngine* engine = new UringIOEngine(options);
+    if (engine->Init()) {
+      return engine;
+    }
+    delete engine;
+  }
+  return new ThreadPoolIOEngine(options);
+}
+
+}
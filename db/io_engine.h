@@ -0,0 +1,66 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tdchunk {
+
+// One read or write of [offset, offset + length) of a chunk file.
+struct IORequest {
+  std::string file_name;
+  uint64_t offset = 0;
+  uint64_t length = 0;
+  char* buf = nullptr; // caller owned, at least length bytes
+  int64_t result = 0;  // bytes transferred, or -errno
+};
+
+enum IOEngineType {
+  kThreadPoolIO = 0, // pread/pwrite on a thread pool
+  kUringIO = 1       // io_uring, falls back to kThreadPoolIO if unavailable
+};
+
+struct IOEngineOptions {
+  IOEngineType type = kUringIO;
+  // max requests in flight
+  int queue_depth = 64;
+  // workers of the thread pool engine
+  int num_threads = 8;
+  // open files with O_DIRECT. Only requests whose offset, length and buf
+  // are aligned to kDirectIOAlignment bypass the page cache, the others
+  // go through a buffered descriptor.
+  bool use_direct_io = false;
+  // bytes one submission transfers at most, longer requests are split.
+  // An io_uring sqe holds a 32-bit length and a cqe a 32-bit result.
+  uint64_t max_transfer_bytes = 1ull << 30;
+};
+
+static const uint64_t kDirectIOAlignment = 4096;
+
+class IOEngine {
+ public:
+  virtual ~IOEngine() {}
+
+  // Submit all requests as one batch and return when every one of them
+  // has finished. Returns true if all requests transferred their full
+  // length.
+  virtual bool Read(std::vector<IORequest>& reqs) = 0;
+  virtual bool Write(std::vector<IORequest>& reqs) = 0;
+
+  virtual const char* Name() const = 0;
+};
+
+// Create an engine for options.type. Returns a thread pool engine when
+// io_uring cannot be set up on this kernel.
+IOEngine* NewIOEngine(const IOEngineOptions& options);
+
+// Aligned allocation usable as an O_DIRECT buffer, free with FreeAligned.
+char* AllocateAligned(size_t size);
+void FreeAligned(char* buf);
+
+}
@@ -0,0 +1,115 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "io_engine.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "file_helper.h"
+#include "util/testharness.h"
+
+namespace tdchunk {
+
+static std::string Pattern(size_t size, int seed) {
+  std::string s;
+  for (size_t i = 0; i < size; i++) {
+    s.push_back(static_cast<char>((i * 7 + seed) % 251));
+  }
+  return s;
+}
+
+// Write three ranges of one file and two files in one batch each, then
+// read them back in one batch.
+static void CheckRoundTrip(const IOEngineOptions& options, const std::string& dir) {
+  IOEngine* engine = NewIOEngine(options);
+  std::vector<std::string> data = {Pattern(10000, 1), Pattern(4096, 2), Pattern(123, 3)};
+  std::vector<uint64_t> offsets = {0, 12288, 20000};
+  std::vector<IORequest> writes;
+  for (size_t i = 0; i < data.size(); i++) {
+    IORequest r;
+    r.file_name = dir + (i == 2 ? "/000002.tdc" : "/000001.tdc");
+    r.offset = offsets[i];
+    r.length = data[i].size();
+    r.buf = &data[i][0];
+    writes.push_back(r);
+  }
+  ASSERT_TRUE(engine->Write(writes)) << engine->Name();
+
+  std::vector<std::string> out(data.size());
+  std::vector<IORequest> reads = writes;
+  for (size_t i = 0; i < reads.size(); i++) {
+    out[i].resize(data[i].size());
+    reads[i].buf = &out[i][0];
+    reads[i].result = 0;
+  }
+  ASSERT_TRUE(engine->Read(reads)) << engine->Name();
+  for (size_t i = 0; i < data.size(); i++) {
+    ASSERT_EQ(reads[i].result, static_cast<int64_t>(data[i].size()));
+    ASSERT_TRUE(out[i] == data[i]) << engine->Name() << " range " << i;
+  }
+
+  // a read past EOF reports the bytes that were there
+  IORequest tail;
+  std::string buf(200, '\0');
+  tail.file_name = dir + "/000002.tdc";
+  tail.offset = 20000;
+  tail.length = buf.size();
+  tail.buf = &buf[0];
+  std::vector<IORequest> short_read(1, tail);
+  ASSERT_FALSE(engine->Read(short_read));
+  ASSERT_EQ(short_read[0].result, 123);
+  delete engine;
+}
+
+TEST(IOEngine, ThreadPool) {
+  IOEngineOptions options;
+  options.type = kThreadPoolIO;
+  CheckRoundTrip(options, lsedb::test::TmpDir("io_threadpool"));
+}
+
+TEST(IOEngine, Uring) {
+  // falls back to the thread pool where io_uring is not available
+  IOEngineOptions options;
+  options.type = kUringIO;
+  CheckRoundTrip(options, lsedb::test::TmpDir("io_uring"));
+}
+
+TEST(IOEngine, SplitTransfers) {
+  // requests longer than max_transfer_bytes go in several submissions
+  for (int type = kThreadPoolIO; type <= kUringIO; type++) {
+    IOEngineOptions options;
+    options.type = static_cast<IOEngineType>(type);
+    options.max_transfer_bytes = 4096;
+    CheckRoundTrip(options, lsedb::test::TmpDir("io_split"));
+  }
+}
+
+TEST(IOEngine, DirectIO) {
+  IOEngineOptions options;
+  options.use_direct_io = true;
+  options.max_transfer_bytes = 8192;
+  std::string dir = lsedb::test::TmpDir("io_direct");
+  IOEngine* engine = NewIOEngine(options);
+  char* buf = AllocateAligned(3 * kDirectIOAlignment);
+  std::string data = Pattern(3 * kDirectIOAlignment, 5);
+  data.copy(buf, data.size());
+  IORequest r;
+  r.file_name = dir + "/000001.tdc";
+  r.length = data.size();
+  r.buf = buf;
+  std::vector<IORequest> reqs(1, r);
+  ASSERT_TRUE(engine->Write(reqs));
+  std::fill(buf, buf + data.size(), 0);
+  reqs[0].result = 0;
+  ASSERT_TRUE(engine->Read(reqs));
+  ASSERT_TRUE(std::string(buf, data.size()) == data);
+  FreeAligned(buf);
+  delete engine;
+}
+
+}
+
+int main() { return lsedb::test::RunAllTests(); }
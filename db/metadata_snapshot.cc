@@ -0,0 +1,205 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "metadata_snapshot.h"
+
+#include <cstring>
+
+#include "util/coding.h"
+#include "util/crc32c.h"
+
+namespace tdchunk {
+
+static const char kSnapshotMagic[] = "TDCSNAPS";
+static const size_t kSnapshotMagicSize = 8;
+static const uint32_t kSnapshotFormatVersion = 3;
+// magic, fixed32 format version, fixed32 crc32c of the rest
+static const size_t kSnapshotHeaderSize = kSnapshotMagicSize + 8;
+
+namespace {
+
+// bounds checked reads over the snapshot, ok() turns false on the first
+// read past the end
+class SnapshotReader {
+ public:
+  SnapshotReader(const char* p, const char* limit) : p_(p), limit_(limit) {}
+
+  uint32_t Get32() {
+    uint32_t v = 0;
+    if (p_ != nullptr) p_ = lsedb::GetVarint32Ptr(p_, limit_, &v);
+    return v;
+  }
+
+  uint64_t Get64() {
+    uint64_t v = 0;
+    if (p_ != nullptr) p_ = lsedb::GetVarint64Ptr(p_, limit_, &v);
+    return v;
+  }
+
+  std::string GetString() {
+    uint32_t size = Get32();
+    if (p_ == nullptr || static_cast<size_t>(limit_ - p_) < size) {
+      p_ = nullptr;
+      return std::string();
+    }
+    std::string s(p_, size);
+    p_ += size;
+    return s;
+  }
+
+  // a count of entries, each at least one byte long
+  uint32_t GetCount() {
+    uint32_t n = Get32();
+    if (p_ == nullptr || static_cast<size_t>(limit_ - p_) < n) {
+      p_ = nullptr;
+      return 0;
+    }
+    return n;
+  }
+
+  bool ok() const { return p_ != nullptr; }
+  bool done() const { return p_ == limit_; }
+
+ private:
+  const char* p_;
+  const char* limit_;
+};
+
+}  // namespace
+
+void EncodeSnapshot(const MetadataSnapshot& snapshot, std::string* dst) {
+  size_t header = dst->size();
+  dst->append(kSnapshotMagic, kSnapshotMagicSize);
+  lsedb::PutFixed32(dst, kSnapshotFormatVersion);
+  lsedb::PutFixed32(dst, 0);
+  lsedb::PutVarint64(dst, snapshot.manifest_size);
+  lsedb::PutLengthPrefixedString(dst, snapshot.manifest_tail);
+  lsedb::PutVarint64(dst, snapshot.generation);
+
+  // the fields the manifest logs for each tag
+  lsedb::PutVarint32(dst, snapshot.files.size());
+  for (auto file : snapshot.files) {
+    lsedb::PutVarint32(dst, file->tag);
+    lsedb::PutVarint32(dst, file->level);
+    lsedb::PutVarint32(dst, file->column);
+    if (file->tag == kFlag) continue;
+    lsedb::PutVarint64(dst, file->start);
+    lsedb::PutVarint64(dst, file->length);
+    lsedb::PutVarint64(dst, file->number);
+    lsedb::PutVarint32(dst, file->smallest);
+    lsedb::PutVarint32(dst, file->largest);
+    lsedb::PutVarint64(dst, file->filter_start);
+    lsedb::PutVarint64(dst, file->filter_length);
+  }
+
+  lsedb::PutVarint32(dst, snapshot.merged_refs.size());
+  for (const auto& ref : snapshot.merged_refs) {
+    lsedb::PutVarint64(dst, ref.first);
+    lsedb::PutVarint32(dst, static_cast<uint32_t>(ref.second));
+  }
+  lsedb::PutVarint64(dst, snapshot.filter_number);
+  lsedb::PutVarint32(dst, snapshot.dropped_columns.size());
+  for (auto column : snapshot.dropped_columns) {
+    lsedb::PutVarint32(dst, static_cast<uint32_t>(column));
+  }
+  lsedb::PutVarint32(dst, snapshot.obsolete.size());
+  for (auto number : snapshot.obsolete) {
+    lsedb::PutVarint64(dst, number);
+  }
+  lsedb::PutVarint32(dst, snapshot.data_paths.size());
+  for (const auto& path : snapshot.data_paths) {
+    lsedb::PutVarint32(dst, path.first);
+    lsedb::PutLengthPrefixedString(dst, path.second);
+  }
+  lsedb::PutVarint32(dst, snapshot.file_paths.size());
+  for (const auto& path : snapshot.file_paths) {
+    lsedb::PutVarint64(dst, path.first);
+    lsedb::PutVarint32(dst, path.second);
+  }
+  lsedb::PutVarint32(dst, snapshot.staging_path_id);
+  lsedb::PutVarint32(dst, snapshot.shared_path_id);
+
+  uint32_t crc = lsedb::crc32c::Value(dst->data() + header + kSnapshotHeaderSize,
+                                      dst->size() - header - kSnapshotHeaderSize);
+  lsedb::EncodeFixed32(&(*dst)[header + kSnapshotMagicSize + 4], crc);
+}
+
+bool DecodeSnapshot(const std::string& src, MetadataSnapshot* snapshot) {
+  if (src.size() < kSnapshotHeaderSize ||
+      std::memcmp(src.data(), kSnapshotMagic, kSnapshotMagicSize) != 0 ||
+      lsedb::DecodeFixed32(src.data() + kSnapshotMagicSize) != kSnapshotFormatVersion) {
+    return false;
+  }
+  // a torn or flipped snapshot can still parse, and a tail that matches
+  // the manifest does not vouch for the rest of it
+  const char* payload = src.data() + kSnapshotHeaderSize;
+  size_t payload_size = src.size() - kSnapshotHeaderSize;
+  if (lsedb::crc32c::Value(payload, payload_size) !=
+      lsedb::DecodeFixed32(src.data() + kSnapshotMagicSize + 4)) {
+    return false;
+  }
+  SnapshotReader in(payload, payload + payload_size);
+  snapshot->manifest_size = in.Get64();
+  snapshot->manifest_tail = in.GetString();
+  snapshot->generation = in.Get64();
+
+  uint32_t n = in.GetCount();
+  snapshot->files.reserve(n);
+  for (uint32_t i = 0; i < n && in.ok(); i++) {
+    FileMetaData* file = new FileMetaData;
+    file->tag = in.Get32();
+    file->level = in.Get32();
+    file->column = in.Get32();
+    if (file->tag == kFlag) {
+      file->number = 0;
+    } else {
+      file->start = in.Get64();
+      file->length = in.Get64();
+      file->number = in.Get64();
+      file->smallest = in.Get32();
+      file->largest = in.Get32();
+      file->filter_start = in.Get64();
+      file->filter_length = in.Get64();
+    }
+    snapshot->files.push_back(file);
+  }
+
+  n = in.GetCount();
+  for (uint32_t i = 0; i < n && in.ok(); i++) {
+    uint64_t number = in.Get64();
+    snapshot->merged_refs.push_back(std::make_pair(number, static_cast<int>(in.Get32())));
+  }
+  snapshot->filter_number = in.Get64();
+  n = in.GetCount();
+  for (uint32_t i = 0; i < n && in.ok(); i++) {
+    snapshot->dropped_columns.push_back(static_cast<int>(in.Get32()));
+  }
+  n = in.GetCount();
+  for (uint32_t i = 0; i < n && in.ok(); i++) {
+    snapshot->obsolete.push_back(in.Get64());
+  }
+  n = in.GetCount();
+  for (uint32_t i = 0; i < n && in.ok(); i++) {
+    uint32_t path_id = in.Get32();
+    snapshot->data_paths.push_back(std::make_pair(path_id, in.GetString()));
+  }
+  n = in.GetCount();
+  for (uint32_t i = 0; i < n && in.ok(); i++) {
+    uint64_t number = in.Get64();
+    snapshot->file_paths.push_back(std::make_pair(number, in.Get32()));
+  }
+  snapshot->staging_path_id = in.Get32();
+  snapshot->shared_path_id = in.Get32();
+
+  if (!in.ok() || !in.done()) {
+    for (auto file : snapshot->files) {
+      delete file;
+    }
+    snapshot->files.clear();
+    return false;
+  }
+  return true;
+}
+
+}
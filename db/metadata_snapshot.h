@@ -0,0 +1,50 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "file_helper.h"
+
+namespace tdchunk {
+
+// Binary image of a rewritten manifest, so open restores the file list
+// with one read and no parsing or sorting. It holds what the manifest
+// held when it was manifest_size bytes long. Records appended to the
+// manifest after that are replayed from the manifest itself.
+struct MetadataSnapshot {
+  uint64_t manifest_size = 0;
+  // last bytes of those manifest_size bytes, ending with the generation
+  // record, a snapshot is used only if the manifest still has them
+  std::string manifest_tail;
+  uint64_t generation = 0;
+
+  // live files sorted by CompareFileMetaData, owned by the caller
+  std::vector<FileMetaData*> files;
+  std::vector<std::pair<uint64_t, int>> merged_refs;
+  uint64_t filter_number = 0;
+  std::vector<int> dropped_columns;
+  std::vector<uint64_t> obsolete;
+  // path id, directory
+  std::vector<std::pair<uint32_t, std::string>> data_paths;
+  // file number, path id
+  std::vector<std::pair<uint64_t, uint32_t>> file_paths;
+  uint32_t staging_path_id = 0;
+  uint32_t shared_path_id = 0;
+};
+
+// bytes of the manifest a snapshot remembers
+const size_t kSnapshotTailSize = 64;
+
+void EncodeSnapshot(const MetadataSnapshot& snapshot, std::string* dst);
+// Returns false for a truncated or corrupt snapshot, or one whose crc32c
+// does not match, in which case no files are left allocated in
+// snapshot->files.
+bool DecodeSnapshot(const std::string& src, MetadataSnapshot* snapshot);
+
+}
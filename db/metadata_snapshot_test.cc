@@ -0,0 +1,91 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "metadata_snapshot.h"
+
+#include "util/testharness.h"
+
+namespace tdchunk {
+
+static void ClearFiles(MetadataSnapshot* snapshot) {
+  for (auto file : snapshot->files) {
+    delete file;
+  }
+  snapshot->files.clear();
+}
+
+static std::string Encode() {
+  MetadataSnapshot snapshot;
+  snapshot.manifest_size = 1234;
+  snapshot.manifest_tail = "11 7\n";
+  snapshot.generation = 7;
+  FileMetaData file;
+  file.tag = kNewFile;
+  file.level = 1;
+  file.column = 3;
+  file.start = 10;
+  file.length = 4096;
+  file.number = 42;
+  file.smallest = 5;
+  file.largest = 900;
+  FileMetaData flag;
+  flag.tag = kFlag;
+  flag.level = 0;
+  flag.column = 4;
+  snapshot.files.push_back(&file);
+  snapshot.files.push_back(&flag);
+  snapshot.merged_refs.push_back(std::make_pair(42ull, 2));
+  snapshot.filter_number = 99;
+  snapshot.dropped_columns.push_back(2);
+  snapshot.obsolete.push_back(17);
+  snapshot.data_paths.push_back(std::make_pair(1u, std::string("/cold")));
+  snapshot.file_paths.push_back(std::make_pair(42ull, 1u));
+  snapshot.staging_path_id = 1;
+  std::string encoded;
+  EncodeSnapshot(snapshot, &encoded);
+  return encoded;
+}
+
+TEST(MetadataSnapshot, RoundTrip) {
+  MetadataSnapshot snapshot;
+  ASSERT_TRUE(DecodeSnapshot(Encode(), &snapshot));
+  ASSERT_EQ(snapshot.manifest_size, 1234u);
+  ASSERT_EQ(snapshot.manifest_tail, "11 7\n");
+  ASSERT_EQ(snapshot.generation, 7u);
+  ASSERT_EQ(snapshot.files.size(), 2u);
+  ASSERT_EQ(snapshot.files[0]->number, 42u);
+  ASSERT_EQ(snapshot.files[0]->length, 4096u);
+  ASSERT_EQ(snapshot.files[0]->largest, 900u);
+  ASSERT_EQ(snapshot.files[1]->tag, static_cast<uint32_t>(kFlag));
+  ASSERT_EQ(snapshot.files[1]->column, 4u);
+  ASSERT_EQ(snapshot.merged_refs[0].second, 2);
+  ASSERT_EQ(snapshot.filter_number, 99u);
+  ASSERT_EQ(snapshot.dropped_columns[0], 2);
+  ASSERT_EQ(snapshot.obsolete[0], 17u);
+  ASSERT_EQ(snapshot.data_paths[0].second, "/cold");
+  ASSERT_EQ(snapshot.file_paths[0].second, 1u);
+  ASSERT_EQ(snapshot.staging_path_id, 1u);
+  ClearFiles(&snapshot);
+}
+
+TEST(MetadataSnapshot, Corruption) {
+  std::string encoded = Encode();
+  // every flipped bit and every truncation is caught
+  for (size_t i = 0; i < encoded.size(); i++) {
+    for (int bit = 0; bit < 8; bit++) {
+      std::string corrupt = encoded;
+      corrupt[i] ^= static_cast<char>(1 << bit);
+      MetadataSnapshot snapshot;
+      ASSERT_FALSE(DecodeSnapshot(corrupt, &snapshot)) << i << " " << bit;
+      ASSERT_TRUE(snapshot.files.empty());
+    }
+    MetadataSnapshot snapshot;
+    ASSERT_FALSE(DecodeSnapshot(encoded.substr(0, i), &snapshot)) << i;
+    ASSERT_TRUE(snapshot.files.empty());
+  }
+}
+
+}
+
+int main() { return lsedb::test::RunAllTests(); }
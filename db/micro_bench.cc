@@ -0,0 +1,341 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Microbenchmarks of the hot kernels: bloom filters, chunk decoding, the
+// extraction merge-join, manifest encoding and version lookup. Each
+// benchmark runs with doubling iteration counts until one run takes at
+// least --min_time seconds; inputs come from fixed seeds so runs can be
+// compared across commits.
+//
+//   micro_bench --filter=MergeJoin --min_time=1
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <msgpack.hpp>
+
+#include "bloom_filter.h"
+#include "extraction.h"
+#include "file_helper.h"
+#include "file_list.h"
+
+using namespace tdchunk;
+
+namespace {
+
+// flags
+std::string FLAGS_filter = "";  // run benchmarks whose name contains this
+double FLAGS_min_time = 0.5;    // seconds per benchmark
+
+uint64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Keep the compiler from dropping a value computed in the timed loop.
+template <class T>
+inline void DoNotOptimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Passed to each benchmark. Setup goes before the first KeepRunning(),
+// which starts the timer.
+class State {
+ public:
+  State(int64_t arg, uint64_t max_iterations)
+    : arg_(arg), max_iterations_(max_iterations) {}
+
+  bool KeepRunning() {
+    if (iterations_ == 0) start_ = NowNanos();
+    if (iterations_ < max_iterations_) {
+      iterations_++;
+      return true;
+    }
+    elapsed_ = NowNanos() - start_;
+    return false;
+  }
+
+  int64_t range() const { return arg_; }
+  uint64_t iterations() const { return iterations_; }
+  uint64_t elapsed_nanos() const { return elapsed_; }
+
+  void SetItemsProcessed(int64_t items) { items_ = items; }
+  void SetBytesProcessed(int64_t bytes) { bytes_ = bytes; }
+  int64_t items_processed() const { return items_; }
+  int64_t bytes_processed() const { return bytes_; }
+
+ private:
+  int64_t arg_;
+  uint64_t max_iterations_;
+  uint64_t iterations_ = 0;
+  uint64_t start_ = 0;
+  uint64_t elapsed_ = 0;
+  int64_t items_ = 0;
+  int64_t bytes_ = 0;
+};
+
+typedef void (*BenchmarkFunction)(State&);
+
+struct Benchmark {
+  const char* name;
+  BenchmarkFunction fn;
+  std::vector<int64_t> args;
+};
+
+std::vector<uint32_t> RandomKeys(size_t n, uint32_t seed) {
+  std::mt19937 rnd(seed);
+  std::vector<uint32_t> keys(n);
+  for (auto& k : keys) k = rnd();
+  return keys;
+}
+
+ChunkMap RandomChunk(size_t rows, uint32_t key_range, int dim, uint32_t seed) {
+  std::mt19937 rnd(seed);
+  std::uniform_real_distribution<double> value(-1.0, 1.0);
+  ChunkMap chunk;
+  while (chunk.size() < rows) {
+    std::vector<double>& row = chunk[rnd() % key_range];
+    row.resize(dim);
+    for (auto& v : row) v = value(rnd);
+  }
+  return chunk;
+}
+
+void BM_CreateFilter(State& state) {
+  BloomFilterPolicy policy(16);
+  std::vector<uint32_t> keys = RandomKeys(state.range(), 301);
+  std::string filter;
+  while (state.KeepRunning()) {
+    filter.clear();
+    policy.CreateFilter(keys, &filter);
+    DoNotOptimize(filter.data());
+  }
+  state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+// half of the probes are keys of the filter
+void BM_KeyMayMatch(State& state) {
+  BloomFilterPolicy policy(16);
+  std::vector<uint32_t> keys = RandomKeys(state.range(), 301);
+  std::string filter;
+  policy.CreateFilter(keys, &filter);
+  std::vector<uint32_t> probes = RandomKeys(state.range(), 302);
+  for (size_t i = 0; i < probes.size(); i += 2) probes[i] = keys[i];
+
+  uint64_t hits = 0;
+  while (state.KeepRunning()) {
+    for (auto key : probes) {
+      hits += policy.KeyMayMatch(key, filter.data(), filter.size());
+    }
+  }
+  DoNotOptimize(hits);
+  state.SetItemsProcessed(state.iterations() * probes.size());
+}
+
+// msgpack decode of one chunk of dimension 16, as restore and
+// extraction read it
+void BM_UnpackChunk(State& state) {
+  ChunkMap chunk = RandomChunk(state.range(), state.range() * 4, 16, 301);
+  std::stringstream buffer;
+  msgpack::pack(buffer, chunk);
+  const std::string packed = buffer.str();
+
+  while (state.KeepRunning()) {
+    msgpack::object_handle oh = msgpack::unpack(packed.data(), packed.size());
+    ChunkMap decoded;
+    oh.get().convert(decoded);
+    DoNotOptimize(decoded.size());
+  }
+  state.SetBytesProcessed(state.iterations() * packed.size());
+}
+
+// a chunk against a base of the same size over the same key range,
+// about a fifth of the rows overlap
+void BM_MergeJoin(State& state) {
+  uint32_t key_range = state.range() * 4;
+  ChunkMap base = RandomChunk(state.range(), key_range, 4, 301);
+  ChunkMap file = RandomChunk(state.range(), key_range, 4, 302);
+
+  while (state.KeepRunning()) {
+    ChunkMap extracted, retained;
+    int n = MergeJoin(base.begin(), base.end(), file, &extracted, &retained);
+    DoNotOptimize(n);
+  }
+  state.SetItemsProcessed(state.iterations() * file.size());
+}
+
+std::vector<FileMetaData> ManifestFiles(size_t n) {
+  std::mt19937 rnd(301);
+  std::vector<FileMetaData> files(n);
+  for (size_t i = 0; i < n; i++) {
+    FileMetaData& f = files[i];
+    f.tag = (i % 8 == 7) ? kFlag : kNewFile;
+    f.start = rnd() % (1 << 20);
+    f.length = rnd() % (1 << 20);
+    f.level = i % 4;
+    f.column = i / 4;
+    f.number = i + 1;
+    f.smallest = rnd() % 1000;
+    f.largest = f.smallest + rnd() % 100000;
+    f.filter_start = rnd();
+    f.filter_length = rnd() % 4096;
+  }
+  return files;
+}
+
+void BM_ManifestEncode(State& state) {
+  std::vector<FileMetaData> files = ManifestFiles(state.range());
+  std::string record;
+  size_t bytes = 0;
+  while (state.KeepRunning()) {
+    std::string manifest;
+    for (auto& f : files) {
+      EncodeTo(&f, record);
+      manifest.append(record);
+    }
+    bytes = manifest.size();
+    DoNotOptimize(manifest.data());
+  }
+  state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+void BM_ManifestParse(State& state) {
+  std::vector<FileMetaData> files = ManifestFiles(state.range());
+  std::string manifest, record;
+  for (auto& f : files) {
+    EncodeTo(&f, record);
+    manifest.append(record);
+  }
+
+  while (state.KeepRunning()) {
+    std::istringstream in(manifest);
+    std::vector<FileMetaData> parsed;
+    parsed.reserve(files.size());
+    uint32_t tag;
+    FileMetaData f;
+    while (in >> tag && DecodeFrom(in, tag, &f)) {
+      parsed.push_back(f);
+    }
+    DoNotOptimize(parsed.size());
+  }
+  state.SetBytesProcessed(state.iterations() * manifest.size());
+}
+
+// range() columns of 4 levels each, every lookup walks all columns
+void BM_GetVersion(State& state) {
+  const int kLevels = 4;
+  std::vector<FileMetaData> files(state.range() * kLevels);
+  std::vector<FileMetaData*> list;
+  for (size_t i = 0; i < files.size(); i++) {
+    files[i].tag = kNewFile;
+    files[i].column = i / kLevels;
+    files[i].level = i % kLevels;
+    files[i].number = i + 1;
+    list.push_back(&files[i]);
+  }
+  FileLinkedList file_list(list);
+
+  std::vector<FileMetaData*> results;
+  int newest = static_cast<int>(state.range()) - 1;
+  while (state.KeepRunning()) {
+    file_list.GetVersion(newest, results);
+    DoNotOptimize(results.data());
+  }
+  state.SetItemsProcessed(state.iterations() * results.size());
+}
+
+const Benchmark kBenchmarks[] = {
+  {"BM_CreateFilter", BM_CreateFilter, {1 << 10, 1 << 14, 1 << 18}},
+  {"BM_KeyMayMatch", BM_KeyMayMatch, {1 << 10, 1 << 14, 1 << 18}},
+  {"BM_UnpackChunk", BM_UnpackChunk, {1 << 10, 1 << 14}},
+  {"BM_MergeJoin", BM_MergeJoin, {1 << 10, 1 << 14, 1 << 18}},
+  {"BM_ManifestEncode", BM_ManifestEncode, {1 << 10, 1 << 14}},
+  {"BM_ManifestParse", BM_ManifestParse, {1 << 10, 1 << 14}},
+  {"BM_GetVersion", BM_GetVersion, {16, 256, 4096}},
+};
+
+std::string Rate(double per_second, const char* unit) {
+  const char* prefixes[] = {"", "k", "M", "G", "T"};
+  int i = 0;
+  while (per_second >= 1000 && i < 4) {
+    per_second /= 1000;
+    i++;
+  }
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.2f%s %s/s", per_second, prefixes[i], unit);
+  return buf;
+}
+
+// Grow the iteration count until one run takes at least min_time.
+void RunBenchmark(const Benchmark& b, int64_t arg) {
+  uint64_t min_nanos = static_cast<uint64_t>(FLAGS_min_time * 1e9);
+  uint64_t iterations = 1;
+  while (true) {
+    State state(arg, iterations);
+    b.fn(state);
+    uint64_t elapsed = std::max<uint64_t>(state.elapsed_nanos(), 1);
+    if (elapsed >= min_nanos || iterations >= 1000000000) {
+      char name[64];
+      std::snprintf(name, sizeof(name), "%s/%lld", b.name, static_cast<long long>(arg));
+      std::string rate;
+      double seconds = elapsed / 1e9;
+      if (state.bytes_processed() > 0) {
+        rate = Rate(state.bytes_processed() / seconds, "B");
+      } else if (state.items_processed() > 0) {
+        rate = Rate(state.items_processed() / seconds, "items");
+      }
+      std::printf("%-28s %12llu %14.1f %18s\n", name,
+                  static_cast<unsigned long long>(iterations),
+                  static_cast<double>(elapsed) / iterations, rate.c_str());
+      std::fflush(stdout);
+      return;
+    }
+    // aim a bit past min_time, at most 10x per step
+    double scale = std::min(10.0, 1.4 * min_nanos / elapsed);
+    iterations = std::max<uint64_t>(iterations + 1, iterations * scale);
+  }
+}
+
+bool ParseFlag(const char* arg, const char* name, std::string* value) {
+  size_t len = std::strlen(name);
+  if (std::strncmp(arg, "--", 2) != 0 || std::strncmp(arg + 2, name, len) != 0 ||
+      arg[2 + len] != '=') {
+    return false;
+  }
+  *value = arg + 3 + len;
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    std::string v;
+    if (ParseFlag(argv[i], "filter", &v)) {
+      FLAGS_filter = v;
+    } else if (ParseFlag(argv[i], "min_time", &v)) {
+      FLAGS_min_time = std::atof(v.c_str());
+    } else {
+      std::fprintf(stderr, "invalid flag '%s'\n", argv[i]);
+      return 1;
+    }
+  }
+
+  std::printf("%-28s %12s %14s %18s\n", "Benchmark", "Iterations", "ns/op", "Throughput");
+  for (const auto& b : kBenchmarks) {
+    if (std::strstr(b.name, FLAGS_filter.c_str()) == nullptr) continue;
+    for (auto arg : b.args) {
+      RunBenchmark(b, arg);
+    }
+  }
+  return 0;
+}
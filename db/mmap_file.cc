@@ -0,0 +1,80 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "mmap_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tdchunk {
+
+MappedRegion::MappedRegion()
+  : base_(nullptr),
+    mapped_length_(0),
+    data_(nullptr),
+    size_(0) {}
+
+MappedRegion::~MappedRegion() {
+  Close();
+}
+
+bool MappedRegion::Open(const std::string& fname, uint64_t start, uint64_t length, int advice) {
+  Close();
+  int fd = ::open(fname.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct ::stat st;
+  if (::fstat(fd, &st) != 0 || start > static_cast<uint64_t>(st.st_size)) {
+    ::close(fd);
+    return false;
+  }
+  if (length == 0) {
+    length = st.st_size - start;
+  } else if (length > static_cast<uint64_t>(st.st_size) - start) {
+    // a short region must not pass for a whole chunk
+    ::close(fd);
+    return false;
+  }
+  if (length == 0) { // empty region, nothing to map
+    ::close(fd);
+    return true;
+  }
+
+  // mmap offset must be page aligned
+  static const uint64_t page_size = ::sysconf(_SC_PAGESIZE);
+  uint64_t aligned_start = start - start % page_size;
+  size_t delta = start - aligned_start;
+  mapped_length_ = delta + length;
+  base_ = ::mmap(nullptr, mapped_length_, PROT_READ, MAP_SHARED, fd, aligned_start);
+  // the mapping keeps its own reference to the file
+  ::close(fd);
+  if (base_ == MAP_FAILED) {
+    base_ = nullptr;
+    mapped_length_ = 0;
+    return false;
+  }
+  if (advice & kAdviseSequential) {
+    ::madvise(base_, mapped_length_, MADV_SEQUENTIAL);
+  }
+  if (advice & kAdviseWillNeed) {
+    ::madvise(base_, mapped_length_, MADV_WILLNEED);
+  }
+  data_ = static_cast<const char*>(base_) + delta;
+  size_ = length;
+  return true;
+}
+
+void MappedRegion::Close() {
+  if (base_ != nullptr) {
+    ::munmap(base_, mapped_length_);
+  }
+  base_ = nullptr;
+  mapped_length_ = 0;
+  data_ = nullptr;
+  size_ = 0;
+}
+
+}
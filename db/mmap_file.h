@@ -0,0 +1,45 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace tdchunk {
+
+enum MmapAdvice {
+  kAdviseNormal = 0,
+  kAdviseSequential = 1, // MADV_SEQUENTIAL
+  kAdviseWillNeed = 2    // MADV_WILLNEED
+};
+
+// Read-only view of [start, start + length) of a chunk file.
+// Only the pages covering the region are mapped, so a chunk inside a
+// concatenated kMergedFile does not map the whole container.
+class MappedRegion {
+ public:
+  MappedRegion();
+  MappedRegion(const MappedRegion&) = delete;
+  MappedRegion& operator=(const MappedRegion&) = delete;
+  ~MappedRegion();
+
+  // length == 0 maps from start to the end of the file. Returns false if
+  // the region reaches past the end of the file.
+  // advice is a mask of MmapAdvice values.
+  bool Open(const std::string& fname, uint64_t start, uint64_t length, int advice);
+  void Close();
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  void* base_;
+  size_t mapped_length_;
+  const char* data_;
+  size_t size_;
+};
+
+}
@@ -0,0 +1,54 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "mmap_file.h"
+
+#include <string>
+
+#include "file_helper.h"
+#include "util/testharness.h"
+
+namespace tdchunk {
+
+static std::string WriteTestFile(const std::string& dir, size_t size) {
+  std::string fname = dir + "/000001.tdc";
+  std::string contents;
+  for (size_t i = 0; i < size; i++) {
+    contents.push_back(static_cast<char>('a' + i % 26));
+  }
+  WriteStringToFileSync(contents, fname);
+  return fname;
+}
+
+TEST(MappedRegion, Region) {
+  std::string fname = WriteTestFile(lsedb::test::TmpDir("mmap_region"), 10000);
+  MappedRegion region;
+  // an unaligned start inside the second page
+  ASSERT_TRUE(region.Open(fname, 4100, 26, kAdviseSequential | kAdviseWillNeed));
+  ASSERT_EQ(region.size(), 26u);
+  ASSERT_EQ(std::string(region.data(), 2), std::string(1, 'a' + 4100 % 26) + std::string(1, 'a' + 4101 % 26));
+}
+
+TEST(MappedRegion, ToEnd) {
+  std::string fname = WriteTestFile(lsedb::test::TmpDir("mmap_to_end"), 100);
+  MappedRegion region;
+  ASSERT_TRUE(region.Open(fname, 40, 0, kAdviseNormal));
+  ASSERT_EQ(region.size(), 60u);
+  ASSERT_TRUE(region.Open(fname, 100, 0, kAdviseNormal));
+  ASSERT_EQ(region.size(), 0u);
+}
+
+TEST(MappedRegion, PastEOF) {
+  std::string fname = WriteTestFile(lsedb::test::TmpDir("mmap_past_eof"), 100);
+  MappedRegion region;
+  ASSERT_FALSE(region.Open(fname, 90, 20, kAdviseNormal));
+  ASSERT_EQ(region.size(), 0u);
+  ASSERT_FALSE(region.Open(fname, 101, 1, kAdviseNormal));
+  ASSERT_FALSE(region.Open(fname + ".missing", 0, 1, kAdviseNormal));
+  ASSERT_TRUE(region.Open(fname, 90, 10, kAdviseNormal));
+}
+
+}
+
+int main() { return lsedb::test::RunAllTests(); }
@@ -9,15 +9,26 @@
 #include <fstream>
 #include <map>
 
-void inline UnpackFile(const std::string& file_name, msgpack::object& obj) {
-  std::ifstream input(file_name, std::ios::binary);
-  std::stringstream buffer;
-  buffer << input.rdbuf();
+#include "mmap_file.h"
+
+// Unpack [start, start + length) of file_name straight from a mapping of
+// that region. length == 0 means until the end of the file.
+bool inline UnpackRegion(const std::string& file_name, uint64_t start, uint64_t length,
+                         msgpack::object_handle& oh) {
+  tdchunk::MappedRegion region;
+  if (!region.Open(file_name, start, length,
+                   tdchunk::kAdviseSequential | tdchunk::kAdviseWillNeed)) {
+    return false;
+  }
+  if (region.size() == 0) return false;
+  // unpack MessagePack data, the decoded objects own their memory
+  // so the mapping can be released afterwards
+  oh = msgpack::unpack(region.data(), region.size());
+  return true;
+}
 
-  // unpack MessagePack data
-  msgpack::object_handle oh = msgpack::unpack(buffer.str().data(), buffer.str().size());
-  obj = oh.get();
-  // input.close();
+bool inline UnpackFile(const std::string& file_name, msgpack::object_handle& oh) {
+  return UnpackRegion(file_name, 0, 0, oh);
 }
 
 uint32_t inline PackToFile(const std::string& file_name, std::map<uint32_t, std::vector<double>>& data_map) {
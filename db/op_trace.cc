@@ -0,0 +1,122 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "op_trace.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "util/coding.h"
+
+namespace tdchunk {
+
+static const char kTraceMagic[] = "TDCTRACE";
+static const size_t kTraceMagicSize = 8;
+static const uint32_t kTraceFormatVersion = 1;
+
+static uint64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TraceWriter::TraceWriter()
+  : open_(false),
+    start_micros_(0) {}
+
+TraceWriter::~TraceWriter() {
+  Close();
+}
+
+bool TraceWriter::Open(const std::string& file_name) {
+  std::lock_guard<std::mutex> l(mu_);
+  if (open_) file_.close();
+  file_.open(file_name, std::ios::out | std::ios::binary | std::ios::trunc);
+  std::string header(kTraceMagic, kTraceMagicSize);
+  lsedb::PutFixed32(&header, kTraceFormatVersion);
+  file_.write(header.data(), header.size());
+  open_ = file_.good();
+  start_micros_ = NowMicros();
+  return open_;
+}
+
+void TraceWriter::Close() {
+  std::lock_guard<std::mutex> l(mu_);
+  if (!open_) return;
+  file_.flush();
+  file_.close();
+  open_ = false;
+}
+
+void TraceWriter::Write(const TraceRecord& record) {
+  std::lock_guard<std::mutex> l(mu_);
+  if (!open_) return;
+  std::string body;
+  body.push_back(static_cast<char>(record.op));
+  lsedb::PutVarint64(&body, NowMicros() - start_micros_);
+  lsedb::PutVarint32(&body, record.index);
+  if (record.op == kTraceJoin) {
+    lsedb::PutVarint64(&body, record.file_number);
+    lsedb::PutVarint64(&body, record.length);
+    lsedb::PutVarint32(&body, record.keys.size());
+    uint32_t prev = 0;
+    for (auto key : record.keys) {
+      lsedb::PutVarint32(&body, key - prev);
+      prev = key;
+    }
+  } else {
+    lsedb::PutVarint32(&body, static_cast<uint32_t>(record.version));
+  }
+  std::string size;
+  lsedb::PutFixed32(&size, body.size());
+  file_.write(size.data(), size.size());
+  file_.write(body.data(), body.size());
+}
+
+bool TraceReader::Open(const std::string& file_name) {
+  file_.open(file_name, std::ios::in | std::ios::binary);
+  char header[kTraceMagicSize + 4];
+  if (!file_.read(header, sizeof(header))) return false;
+  return std::memcmp(header, kTraceMagic, kTraceMagicSize) == 0 &&
+         lsedb::DecodeFixed32(header + kTraceMagicSize) == kTraceFormatVersion;
+}
+
+bool TraceReader::Next(TraceRecord* record) {
+  char size_buf[4];
+  if (!file_.read(size_buf, sizeof(size_buf))) return false;
+  body_.resize(lsedb::DecodeFixed32(size_buf));
+  if (body_.empty() || !file_.read(&body_[0], body_.size())) return false;
+
+  const char* p = body_.data();
+  const char* limit = p + body_.size();
+  record->op = static_cast<TraceOp>(static_cast<unsigned char>(*p++));
+  record->keys.clear();
+  uint32_t value;
+  p = lsedb::GetVarint64Ptr(p, limit, &record->micros);
+  if (p == nullptr || (p = lsedb::GetVarint32Ptr(p, limit, &record->index)) == nullptr) {
+    return false;
+  }
+  if (record->op == kTraceJoin) {
+    uint32_t count;
+    if ((p = lsedb::GetVarint64Ptr(p, limit, &record->file_number)) == nullptr ||
+        (p = lsedb::GetVarint64Ptr(p, limit, &record->length)) == nullptr ||
+        (p = lsedb::GetVarint32Ptr(p, limit, &count)) == nullptr) {
+      return false;
+    }
+    record->keys.reserve(count);
+    uint32_t key = 0;
+    for (uint32_t i = 0; i < count; i++) {
+      if ((p = lsedb::GetVarint32Ptr(p, limit, &value)) == nullptr) return false;
+      key += value;
+      record->keys.push_back(key);
+    }
+  } else if (record->op == kTraceGetVersion || record->op == kTraceDeleteVersion) {
+    if ((p = lsedb::GetVarint32Ptr(p, limit, &value)) == nullptr) return false;
+    record->version = static_cast<int>(value);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+}
@@ -0,0 +1,72 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tdchunk {
+
+enum TraceOp {
+  kTraceJoin = 1,
+  kTraceGetVersion = 2,    // GetCheckpointFiles and ReadCheckpoint
+  kTraceDeleteVersion = 3  // DeleteCheckpointsBefore
+};
+
+struct TraceRecord {
+  TraceOp op;
+  uint64_t micros = 0;   // since the recording started
+  uint32_t index = 0;    // DB of the manager
+  int version = 0;       // get and delete
+  uint64_t file_number = 0; // join
+  uint64_t length = 0;      // join
+  std::vector<uint32_t> keys; // join
+};
+
+// A trace is the magic "TDCTRACE", a fixed32 format version, then one
+// record per call: a fixed32 body size and the body
+//   op: byte, micros, index: varint
+//   join: file_number, length, key count: varint, keys: varint32
+//         deltas, mod 2^32 so any order round-trips
+//   get / delete version: version: varint32
+class TraceWriter {
+ public:
+  TraceWriter();
+  TraceWriter(const TraceWriter&) = delete;
+  TraceWriter& operator=(const TraceWriter&) = delete;
+  ~TraceWriter();
+
+  // Start a new trace in file_name, ending the current one.
+  bool Open(const std::string& file_name);
+  void Close();
+
+  // Thread safe, does nothing unless open.
+  void Write(const TraceRecord& record);
+  // lets callers skip building records
+  bool IsOpen() const { return open_; }
+
+ private:
+  std::mutex mu_;
+  std::ofstream file_;
+  std::atomic<bool> open_;
+  uint64_t start_micros_;
+};
+
+class TraceReader {
+ public:
+  bool Open(const std::string& file_name);
+  // false at the end of the trace or on a corrupt record
+  bool Next(TraceRecord* record);
+
+ private:
+  std::ifstream file_;
+  std::string body_;
+};
+
+}
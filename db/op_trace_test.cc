@@ -0,0 +1,100 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "op_trace.h"
+
+#include <unistd.h>
+
+#include "file_helper.h"
+#include "util/testharness.h"
+
+namespace tdchunk {
+
+static TraceRecord JoinRecord(uint32_t index, const std::vector<uint32_t>& keys) {
+  TraceRecord record;
+  record.op = kTraceJoin;
+  record.index = index;
+  record.file_number = 12345678901ull;
+  record.length = 1ull << 33;
+  record.keys = keys;
+  return record;
+}
+
+static TraceRecord VersionRecord(TraceOp op, uint32_t index, int version) {
+  TraceRecord record;
+  record.op = op;
+  record.index = index;
+  record.version = version;
+  return record;
+}
+
+TEST(OpTrace, RoundTrip) {
+  std::string fname = lsedb::test::TmpDir("op_trace_round_trip") + "/trace";
+  // unsorted keys at both ends of the range
+  std::vector<uint32_t> keys = {7, 0, 0xffffffffu, 3, 3, 1u << 31};
+  TraceWriter writer;
+  ASSERT_FALSE(writer.IsOpen());
+  ASSERT_TRUE(writer.Open(fname));
+  ASSERT_TRUE(writer.IsOpen());
+  writer.Write(JoinRecord(2, keys));
+  writer.Write(VersionRecord(kTraceGetVersion, 0, 41));
+  writer.Write(VersionRecord(kTraceDeleteVersion, 1, 40));
+  writer.Close();
+  ASSERT_FALSE(writer.IsOpen());
+  // not recorded once closed
+  writer.Write(VersionRecord(kTraceGetVersion, 0, 1));
+
+  TraceReader reader;
+  ASSERT_TRUE(reader.Open(fname));
+  TraceRecord record;
+  ASSERT_TRUE(reader.Next(&record));
+  ASSERT_EQ(record.op, kTraceJoin);
+  ASSERT_EQ(record.index, 2u);
+  ASSERT_EQ(record.file_number, 12345678901ull);
+  ASSERT_EQ(record.length, 1ull << 33);
+  ASSERT_TRUE(record.keys == keys);
+  uint64_t micros = record.micros;
+  ASSERT_TRUE(reader.Next(&record));
+  ASSERT_EQ(record.op, kTraceGetVersion);
+  ASSERT_EQ(record.version, 41);
+  ASSERT_TRUE(record.keys.empty());
+  ASSERT_GE(record.micros, micros);
+  ASSERT_TRUE(reader.Next(&record));
+  ASSERT_EQ(record.op, kTraceDeleteVersion);
+  ASSERT_EQ(record.index, 1u);
+  ASSERT_EQ(record.version, 40);
+  ASSERT_FALSE(reader.Next(&record));
+}
+
+TEST(OpTrace, TruncatedRecord) {
+  std::string fname = lsedb::test::TmpDir("op_trace_truncated") + "/trace";
+  TraceWriter writer;
+  ASSERT_TRUE(writer.Open(fname));
+  writer.Write(VersionRecord(kTraceGetVersion, 0, 1));
+  writer.Write(JoinRecord(0, {1, 2, 3}));
+  writer.Close();
+  uint64_t size;
+  ASSERT_TRUE(GetFileSize(fname, &size));
+  ASSERT_EQ(::truncate(fname.c_str(), size - 2), 0);
+
+  TraceReader reader;
+  ASSERT_TRUE(reader.Open(fname));
+  TraceRecord record;
+  ASSERT_TRUE(reader.Next(&record));
+  ASSERT_EQ(record.version, 1);
+  ASSERT_FALSE(reader.Next(&record));
+}
+
+TEST(OpTrace, NotATrace) {
+  std::string dir = lsedb::test::TmpDir("op_trace_not_a_trace");
+  TraceReader missing;
+  ASSERT_FALSE(missing.Open(dir + "/missing"));
+  ASSERT_TRUE(WriteStringToFileSync("TDCTRACX\x01\x00\x00\x00", dir + "/bad_magic"));
+  TraceReader bad_magic;
+  ASSERT_FALSE(bad_magic.Open(dir + "/bad_magic"));
+}
+
+}
+
+int main() { return lsedb::test::RunAllTests(); }
@@ -0,0 +1,84 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "packed_container.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "file_helper.h"
+#include "util/coding.h"
+
+namespace tdchunk {
+
+static const char kPackedMagic[] = "TDCPACK1";
+static const size_t kPackedMagicSize = 8;
+// fixed64 offset, fixed32 count, magic
+static const size_t kPackedFooterSize = 8 + 4 + kPackedMagicSize;
+
+bool WritePackedToc(const std::string& file_name, const std::vector<PackedEntry>& entries) {
+  uint64_t size = 0;
+  if (!GetFileSize(file_name, &size)) return false;
+  std::string toc;
+  for (const auto& entry : entries) {
+    if (entry.start > size || entry.length > size - entry.start) return false;
+    lsedb::PutVarint32(&toc, entry.table);
+    lsedb::PutVarint64(&toc, entry.start);
+    lsedb::PutVarint64(&toc, entry.length);
+  }
+  lsedb::PutFixed64(&toc, size);
+  lsedb::PutFixed32(&toc, entries.size());
+  toc.append(kPackedMagic, kPackedMagicSize);
+
+  int fd = ::open(file_name.c_str(), O_WRONLY);
+  if (fd < 0) return false;
+  // the chunks and the table of contents become durable with one sync
+  bool success = ::pwrite(fd, toc.data(), toc.size(), size) == static_cast<ssize_t>(toc.size()) &&
+                 ::fdatasync(fd) == 0;
+  ::close(fd);
+  return success;
+}
+
+bool ReadPackedToc(const std::string& file_name, std::vector<PackedEntry>* entries) {
+  entries->clear();
+  uint64_t size = 0;
+  if (!GetFileSize(file_name, &size) || size < kPackedFooterSize) return false;
+  int fd = ::open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  char footer[kPackedFooterSize];
+  bool success = ::pread(fd, footer, sizeof(footer), size - sizeof(footer)) ==
+                 static_cast<ssize_t>(sizeof(footer));
+  uint64_t offset = lsedb::DecodeFixed64(footer);
+  uint32_t count = lsedb::DecodeFixed32(footer + 8);
+  success = success && std::memcmp(footer + 12, kPackedMagic, kPackedMagicSize) == 0 &&
+            offset <= size - sizeof(footer);
+  std::string toc;
+  if (success) {
+    toc.resize(size - sizeof(footer) - offset);
+    success = toc.empty() || ::pread(fd, &toc[0], toc.size(), offset) ==
+                             static_cast<ssize_t>(toc.size());
+  }
+  ::close(fd);
+  if (!success) return false;
+
+  const char* p = toc.data();
+  const char* limit = p + toc.size();
+  for (uint32_t i = 0; i < count && p != nullptr; i++) {
+    PackedEntry entry;
+    p = lsedb::GetVarint32Ptr(p, limit, &entry.table);
+    if (p != nullptr) p = lsedb::GetVarint64Ptr(p, limit, &entry.start);
+    if (p != nullptr) p = lsedb::GetVarint64Ptr(p, limit, &entry.length);
+    if (p != nullptr) entries->push_back(entry);
+  }
+  if (p != limit) {
+    entries->clear();
+    return false;
+  }
+  return true;
+}
+
+}
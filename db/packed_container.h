@@ -0,0 +1,36 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tdchunk {
+
+// One chunk of a packed container, the region of table (a DB index) in
+// it. The region is joined into that DB as a kMergedFile region.
+struct PackedEntry {
+  uint32_t table = 0;
+  uint64_t start = 0;
+  uint64_t length = 0;
+};
+
+// A packed container holds the chunks of several tables for one
+// checkpoint, written by the caller, followed by its table of contents:
+//   entries   varint32 table, varint64 start, varint64 length each
+//   fixed64   offset of the entries
+//   fixed32   number of entries
+//   "TDCPACK1"
+// The table of contents makes a container readable without any manifest.
+
+// Append the table of contents to file_name and fdatasync it. Returns
+// false, appending nothing, if an entry reaches past the end of the file.
+bool WritePackedToc(const std::string& file_name, const std::vector<PackedEntry>& entries);
+
+// Returns false if file_name does not end with a table of contents.
+bool ReadPackedToc(const std::string& file_name, std::vector<PackedEntry>* entries);
+
+}
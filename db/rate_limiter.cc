@@ -0,0 +1,146 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "rate_limiter.h"
+
+#include <algorithm>
+
+namespace tdchunk {
+
+RateLimiter::RateLimiter(uint64_t bytes_per_sec, uint64_t ios_per_sec, int64_t refill_period_us)
+  : bytes_per_sec_(bytes_per_sec),
+    ios_per_sec_(ios_per_sec),
+    refill_period_(refill_period_us),
+    available_bytes_(0),
+    available_ios_(0),
+    next_refill_(std::chrono::steady_clock::now()),
+    leader_(false) {
+  for (int i = 0; i < kNumIOPriorities; i++) {
+    total_bytes_[i] = 0;
+    total_requests_[i] = 0;
+  }
+}
+
+void RateLimiter::SetBytesPerSecond(uint64_t bytes_per_sec) {
+  std::lock_guard<std::mutex> l(mu_);
+  bytes_per_sec_ = bytes_per_sec;
+  cv_.notify_all();
+}
+
+void RateLimiter::SetIOsPerSecond(uint64_t ios_per_sec) {
+  std::lock_guard<std::mutex> l(mu_);
+  ios_per_sec_ = ios_per_sec;
+  cv_.notify_all();
+}
+
+uint64_t RateLimiter::GetBytesPerSecond() {
+  std::lock_guard<std::mutex> l(mu_);
+  return bytes_per_sec_;
+}
+
+uint64_t RateLimiter::GetIOsPerSecond() {
+  std::lock_guard<std::mutex> l(mu_);
+  return ios_per_sec_;
+}
+
+uint64_t RateLimiter::GetTotalBytes(IOPriority priority) {
+  std::lock_guard<std::mutex> l(mu_);
+  return total_bytes_[priority];
+}
+
+uint64_t RateLimiter::GetTotalRequests(IOPriority priority) {
+  std::lock_guard<std::mutex> l(mu_);
+  return total_requests_[priority];
+}
+
+void RateLimiter::Request(uint64_t bytes, IOPriority priority) {
+  std::unique_lock<std::mutex> l(mu_);
+  total_bytes_[priority] += bytes;
+  total_requests_[priority]++;
+  do {
+    // a request must fit into one refill
+    uint64_t burst = bytes;
+    if (bytes_per_sec_ != 0) {
+      burst = std::min(bytes, static_cast<uint64_t>(BytesCap()));
+    }
+    RequestLocked(l, burst, priority);
+    bytes -= burst;
+  } while (bytes > 0);
+}
+
+void RateLimiter::RequestLocked(std::unique_lock<std::mutex>& l, uint64_t bytes, IOPriority priority) {
+  if (Unlimited()) return;
+
+  Req r(bytes);
+  // fast path, nobody of any priority is waiting
+  bool idle = true;
+  for (int i = 0; i < kNumIOPriorities; i++) {
+    idle = idle && queues_[i].empty();
+  }
+  if (idle && HasTokens(r)) {
+    Grant(&r);
+    return;
+  }
+
+  queues_[priority].push_back(&r);
+  while (!r.granted) {
+    if (Unlimited()) {
+      // limits were lifted while waiting
+      queues_[priority].erase(std::find(queues_[priority].begin(), queues_[priority].end(), &r));
+      return;
+    }
+    if (!leader_) {
+      leader_ = true;
+      cv_.wait_until(l, next_refill_);
+      if (std::chrono::steady_clock::now() >= next_refill_) {
+        Refill();
+      }
+      leader_ = false;
+      cv_.notify_all();
+    } else {
+      cv_.wait(l);
+    }
+  }
+}
+
+double RateLimiter::BytesCap() const {
+  return std::max(1.0, bytes_per_sec_ * (refill_period_.count() / 1e6));
+}
+
+double RateLimiter::IOsCap() const {
+  return std::max(1.0, ios_per_sec_ * (refill_period_.count() / 1e6));
+}
+
+bool RateLimiter::HasTokens(const Req& r) const {
+  // a request split under a higher limit goes once the bucket is full,
+  // the debt is paid by the next refills
+  return (bytes_per_sec_ == 0 || available_bytes_ >= std::min<double>(r.bytes, BytesCap())) &&
+         (ios_per_sec_ == 0 || available_ios_ >= r.ios);
+}
+
+void RateLimiter::Grant(Req* r) {
+  if (bytes_per_sec_ != 0) available_bytes_ -= r->bytes;
+  if (ios_per_sec_ != 0) available_ios_ -= r->ios;
+  r->granted = true;
+}
+
+void RateLimiter::Refill() {
+  double seconds = refill_period_.count() / 1e6;
+  // a bucket holds at most one refill
+  available_bytes_ = std::min(BytesCap(), available_bytes_ + bytes_per_sec_ * seconds);
+  available_ios_ = std::min(IOsCap(), available_ios_ + ios_per_sec_ * seconds);
+  next_refill_ = std::chrono::steady_clock::now() + refill_period_;
+
+  // strict priority, a lower class waits while a higher one is short
+  for (int i = 0; i < kNumIOPriorities; i++) {
+    while (!queues_[i].empty()) {
+      Req* r = queues_[i].front();
+      if (!HasTokens(*r)) return;
+      Grant(r);
+      queues_[i].pop_front();
+    }
+  }
+}
+
+}
@@ -0,0 +1,80 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+namespace tdchunk {
+
+// Lower value = served first.
+enum IOPriority {
+  kIOPriorityRestore = 0,
+  kIOPriorityWrite = 1,      // checkpoint writes
+  kIOPriorityExtraction = 2,
+  kIOPriorityBackground = 3, // merge, compaction, rewrites, deletion
+  kNumIOPriorities = 4
+};
+
+// Token buckets for bytes and I/Os, refilled every refill period. When
+// the buckets run dry, waiting requests are granted strictly by
+// priority at the next refill, so a restore never queues behind
+// background work. A limit of 0 disables that bucket.
+class RateLimiter {
+ public:
+  RateLimiter(uint64_t bytes_per_sec, uint64_t ios_per_sec, int64_t refill_period_us = 10000);
+  RateLimiter(const RateLimiter&) = delete;
+  RateLimiter& operator=(const RateLimiter&) = delete;
+
+  // take effect at the next refill, waiters are released if unlimited
+  void SetBytesPerSecond(uint64_t bytes_per_sec);
+  void SetIOsPerSecond(uint64_t ios_per_sec);
+  uint64_t GetBytesPerSecond();
+  uint64_t GetIOsPerSecond();
+
+  // Block until one I/O of bytes may be issued at priority. Requests
+  // larger than one refill are split.
+  void Request(uint64_t bytes, IOPriority priority);
+
+  uint64_t GetTotalBytes(IOPriority priority);
+  uint64_t GetTotalRequests(IOPriority priority);
+
+ private:
+  struct Req {
+    explicit Req(uint64_t b) : bytes(b), ios(1), granted(false) {}
+    uint64_t bytes;
+    int ios;
+    bool granted;
+  };
+
+  // REQUIRES: mu_ held
+  void RequestLocked(std::unique_lock<std::mutex>& l, uint64_t bytes, IOPriority priority);
+  bool Unlimited() const { return bytes_per_sec_ == 0 && ios_per_sec_ == 0; }
+  // most tokens a bucket holds, one refill
+  double BytesCap() const;
+  double IOsCap() const;
+  bool HasTokens(const Req& r) const;
+  void Grant(Req* r);
+  void Refill();
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  uint64_t bytes_per_sec_;
+  uint64_t ios_per_sec_;
+  std::chrono::microseconds refill_period_;
+  double available_bytes_;
+  double available_ios_;
+  std::chrono::steady_clock::time_point next_refill_;
+  // one waiter sleeps until the refill and hands out the tokens
+  bool leader_;
+  std::deque<Req*> queues_[kNumIOPriorities];
+  uint64_t total_bytes_[kNumIOPriorities];
+  uint64_t total_requests_[kNumIOPriorities];
+};
+
+}
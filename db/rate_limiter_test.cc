@@ -0,0 +1,80 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "rate_limiter.h"
+
+#include <atomic>
+#include <thread>
+
+#include "util/testharness.h"
+
+namespace tdchunk {
+
+static int64_t MicrosSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+TEST(RateLimiter, Unlimited) {
+  RateLimiter limiter(0, 0);
+  auto start = std::chrono::steady_clock::now();
+  limiter.Request(1ull << 30, kIOPriorityBackground);
+  limiter.Request(1ull << 30, kIOPriorityRestore);
+  ASSERT_LT(MicrosSince(start), 100000);
+  ASSERT_EQ(limiter.GetTotalBytes(kIOPriorityBackground), 1ull << 30);
+  ASSERT_EQ(limiter.GetTotalRequests(kIOPriorityRestore), 1u);
+}
+
+TEST(RateLimiter, BytesPerSecond) {
+  RateLimiter limiter(1 << 20, 0);
+  auto start = std::chrono::steady_clock::now();
+  // 200 KiB at 1 MiB/s, one request larger than a refill
+  for (int i = 0; i < 19; i++) {
+    limiter.Request(10 << 10, kIOPriorityWrite);
+  }
+  limiter.Request(10 << 10, kIOPriorityWrite);
+  ASSERT_GE(MicrosSince(start), 150000);
+  ASSERT_EQ(limiter.GetTotalBytes(kIOPriorityWrite), 200u << 10);
+  ASSERT_EQ(limiter.GetTotalRequests(kIOPriorityWrite), 20u);
+}
+
+TEST(RateLimiter, IOsPerSecond) {
+  RateLimiter limiter(0, 100);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < 20; i++) {
+    limiter.Request(1, kIOPriorityExtraction);
+  }
+  ASSERT_GE(MicrosSince(start), 150000);
+}
+
+TEST(RateLimiter, RestoreFirst) {
+  RateLimiter limiter(100 << 10, 0);
+  std::atomic<bool> background_done(false);
+  // about one second of background bytes
+  std::thread background([&] {
+    limiter.Request(100 << 10, kIOPriorityBackground);
+    background_done = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  auto start = std::chrono::steady_clock::now();
+  limiter.Request(1 << 10, kIOPriorityRestore);
+  ASSERT_LT(MicrosSince(start), 500000);
+  ASSERT_FALSE(background_done.load());
+  background.join();
+}
+
+TEST(RateLimiter, LiftLimitReleasesWaiters) {
+  RateLimiter limiter(1 << 10, 0);
+  std::thread waiter([&] { limiter.Request(1 << 20, kIOPriorityBackground); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  auto start = std::chrono::steady_clock::now();
+  limiter.SetBytesPerSecond(0);
+  waiter.join();
+  ASSERT_LT(MicrosSince(start), 500000);
+}
+
+}
+
+int main() { return lsedb::test::RunAllTests(); }
@@ -0,0 +1,53 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "restore_plan.h"
+
+#include <algorithm>
+
+namespace tdchunk {
+
+std::vector<RestoreRead> PlanRestore(const std::vector<CkptMetaData>& chunks, uint64_t max_gap) {
+  std::vector<size_t> order(chunks.size());
+  for (size_t i = 0; i < chunks.size(); i++) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&chunks](size_t a, size_t b) {
+    if (chunks[a].file_name == chunks[b].file_name) {
+      return chunks[a].start < chunks[b].start;
+    }
+    return chunks[a].file_name < chunks[b].file_name;
+  });
+
+  std::vector<RestoreRead> plan;
+  for (auto i : order) {
+    const CkptMetaData& chunk = chunks[i];
+    bool extend = false;
+    if (!plan.empty()) {
+      const RestoreRead& last = plan.back();
+      extend = last.file_name == chunk.file_name &&
+               chunk.start <= last.start + last.length + max_gap;
+    }
+    if (!extend) {
+      RestoreRead read;
+      read.file_name = chunk.file_name;
+      read.start = chunk.start;
+      read.length = 0;
+      plan.push_back(read);
+    }
+    RestoreRead& read = plan.back();
+    uint64_t end = chunk.start + chunk.length;
+    if (end > read.start + read.length) {
+      read.length = end - read.start;
+    }
+    RestoreSegment segment;
+    segment.chunk = i;
+    segment.offset = chunk.start - read.start;
+    segment.length = chunk.length;
+    read.segments.push_back(segment);
+  }
+  return plan;
+}
+
+}
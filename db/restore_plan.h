@@ -0,0 +1,39 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "file_helper.h"
+
+namespace tdchunk {
+
+// Ranges of the same file at most this far apart are read together
+// by the native restore path.
+static const uint64_t kRestoreMaxGap = 64 * 1024;
+
+// Part of a planned read that belongs to one chunk.
+struct RestoreSegment {
+  size_t chunk;    // index into the GetCheckpointFiles result
+  uint64_t offset; // offset of the chunk inside the read
+  uint64_t length;
+};
+
+// One physical read of [start, start + length) of file_name.
+struct RestoreRead {
+  std::string file_name;
+  uint64_t start;
+  uint64_t length;
+  std::vector<RestoreSegment> segments;
+};
+
+// Sort chunk ranges by (file, offset) and coalesce ranges of the same
+// file that overlap or are separated by at most max_gap bytes. The gap
+// bytes are read and thrown away, trading bandwidth for fewer seeks.
+std::vector<RestoreRead> PlanRestore(const std::vector<CkptMetaData>& chunks, uint64_t max_gap);
+
+}
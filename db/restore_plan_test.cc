@@ -0,0 +1,64 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "restore_plan.h"
+
+#include "util/testharness.h"
+
+namespace tdchunk {
+
+static CkptMetaData Chunk(const std::string& file_name, uint64_t start, uint64_t length) {
+  CkptMetaData c;
+  c.file_name = file_name;
+  c.start = start;
+  c.length = length;
+  return c;
+}
+
+TEST(RestorePlan, SortsByFileAndOffset) {
+  std::vector<CkptMetaData> chunks = {Chunk("b", 0, 10), Chunk("a", 500, 10), Chunk("a", 0, 10)};
+  std::vector<RestoreRead> plan = PlanRestore(chunks, 0);
+  ASSERT_EQ(plan.size(), 3u);
+  ASSERT_EQ(plan[0].file_name, "a");
+  ASSERT_EQ(plan[0].start, 0u);
+  ASSERT_EQ(plan[0].segments[0].chunk, 2u);
+  ASSERT_EQ(plan[1].start, 500u);
+  ASSERT_EQ(plan[2].file_name, "b");
+}
+
+TEST(RestorePlan, CoalescesWithinGap) {
+  std::vector<CkptMetaData> chunks = {Chunk("a", 100, 50), Chunk("a", 0, 50), Chunk("a", 1000, 10)};
+  std::vector<RestoreRead> plan = PlanRestore(chunks, 60);
+  // 0-50 and 100-150 are 50 bytes apart, 1000 is too far
+  ASSERT_EQ(plan.size(), 2u);
+  ASSERT_EQ(plan[0].start, 0u);
+  ASSERT_EQ(plan[0].length, 150u);
+  ASSERT_EQ(plan[0].segments.size(), 2u);
+  ASSERT_EQ(plan[0].segments[0].chunk, 1u);
+  ASSERT_EQ(plan[0].segments[1].chunk, 0u);
+  ASSERT_EQ(plan[0].segments[1].offset, 100u);
+  ASSERT_EQ(plan[0].segments[1].length, 50u);
+  ASSERT_EQ(plan[1].start, 1000u);
+
+  // without a gap only touching ranges merge
+  plan = PlanRestore({Chunk("a", 0, 50), Chunk("a", 50, 50), Chunk("a", 101, 1)}, 0);
+  ASSERT_EQ(plan.size(), 2u);
+  ASSERT_EQ(plan[0].length, 100u);
+}
+
+TEST(RestorePlan, OverlapsAndFiles) {
+  // a range inside another one does not shrink the read
+  std::vector<RestoreRead> plan =
+      PlanRestore({Chunk("a", 0, 100), Chunk("a", 10, 20), Chunk("b", 10, 20)}, 1000);
+  ASSERT_EQ(plan.size(), 2u);
+  ASSERT_EQ(plan[0].length, 100u);
+  ASSERT_EQ(plan[0].segments[1].offset, 10u);
+  ASSERT_EQ(plan[1].file_name, "b");
+  ASSERT_EQ(plan[1].start, 10u);
+  ASSERT_TRUE(PlanRestore({}, 10).empty());
+}
+
+}
+
+int main() { return lsedb::test::RunAllTests(); }
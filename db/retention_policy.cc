@@ -0,0 +1,35 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "retention_policy.h"
+
+namespace tdchunk {
+
+RetentionPolicy::RetentionPolicy(int keep_last, const std::vector<RetentionTier>& tiers)
+  : keep_last_(keep_last),
+    tiers_(tiers) {}
+
+bool RetentionPolicy::Keep(int column, int newest) const {
+  int age = newest - column;
+  if (age <= 0 || age < keep_last_) return true;
+  for (const auto& tier : tiers_) {
+    if (tier.max_age <= 0 || age < tier.max_age) {
+      return tier.every > 0 && column % tier.every == 0;
+    }
+  }
+  return false;
+}
+
+std::vector<int> RetentionPolicy::Dropped(const std::vector<int>& columns) const {
+  std::vector<int> dropped;
+  if (columns.empty()) return dropped;
+  for (auto column : columns) {
+    if (!Keep(column, columns[0])) {
+      dropped.push_back(column);
+    }
+  }
+  return dropped;
+}
+
+}
@@ -0,0 +1,36 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <vector>
+
+namespace tdchunk {
+
+// Versions younger than max_age (in columns behind the newest one) are
+// kept if their column is a multiple of every. max_age 0 = no bound.
+struct RetentionTier {
+  int max_age;
+  int every;
+};
+
+// Which versions of a DB survive, e.g. "the last 10, then every 100th
+// up to age 1000, then every 1000th": keep_last = 10,
+// tiers = {{1000, 100}, {0, 1000}}. Versions older than the last tier
+// are dropped. The newest version is always kept.
+class RetentionPolicy {
+ public:
+  RetentionPolicy(int keep_last, const std::vector<RetentionTier>& tiers);
+
+  bool Keep(int column, int newest) const;
+
+  // columns out of columns (newest first) whose versions are dropped
+  std::vector<int> Dropped(const std::vector<int>& columns) const;
+
+ private:
+  int keep_last_;
+  std::vector<RetentionTier> tiers_;
+};
+
+}
@@ -0,0 +1,51 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "retention_policy.h"
+
+#include "util/testharness.h"
+
+namespace tdchunk {
+
+TEST(RetentionPolicy, Tiers) {
+  // the last 10, then every 100th up to age 1000, then every 1000th
+  RetentionPolicy policy(10, {{1000, 100}, {0, 1000}});
+  ASSERT_TRUE(policy.Keep(2000, 2000));
+  ASSERT_TRUE(policy.Keep(1991, 2000));
+  ASSERT_FALSE(policy.Keep(1990, 2000));
+  ASSERT_TRUE(policy.Keep(1900, 2000));
+  ASSERT_TRUE(policy.Keep(1100, 2000));
+  ASSERT_FALSE(policy.Keep(1050, 2000));
+  ASSERT_TRUE(policy.Keep(1000, 2000));
+  ASSERT_FALSE(policy.Keep(500, 2000));
+  ASSERT_TRUE(policy.Keep(0, 2000));
+}
+
+TEST(RetentionPolicy, OlderThanLastTier) {
+  RetentionPolicy policy(2, {{4, 2}});
+  ASSERT_TRUE(policy.Keep(9, 10));
+  ASSERT_TRUE(policy.Keep(8, 10));
+  ASSERT_FALSE(policy.Keep(7, 10));
+  ASSERT_FALSE(policy.Keep(6, 10));
+
+  // without tiers only the last versions stay
+  RetentionPolicy last(3, {});
+  ASSERT_TRUE(last.Keep(8, 10));
+  ASSERT_FALSE(last.Keep(7, 10));
+}
+
+TEST(RetentionPolicy, Dropped) {
+  RetentionPolicy policy(1, {{0, 2}});
+  // newest first, the newest is always kept
+  std::vector<int> dropped = policy.Dropped({7, 6, 5, 4, 3});
+  ASSERT_EQ(dropped.size(), 2u);
+  ASSERT_EQ(dropped[0], 5);
+  ASSERT_EQ(dropped[1], 3);
+  ASSERT_TRUE(policy.Dropped({}).empty());
+  ASSERT_TRUE(policy.Dropped({3}).empty());
+}
+
+}
+
+int main() { return lsedb::test::RunAllTests(); }
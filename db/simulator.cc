@@ -0,0 +1,381 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "simulator.h"
+
+#include <algorithm>
+#include <set>
+
+#include "restore_plan.h"
+
+namespace tdchunk {
+
+// One DB: the linked list and metadata as DB keeps them, with the keys
+// of every chunk instead of its data. The steps mirror DB::Join and the
+// maintenance that follows it.
+class Simulator::SimDB {
+ public:
+  SimDB(const SimOptions& options, RetentionPolicy* retention)
+    : options_(options),
+      retention_(retention),
+      policy_(NewExtractionPolicy(options.policy, options.policy_param)),
+      written_bytes_(0) {
+    list_ = new FileLinkedList(file_list_);
+  }
+
+  ~SimDB() {
+    delete list_;
+    for (auto meta : file_list_) {
+      delete meta;
+    }
+    delete policy_;
+  }
+
+  void Join(const std::vector<uint32_t>& keys, uint64_t number, uint64_t length) {
+    FileMetaData* meta = NewMeta(kNewFile, number, keys);
+    meta->level = 0;
+    meta->length = length;
+    list_->max_file_num_ = std::max(list_->max_file_num_, number);
+    list_->AddL0Node(meta);
+    amp_stats_.RecordJoin(keys, length);
+
+    Extract(meta);
+    amp_stats_.RecordVersion(meta->column, VersionBytes(meta->column));
+    MaybeMerge();
+    MaybeApplyRetention();
+    MaybeCompact();
+  }
+
+  // false if version cannot be restored
+  bool GetVersion(int version, uint64_t* bytes, uint64_t* reads) {
+    std::vector<FileMetaData*> files;
+    if (dropped_.count(version) != 0 || !list_->GetVersion(version, files)) return false;
+    std::vector<CkptMetaData> metas;
+    *bytes = 0;
+    for (auto file : files) {
+      if (file->tag != kNewFile && file->tag != kMergedFile) continue;
+      CkptMetaData meta;
+      meta.file_name = std::to_string(file->number);
+      meta.start = file->start;
+      meta.length = file->length;
+      metas.push_back(meta);
+      *bytes += file->length;
+    }
+    *reads = PlanRestore(metas, kRestoreMaxGap).size();
+    return true;
+  }
+
+  void DeleteVersion(int version) {
+    std::vector<FileMetaData*> should_delete;
+    list_->DeleteVersion(version, should_delete);
+    DropFiles(should_delete);
+  }
+
+  // newest version, -1 if empty
+  int Newest() {
+    int oldest, newest;
+    return list_->GetColumnRange(&oldest, &newest) ? newest : -1;
+  }
+
+  uint64_t LiveBytes() const {
+    uint64_t bytes = 0;
+    for (auto meta : file_list_) {
+      if (meta->tag == kNewFile || meta->tag == kMergedFile) bytes += meta->length;
+    }
+    return bytes;
+  }
+
+  uint64_t WrittenBytes() const { return written_bytes_; }
+
+ private:
+  FileMetaData* NewMeta(uint32_t tag, uint64_t number, const std::vector<uint32_t>& keys) {
+    FileMetaData* meta = new FileMetaData();
+    meta->tag = tag;
+    meta->number = number;
+    meta->start = 0;
+    meta->length = 0;
+    if (!keys.empty()) {
+      meta->smallest = keys.front();
+      meta->largest = keys.back();
+    }
+    file_list_.push_back(meta);
+    keys_[meta] = keys;
+    return meta;
+  }
+
+  uint64_t RowsToBytes(size_t rows) {
+    return static_cast<uint64_t>(rows * amp_stats_.RowBytes() + 0.5);
+  }
+
+  uint64_t VersionBytes(int version) {
+    std::vector<FileMetaData*> files;
+    uint64_t bytes = 0;
+    if (list_->GetVersion(version, files)) {
+      for (auto file : files) {
+        if (file->tag == kNewFile || file->tag == kMergedFile) bytes += file->length;
+      }
+    }
+    return bytes;
+  }
+
+  // DB::ShouldExtract, DoExtractionWork and InstallExtractionResults
+  void Extract(FileMetaData* base) {
+    std::vector<FileMetaData*> overlapped;
+    list_->GetOverlappedFilesL0(overlapped);
+    if (overlapped.empty()) return;
+
+    const std::vector<uint32_t>& base_keys = keys_[base];
+    std::vector<ExtractionCandidate> candidates;
+    for (auto file : overlapped) {
+      const std::vector<uint32_t>& file_keys = keys_[file];
+      ExtractionCandidate c;
+      c.file = file;
+      c.hits = 0;
+      auto b = base_keys.begin();
+      for (auto key : file_keys) {
+        b = std::lower_bound(b, base_keys.end(), key);
+        if (b == base_keys.end()) break;
+        if (*b == key) c.hits++;
+      }
+      candidates.push_back(c);
+    }
+    ExtractionContext ctx;
+    ctx.new_rows = base_keys.size();
+    ctx.version_bytes = VersionBytes(base->column);
+    ctx.stats = &amp_stats_;
+    std::vector<FileMetaData*> chosen;
+    if (!policy_->PickFiles(ctx, candidates, &chosen)) return;
+
+    // like out_extracted, rows of a file that is not installed are
+    // written with the next installed one
+    std::set<uint32_t> extracted;
+    std::unordered_set<uint64_t> input_columns;
+    std::vector<FileMetaData*> done;
+    for (auto file : chosen) {
+      const std::vector<uint32_t>& file_keys = keys_[file];
+      auto first = std::lower_bound(base_keys.begin(), base_keys.end(), file->smallest);
+      if (first == base_keys.end() || *first > file->largest) continue;
+
+      std::vector<uint32_t> retained;
+      uint64_t total_extracted = 0;
+      for (auto key : file_keys) {
+        if (std::binary_search(first, base_keys.end(), key)) {
+          extracted.insert(key);
+          total_extracted++;
+        } else {
+          retained.push_back(key);
+        }
+      }
+      if (!policy_->ShouldInstall(total_extracted, base_keys.size())) continue;
+
+      uint64_t written = 0;
+      FileMetaData* retained_meta;
+      if (!retained.empty()) {
+        retained_meta = NewMeta(kNewFile, list_->NextFileNumber(), retained);
+        retained_meta->length = RowsToBytes(retained.size());
+        written += retained_meta->length;
+      } else {
+        retained_meta = NewMeta(kFlag, 0, retained);
+      }
+      retained_meta->level = 0;
+      retained_meta->column = file->column;
+      list_->ReplaceL0Node(retained_meta, file->column);
+      if (!extracted.empty()) {
+        std::vector<uint32_t> rows(extracted.begin(), extracted.end());
+        FileMetaData* extracted_meta = NewMeta(kNewFile, list_->NextFileNumber(), rows);
+        extracted_meta->length = RowsToBytes(rows.size());
+        extracted_meta->level = 1;
+        extracted_meta->column = file->column;
+        list_->ExtractOneChild(extracted_meta, file->column);
+        written += extracted_meta->length;
+        extracted.clear();
+      }
+      amp_stats_.RecordExtraction(written);
+      written_bytes_ += written;
+      input_columns.insert(file->column);
+      done.push_back(file);
+    }
+    list_->MoveOtherToDeeper(input_columns, file_list_);
+    DropFiles(done);
+  }
+
+  void MaybeMerge() {
+    int start, end;
+    if (options_.merge_every <= 1 || list_->getHeadFileMeta() == nullptr ||
+        !list_->ShouldMerge(start, end, options_.merge_every)) {
+      return;
+    }
+    for (auto& level_files : list_->MergeColumns(start, end)) {
+      uint64_t offset = level_files[0]->length;
+      for (size_t i = 0; i < level_files.size(); i++) {
+        if (i > 0) {
+          level_files[i]->start = offset;
+          offset += level_files[i]->length;
+          written_bytes_ += level_files[i]->length;
+        }
+        level_files[i]->tag = kMergedFile;
+        level_files[i]->number = level_files[0]->number;
+      }
+    }
+  }
+
+  void MaybeApplyRetention() {
+    if (retention_ == nullptr) return;
+    std::vector<int> columns;
+    list_->GetColumns(&columns);
+    bool changed = false;
+    for (auto column : retention_->Dropped(columns)) {
+      changed = dropped_.insert(column).second || changed;
+    }
+    if (changed) {
+      std::vector<FileMetaData*> freed, flags;
+      list_->DropColumns(dropped_, &freed, &flags);
+      for (auto flag : flags) {
+        file_list_.push_back(flag);
+      }
+      DropFiles(freed);
+    }
+    int start, end;
+    if (list_->OldestDroppedRun(dropped_, &start, &end)) {
+      CompactColumns(start, end);
+    }
+  }
+
+  void MaybeCompact() {
+    int oldest, newest;
+    if (options_.max_columns <= 0 || !list_->GetColumnRange(&oldest, &newest)) return;
+    if (newest - oldest + 1 > options_.max_columns) {
+      CompactColumns(oldest, newest - options_.max_columns / 2);
+    }
+  }
+
+  void CompactColumns(int start, int end) {
+    std::vector<std::vector<FileMetaData*>> inputs;
+    if (!list_->GetCompactionInputs(start, end, &inputs)) return;
+
+    std::vector<FileMetaData*> outputs;
+    for (size_t level = 0; level < inputs.size(); level++) {
+      std::set<uint32_t> merged;
+      for (auto file : inputs[level]) {
+        const std::vector<uint32_t>& file_keys = keys_[file];
+        merged.insert(file_keys.begin(), file_keys.end());
+      }
+      std::vector<uint32_t> rows(merged.begin(), merged.end());
+      FileMetaData* meta;
+      if (rows.empty()) {
+        meta = NewMeta(kFlag, 0, rows);
+      } else {
+        meta = NewMeta(kNewFile, list_->NextFileNumber(), rows);
+        meta->length = RowsToBytes(rows.size());
+        written_bytes_ += meta->length;
+      }
+      meta->level = level;
+      meta->column = end;
+      outputs.push_back(meta);
+    }
+
+    std::vector<FileMetaData*> obsolete;
+    list_->InstallCompaction(start, end, outputs, &obsolete);
+    DropFiles(obsolete);
+
+    // forget dropped columns whose nodes are gone, as RewriteManifest
+    std::vector<int> columns;
+    list_->GetColumns(&columns);
+    std::unordered_set<int> present(columns.begin(), columns.end());
+    for (auto it = dropped_.begin(); it != dropped_.end();) {
+      it = present.count(*it) == 0 ? dropped_.erase(it) : std::next(it);
+    }
+  }
+
+  void DropFiles(const std::vector<FileMetaData*>& metas) {
+    std::unordered_set<FileMetaData*> dropped(metas.begin(), metas.end());
+    file_list_.erase(std::remove_if(file_list_.begin(), file_list_.end(),
+                                    [&dropped](FileMetaData* meta) {
+                                      return dropped.count(meta) != 0;
+                                    }),
+                     file_list_.end());
+    for (auto meta : dropped) {
+      keys_.erase(meta);
+      delete meta;
+    }
+  }
+
+  const SimOptions& options_;
+  RetentionPolicy* retention_;
+  ExtractionPolicy* policy_;
+  AmplificationStats amp_stats_;
+  uint64_t written_bytes_;
+  std::vector<FileMetaData*> file_list_;
+  FileLinkedList* list_;
+  std::unordered_map<FileMetaData*, std::vector<uint32_t>> keys_;
+  std::unordered_set<int> dropped_;
+};
+
+Simulator::Simulator(const SimOptions& options)
+  : options_(options),
+    retention_(nullptr) {
+  ExtractionPolicy* policy = NewExtractionPolicy(options_.policy, options_.policy_param);
+  valid_ = policy != nullptr;
+  delete policy;
+  if (options_.keep_last > 0 || !options_.tiers.empty()) {
+    retention_ = new RetentionPolicy(options_.keep_last, options_.tiers);
+  }
+}
+
+Simulator::~Simulator() {
+  for (auto db : dbs_) {
+    delete db;
+  }
+  delete retention_;
+}
+
+void Simulator::Apply(const TraceRecord& record) {
+  if (!valid_) return;
+  while (dbs_.size() <= record.index) {
+    dbs_.push_back(new SimDB(options_, retention_));
+  }
+  SimDB* db = dbs_[record.index];
+  if (record.op == kTraceJoin) {
+    if (record.keys.empty()) return;
+    db->Join(record.keys, record.file_number, record.length);
+    result_.joins++;
+    result_.joined_bytes += record.length;
+  } else if (record.op == kTraceGetVersion) {
+    uint64_t bytes, reads;
+    if (!db->GetVersion(record.version, &bytes, &reads)) return;
+    result_.restores++;
+    result_.restore_bytes += bytes;
+    result_.restore_reads += reads;
+    result_.max_restore_bytes = std::max(result_.max_restore_bytes, bytes);
+    return;
+  } else if (record.op == kTraceDeleteVersion) {
+    if (!options_.replay_deletes) return;
+    db->DeleteVersion(record.version);
+  }
+
+  uint64_t live = 0;
+  for (auto d : dbs_) {
+    live += d->LiveBytes();
+  }
+  result_.peak_live_bytes = std::max(result_.peak_live_bytes, live);
+}
+
+SimResult Simulator::Result() {
+  SimResult result = result_;
+  result.written_bytes = 0;
+  for (auto db : dbs_) {
+    result.written_bytes += db->WrittenBytes();
+    result.live_bytes += db->LiveBytes();
+    uint64_t bytes, reads;
+    if (db->Newest() >= 0 && db->GetVersion(db->Newest(), &bytes, &reads)) {
+      result.newest_bytes += bytes;
+      result.newest_reads += reads;
+    }
+  }
+  result.write_amp = result.joined_bytes > 0
+                     ? static_cast<double>(result.written_bytes) / result.joined_bytes : 0;
+  return result;
+}
+
+}
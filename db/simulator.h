@@ -0,0 +1,75 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "extraction_policy.h"
+#include "file_list.h"
+#include "op_trace.h"
+#include "retention_policy.h"
+
+namespace tdchunk {
+
+// Settings a replay is run with, the knobs of DB and DBManager.
+struct SimOptions {
+  std::string policy = "threshold"; // see NewExtractionPolicy
+  double policy_param = 0.3;
+  int max_columns = 0;
+  int merge_every = 0;
+  // retention is off unless keep_last > 0 or tiers are set
+  int keep_last = 0;
+  std::vector<RetentionTier> tiers;
+  // apply the recorded DeleteCheckpointsBefore calls
+  bool replay_deletes = true;
+};
+
+struct SimResult {
+  uint64_t joins = 0;
+  uint64_t joined_bytes = 0;
+  uint64_t written_bytes = 0;  // by extraction, merge and compaction
+  double write_amp = 0;        // written_bytes / joined_bytes
+  uint64_t restores = 0;       // recorded get version calls
+  uint64_t restore_bytes = 0;  // summed over them
+  uint64_t restore_reads = 0;
+  uint64_t max_restore_bytes = 0;
+  uint64_t newest_bytes = 0;   // restore of the newest version at the end
+  uint64_t newest_reads = 0;
+  uint64_t live_bytes = 0;     // at the end
+  uint64_t peak_live_bytes = 0;
+};
+
+// Replays a trace against the file lists of the DBs, keeping only the
+// keys of every chunk. Row sizes come from the joins, so bytes are
+// projected, not measured. Filters are taken as exact.
+class Simulator {
+ public:
+  explicit Simulator(const SimOptions& options);
+  Simulator(const Simulator&) = delete;
+  Simulator& operator=(const Simulator&) = delete;
+  ~Simulator();
+
+  // false for an unknown policy name
+  bool Valid() const { return valid_; }
+
+  void Apply(const TraceRecord& record);
+  // totals over all DBs
+  SimResult Result();
+
+ private:
+  class SimDB;
+
+  SimOptions options_;
+  bool valid_;
+  RetentionPolicy* retention_;
+  std::vector<SimDB*> dbs_;
+  SimResult result_;
+};
+
+}
@@ -0,0 +1,159 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "simulator.h"
+
+#include <cmath>
+
+#include "db_manager.h"
+#include "msgpack_helper.h"
+#include "util/testharness.h"
+
+namespace tdchunk {
+
+static TraceRecord Join(uint32_t index, uint32_t first, uint32_t last, uint64_t length) {
+  static uint64_t number = 0;
+  TraceRecord record;
+  record.op = kTraceJoin;
+  record.index = index;
+  record.file_number = ++number;
+  record.length = length;
+  for (uint32_t key = first; key <= last; key++) {
+    record.keys.push_back(key);
+  }
+  return record;
+}
+
+static TraceRecord Version(TraceOp op, uint32_t index, int version) {
+  TraceRecord record;
+  record.op = op;
+  record.index = index;
+  record.version = version;
+  return record;
+}
+
+TEST(Simulator, UnknownPolicy) {
+  SimOptions options;
+  options.policy = "no-such-policy";
+  Simulator sim(options);
+  ASSERT_FALSE(sim.Valid());
+  sim.Apply(Join(0, 0, 9, 100));
+  ASSERT_EQ(sim.Result().joins, 0u);
+}
+
+TEST(Simulator, DisjointJoins) {
+  Simulator sim((SimOptions()));
+  ASSERT_TRUE(sim.Valid());
+  for (uint32_t i = 0; i < 3; i++) {
+    sim.Apply(Join(0, i * 100, i * 100 + 99, 1000));
+  }
+  sim.Apply(Join(1, 0, 99, 500));
+  sim.Apply(Version(kTraceGetVersion, 0, 2));
+  // not restorable, not counted
+  sim.Apply(Version(kTraceGetVersion, 0, 9));
+
+  SimResult result = sim.Result();
+  ASSERT_EQ(result.joins, 4u);
+  ASSERT_EQ(result.joined_bytes, 3500u);
+  ASSERT_EQ(result.written_bytes, 0u);
+  ASSERT_EQ(result.write_amp, 0);
+  ASSERT_EQ(result.restores, 1u);
+  ASSERT_EQ(result.restore_bytes, 3000u);
+  ASSERT_EQ(result.restore_reads, 3u);
+  ASSERT_EQ(result.max_restore_bytes, 3000u);
+  // the newest version of each DB
+  ASSERT_EQ(result.newest_bytes, 3500u);
+  ASSERT_EQ(result.live_bytes, 3500u);
+  ASSERT_EQ(result.peak_live_bytes, 3500u);
+}
+
+// two full overwrites of the same 200 keys, the threshold policy skips
+// joins of 100 rows or less
+static SimResult Overwrite(const SimOptions& options, bool delete_old) {
+  Simulator sim(options);
+  sim.Apply(Join(0, 0, 199, 1000));
+  sim.Apply(Join(0, 0, 199, 1000));
+  sim.Apply(Join(0, 0, 199, 1000));
+  // drops versions 1 and older
+  if (delete_old) sim.Apply(Version(kTraceDeleteVersion, 0, 1));
+  return sim.Result();
+}
+
+TEST(Simulator, ExtractionWrites) {
+  SimResult result = Overwrite(SimOptions(), false);
+  ASSERT_GT(result.written_bytes, 0u);
+  ASSERT_LT(std::fabs(result.write_amp - static_cast<double>(result.written_bytes) / 3000), 1e-9);
+  // the newest version reads only its own chunk
+  ASSERT_EQ(result.newest_bytes, 1000u);
+  ASSERT_EQ(result.newest_reads, 1u);
+  ASSERT_GT(result.live_bytes, 1000u);
+}
+
+TEST(Simulator, DeletesAndRetention) {
+  SimOptions options;
+  SimResult kept = Overwrite(options, false);
+  SimResult deleted = Overwrite(options, true);
+  ASSERT_EQ(deleted.live_bytes, 1000u);
+  ASSERT_GE(deleted.peak_live_bytes, kept.live_bytes);
+
+  options.replay_deletes = false;
+  ASSERT_EQ(Overwrite(options, true).live_bytes, kept.live_bytes);
+
+  // only the newest version is kept
+  options.keep_last = 1;
+  ASSERT_EQ(Overwrite(options, false).live_bytes, 1000u);
+}
+
+TEST(Simulator, ReplayMatchesDB) {
+  std::string dir = lsedb::test::TmpDir("simulator_replay");
+  std::string trace = dir + "/trace";
+  uint64_t joined = 0;
+  std::vector<std::string> chunks;
+  {
+    DBManager manager;
+    ASSERT_TRUE(manager.OpenDBs({dir + "/table.0"}, false, 2.0f));
+    ASSERT_TRUE(manager.StartOpTrace(trace));
+    for (uint32_t i = 0; i < 3; i++) {
+      std::pair<uint64_t, std::string> file = manager.GetNextFilePath(0);
+      std::map<uint32_t, std::vector<double>> rows;
+      std::vector<uint32_t> keys;
+      for (uint32_t key = i * 100; key < i * 100 + 100; key++) {
+        rows[key] = std::vector<double>(4, i);
+        keys.push_back(key);
+      }
+      uint64_t length = PackToFile(file.second, rows);
+      joined += length;
+      manager.Join(0, keys, file.first, length);
+      manager.WaitForBackgroundWork();
+    }
+    ASSERT_TRUE(manager.ReadCheckpoint(0, 2, &chunks));
+    manager.EndOpTrace();
+  }
+  uint64_t restored = 0;
+  for (const auto& chunk : chunks) {
+    restored += chunk.size();
+  }
+
+  TraceReader reader;
+  ASSERT_TRUE(reader.Open(trace));
+  SimOptions options;
+  options.policy_param = 2.0;
+  Simulator sim(options);
+  TraceRecord record;
+  int records = 0;
+  while (reader.Next(&record)) {
+    sim.Apply(record);
+    records++;
+  }
+  ASSERT_EQ(records, 4);
+  SimResult result = sim.Result();
+  ASSERT_EQ(result.joins, 3u);
+  ASSERT_EQ(result.joined_bytes, joined);
+  ASSERT_EQ(result.restores, 1u);
+  ASSERT_EQ(result.restore_bytes, restored);
+}
+
+}
+
+int main() { return lsedb::test::RunAllTests(); }
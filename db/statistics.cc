@@ -0,0 +1,209 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "statistics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+
+namespace tdchunk {
+
+namespace {
+
+const char* kTickerNames[kNumTickers] = {
+  "joins",
+  "extractions",
+  "files_extracted",
+  "bytes_read",
+  "bytes_written",
+  "filter_probes",
+  "filter_hits",
+  "files_deleted",
+  "restores",
+};
+
+const char* kHistogramNames[kNumHistograms] = {
+  "join_micros",
+  "extraction_micros",
+  "manifest_write_micros",
+  "restore_micros",
+};
+
+void AtomicMin(std::atomic<uint64_t>* a, uint64_t value) {
+  uint64_t cur = a->load(std::memory_order_relaxed);
+  while (value < cur && !a->compare_exchange_weak(cur, value, std::memory_order_relaxed)) {
+  }
+}
+
+void AtomicMax(std::atomic<uint64_t>* a, uint64_t value) {
+  uint64_t cur = a->load(std::memory_order_relaxed);
+  while (value > cur && !a->compare_exchange_weak(cur, value, std::memory_order_relaxed)) {
+  }
+}
+
+}  // namespace
+
+const char* TickerName(Ticker ticker) {
+  return kTickerNames[ticker];
+}
+
+const char* HistogramName(HistogramType type) {
+  return kHistogramNames[type];
+}
+
+Histogram::Histogram() {
+  Clear();
+}
+
+int Histogram::BucketIndex(uint64_t value) {
+  if (value < kSubBuckets) return static_cast<int>(value);
+  int msb = 63 - __builtin_clzll(value);
+  int shift = msb - kSubBucketBits;
+  // value >> shift is in [kSubBuckets, 2 * kSubBuckets)
+  return shift * kSubBuckets + static_cast<int>(value >> shift);
+}
+
+uint64_t Histogram::BucketLimit(int index) {
+  if (index < kSubBuckets) return index;
+  int shift = index / kSubBuckets - 1;
+  uint64_t sub = index % kSubBuckets + kSubBuckets;
+  if (shift + kSubBucketBits == 63 && sub == 2 * kSubBuckets - 1) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  return ((sub + 1) << shift) - 1;
+}
+
+void Histogram::Add(uint64_t value) {
+  buckets_[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  AtomicMin(&min_, value);
+  AtomicMax(&max_, value);
+}
+
+void Histogram::Merge(const Histogram& other) {
+  for (int i = 0; i < kNumBuckets; i++) {
+    uint64_t n = other.buckets_[i].load(std::memory_order_relaxed);
+    if (n != 0) buckets_[i].fetch_add(n, std::memory_order_relaxed);
+  }
+  count_.fetch_add(other.count_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  sum_.fetch_add(other.sum_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  AtomicMin(&min_, other.min_.load(std::memory_order_relaxed));
+  AtomicMax(&max_, other.max_.load(std::memory_order_relaxed));
+}
+
+void Histogram::Clear() {
+  for (int i = 0; i < kNumBuckets; i++) {
+    buckets_[i].store(0, std::memory_order_relaxed);
+  }
+  count_.store(0, std::memory_order_relaxed);
+  sum_.store(0, std::memory_order_relaxed);
+  min_.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+double Histogram::Percentile(double p) const {
+  // sum the buckets rather than trusting count_, which may run ahead
+  // of them while writers are adding
+  uint64_t total = 0;
+  for (int i = 0; i < kNumBuckets; i++) {
+    total += buckets_[i].load(std::memory_order_relaxed);
+  }
+  if (total == 0) return 0;
+  double threshold = total * (p / 100.0);
+  uint64_t seen = 0;
+  for (int i = 0; i < kNumBuckets; i++) {
+    uint64_t n = buckets_[i].load(std::memory_order_relaxed);
+    if (n == 0) continue;
+    seen += n;
+    if (seen >= threshold) {
+      // interpolate inside the bucket
+      double low = i == 0 ? 0 : static_cast<double>(BucketLimit(i - 1)) + 1;
+      double high = static_cast<double>(BucketLimit(i));
+      double pos = (threshold - (seen - n)) / n;
+      double value = low + (high - low) * pos;
+      double min = static_cast<double>(min_.load(std::memory_order_relaxed));
+      double max = static_cast<double>(max_.load(std::memory_order_relaxed));
+      return std::max(min, std::min(max, value));
+    }
+  }
+  return static_cast<double>(max_.load(std::memory_order_relaxed));
+}
+
+void Histogram::Data(HistogramData* data) const {
+  data->count = count_.load(std::memory_order_relaxed);
+  data->sum = sum_.load(std::memory_order_relaxed);
+  data->min = data->count == 0 ? 0 : min_.load(std::memory_order_relaxed);
+  data->max = max_.load(std::memory_order_relaxed);
+  data->average = data->count == 0 ? 0 : static_cast<double>(data->sum) / data->count;
+  data->p50 = Percentile(50);
+  data->p95 = Percentile(95);
+  data->p99 = Percentile(99);
+  data->p999 = Percentile(99.9);
+}
+
+Statistics::Statistics() {
+  for (int i = 0; i < kNumTickers; i++) {
+    tickers_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void Statistics::Merge(const Statistics& other) {
+  for (int i = 0; i < kNumTickers; i++) {
+    tickers_[i].fetch_add(other.tickers_[i].load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+  }
+  for (int i = 0; i < kNumHistograms; i++) {
+    histograms_[i].Merge(other.histograms_[i]);
+  }
+}
+
+void Statistics::Reset() {
+  for (int i = 0; i < kNumTickers; i++) {
+    tickers_[i].store(0, std::memory_order_relaxed);
+  }
+  for (int i = 0; i < kNumHistograms; i++) {
+    histograms_[i].Clear();
+  }
+}
+
+std::string PrometheusText(const std::vector<const Statistics*>& stats,
+                           const std::vector<std::string>& labels) {
+  std::string out;
+  char buf[256];
+  for (int t = 0; t < kNumTickers; t++) {
+    std::string name = std::string("tdchunk_") + TickerName(static_cast<Ticker>(t)) + "_total";
+    out += "# TYPE " + name + " counter\n";
+    for (size_t i = 0; i < stats.size(); i++) {
+      std::snprintf(buf, sizeof(buf), "%s{db=\"%s\"} %llu\n", name.c_str(), labels[i].c_str(),
+                    static_cast<unsigned long long>(
+                        stats[i]->GetTickerCount(static_cast<Ticker>(t))));
+      out += buf;
+    }
+  }
+  for (int h = 0; h < kNumHistograms; h++) {
+    std::string name = std::string("tdchunk_") + HistogramName(static_cast<HistogramType>(h));
+    out += "# TYPE " + name + " summary\n";
+    for (size_t i = 0; i < stats.size(); i++) {
+      HistogramData data;
+      stats[i]->GetHistogramData(static_cast<HistogramType>(h), &data);
+      const char* db = labels[i].c_str();
+      const std::pair<const char*, double> quantiles[] = {
+        {"0.5", data.p50}, {"0.95", data.p95}, {"0.99", data.p99}, {"0.999", data.p999}};
+      for (const auto& q : quantiles) {
+        std::snprintf(buf, sizeof(buf), "%s{db=\"%s\",quantile=\"%s\"} %.1f\n",
+                      name.c_str(), db, q.first, q.second);
+        out += buf;
+      }
+      std::snprintf(buf, sizeof(buf), "%s_sum{db=\"%s\"} %llu\n%s_count{db=\"%s\"} %llu\n",
+                    name.c_str(), db, static_cast<unsigned long long>(data.sum),
+                    name.c_str(), db, static_cast<unsigned long long>(data.count));
+      out += buf;
+    }
+  }
+  return out;
+}
+
+}
@@ -0,0 +1,137 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tdchunk {
+
+enum Ticker {
+  kJoins = 0,
+  kExtractions,       // extractions run, after the policy picked files
+  kFilesExtracted,    // input files split by extraction
+  kBytesRead,         // restore, extraction and background reads
+  kBytesWritten,      // extraction and background writes
+  kFilterProbes,      // bloom filter lookups of ShouldExtract
+  kFilterHits,
+  kFilesDeleted,      // unlinked by the background deleter
+  kRestores,
+  kNumTickers
+};
+
+enum HistogramType {
+  kJoinMicros = 0,     // lock wait, filter, manifest append and extraction
+  kExtractionMicros,
+  kManifestWriteMicros, // manifest rewrites
+  kRestoreMicros,
+  kNumHistograms
+};
+
+const char* TickerName(Ticker ticker);
+const char* HistogramName(HistogramType type);
+
+struct HistogramData {
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t min = 0;
+  uint64_t max = 0;
+  double average = 0;
+  double p50 = 0;
+  double p95 = 0;
+  double p99 = 0;
+  double p999 = 0;
+};
+
+// Log-linear buckets as in HdrHistogram: every power of two is split
+// into 2^kSubBucketBits buckets, so a value is off by at most 1/32 of
+// itself. Recording is a few relaxed atomic adds, readers see a
+// consistent enough snapshot without stopping writers.
+class Histogram {
+ public:
+  static const int kSubBucketBits = 5;
+  static const int kSubBuckets = 1 << kSubBucketBits;
+  static const int kNumBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  Histogram();
+  Histogram(const Histogram&) = delete;
+  Histogram& operator=(const Histogram&) = delete;
+
+  void Add(uint64_t value);
+  void Merge(const Histogram& other);
+  void Clear();
+
+  uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+  // value below which p percent of the samples fall
+  double Percentile(double p) const;
+  void Data(HistogramData* data) const;
+
+  static int BucketIndex(uint64_t value);
+  static uint64_t BucketLimit(int index); // largest value of the bucket
+
+ private:
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> min_;
+  std::atomic<uint64_t> max_;
+  std::atomic<uint64_t> buckets_[kNumBuckets];
+};
+
+// Counters and latency histograms of one DB. All methods are safe to
+// call from any thread without locks.
+class Statistics {
+ public:
+  Statistics();
+  Statistics(const Statistics&) = delete;
+  Statistics& operator=(const Statistics&) = delete;
+
+  void RecordTick(Ticker ticker, uint64_t count = 1) {
+    tickers_[ticker].fetch_add(count, std::memory_order_relaxed);
+  }
+  uint64_t GetTickerCount(Ticker ticker) const {
+    return tickers_[ticker].load(std::memory_order_relaxed);
+  }
+
+  void MeasureTime(HistogramType type, uint64_t micros) { histograms_[type].Add(micros); }
+  void GetHistogramData(HistogramType type, HistogramData* data) const {
+    histograms_[type].Data(data);
+  }
+
+  // add the counts of other, e.g. to aggregate the DBs of a manager
+  void Merge(const Statistics& other);
+  void Reset();
+
+ private:
+  std::atomic<uint64_t> tickers_[kNumTickers];
+  Histogram histograms_[kNumHistograms];
+};
+
+// Records the micros between construction and destruction into a
+// histogram of stats.
+class StopWatch {
+ public:
+  StopWatch(Statistics* stats, HistogramType type)
+    : stats_(stats), type_(type), start_(std::chrono::steady_clock::now()) {}
+  ~StopWatch() {
+    stats_->MeasureTime(type_, std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start_).count());
+  }
+
+ private:
+  Statistics* stats_;
+  HistogramType type_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Prometheus text exposition of stats[i] labelled db="labels[i]".
+// Counters are named tdchunk_<ticker>_total and histograms are
+// summaries with the 0.5, 0.95, 0.99 and 0.999 quantiles.
+std::string PrometheusText(const std::vector<const Statistics*>& stats,
+                           const std::vector<std::string>& labels);
+
+}
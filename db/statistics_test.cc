@@ -0,0 +1,111 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "statistics.h"
+
+#include <cmath>
+#include <limits>
+#include <thread>
+
+#include "util/testharness.h"
+
+namespace tdchunk {
+
+TEST(Histogram, Buckets) {
+  ASSERT_EQ(Histogram::BucketIndex(0), 0);
+  ASSERT_EQ(Histogram::BucketIndex(31), 31);
+  ASSERT_EQ(Histogram::BucketIndex(std::numeric_limits<uint64_t>::max()),
+            Histogram::kNumBuckets - 1);
+  ASSERT_EQ(Histogram::BucketLimit(Histogram::kNumBuckets - 1),
+            std::numeric_limits<uint64_t>::max());
+  // a value falls in the bucket whose range holds it, 1/32 wide at most
+  for (uint64_t value = 1; value < (1ull << 62); value = value * 3 / 2 + 1) {
+    int index = Histogram::BucketIndex(value);
+    ASSERT_LE(value, Histogram::BucketLimit(index)) << value;
+    ASSERT_GT(value, Histogram::BucketLimit(index - 1)) << value;
+    ASSERT_LE(Histogram::BucketLimit(index) - Histogram::BucketLimit(index - 1),
+              value / Histogram::kSubBuckets + 1) << value;
+  }
+}
+
+TEST(Histogram, Percentiles) {
+  Histogram histogram;
+  ASSERT_EQ(histogram.Percentile(50), 0);
+  for (uint64_t value = 1; value <= 10000; value++) {
+    histogram.Add(value);
+  }
+  HistogramData data;
+  histogram.Data(&data);
+  ASSERT_EQ(data.count, 10000u);
+  ASSERT_EQ(data.sum, 50005000u);
+  ASSERT_EQ(data.min, 1u);
+  ASSERT_EQ(data.max, 10000u);
+  ASSERT_LT(std::fabs(data.p50 - 5000), 5000 / 32.0);
+  ASSERT_LT(std::fabs(data.p99 - 9900), 9900 / 32.0);
+  ASSERT_LE(data.p999, 10000);
+}
+
+TEST(Histogram, MergeAndClear) {
+  Histogram a, b;
+  a.Add(10);
+  b.Add(1000);
+  b.Add(5);
+  a.Merge(b);
+  HistogramData data;
+  a.Data(&data);
+  ASSERT_EQ(data.count, 3u);
+  ASSERT_EQ(data.min, 5u);
+  ASSERT_EQ(data.max, 1000u);
+  a.Clear();
+  a.Data(&data);
+  ASSERT_EQ(data.count, 0u);
+  ASSERT_EQ(data.min, 0u);
+  ASSERT_EQ(data.p50, 0);
+}
+
+TEST(Statistics, ConcurrentTicks) {
+  Statistics stats;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&stats] {
+      for (int i = 0; i < 10000; i++) {
+        stats.RecordTick(kJoins);
+        stats.MeasureTime(kJoinMicros, i);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(stats.GetTickerCount(kJoins), 40000u);
+  HistogramData data;
+  stats.GetHistogramData(kJoinMicros, &data);
+  ASSERT_EQ(data.count, 40000u);
+  ASSERT_EQ(data.max, 9999u);
+}
+
+TEST(Statistics, MergeAndPrometheus) {
+  Statistics a, b;
+  a.RecordTick(kRestores, 2);
+  b.RecordTick(kRestores, 3);
+  b.MeasureTime(kRestoreMicros, 100);
+  std::string text = PrometheusText({&a, &b}, {"t0", "t1"});
+  ASSERT_TRUE(text.find("# TYPE tdchunk_restores_total counter\n") != std::string::npos);
+  ASSERT_TRUE(text.find("tdchunk_restores_total{db=\"t0\"} 2\n") != std::string::npos);
+  ASSERT_TRUE(text.find("tdchunk_restores_total{db=\"t1\"} 3\n") != std::string::npos);
+  ASSERT_TRUE(text.find("# TYPE tdchunk_restore_micros summary\n") != std::string::npos);
+  ASSERT_TRUE(text.find("tdchunk_restore_micros_count{db=\"t1\"} 1\n") != std::string::npos);
+
+  a.Merge(b);
+  ASSERT_EQ(a.GetTickerCount(kRestores), 5u);
+  HistogramData data;
+  a.GetHistogramData(kRestoreMicros, &data);
+  ASSERT_EQ(data.count, 1u);
+  a.Reset();
+  ASSERT_EQ(a.GetTickerCount(kRestores), 0u);
+}
+
+}
+
+int main() { return lsedb::test::RunAllTests(); }
@@ -0,0 +1,65 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tdchunk {
+
+class ThreadPool {
+ public:
+  explicit ThreadPool(int num_threads);
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Waits for queued tasks to finish.
+  ~ThreadPool();
+
+  void Schedule(std::function<void()> task);
+
+  int NumThreads() const { return static_cast<int>(workers_.size()); }
+
+ private:
+  void WorkerLoop();
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> queue_;
+  bool stop_;
+  std::vector<std::thread> workers_;
+};
+
+// Counts outstanding tasks so a caller can block until all of them finish.
+class WaitGroup {
+ public:
+  WaitGroup() : pending_(0) {}
+
+  void Add(int n) {
+    std::lock_guard<std::mutex> l(mu_);
+    pending_ += n;
+  }
+
+  void Done() {
+    std::lock_guard<std::mutex> l(mu_);
+    if (--pending_ == 0) cv_.notify_all();
+  }
+
+  void Wait() {
+    std::unique_lock<std::mutex> l(mu_);
+    cv_.wait(l, [this] { return pending_ == 0; });
+  }
+
+ private:
+  std::mutex mu_;
+  std::condition_variable cv_;
+  int pending_;
+};
+
+}
@@ -0,0 +1,135 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "trace.h"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace tdchunk {
+
+std::atomic<bool> tracing_enabled(false);
+
+namespace {
+
+struct TraceEvent {
+  const char* name;
+  uint64_t start;
+  uint64_t duration;
+};
+
+struct ThreadBuffer {
+  // taken by the owner for every event, contended only by dumps
+  std::mutex mu;
+  std::vector<TraceEvent> events;
+  uint64_t next = 0;
+  uint32_t tid = 0;
+  bool in_use = false; // guarded by registry_mu
+};
+
+std::mutex registry_mu;
+// never freed, threads may exit after static destructors ran
+std::vector<ThreadBuffer*>* registry = new std::vector<ThreadBuffer*>();
+
+// Background work runs on short-lived threads, so a buffer goes back to
+// the registry when its thread exits and is reused by the next one.
+// Threads sharing a buffer show up as one row of the trace.
+struct ThreadState {
+  ThreadBuffer* buffer = nullptr;
+  ~ThreadState() {
+    if (buffer != nullptr) {
+      std::lock_guard<std::mutex> l(registry_mu);
+      buffer->in_use = false;
+    }
+  }
+};
+
+thread_local ThreadState thread_state;
+
+ThreadBuffer* GetThreadBuffer() {
+  if (thread_state.buffer == nullptr) {
+    std::lock_guard<std::mutex> l(registry_mu);
+    for (auto buffer : *registry) {
+      if (!buffer->in_use) {
+        thread_state.buffer = buffer;
+        break;
+      }
+    }
+    if (thread_state.buffer == nullptr) {
+      ThreadBuffer* buffer = new ThreadBuffer();
+      buffer->events.resize(kTraceBufferEvents);
+      buffer->tid = static_cast<uint32_t>(registry->size()) + 1;
+      registry->push_back(buffer);
+      thread_state.buffer = buffer;
+    }
+    thread_state.buffer->in_use = true;
+  }
+  return thread_state.buffer;
+}
+
+}  // namespace
+
+uint64_t TraceNowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void RecordSpan(const char* name, uint64_t start_micros, uint64_t duration_micros) {
+  ThreadBuffer* buffer = GetThreadBuffer();
+  std::lock_guard<std::mutex> l(buffer->mu);
+  TraceEvent& event = buffer->events[buffer->next % kTraceBufferEvents];
+  event.name = name;
+  event.start = start_micros;
+  event.duration = duration_micros;
+  buffer->next++;
+}
+
+void StartTracing() {
+  std::lock_guard<std::mutex> l(registry_mu);
+  for (auto buffer : *registry) {
+    std::lock_guard<std::mutex> bl(buffer->mu);
+    buffer->next = 0;
+  }
+  tracing_enabled.store(true, std::memory_order_relaxed);
+}
+
+void StopTracing() {
+  tracing_enabled.store(false, std::memory_order_relaxed);
+}
+
+bool DumpTrace(const std::string& file_name) {
+  std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  char buf[256];
+  int pid = static_cast<int>(::getpid());
+  std::lock_guard<std::mutex> l(registry_mu);
+  for (auto buffer : *registry) {
+    std::lock_guard<std::mutex> bl(buffer->mu);
+    uint64_t begin = buffer->next > kTraceBufferEvents ? buffer->next - kTraceBufferEvents : 0;
+    for (uint64_t i = begin; i < buffer->next; i++) {
+      const TraceEvent& event = buffer->events[i % kTraceBufferEvents];
+      std::snprintf(buf, sizeof(buf),
+                    "%s\n{\"name\":\"%s\",\"cat\":\"tdchunk\",\"ph\":\"X\",\"ts\":%llu,"
+                    "\"dur\":%llu,\"pid\":%d,\"tid\":%u}",
+                    first ? "" : ",", event.name,
+                    static_cast<unsigned long long>(event.start),
+                    static_cast<unsigned long long>(event.duration), pid, buffer->tid);
+      out += buf;
+      first = false;
+    }
+  }
+  out += "\n]}\n";
+
+  std::ofstream file(file_name, std::ios::out | std::ios::trunc);
+  file << out;
+  file.close();
+  return !file.fail();
+}
+
+}
@@ -0,0 +1,56 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace tdchunk {
+
+// events kept per thread, older ones are overwritten
+static const size_t kTraceBufferEvents = 1 << 16;
+
+extern std::atomic<bool> tracing_enabled;
+
+// Process-wide tracing of the spans below into per-thread ring buffers.
+// Off by default, a disabled span costs one relaxed load.
+// StartTracing drops the events recorded so far.
+void StartTracing();
+void StopTracing();
+inline bool TracingEnabled() {
+  return tracing_enabled.load(std::memory_order_relaxed);
+}
+
+// Write the buffered events as Chrome trace JSON, for chrome://tracing
+// or Perfetto. Can be called while tracing.
+bool DumpTrace(const std::string& file_name);
+
+// REQUIRES: name outlives the trace, e.g. a string literal
+void RecordSpan(const char* name, uint64_t start_micros, uint64_t duration_micros);
+uint64_t TraceNowMicros();
+
+// Records a complete event from construction to destruction.
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char* name)
+    : name_(TracingEnabled() ? name : nullptr),
+      start_(name_ != nullptr ? TraceNowMicros() : 0) {}
+  ~TraceSpan() { Finish(); }
+
+  // end the span before the scope does
+  void Finish() {
+    if (name_ != nullptr) RecordSpan(name_, start_, TraceNowMicros() - start_);
+    name_ = nullptr;
+  }
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+ private:
+  const char* name_;
+  uint64_t start_;
+};
+
+}
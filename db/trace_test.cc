@@ -0,0 +1,83 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "trace.h"
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "util/testharness.h"
+
+namespace tdchunk {
+
+static std::string Dump(const std::string& name) {
+  std::string fname = lsedb::test::TmpDir(name) + "/trace.json";
+  if (!DumpTrace(fname)) return "";
+  std::ifstream in(fname);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+static size_t Count(const std::string& text, const std::string& pattern) {
+  size_t n = 0;
+  for (size_t pos = text.find(pattern); pos != std::string::npos;
+       pos = text.find(pattern, pos + 1)) {
+    n++;
+  }
+  return n;
+}
+
+TEST(Trace, DisabledRecordsNothing) {
+  StartTracing();
+  StopTracing();
+  ASSERT_FALSE(TracingEnabled());
+  { TraceSpan span("Test.Disabled"); }
+  std::string json = Dump("trace_disabled");
+  ASSERT_EQ(json.compare(0, 1, "{"), 0) << json;
+  ASSERT_EQ(Count(json, "Test.Disabled"), 0u);
+}
+
+TEST(Trace, Spans) {
+  StartTracing();
+  {
+    TraceSpan outer("Test.Outer");
+    TraceSpan inner("Test.Inner");
+    inner.Finish();
+    // a finished span is not recorded again
+    inner.Finish();
+  }
+  std::thread thread([] { TraceSpan span("Test.Thread"); });
+  thread.join();
+  StopTracing();
+  std::string json = Dump("trace_spans");
+  ASSERT_EQ(Count(json, "\"name\":\"Test.Outer\",\"cat\":\"tdchunk\",\"ph\":\"X\""), 1u);
+  ASSERT_EQ(Count(json, "\"name\":\"Test.Inner\""), 1u);
+  ASSERT_EQ(Count(json, "\"name\":\"Test.Thread\""), 1u);
+  ASSERT_EQ(Count(json, "\"tid\":"), 3u);
+
+  // events recorded before StartTracing are dropped
+  StartTracing();
+  StopTracing();
+  ASSERT_EQ(Count(Dump("trace_spans"), "\"tid\":"), 0u);
+}
+
+TEST(Trace, RingBufferKeepsNewest) {
+  StartTracing();
+  for (int i = 0; i < 10; i++) {
+    RecordSpan("Test.Old", TraceNowMicros(), 0);
+  }
+  for (size_t i = 0; i < kTraceBufferEvents; i++) {
+    RecordSpan("Test.New", TraceNowMicros(), 0);
+  }
+  StopTracing();
+  std::string json = Dump("trace_ring");
+  ASSERT_EQ(Count(json, "Test.Old"), 0u);
+  ASSERT_EQ(Count(json, "Test.New"), kTraceBufferEvents);
+}
+
+}
+
+int main() { return lsedb::test::RunAllTests(); }
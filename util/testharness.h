@@ -0,0 +1,156 @@
+// Copyright (c) 2024 Qingyin Lin. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace lsedb {
+namespace test {
+
+// Run every TEST() of the binary, returns 0 if all of them passed.
+//
+//   TEST(MappedRegion, PastEOF) {
+//     ASSERT_TRUE(...);
+//     ASSERT_EQ(a, b);
+//   }
+//
+//   int main() { return lsedb::test::RunAllTests(); }
+inline int RunAllTests();
+
+// A fresh directory for the test, removed with everything in it first.
+inline std::string TmpDir(const std::string& name);
+
+inline bool RegisterTest(const char* base, const char* name, void (*func)());
+
+class Tester {
+ public:
+  Tester(const char* fname, int line) : ok_(true), fname_(fname), line_(line) {}
+
+  ~Tester() {
+    if (!ok_) {
+      std::fprintf(stderr, "%s:%d:%s\n", fname_, line_, ss_.str().c_str());
+      std::exit(1);
+    }
+  }
+
+  Tester& Is(bool b, const char* msg) {
+    if (!b) {
+      ss_ << " Assertion failure " << msg;
+      ok_ = false;
+    }
+    return *this;
+  }
+
+#define BINARY_OP(name, op)                                \
+  template <class X, class Y>                              \
+  Tester& name(const X& x, const Y& y) {                   \
+    if (!(x op y)) {                                       \
+      ss_ << " failed: " << x << (" " #op " ") << y;       \
+      ok_ = false;                                         \
+    }                                                      \
+    return *this;                                          \
+  }
+
+  BINARY_OP(IsEq, ==)
+  BINARY_OP(IsNe, !=)
+  BINARY_OP(IsGe, >=)
+  BINARY_OP(IsGt, >)
+  BINARY_OP(IsLe, <=)
+  BINARY_OP(IsLt, <)
+#undef BINARY_OP
+
+  // attach the specified value to the error message if an error occurs
+  template <class V>
+  Tester& operator<<(const V& value) {
+    if (!ok_) {
+      ss_ << " " << value;
+    }
+    return *this;
+  }
+
+ private:
+  bool ok_;
+  const char* fname_;
+  int line_;
+  std::stringstream ss_;
+};
+
+#define ASSERT_TRUE(c) ::lsedb::test::Tester(__FILE__, __LINE__).Is((c), #c)
+#define ASSERT_FALSE(c) ::lsedb::test::Tester(__FILE__, __LINE__).Is(!(c), #c)
+#define ASSERT_EQ(a, b) ::lsedb::test::Tester(__FILE__, __LINE__).IsEq((a), (b))
+#define ASSERT_NE(a, b) ::lsedb::test::Tester(__FILE__, __LINE__).IsNe((a), (b))
+#define ASSERT_GE(a, b) ::lsedb::test::Tester(__FILE__, __LINE__).IsGe((a), (b))
+#define ASSERT_GT(a, b) ::lsedb::test::Tester(__FILE__, __LINE__).IsGt((a), (b))
+#define ASSERT_LE(a, b) ::lsedb::test::Tester(__FILE__, __LINE__).IsLe((a), (b))
+#define ASSERT_LT(a, b) ::lsedb::test::Tester(__FILE__, __LINE__).IsLt((a), (b))
+
+#define TEST(base, name)                                                 \
+  class _Test_##base##_##name {                                          \
+   public:                                                               \
+    void _Run();                                                         \
+    static void _RunIt() {                                               \
+      _Test_##base##_##name t;                                           \
+      t._Run();                                                          \
+    }                                                                    \
+  };                                                                     \
+  bool _Test_ignored_##base##_##name = ::lsedb::test::RegisterTest(      \
+      #base, #name, &_Test_##base##_##name::_RunIt);                     \
+  void _Test_##base##_##name::_Run()
+
+struct Test {
+  const char* base;
+  const char* name;
+  void (*func)();
+};
+
+inline std::vector<Test>* Tests() {
+  static std::vector<Test> tests;
+  return &tests;
+}
+
+inline bool RegisterTest(const char* base, const char* name, void (*func)()) {
+  Test t;
+  t.base = base;
+  t.name = name;
+  t.func = func;
+  Tests()->push_back(t);
+  return true;
+}
+
+inline int RunAllTests() {
+  // TESTS=name runs only the tests whose base.name contains name
+  const char* matcher = std::getenv("TESTS");
+  int num = 0;
+  for (const auto& t : *Tests()) {
+    std::string full = std::string(t.base) + "." + t.name;
+    if (matcher != nullptr && full.find(matcher) == std::string::npos) continue;
+    std::fprintf(stderr, "==== Test %s\n", full.c_str());
+    (*t.func)();
+    ++num;
+  }
+  std::fprintf(stderr, "==== PASSED %d tests\n", num);
+  return 0;
+}
+
+inline std::string TmpDir(const std::string& name) {
+  const char* env = std::getenv("TEST_TMPDIR");
+  std::string dir = std::string(env != nullptr && env[0] != '\0' ? env : "/tmp") +
+                    "/tdchunk_test-" + std::to_string(::getuid()) + "-" + name;
+  std::string cmd = "rm -rf '" + dir + "' && mkdir -p '" + dir + "'";
+  if (std::system(cmd.c_str()) != 0) {
+    std::fprintf(stderr, "cannot create %s\n", dir.c_str());
+    std::exit(1);
+  }
+  return dir;
+}
+
+}  // namespace test
+}  // namespace lsedb